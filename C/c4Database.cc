@@ -32,6 +32,8 @@
 #include "Error.hh"
 #include "StringUtil.hh"
 #include "PrebuiltCopier.hh"
+#include "CompactionJob.hh"
+#include "RevTreePruner.hh"
 #include <thread>
 
 using namespace fleece;
@@ -153,11 +155,124 @@ bool c4db_compact(C4Database* database, C4Error *outError) noexcept {
 }
 
 
+// This is the struct that's forward-declared in the public c4Database.h
+struct C4CompactionJob : public CompactionJob {
+    C4CompactionJob(C4Database *db, C4CompactionCallback callback, void *context)
+    :CompactionJob(db, [=](const Progress &progress) {
+        if (callback) {
+            C4CompactionProgress c4progress = c4Progress(progress);
+            callback(this, &c4progress, context);
+        }
+    })
+    { }
+
+    static C4CompactionProgress c4Progress(const Progress &p) {
+        return {(C4CompactionPhase)p.phase, p.running, p.pagesFreed, p.docsScanned,
+                p.blobsScanned, p.blobsDeleted, p.error};
+    }
+};
+
+
+C4CompactionJob* c4db_startCompaction(C4Database* database, C4CompactionCallback callback,
+                                      void *context, C4Error *outError) noexcept
+{
+    return tryCatch<C4CompactionJob*>(outError, [=] {
+        Retained<C4CompactionJob> job = new C4CompactionJob(database, callback, context);
+        job->start();
+        return retain(job.get());
+    });
+}
+
+
+void c4compact_cancel(C4CompactionJob *job) noexcept {
+    job->cancel();
+}
+
+
+void c4compact_resume(C4CompactionJob *job) noexcept {
+    try {
+        job->start();
+    } catchExceptions()
+}
+
+
+C4CompactionProgress c4compact_getProgress(C4CompactionJob *job) noexcept {
+    return C4CompactionJob::c4Progress(job->progress());
+}
+
+
+void c4compact_wait(C4CompactionJob *job) noexcept {
+    job->wait();
+}
+
+
+void c4compact_free(C4CompactionJob *job) noexcept {
+    if (!job)
+        return;
+    job->cancel();
+    job->wait();
+    release(job);
+}
+
+
 bool c4db_rekey(C4Database* database, const C4EncryptionKey *newKey, C4Error *outError) noexcept {
     return tryCatch(outError, bind(&Database::rekey, database, newKey));
 }
 
 
+bool c4db_setStorageTuning(C4Database* database, const C4StorageTuning *tuning,
+                           C4Error *outError) noexcept
+{
+    return tryCatch(outError, bind(&Database::setStorageTuning, database, *tuning));
+}
+
+
+static C4MaintenanceStats toC4MaintenanceStats(const DataFile::MaintenanceStats &s) {
+    return {s.runs, s.deferred, s.checkpoints, s.pagesCheckpointed,
+            s.vacuumSteps, s.pagesVacuumed, s.optimizes};
+}
+
+
+C4MaintenanceStats c4db_getMaintenanceStats(C4Database *database) noexcept {
+    return toC4MaintenanceStats(database->dataFile()->maintenanceStats());
+}
+
+
+void c4db_setMaintenanceCallback(C4Database *database, C4MaintenanceCallback callback,
+                                 void *context) noexcept
+{
+    if (!callback) {
+        database->dataFile()->setMaintenanceObserver(nullptr);
+        return;
+    }
+    database->dataFile()->setMaintenanceObserver([=](const DataFile::MaintenanceStats &stats) {
+        C4MaintenanceStats c4stats = toC4MaintenanceStats(stats);
+        callback(database, &c4stats, context);
+    });
+}
+
+
+C4PruningStats c4db_getPruningStats(C4Database *database) noexcept {
+    auto pruner = database->revTreePruner();
+    if (!pruner)
+        return { };
+    auto s = pruner->stats();
+    return {s.docsScanned, s.docsPruned, s.revsPruned, s.bodiesRemoved, s.bytesReclaimed};
+}
+
+
+bool c4db_pruneRevTrees(C4Database *database, C4Error *outError) noexcept {
+    if (!database->mustUseVersioning(kC4RevisionTrees, outError))
+        return false;
+    auto pruner = database->revTreePruner();
+    if (!pruner) {
+        recordError(LiteCoreDomain, kC4ErrorNotWriteable, outError);
+        return false;
+    }
+    return tryCatch(outError, [&]{ pruner->pruneAll(); });
+}
+
+
 C4SliceResult c4db_getPath(C4Database *database) noexcept {
     return sliceResult(database->path().path());
 }
@@ -45,14 +45,18 @@ struct C4DocEnumerator: C4InstanceCounted {
     :_database(database),
      _e(database->defaultKeyStore(), since, allDocOptions(options)),
      _options(options)
-    { }
+    {
+        initLimit();
+    }
 
     C4DocEnumerator(C4Database *database,
                     const C4EnumeratorOptions &options)
     :_database(database),
      _e(database->defaultKeyStore(), allDocOptions(options)),
      _options(options)
-    { }
+    {
+        initLimit();
+    }
 
     void close() {
         _e.close();
@@ -64,18 +68,35 @@ struct C4DocEnumerator: C4InstanceCounted {
         options.includeDeleted  = (c4options.flags & kC4IncludeDeleted) != 0;
         if ((c4options.flags & kC4IncludeBodies) == 0)
             options.contentOptions = kMetaOnly;
+        options.startKey        = c4options.startKey;
+        options.endKey          = c4options.endKey;
+        options.prefix          = c4options.prefix;
+        if (canPushDownLimit(c4options)) {
+            options.skip        = c4options.skip;
+            options.limit       = c4options.limit;
+        }
         return options;
     }
 
+    // Skip and limit can only be left to the storage layer if every record it returns is used.
+    static bool canPushDownLimit(const C4EnumeratorOptions &c4options) {
+        return (c4options.flags & kC4IncludeNonConflicted) != 0;
+    }
+
     void setFilter(const EnumFilter &f)  {_filter = f;}
 
     C4Database* database() const {return external(_database);}
 
     bool next() {
+        if (_limit == 0) {
+            _e.close();
+            return false;
+        }
         do {
             if (!_e.next())
                 return false;
-        } while (!useDoc());
+        } while (!useDoc() || skipDoc());
+        --_limit;
         return true;
     }
 
@@ -86,7 +107,7 @@ struct C4DocEnumerator: C4InstanceCounted {
     bool getDocInfo(C4DocumentInfo *outInfo) {
         if (!_e)
             return false;
-        outInfo->docID = _e.record().key();
+        outInfo->docID = _e.record().keySlice();
         outInfo->revID = _docRevID;
         outInfo->flags = _docFlags;
         outInfo->sequence = _e.record().sequence();
@@ -95,6 +116,23 @@ struct C4DocEnumerator: C4InstanceCounted {
     }
 
 private:
+    void initLimit() {
+        if (canPushDownLimit(_options)) {
+            _skip = 0;
+            _limit = UINT64_MAX;
+        } else {
+            _skip = _options.skip;
+            _limit = _options.limit ? _options.limit : UINT64_MAX;
+        }
+    }
+
+    inline bool skipDoc() {
+        if (_skip == 0)
+            return false;
+        --_skip;
+        return true;
+    }
+
     inline bool useDoc() {
         auto &rec = _e.record();
         if (!rec.exists()) {
@@ -104,7 +142,7 @@ private:
             _docRevID = nullslice;
             return (!_filter || _filter(rec, 0));
         }
-        _docRevID = _database->documentFactory().revIDFromVersion(rec.version());
+        _docRevID = _database->documentFactory().revIDFromVersion(rec.versionSlice());
         _docFlags = (C4DocumentFlags)rec.flags() | kDocExists;
         auto optFlags = _options.flags;
         return (optFlags & kC4IncludeNonConflicted ||  (_docFlags & ::kDocConflicted))
@@ -115,6 +153,7 @@ private:
     RecordEnumerator _e;
     C4EnumeratorOptions _options;
     EnumFilter _filter;
+    uint64_t _skip, _limit;             // Remaining skip/limit, if not handled by _e
 
     C4DocumentFlags _docFlags;
     alloc_slice _docRevID;
@@ -114,9 +114,9 @@ uint64_t c4db_nextDocExpiration(C4Database *database) noexcept
     return tryCatch<uint64_t>(nullptr, [database]{
         KeyStore& expiryKvs = database->getKeyStore("expiry");
         RecordEnumerator e(expiryKvs);
-        if(e.next() && e.record().body() == nullslice) {
+        if(e.next() && e.record().bodySlice() == nullslice) {
             // Look for an entry with a null body (otherwise, its key is simply a doc ID)
-            Array info = Value::fromData(e.record().key()).asArray();
+            Array info = Value::fromData(e.record().keySlice()).asArray();
             return info[0U].asUnsigned();
         }
         return (uint64_t)0;
@@ -143,8 +143,8 @@ public:
         if(!_e.next()) {
             return false;
         }
-        auto key = _e.record().key();
-        if (key > _endKey) {
+        slice key = _e.record().keySlice();
+        if (key.compare(_endKey) > 0) {
             return false;
         }
         auto info = Value::fromData(key).asArray();
@@ -160,7 +160,7 @@ public:
     
     slice key() const
     {
-        return _e.record().key();
+        return _e.record().keySlice();
     }
     
     void reset()
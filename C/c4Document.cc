@@ -72,6 +72,29 @@ C4Document* c4doc_getBySequence(C4Database *database,
 }
 
 
+bool c4doc_getMulti(C4Database *database,
+                    const C4Slice docIDs[],
+                    size_t count,
+                    C4Document* outDocs[],
+                    C4Error *outError) noexcept
+{
+    vector<C4Document*> docs;
+    try {
+        vector<slice> keys(docIDs, docIDs + count);
+        auto recs = database->defaultKeyStore().getMany(keys);
+        docs.reserve(count);
+        for (auto &rec : recs)
+            docs.push_back(rec.exists() ? database->documentFactory().newDocumentInstance(rec)
+                                        : nullptr);
+        copy(docs.begin(), docs.end(), outDocs);
+        return true;
+    } catchError(outError)
+    for (auto doc : docs)
+        delete doc;
+    return false;
+}
+
+
 #pragma mark - REVISIONS:
 
 
@@ -567,7 +590,8 @@ C4Document* c4doc_update(C4Document *doc,
 
 bool c4doc_removeRevisionBody(C4Document* doc) noexcept {
     auto idoc = internal(doc);
-    return idoc->mustBeInTransaction(NULL) && idoc->removeSelectedRevBody();
+    return idoc->mustBeInTransaction(NULL)
+        && tryCatch<bool>(nullptr, bind(&Document::removeSelectedRevBody, idoc));
 }
 
 
@@ -23,8 +23,11 @@
 #include "DataFile.hh"
 #include "Query.hh"
 #include "Record.hh"
+#include "SequenceTracker.hh"
 #include <math.h>
 #include <limits.h>
+#include <algorithm>
+#include <deque>
 #include <mutex>
 using namespace litecore;
 
@@ -33,7 +36,8 @@ using namespace litecore;
 
 
 CBL_CORE_API const C4QueryOptions kC4DefaultQueryOptions = {
-    true
+    true,
+    false
 };
 
 
@@ -150,6 +154,12 @@ unsigned c4query_columnCount(C4Query *query) noexcept {
 }
 
 
+C4QueryCacheStats c4db_getQueryCacheStats(C4Database *database) noexcept {
+    auto stats = database->dataFile()->queryCacheStats();
+    return {stats.hits, stats.misses, (uint32_t)stats.count};
+}
+
+
 C4QueryEnumerator* c4query_run(C4Query *query,
                                const C4QueryOptions *c4options,
                                C4Slice encodedParameters,
@@ -158,6 +168,8 @@ C4QueryEnumerator* c4query_run(C4Query *query,
     return tryCatch<C4QueryEnumerator*>(outError, [&]{
         Query::Options options;
         options.paramBindings = encodedParameters;
+        if (c4options)
+            options.streaming = c4options->streaming;
         return new C4QueryEnumeratorImpl(query, &options);
     });
 }
@@ -242,6 +254,135 @@ void c4queryenum_free(C4QueryEnumerator *e) noexcept {
 }
 
 
+#pragma mark - LIVE QUERY:
+
+
+struct c4QueryObserver : C4InstanceCounted {
+    c4QueryObserver(C4Query *query, C4Slice encodedParameters,
+                    C4QueryObserverCallback callback, void *context)
+    :_database(query->database())
+    ,_query(query->query())
+    ,_callback(callback)
+    ,_context(context)
+    {
+        // Start observing before running the query, so no change can slip in between:
+        {
+            lock_guard<mutex> lock(_database->sequenceTracker().mutex());
+            _notifier.reset(new DatabaseChangeNotifier(_database->sequenceTracker(),
+                                                       [this](DatabaseChangeNotifier&) {
+                                                           _callback(this, _context);
+                                                       }));
+        }
+        try {
+            Query::Options options;
+            options.paramBindings = encodedParameters;
+            _liveQuery.reset(_query->createLiveQuery(&options));
+        } catch (...) {
+            lock_guard<mutex> lock(_notifier->tracker.mutex());
+            _notifier.reset();
+            throw;
+        }
+    }
+
+    ~c4QueryObserver() {
+        if (_notifier) {
+            lock_guard<mutex> lock(_notifier->tracker.mutex());
+            _notifier.reset();
+        }
+    }
+
+    uint32_t getChanges(C4QueryRowChange outChanges[], uint32_t maxChanges) {
+        static_assert(sizeof(C4QueryRowChange) == sizeof(LiveQuery::RowChange),
+                      "C4QueryRowChange doesn't match LiveQuery::RowChange");
+        if (_pending.empty()) {
+            vector<alloc_slice> docIDs = readChangedDocIDs();
+            if (!docIDs.empty()) {
+                vector<LiveQuery::RowChange> changes;
+                _liveQuery->update(docIDs, changes);
+                _pending.insert(_pending.end(), changes.begin(), changes.end());
+            }
+        }
+        uint32_t n = (uint32_t)min((size_t)maxChanges, _pending.size());
+        copy(_pending.begin(), _pending.begin() + n, (LiveQuery::RowChange*)outChanges);
+        _pending.erase(_pending.begin(), _pending.begin() + n);
+        return n;
+    }
+
+    QueryEnumerator* createEnumerator() {
+        return _liveQuery->createEnumerator();
+    }
+
+    Retained<Database> _database;
+
+private:
+    // Reads all the changes from the notifier, which also re-arms its callback.
+    vector<alloc_slice> readChangedDocIDs() {
+        static const size_t kBatchSize = 100;
+        SequenceTracker::Change changes[kBatchSize];
+        vector<alloc_slice> docIDs;
+        lock_guard<mutex> lock(_notifier->tracker.mutex());
+        size_t n;
+        do {
+            bool external;
+            n = _notifier->readChanges(changes, kBatchSize, external);
+            for (size_t i = 0; i < n; ++i)
+                docIDs.push_back(changes[i].docID);
+        } while (n == kBatchSize);
+        return docIDs;
+    }
+
+    Retained<Query> _query;
+    C4QueryObserverCallback _callback;
+    void *_context;
+    unique_ptr<DatabaseChangeNotifier> _notifier;
+    unique_ptr<LiveQuery> _liveQuery;
+    deque<LiveQuery::RowChange> _pending;       // Changes not yet returned by getChanges
+    //NOTE: _notifier is deleted explicitly in the destructor, with the tracker locked, while
+    // _database (and hence the SequenceTracker) is still alive.
+};
+
+
+C4QueryObserver* c4queryobs_create(C4Query *query,
+                                   C4Slice encodedParameters,
+                                   C4QueryObserverCallback callback,
+                                   void *context,
+                                   C4Error *outError) noexcept
+{
+    return tryCatch<C4QueryObserver*>(outError, [&]{
+        return new c4QueryObserver(query, encodedParameters, callback, context);
+    });
+}
+
+
+uint32_t c4queryobs_getChanges(C4QueryObserver *obs,
+                               C4QueryRowChange outChanges[],
+                               uint32_t maxChanges,
+                               C4Error *outError) noexcept
+{
+    clearError(outError);
+    return tryCatch<uint32_t>(outError, [&]{
+        return obs->getChanges(outChanges, maxChanges);
+    });
+}
+
+
+C4QueryEnumerator* c4queryobs_getEnumerator(C4QueryObserver *obs,
+                                            C4Error *outError) noexcept
+{
+    return tryCatch<C4QueryEnumerator*>(outError, [&]{
+        return new C4QueryEnumeratorImpl(obs->_database, obs->createEnumerator());
+    });
+}
+
+
+void c4queryobs_free(C4QueryObserver *obs) noexcept {
+    if (obs) {
+        Retained<Database> retainDB(obs->_database);   // keep db alive until obs is deleted
+        delete obs;
+    }
+}
+
+
 #pragma mark - INDEXES:
 
 
@@ -43,6 +43,9 @@ extern "C" {
         kC4DB_SharedKeys    = 0x10, ///< Enable shared-keys optimization at creation time
         kC4DB_NoUpgrade     = 0x20, ///< Disable upgrading an older-version database
         kC4DB_NonObservable = 0x40, ///< Disable c4DatabaseObserver
+        kC4DB_BackgroundMaintenance = 0x80, ///< Checkpoint/vacuum/optimize/prune on a background thread
+        kC4DB_UpgradeFormat = 0x100,///< Let docs in an older file be saved in newer formats
+                                    ///< (after which older versions of LiteCore can't open it)
     };
 
     /** Document versioning system (also determines database storage schema) */
@@ -67,6 +70,16 @@ extern "C" {
         uint8_t bytes[32];
     } C4EncryptionKey;
 
+    /** Storage-engine cache and I/O settings, in C4DatabaseConfig or c4db_setStorageTuning.
+        A zero field means "use the default"; all-zero (the default) is a good general setting. */
+    typedef struct C4StorageTuning {
+        int64_t cacheSize;          ///< Page cache size per connection, in bytes
+        int64_t mmapSize;           ///< Bytes of file to memory-map; negative disables mmap
+        int64_t journalSizeLimit;   ///< Max size of the journal after a commit; negative = no limit
+        int32_t pageSize;           ///< Page size, in bytes (power of 2); only used at creation
+        int32_t workerThreads;      ///< Extra threads for large sorts & index builds; negative = none
+    } C4StorageTuning;
+
     /** Underlying storage engines that can be used. */
     typedef const char* C4StorageEngine;
     CBL_CORE_API extern C4StorageEngine const kC4SQLiteStorageEngine;
@@ -77,6 +90,7 @@ extern "C" {
         C4StorageEngine storageEngine;  ///< Which storage to use, or NULL for no preference
         C4DocumentVersioning versioning;///< Type of document versioning
         C4EncryptionKey encryptionKey;  ///< Encryption to use creating/opening the db
+        C4StorageTuning tuning;         ///< Cache/mmap/page-size settings (zero for defaults)
     } C4DatabaseConfig;
 
 
@@ -144,6 +158,62 @@ extern "C" {
                     const C4EncryptionKey *newKey,
                     C4Error *outError) C4API;
 
+    /** Changes a database's cache, mmap, journal and worker-thread settings while it's open.
+        The page size can't be changed once the database exists, so that field is ignored. */
+    bool c4db_setStorageTuning(C4Database* database C4NONNULL,
+                               const C4StorageTuning *tuning C4NONNULL,
+                               C4Error *outError) C4API;
+
+    /** Counters of the work done by background maintenance (see kC4DB_BackgroundMaintenance),
+        which checkpoints the WAL, frees unused pages and updates query-planner statistics
+        while the database is idle. */
+    typedef struct {
+        uint64_t runs;                  ///< Number of times maintenance ran
+        uint64_t deferred;              ///< Number of times it yielded to a busy database
+        uint64_t checkpoints;           ///< Number of WAL checkpoints that copied pages
+        uint64_t pagesCheckpointed;     ///< Number of WAL pages copied into the database
+        uint64_t vacuumSteps;           ///< Number of incremental vacuum steps
+        uint64_t pagesVacuumed;         ///< Number of free pages returned to the filesystem
+        uint64_t optimizes;             ///< Number of times query-planner stats were updated
+    } C4MaintenanceStats;
+
+    /** Returns the counters of the database's background maintenance (all zero if the database
+        wasn't opened with kC4DB_BackgroundMaintenance.) */
+    C4MaintenanceStats c4db_getMaintenanceStats(C4Database* database C4NONNULL) C4API;
+
+    /** Callback invoked after background maintenance did some work. It's called on the
+        maintenance thread, with the updated counters. */
+    typedef void (*C4MaintenanceCallback)(C4Database* database C4NONNULL,
+                                          const C4MaintenanceStats *stats C4NONNULL,
+                                          void *context);
+
+    /** Registers a callback to be invoked after background maintenance does some work, or
+        removes it if `callback` is NULL. */
+    void c4db_setMaintenanceCallback(C4Database* database C4NONNULL,
+                                     C4MaintenanceCallback callback,
+                                     void *context) C4API;
+
+    /** Counters of the work done pruning documents' revision trees, which removes revisions
+        deeper than c4db_getMaxRevTreeDepth and the bodies of closed conflict branches. With
+        kC4DB_BackgroundMaintenance this is mostly done on a background thread, instead of
+        whenever a document is saved; c4db_pruneRevTrees does it on demand. */
+    typedef struct {
+        uint64_t docsScanned;           ///< Number of documents examined
+        uint64_t docsPruned;            ///< Number of documents whose trees were rewritten
+        uint64_t revsPruned;            ///< Number of revisions removed from trees
+        uint64_t bodiesRemoved;         ///< Number of closed conflict branches' bodies removed
+        uint64_t bytesReclaimed;        ///< Decrease in size of the stored trees and bodies
+    } C4PruningStats;
+
+    /** Returns the counters of rev-tree pruning done through this C4Database, both in the
+        background and by c4db_pruneRevTrees. */
+    C4PruningStats c4db_getPruningStats(C4Database* database C4NONNULL) C4API;
+
+    /** Prunes the revision trees of all documents saved since they were last pruned, on the
+        calling thread, in a series of short transactions. Only supported with kC4RevisionTrees
+        versioning, in a writeable database. */
+    bool c4db_pruneRevTrees(C4Database* database C4NONNULL, C4Error *outError) C4API;
+
     /** Closes down the storage engines. Must close all databases first.
         You don't generally need to do this, but it can be useful in tests. */
     bool c4_shutdown(C4Error *outError) C4API;
@@ -194,13 +264,73 @@ extern "C" {
     bool c4db_compact(C4Database* database C4NONNULL, C4Error *outError) C4API;
 
 
+    /** A compaction running on a background thread; see c4db_startCompaction. */
+    typedef struct C4CompactionJob C4CompactionJob;
+
+    /** The stages of a compaction job, in order. */
+    typedef C4_ENUM(uint32_t, C4CompactionPhase) {
+        kC4CompactionVacuuming,         ///< Freeing unused pages of the database file
+        kC4CompactionScanningDocs,      ///< Indexing blob references, if the file predates that
+        kC4CompactionDeletingBlobs,     ///< Deleting unreferenced blobs
+        kC4CompactionFinished,          ///< Done
+    };
+
+    /** The state of a compaction job. */
+    typedef struct {
+        C4CompactionPhase phase;
+        bool     running;           ///< False when finished, canceled, or stopped by an error
+        uint64_t pagesFreed;        ///< Database pages returned to the filesystem
+        uint64_t docsScanned;       ///< Documents added to the blob reference index
+        uint64_t blobsScanned;      ///< Blob files examined
+        uint64_t blobsDeleted;      ///< Blob files deleted
+        C4Error  error;             ///< The error that stopped the job, if any
+    } C4CompactionProgress;
+
+    /** Callback invoked on the job's thread after each step of a compaction, and when it stops
+        (when `progress->running` is false.) It must not free the job. */
+    typedef void (*C4CompactionCallback)(C4CompactionJob* job C4NONNULL,
+                                         const C4CompactionProgress* progress C4NONNULL,
+                                         void *context);
+
+    /** Starts compacting the database on a background thread. Unlike c4db_compact, this uses its
+        own connection and works in small steps, so the database can be used normally while it
+        runs. The job can be canceled and later resumed.
+        @param database  The database to compact.
+        @param callback  Optional function to call with progress updates.
+        @param context  Arbitrary value passed to the callback.
+        @param outError  On failure, will be set to the error status.
+        @return  The new job, which must be freed with c4compact_free. */
+    C4CompactionJob* c4db_startCompaction(C4Database* database C4NONNULL,
+                                          C4CompactionCallback callback,
+                                          void *context,
+                                          C4Error *outError) C4API;
+
+    /** Asks a compaction job to stop after its current step. Returns immediately; the callback
+        is invoked when it has stopped. */
+    void c4compact_cancel(C4CompactionJob* job C4NONNULL) C4API;
+
+    /** Resumes a compaction job that was canceled or stopped by an error. */
+    void c4compact_resume(C4CompactionJob* job C4NONNULL) C4API;
+
+    /** Returns the current state of a compaction job. */
+    C4CompactionProgress c4compact_getProgress(C4CompactionJob* job C4NONNULL) C4API;
+
+    /** Blocks until a compaction job stops running. */
+    void c4compact_wait(C4CompactionJob* job C4NONNULL) C4API;
+
+    /** Cancels a compaction job if it's running, waits for it to stop, and frees it. */
+    void c4compact_free(C4CompactionJob* job) C4API;
+
+
     /** @} */
     /** \name Transactions
         @{ */
 
 
     /** Begins a transaction.
-        Transactions can nest; only the first call actually creates a database transaction. */
+        Transactions can nest; only the first call actually creates a database transaction.
+        Until it's committed, its changes are visible to all reads through this C4Database, on
+        any thread; other C4Databases on the same file see the last committed state. */
     bool c4db_beginTransaction(C4Database* database C4NONNULL,
                                C4Error *outError) C4API;
 
@@ -43,9 +43,16 @@ extern "C" {
     };
 
 
-    /** Options for enumerating over all documents. */
+    /** Options for enumerating over all documents.
+        The key range and prefix are applied to document IDs; they're pushed down into the
+        storage engine's query so they use the docID index. Fields left zeroed have no effect. */
     typedef struct {
         C4EnumeratorFlags flags;    ///< Option flags */
+        C4String startKey;          ///< First docID to include (inclusive), if non-null
+        C4String endKey;            ///< Last docID to include (inclusive), if non-null
+        C4String prefix;            ///< Only include docIDs starting with this, if non-null
+        uint64_t skip;              ///< Number of initial documents to skip
+        uint64_t limit;             ///< Max number of documents to return; 0 means no limit
     } C4EnumeratorOptions;
 
     /** Default all-docs enumeration options.
@@ -88,8 +95,9 @@ extern "C" {
                                            C4Error *outError) C4API;
 
     /** Creates an enumerator ordered by docID.
-        Options have the same meanings as in Couchbase Lite.
-        There's no 'limit' option; just stop enumerating when you're done.
+        Options have the same meanings as in Couchbase Lite. startKey and endKey are in iteration
+        order, so if kC4Descending is set the startKey should be the greater one. The option
+        strings only need to remain valid during this call.
         Caller is responsible for freeing the enumerator when finished with it.
         @param database  The database.
         @param options  Enumeration options (NULL for defaults).
@@ -92,6 +92,22 @@ extern "C" {
                                     C4SequenceNumber,
                                     C4Error *outError) C4API;
 
+    /** Gets multiple documents from the database at once, which is much faster than calling
+        c4doc_get for each. The current revision of each document is selected.
+        @param database  The database to read from.
+        @param docIDs  An array of `count` document IDs.
+        @param count  The number of document IDs.
+        @param outDocs  An array with room for `count` documents. On success, each item is set to
+                    the document with the corresponding ID, or NULL if that document doesn't
+                    exist. The caller must free each document with c4doc_free.
+        @param outError  On failure, will be set to the error status.
+        @return  True on success, false on failure (in which case no documents are returned.) */
+    bool c4doc_getMulti(C4Database *database C4NONNULL,
+                        const C4String docIDs[],
+                        size_t count,
+                        C4Document* outDocs[],
+                        C4Error *outError) C4API;
+
     /** Saves changes to a C4Document.
         Must be called within a transaction.
         The revision history will be pruned to the maximum depth given. */
@@ -320,6 +336,33 @@ extern "C" {
                              C4RevisionFlags revisionFlags,
                              C4Error *error) C4API;
 
+    /** A new document to be added by c4db_putNewDocs. */
+    typedef struct {
+        C4String docID;             ///< Document ID (required)
+        C4Slice body;               ///< Body of the document
+        C4RevisionFlags revFlags;   ///< Revision flags (attachments, keepBody)
+    } C4NewDocument;
+
+    /** Adds many new documents at once, as for an initial import. This is much faster than
+        calling c4doc_create for each, since no C4Documents are created and the records are
+        written in batches. Each document gets the same revision ID c4doc_create would give it.
+        Must be called within a transaction. Only supported with kC4RevisionTrees versioning.
+        If a document already exists and `overwrite` is true, the new body is saved as a child of
+        its current revision, as by c4doc_update, keeping its history; otherwise the call fails
+        with kC4ErrorConflict. After an error the caller should abort the transaction, since some
+        of the documents may have been saved.
+        @param db  The database to add the documents to
+        @param docs  The documents to add
+        @param count  The number of documents in `docs`
+        @param overwrite  If true, existing documents with the same IDs get new revisions
+        @param error Information about any error that occurred
+        @return  True on success, false on failure. */
+    bool c4db_putNewDocs(C4Database *db C4NONNULL,
+                         const C4NewDocument docs[],
+                         size_t count,
+                         bool overwrite,
+                         C4Error *error) C4API;
+
     /** Adds a revision to a document already in memory as a C4Document. This is more efficient
         than c4doc_put because it doesn't have to read from the database before writing; but if
         the C4Document doesn't have the current state of the document, it will fail with the error
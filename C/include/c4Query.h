@@ -64,16 +64,30 @@ extern "C" {
     unsigned c4query_columnCount(C4Query *query) C4API;
 
 
+    /** Counters of a database's cache of compiled queries. `c4query_new` reuses a compiled
+        query if the same expression (ignoring whitespace and the order of object keys) was
+        compiled before; the cache is cleared when an index is created or deleted. */
+    typedef struct {
+        uint64_t hits;          ///< Number of queries that were found in the cache
+        uint64_t misses;        ///< Number of queries that had to be compiled
+        uint32_t count;         ///< Number of compiled queries currently in the cache
+    } C4QueryCacheStats;
+
+    /** Returns the counters of the database's compiled-query cache. */
+    C4QueryCacheStats c4db_getQueryCacheStats(C4Database *database C4NONNULL) C4API;
+
+
     //////// RUNNING QUERIES:
 
 
     /** Options for running queries. */
     typedef struct {
         bool rankFullText;      ///< Should full-text results be ranked by relevance?
+        bool streaming;         ///< Read rows lazily as the enumerator advances (see below)
     } C4QueryOptions;
 
 
-    /** Default query options. Has skip=0, limit=UINT_MAX, rankFullText=true. */
+    /** Default query options. Has skip=0, limit=UINT_MAX, rankFullText=true, streaming=false. */
 	CBL_CORE_API extern const C4QueryOptions kC4DefaultQueryOptions;
 
 
@@ -112,7 +126,13 @@ extern "C" {
         NOTE: Queries will run much faster if the appropriate properties are indexed.
         Indexes must be created explicitly by calling `c4db_createIndex`.
         @param query  The compiled query to run.
-        @param options  Query options; only `skip` and `limit` are currently recognized.
+        @param options  Query options; `rankFullText` and `streaming` are recognized.
+                If `streaming` is true, rows are read from the database as the enumerator
+                advances instead of all at once, which keeps memory use flat and returns the
+                first row quickly. The enumerator then holds a read snapshot of the database
+                until it reaches the end or is closed. Calling c4queryenum_getRowCount or
+                c4queryenum_seek makes it read the remaining rows into memory, and it can't
+                seek back to rows it already returned.
         @param encodedParameters  Optional JSON object whose keys correspond to the named
                 parameters in the query expression, and values correspond to the values to
                 bind. Any unbound parameters will be `null`.
@@ -171,6 +191,85 @@ extern "C" {
     /** @} */
 
 
+    //////// LIVE QUERIES:
+
+
+    /** \name Live Queries
+        @{ */
+
+
+    /** Types of changes to a query's result rows. */
+    typedef C4_ENUM(uint8_t, C4QueryRowChangeType) {
+        kC4RowInserted,     ///< A new row, at `newIndex`
+        kC4RowRemoved,      ///< The row at `oldIndex` is gone
+        kC4RowMoved,        ///< The row moved from `oldIndex` to `newIndex` (and may have changed)
+        kC4RowUpdated,      ///< The row's values changed, but its position didn't
+    };
+
+    /** A change to a query's result rows. `oldIndex` refers to the previous results and
+        `newIndex` to the updated ones, so a set of changes can be applied as one batch. */
+    typedef struct {
+        C4QueryRowChangeType type;
+        int64_t oldIndex;           ///< Row's index in the previous results, or -1 if inserted
+        int64_t newIndex;           ///< Row's index in the updated results, or -1 if removed
+    } C4QueryRowChange;
+
+    /** A query-observer reference. */
+    typedef struct c4QueryObserver C4QueryObserver;
+
+    /** Callback invoked by a query observer when documents have changed, so the query's
+        results may have changed too. As with a database observer, it's called _once_, and then
+        not again until `c4queryobs_getChanges` has been called. It's called on the thread that
+        made the change, so it should only schedule a call to `c4queryobs_getChanges`.
+        @param observer  The observer that initiated the callback.
+        @param context  user-defined parameter given when registering the callback. */
+    typedef void (*C4QueryObserverCallback)(C4QueryObserver* observer C4NONNULL,
+                                            void *context);
+
+    /** Creates a live query: runs the query and keeps its results up to date as documents
+        change. Instead of re-running the whole query after every change, the changed documents
+        are matched against it, and its results are patched; only queries with aggregates,
+        JOINs, OFFSET or full-text matching are always re-run.
+        @param query  The compiled query. It may go on being used elsewhere, even by other
+                        threads (`c4query_new` shares compiled queries anyway); the observer
+                        compiles its own statements for patching the results.
+        @param encodedParameters  Optional JSON object of parameter values, as in c4query_run.
+        @param callback  The function to call after documents change.
+        @param context  An arbitrary value that will be passed to the callback.
+        @param outError  On failure, will be set to the error status.
+        @return  The new observer reference, or NULL on error. */
+    C4QueryObserver* c4queryobs_create(C4Query *query C4NONNULL,
+                                       C4String encodedParameters,
+                                       C4QueryObserverCallback callback C4NONNULL,
+                                       void *context,
+                                       C4Error *outError) C4API;
+
+    /** Brings the query's results up to date with the documents that have changed, and returns
+        how the result rows changed. Like `c4dbobs_getChanges`, this reads changes from a stream:
+        if there are more than `maxChanges`, the rest are returned by the next call(s) before any
+        further document changes are processed.
+        @param observer  The observer.
+        @param outChanges  A caller-provided buffer of structs into which changes will be written.
+        @param maxChanges  The maximum number of changes to return.
+        @param outError  On failure, will be set to the error status; otherwise cleared.
+        @return  The number of changes written to `outChanges`. */
+    uint32_t c4queryobs_getChanges(C4QueryObserver *observer C4NONNULL,
+                                   C4QueryRowChange outChanges[] C4NONNULL,
+                                   uint32_t maxChanges,
+                                   C4Error *outError) C4API;
+
+    /** Returns an enumerator over the observer's current results, as of the last call to
+        `c4queryobs_getChanges`. Must be freed with c4queryenum_free. */
+    C4QueryEnumerator* c4queryobs_getEnumerator(C4QueryObserver *observer C4NONNULL,
+                                                C4Error *outError) C4API;
+
+    /** Stops an observer and frees the resources it's using.
+        It is safe to pass NULL to this call. */
+    void c4queryobs_free(C4QueryObserver*) C4API;
+
+    /** @} */
+
+
     //////// INDEXES:
 
 
@@ -182,7 +281,8 @@ extern "C" {
     typedef C4_ENUM(uint32_t, C4IndexType) {
         kC4ValueIndex,         ///< Regular index of property value
         kC4FullTextIndex,      ///< Full-text index
-        kC4GeoIndex,           ///< Geospatial index of GeoJSON values (NOT YET IMPLEMENTED)
+        kC4GeoIndex,           ///< Geospatial index of latitude/longitude values
+        kC4ArrayIndex,         ///< Index of the values in an array property, used by ANY/EVERY
     };
 
 
@@ -225,7 +325,7 @@ extern "C" {
         The name is used to identify the index for later updating or deletion; if an index with the
         same name already exists, it will be replaced unless it has the exact same expressions.
 
-        Currently two types of indexes are supported:
+        Currently four types of indexes are supported:
 
         * Value indexes speed up queries by making it possible to look up property (or expression)
           values without scanning every document. They're just like regular indexes in SQL or N1QL.
@@ -236,6 +336,13 @@ extern "C" {
           search: a query with a `MATCH` operator will fail to compile unless there is already a
           FTS index for the property/expression being matched. Only a single expression is
           currently allowed, and it must evaluate to a string.
+        * Array indexes speed up `ANY` and `EVERY` queries over an array property, by indexing
+          each element of the array. The single expression must be a property. The index is only
+          used when the query's test uses the elements' values directly (like `?x = 'red'`), not
+          properties nested inside them.
+        * Geospatial indexes enable fast `WITHIN_BOX` and `WITHIN_RADIUS` queries. There must be
+          two expressions, the latitude and longitude in degrees. The index stores coordinates
+          as 32-bit floats, so it's precise to about a meter.
 
         Note: If the value of an expression in some document is missing or an unsupported type,
         that document will just be omitted from the index. It's not an error.
@@ -244,16 +351,22 @@ extern "C" {
         `[[".name.first"]]` will index on the first-name property. Note the two levels of brackets,
         since an expression is already an array.
 
+        A value index can be limited to the documents matching a test, by giving a dictionary
+        instead of an array: the expressions are its "WHAT" and the test, in query syntax, is its
+        "WHERE". For example `{"WHAT": [[".date"]], "WHERE": ["=", [".type"], "order"]}`.
+        Such a partial index is smaller and cheaper to update; a query uses it only if its own
+        WHERE clause contains the same test (possibly ANDed with others.)
+
         Currently, full-text indexes are limited to a single expression only.
-        Geospatial indexes are not implemented at all yet.
 
         @param database  The database to index.
         @param name  The name of the index. Any existing index with the same name will be replaced,
                      unless it has the identical expressions (in which case this is a no-op.)
         @param expressionsJSON  A JSON array of one or more expressions to index. Each expression
                      takes the same form as in a query, which means it's a JSON array as well;
-                     don't get mixed up by the nesting!
-        @param indexType  The type of index (value or full-text.)
+                     don't get mixed up by the nesting! (Or, for a partial value index, a
+                     dictionary with "WHAT" and "WHERE" keys.)
+        @param indexType  The type of index (value, full-text, array or geospatial.)
         @param indexOptions  Options for the index. If NULL, each option will get a default value.
         @param outError  On failure, will be set to the error status.
         @return  True on success, false on failure. */
@@ -19,8 +19,10 @@
 #include "c4Test.hh"
 #include "c4Private.h"
 #include "c4DocEnumerator.h"
+#include "c4.hh"
 #include "c4ExpiryEnumerator.h"
 #include "c4BlobStore.h"
+#include <atomic>
 #include <cmath>
 #include <errno.h>
 #include <iostream>
@@ -57,6 +59,15 @@ class C4DatabaseTest : public C4Test {
         REQUIRE(cmsg == &buf[0]);
     }
 
+    // Returns the value of an integer SQLite pragma on a database's main connection.
+    int64_t pragma(C4Database *database, const char *name) {
+        C4Error error;
+        string sql = string("PRAGMA ") + name;
+        fleece::alloc_slice result(c4db_rawQuery(database, c4str(sql.c_str()), &error));
+        REQUIRE(result);
+        return Value::fromTrustedData(result).asArray()[0].asArray()[0].asInt();
+    }
+
     void setupAllDocs() {
         createNumberedDocs(99);
         // Add a deleted doc to make sure it's skipped by default:
@@ -330,6 +341,59 @@ N_WAY_TEST_CASE_METHOD(C4DatabaseTest, "Database AllDocsInfo", "[Database][C]")
 }
 
 
+N_WAY_TEST_CASE_METHOD(C4DatabaseTest, "Database AllDocs Range", "[Database][C]") {
+    setupAllDocs();
+    C4Error error;
+
+    auto collect = [&](const C4EnumeratorOptions &options) {
+        std::vector<std::string> docIDs;
+        c4::ref<C4DocEnumerator> e = c4db_enumerateAllDocs(db, &options, &error);
+        REQUIRE(e);
+        while (c4enum_next(e, &error)) {
+            C4DocumentInfo info;
+            REQUIRE(c4enum_getDocumentInfo(e, &info));
+            docIDs.push_back(toString(info.docID));
+        }
+        CHECK(error.code == 0);
+        return docIDs;
+    };
+
+    C4EnumeratorOptions options = kC4DefaultEnumeratorOptions;
+    options.startKey = c4str("doc-010");
+    options.endKey = c4str("doc-020");
+    auto docIDs = collect(options);
+    REQUIRE(docIDs.size() == 11);
+    CHECK(docIDs.front() == "doc-010");
+    CHECK(docIDs.back() == "doc-020");
+
+    options.flags |= kC4Descending;
+    options.startKey = c4str("doc-020");
+    options.endKey = c4str("doc-010");
+    options.skip = 2;
+    options.limit = 3;
+    CHECK(collect(options) == (std::vector<std::string>{"doc-018", "doc-017", "doc-016"}));
+
+    options = kC4DefaultEnumeratorOptions;
+    options.prefix = c4str("doc-00");
+    docIDs = collect(options);
+    REQUIRE(docIDs.size() == 9);            // doc-005DEL is deleted, so it's skipped
+    CHECK(docIDs.front() == "doc-001");
+    CHECK(docIDs.back() == "doc-009");
+
+    options.flags |= kC4IncludeDeleted;
+    options.limit = 6;
+    docIDs = collect(options);
+    REQUIRE(docIDs.size() == 6);
+    CHECK(docIDs.back() == "doc-005DEL");
+
+    // Limit is applied after the conflict filter, which the storage layer doesn't know about:
+    options = kC4DefaultEnumeratorOptions;
+    options.flags &= ~kC4IncludeNonConflicted;
+    options.limit = 1;
+    CHECK(collect(options).empty());
+}
+
+
 N_WAY_TEST_CASE_METHOD(C4DatabaseTest, "Database Changes", "[Database][C]") {
     createNumberedDocs(99);
 
@@ -552,6 +616,198 @@ N_WAY_TEST_CASE_METHOD(C4DatabaseTest, "Database Compact", "[Database][C]")
     REQUIRE(c4blob_getSize(store, key3) == -1);
 }
 
+N_WAY_TEST_CASE_METHOD(C4DatabaseTest, "Database Blob References", "[Database][C]")
+{
+    C4Error err;
+    vector<string> atts;
+    atts.emplace_back("This is the first attachment");
+    C4BlobKey key1, key2;
+    {
+        TransactionHelper t(db);
+        key1 = addDocWithAttachments(C4STR("doc001"), atts, "text/plain")[0];
+        addDocWithAttachments(C4STR("doc002"), atts, "text/plain");
+    }
+    C4BlobStore* store = c4db_getBlobStore(db, &err);
+    REQUIRE(store);
+    REQUIRE(c4blob_create(store, C4STR("This blob isn't referenced"), nullptr, &key2, &err));
+
+    // Purging one of the docs leaves the blob referenced by the other:
+    {
+        TransactionHelper t(db);
+        REQUIRE(c4db_purgeDoc(db, C4STR("doc001"), &err));
+    }
+    REQUIRE(c4db_compact(db, &err));
+    CHECK(c4blob_getSize(store, key1) > 0);
+    CHECK(c4blob_getSize(store, key2) == -1);
+
+    // The references are persistent:
+    reopenDB();
+    store = c4db_getBlobStore(db, &err);
+    {
+        TransactionHelper t(db);
+        REQUIRE(c4db_purgeDoc(db, C4STR("doc002"), &err));
+    }
+    REQUIRE(c4db_compact(db, &err));
+    CHECK(c4blob_getSize(store, key1) == -1);
+}
+
+static void compactionCallback(C4CompactionJob *job, const C4CompactionProgress *progress,
+                               void *context)
+{
+    ++*(std::atomic<int>*)context;
+}
+
+N_WAY_TEST_CASE_METHOD(C4DatabaseTest, "Database Background Compaction", "[Database][C]")
+{
+    C4Error err;
+    string content1 = "This is the first attachment";
+    string content2 = "This is the second attachment";
+    vector<string> atts;
+    C4BlobKey key1, key2;
+    {
+        TransactionHelper t(db);
+        atts.emplace_back(content1);
+        key1 = addDocWithAttachments(C4STR("doc001"), atts, "text/plain")[0];
+        atts.clear();
+        atts.emplace_back(content2);
+        key2 = addDocWithAttachments(C4STR("doc002"), atts, "text/plain")[0];
+    }
+    createNumberedDocs(50);
+    createRev(C4STR("doc001"), kRev2ID, kC4SliceNull, kRevDeleted);
+
+    C4BlobStore* store = c4db_getBlobStore(db, &err);
+    REQUIRE(store);
+
+    std::atomic<int> callbacks {0};
+    C4CompactionJob *job = c4db_startCompaction(db, compactionCallback, &callbacks, &err);
+    REQUIRE(job);
+
+    // The database can be used while the job runs; cancel it, then resume it:
+    createRev(C4STR("doc051"), kRevID, kBody);
+    c4compact_cancel(job);
+    c4compact_wait(job);
+    C4CompactionProgress progress = c4compact_getProgress(job);
+    CHECK(!progress.running);
+    CHECK(progress.error.code == 0);
+    if (progress.phase != kC4CompactionFinished) {
+        c4compact_resume(job);
+        c4compact_wait(job);
+        progress = c4compact_getProgress(job);
+    }
+    CHECK(progress.phase == kC4CompactionFinished);
+    CHECK(!progress.running);
+    CHECK(progress.error.code == 0);
+    CHECK(progress.docsScanned == 0);      // A new database's blob references are already indexed
+    CHECK(progress.blobsScanned == 2);
+    CHECK(progress.blobsDeleted == 1);
+    CHECK(callbacks > 0);
+    c4compact_free(job);
+
+    CHECK(c4blob_getSize(store, key1) == -1);
+    CHECK(c4blob_getSize(store, key2) > 0);
+    CHECK(c4db_getDocumentCount(db) == 52);
+}
+
+
+N_WAY_TEST_CASE_METHOD(C4DatabaseTest, "Database Storage Tuning", "[Database][C]") {
+    createNumberedDocs(99);
+
+    // Change the settings of the open database; readers and writers should keep working:
+    C4StorageTuning tuning = {};
+    tuning.cacheSize = 1 << 20;
+    tuning.mmapSize = -1;
+    tuning.journalSizeLimit = -1;
+    tuning.workerThreads = 2;
+    C4Error error;
+    REQUIRE(c4db_setStorageTuning(db, &tuning, &error));
+    CHECK(c4db_getConfig(db)->tuning.cacheSize == tuning.cacheSize);
+    CHECK(c4db_getConfig(db)->tuning.mmapSize == -1);
+    CHECK(pragma(db, "cache_size") == -1024);           // (negative means KB)
+    CHECK(pragma(db, "mmap_size") == 0);
+    CHECK(pragma(db, "journal_size_limit") == -1);
+    CHECK(c4db_getDocumentCount(db) == 99);
+    createRev(C4STR("tuned"), kRevID, kBody);
+    c4::ref<C4Document> doc = c4doc_get(db, C4STR("tuned"), true, &error);
+    CHECK(doc);
+
+    // The tuning is part of the config, so it's used when reopening:
+    reopenDB();
+    CHECK(c4db_getConfig(db)->tuning.cacheSize == tuning.cacheSize);
+    CHECK(pragma(db, "cache_size") == -1024);
+    CHECK(pragma(db, "mmap_size") == 0);
+    CHECK(pragma(db, "journal_size_limit") == -1);
+    CHECK(c4db_getDocumentCount(db) == 100);
+
+    // A new database can be created with a different page size:
+    string path = TempDir() + "tuned.cblite2" + kPathSeparator;
+    C4DatabaseConfig config = *c4db_getConfig(db);
+    config.flags |= kC4DB_Create;
+    config.tuning = {};
+    config.tuning.pageSize = 8192;
+    if (!c4db_deleteAtPath(c4str(path.c_str()), &error))
+        REQUIRE(error.code == 0);
+    auto tunedDB = c4db_open(c4str(path.c_str()), &config, &error);
+    REQUIRE(tunedDB);
+    CHECK(pragma(tunedDB, "page_size") == 8192);
+    createRev(tunedDB, C4STR("doc"), kRevID, kBody);
+    CHECK(c4db_getDocumentCount(tunedDB) == 1);
+    REQUIRE(c4db_delete(tunedDB, &error));
+    c4db_free(tunedDB);
+}
+
+
+N_WAY_TEST_CASE_METHOD(C4DatabaseTest, "Database File Version", "[Database][C]") {
+    // New files use formats older versions of LiteCore can't read, so their user_version has to
+    // be above the range (201...299) those accept:
+    CHECK(pragma(db, "user_version") == 302);
+    reopenDB();
+    CHECK(pragma(db, "user_version") == 302);
+}
+
+
+N_WAY_TEST_CASE_METHOD(C4DatabaseTest, "Database Older File Version", "[Database][C]") {
+    // Make the file look like one written by an older version of LiteCore:
+    C4Error error;
+    fleece::alloc_slice result(c4db_rawQuery(db, C4STR("PRAGMA user_version=201"), &error));
+    REQUIRE(result);
+    reopenDB();
+
+    // Writing to it leaves it in the original format, so that version can still open it:
+    createRev(C4STR("doc"), kRevID, kBody);
+    createRev(C4STR("doc"), kRev2ID, kBody);
+    reopenDB();
+    CHECK(pragma(db, "user_version") == 201);
+    c4::ref<C4Document> doc = c4doc_get(db, C4STR("doc"), true, &error);
+    REQUIRE(doc);
+    CHECK(doc->revID == kRev2ID);
+    CHECK(doc->selectedRev.body == kBody);
+    doc = nullptr;
+
+    if (!isRevTrees())
+        return;
+
+    // With kC4DB_UpgradeFormat it's upgraded, but only when a doc is saved in the new format:
+    C4DatabaseConfig config = *c4db_getConfig(db);
+    config.flags |= kC4DB_UpgradeFormat;
+    REQUIRE(c4db_close(db, &error));
+    c4db_free(db);
+    db = c4db_open(databasePath(), &config, &error);
+    REQUIRE(db);
+    CHECK(pragma(db, "user_version") == 201);
+    createRev(C4STR("doc2"), kRevID, kBody);
+    CHECK(pragma(db, "user_version") == 302);
+
+    reopenDB();
+    CHECK(pragma(db, "user_version") == 302);
+    doc = c4doc_get(db, C4STR("doc"), true, &error);
+    REQUIRE(doc);
+    CHECK(doc->selectedRev.body == kBody);
+    doc = c4doc_get(db, C4STR("doc2"), true, &error);
+    REQUIRE(doc);
+    CHECK(doc->selectedRev.body == kBody);
+}
+
+
 N_WAY_TEST_CASE_METHOD(C4DatabaseTest, "Database copy", "[Database][C]") {
     C4Slice doc1ID = C4STR("doc001");
     C4Slice doc2ID = C4STR("doc002");
@@ -21,6 +21,9 @@
 #include "Benchmark.hh"
 #include "FleeceCpp.hh"
 #include "c4Document+Fleece.h"
+#include <chrono>
+#include <functional>
+#include <thread>
 
 using namespace fleece;
 
@@ -79,6 +82,69 @@ N_WAY_TEST_CASE_METHOD(C4Test, "FleeceDocs", "[Document][Fleece][C]") {
 }
 
 
+N_WAY_TEST_CASE_METHOD(C4Test, "Document PutNewDocs", "[Document][C]") {
+    C4Error error;
+    C4NewDocument docs[2] = {{C4STR("doc1"), kFleeceBody, 0},
+                             {C4STR("doc2"), kEmptyFleeceBody, 0}};
+    {
+        TransactionHelper t(db);
+        bool ok = c4db_putNewDocs(db, docs, 2, false, &error);
+        if (!isRevTrees()) {
+            REQUIRE(!ok);
+            CHECK(error.code == (int)kC4ErrorUnsupported);
+            return;
+        }
+        REQUIRE(ok);
+    }
+    CHECK(c4db_getDocumentCount(db) == 2);
+    CHECK(c4db_getLastSequence(db) == 2);
+
+    // The docs should be the same as if created by c4doc_create:
+    C4Document *doc;
+    {
+        TransactionHelper t(db);
+        doc = c4doc_create(db, C4STR("doc3"), kFleeceBody, 0, &error);
+        REQUIRE(doc);
+    }
+    C4Document *doc1 = c4doc_get(db, C4STR("doc1"), true, &error);
+    REQUIRE(doc1);
+    alloc_slice revID1 = doc1->revID;
+    CHECK(doc1->revID == doc->revID);
+    CHECK(doc1->sequence == 1);
+    CHECK(doc1->flags == kDocExists);
+    CHECK(doc1->selectedRev.body == kFleeceBody);
+    c4doc_free(doc1);
+    c4doc_free(doc);
+
+    // An existing doc is a conflict unless overwriting, and then none of the docs are written:
+    REQUIRE(c4db_beginTransaction(db, &error));
+    C4NewDocument conflicting[2] = {{C4STR("doc4"), kFleeceBody, 0},
+                                    {C4STR("doc2"), kFleeceBody, 0}};
+    REQUIRE(!c4db_putNewDocs(db, conflicting, 2, false, &error));
+    CHECK(error.domain == LiteCoreDomain);
+    CHECK(error.code == (int)kC4ErrorConflict);
+    CHECK(c4db_getDocumentCount(db) == 3);
+    CHECK(c4db_getLastSequence(db) == 3);
+    CHECK(c4doc_get(db, C4STR("doc4"), true, &error) == nullptr);
+    REQUIRE(c4db_endTransaction(db, false, &error));
+
+    {
+        TransactionHelper t(db);
+        C4NewDocument replacement = {C4STR("doc1"), kEmptyFleeceBody, 0};
+        REQUIRE(c4db_putNewDocs(db, &replacement, 1, true, &error));
+    }
+    CHECK(c4db_getDocumentCount(db) == 3);
+    doc1 = c4doc_get(db, C4STR("doc1"), true, &error);
+    REQUIRE(doc1);
+    CHECK(doc1->sequence == 4);
+    CHECK(doc1->selectedRev.body == kEmptyFleeceBody);
+    CHECK(c4rev_getGeneration(doc1->revID) == 2);      // a child of the existing revision
+    REQUIRE(c4doc_selectParentRevision(doc1));
+    CHECK(doc1->selectedRev.revID == revID1);
+    c4doc_free(doc1);
+}
+
+
 N_WAY_TEST_CASE_METHOD(C4Test, "Document PossibleAncestors", "[Document][C]") {
     if (!isRevTrees()) return;
 
@@ -350,6 +416,173 @@ N_WAY_TEST_CASE_METHOD(C4Test, "Document maxRevTreeDepth", "[Database][C]") {
 }
 
 
+N_WAY_TEST_CASE_METHOD(C4Test, "Document PruneRevTrees", "[Database][C]") {
+    if (!isRevTrees())
+        return;
+    C4Error error;
+    // Create a doc with 50 revisions, without pruning it:
+    {
+        TransactionHelper t(db);
+        C4Document *doc = c4doc_get(db, kDocID, false, &error);
+        REQUIRE(doc);
+        for (int i = 0; i < 50; ++i) {
+            C4DocPutRequest rq = {};
+            rq.docID = kDocID;
+            rq.history = &doc->revID;
+            rq.historyCount = (doc->revID.buf != nullptr);
+            rq.body = kFleeceBody;
+            rq.save = true;
+            rq.maxRevTreeDepth = 100;
+            auto savedDoc = c4doc_put(db, &rq, nullptr, &error);
+            REQUIRE(savedDoc);
+            c4doc_free(doc);
+            doc = savedDoc;
+        }
+        c4doc_free(doc);
+    }
+
+    // Create a doc with a closed conflict branch whose revision has a body:
+    const C4Slice kConflictDocID = C4STR("conflicted");
+    const C4Slice kLosingRevID = C4STR("2-0000");
+    createRev(kConflictDocID, kRevID, kFleeceBody);
+    createRev(kConflictDocID, kRev2ID, kFleeceBody);
+    {
+        TransactionHelper t(db);
+        createConflictingRev(db, kConflictDocID, kRevID, kLosingRevID, kFleeceBody, kRevKeepBody);
+        C4Document *doc = c4doc_get(db, kConflictDocID, true, &error);
+        REQUIRE(doc);
+        REQUIRE(c4doc_resolveConflict(doc, kRev2ID, kLosingRevID, kC4SliceNull, 0, &error));
+        REQUIRE(c4doc_save(doc, 0, &error));
+        REQUIRE(c4doc_selectRevision(doc, kLosingRevID, true, &error));
+        CHECK(c4doc_hasRevisionBody(doc));
+        c4doc_free(doc);
+    }
+    C4SequenceNumber lastSeq = c4db_getLastSequence(db);
+
+    c4db_setMaxRevTreeDepth(db, 10);
+    REQUIRE(c4db_pruneRevTrees(db, &error));
+    C4PruningStats stats = c4db_getPruningStats(db);
+    CHECK(stats.docsScanned == 2);
+    CHECK(stats.docsPruned == 2);
+    CHECK(stats.revsPruned == 40);
+    CHECK(stats.bodiesRemoved == 1);
+    CHECK(stats.bytesReclaimed > 0);
+    CHECK(c4db_getLastSequence(db) == lastSeq);     // Pruning doesn't create sequences
+
+    C4Document *doc = c4doc_get(db, kDocID, true, &error);
+    REQUIRE(doc);
+    CHECK(c4rev_getGeneration(doc->revID) == 50);
+    unsigned nRevs = 0;
+    do {
+        ++nRevs;
+    } while (c4doc_selectParentRevision(doc));
+    CHECK(nRevs == 10);
+    c4doc_free(doc);
+
+    doc = c4doc_get(db, kConflictDocID, true, &error);
+    REQUIRE(doc);
+    CHECK(doc->revID == kRev2ID);
+    REQUIRE(c4doc_selectRevision(doc, kLosingRevID, false, &error));
+    CHECK(!c4doc_hasRevisionBody(doc));
+    c4doc_free(doc);
+
+    // Nothing has been saved since, so there's nothing more to do:
+    REQUIRE(c4db_pruneRevTrees(db, &error));
+    CHECK(c4db_getPruningStats(db).docsScanned == 2);
+}
+
+
+N_WAY_TEST_CASE_METHOD(C4Test, "Document PruneRevTrees In Background", "[Database][C]") {
+    if (!isRevTrees())
+        return;
+    // Reopen with the pruner thread running:
+    auto config = *c4db_getConfig(db);
+    config.flags |= kC4DB_BackgroundMaintenance;
+    C4Error error;
+    REQUIRE(c4db_close(db, &error));
+    c4db_free(db);
+    db = c4db_open(databasePath(), &config, &error);
+    REQUIRE(db);
+    c4db_setMaxRevTreeDepth(db, 10);
+
+    // Wait until the thread has scanned a doc, so it's known to be keeping up:
+    createRev(kDocID, kRevID, kFleeceBody);
+    auto waitForPruner = [&](std::function<bool(const C4PruningStats&)> done) {
+        for (int i = 0; i < 100 && !done(c4db_getPruningStats(db)); ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        return done(c4db_getPruningStats(db));
+    };
+    REQUIRE(waitForPruner([](const C4PruningStats &s) {return s.docsScanned >= 1;}));
+
+    // Saving 15 more revisions with the default depth leaves the tree for the thread to prune:
+    C4Document *doc = c4doc_get(db, kDocID, true, &error);
+    REQUIRE(doc);
+    {
+        TransactionHelper t(db);
+        for (int i = 0; i < 15; ++i) {
+            C4DocPutRequest rq = {};
+            rq.docID = kDocID;
+            rq.history = &doc->revID;
+            rq.historyCount = 1;
+            rq.body = kFleeceBody;
+            rq.save = true;
+            auto savedDoc = c4doc_put(db, &rq, nullptr, &error);
+            REQUIRE(savedDoc);
+            c4doc_free(doc);
+            doc = savedDoc;
+        }
+    }
+    unsigned nRevs = 0;
+    do {
+        ++nRevs;
+    } while (c4doc_selectParentRevision(doc));
+    CHECK(nRevs == 16);
+    c4doc_free(doc);
+
+    REQUIRE(waitForPruner([](const C4PruningStats &s) {return s.revsPruned >= 6;}));
+    doc = c4doc_get(db, kDocID, true, &error);
+    REQUIRE(doc);
+    CHECK(c4rev_getGeneration(doc->revID) == 16);
+    nRevs = 0;
+    do {
+        ++nRevs;
+    } while (c4doc_selectParentRevision(doc));
+    CHECK(nRevs == 10);
+    c4doc_free(doc);
+}
+
+
+N_WAY_TEST_CASE_METHOD(C4Test, "Document GetMulti", "[Database][C]") {
+    char docIDBuf[20];
+    std::vector<std::string> docIDs;
+    for (int i = 0; i < 100; ++i) {
+        sprintf(docIDBuf, "doc-%03d", i);
+        docIDs.push_back(docIDBuf);
+        if (i % 3 != 0)                     // every third doc doesn't exist
+            createRev(c4str(docIDBuf), kRevID, kFleeceBody);
+    }
+    docIDs.push_back("doc-002");            // duplicates are allowed
+
+    std::vector<C4Slice> keys;
+    for (auto &docID : docIDs)
+        keys.push_back(c4str(docID.c_str()));
+    std::vector<C4Document*> docs(keys.size());
+    C4Error error;
+    REQUIRE(c4doc_getMulti(db, keys.data(), keys.size(), docs.data(), &error));
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (i % 3 == 0 && i < 100) {
+            CHECK(docs[i] == nullptr);
+        } else {
+            REQUIRE(docs[i] != nullptr);
+            CHECK(docs[i]->docID == keys[i]);
+            CHECK(docs[i]->revID == kRevID);
+            CHECK(docs[i]->selectedRev.body == kFleeceBody);
+            c4doc_free(docs[i]);
+        }
+    }
+}
+
+
 N_WAY_TEST_CASE_METHOD(C4Test, "Document GetForPut", "[Database][C]") {
     C4Error error;
     TransactionHelper t(db);
@@ -645,6 +878,66 @@ N_WAY_TEST_CASE_METHOD(C4Test, "Document Conflict", "[Database][C]") {
     c4doc_free(doc);
 }
 
+N_WAY_TEST_CASE_METHOD(C4Test, "Document Conflict Body Storage", "[Database][C]") {
+    if (!isRevTrees())
+        return;
+
+    const C4Slice kBody2 = C4STR("{\"ok\":\"go\"}");
+    const C4Slice kConflictBody = C4STR("{\"conflicting\":\"value\"}");
+    createRev(kDocID, kRevID, kBody);
+    createRev(kDocID, kRev2ID, kBody2);
+    C4Error error;
+    {
+        // "Pull" a conflicting revision:
+        TransactionHelper t(db);
+        C4Slice history[2] = {C4STR("2-ababab"), kRevID};
+        C4DocPutRequest rq = {};
+        rq.existingRevision = true;
+        rq.docID = kDocID;
+        rq.history = history;
+        rq.historyCount = 2;
+        rq.body = kConflictBody;
+        rq.save = true;
+        rq.remoteDBID = 1;
+        auto doc = c4doc_put(db, &rq, nullptr, &error);
+        REQUIRE(doc);
+        c4doc_free(doc);
+    }
+
+    // Only the current revision's body is stored in the document's record:
+    C4RawDocument *raw = c4raw_get(db, C4STR("default"), kDocID, &error);
+    REQUIRE(raw);
+    string tree((const char*)raw->body.buf, raw->body.size);
+    CHECK(tree.find(string((const char*)kBody2.buf, kBody2.size)) != string::npos);
+    CHECK(tree.find(string((const char*)kConflictBody.buf, kConflictBody.size)) == string::npos);
+    c4raw_free(raw);
+
+    // ...but the conflicting revision's body is still available:
+    reopenDB();
+    C4Document *doc = c4doc_get(db, kDocID, true, &error);
+    REQUIRE(doc);
+    CHECK(doc->selectedRev.revID == kRev2ID);
+    CHECK(doc->selectedRev.body == kBody2);
+    REQUIRE(c4doc_selectNextLeafRevision(doc, true, true, &error));
+    CHECK(doc->selectedRev.revID == C4STR("2-ababab"));
+    CHECK(c4doc_hasRevisionBody(doc));
+    CHECK(doc->selectedRev.body == kConflictBody);
+
+    // When the conflicting revision wins, its body moves into the record:
+    {
+        TransactionHelper t(db);
+        REQUIRE(c4doc_resolveConflict(doc, C4STR("2-ababab"), kRev2ID, kC4SliceNull, 0, &error));
+        REQUIRE(c4doc_save(doc, 0, &error));
+    }
+    c4doc_free(doc);
+    reopenDB();
+    doc = c4doc_get(db, kDocID, true, &error);
+    REQUIRE(doc);
+    CHECK(doc->revID == C4STR("2-ababab"));
+    CHECK(doc->selectedRev.body == kConflictBody);
+    c4doc_free(doc);
+}
+
 N_WAY_TEST_CASE_METHOD(C4Test, "Document Legacy Properties", "[Database][C]") {
     CHECK(c4doc_isOldMetaProperty(C4STR("_attachments")));
     CHECK(!c4doc_isOldMetaProperty(C4STR("@type")));
@@ -163,6 +163,97 @@ N_WAY_TEST_CASE_METHOD(PerfTest, "Performance", "[Perf][C]") {
 }
 
 
+N_WAY_TEST_CASE_METHOD(PerfTest, "Storage Tuning", "[Perf][C][.slow]") {
+    // Compares random reads and a full scan of the same data under different cache/mmap settings.
+    struct Profile {const char *name; C4StorageTuning tuning;};
+    const Profile profiles[] = {
+        {"1MB cache, no mmap",      {1 << 20,   -1,         0, 0}},
+        {"default",                 {0,         0,          0, 0}},
+        {"64MB cache, 256MB mmap",  {64 << 20,  256 << 20,  0, 0}},
+    };
+
+    auto numDocs = importJSONLines(sFixturesDir + "iTunesMusicLibrary.json");
+    REQUIRE(numDocs == 12189);
+    for (auto &profile : profiles) {
+        std::cerr << "---- " << profile.name << " ----\n";
+        C4Error error;
+        REQUIRE(c4db_setStorageTuning(db, &profile.tuning, &error));
+        reopenDB();     // start with a cold cache
+
+        readRandomDocs(numDocs, 100000);
+
+        Stopwatch st;
+        unsigned n = 0;
+        C4EnumeratorOptions options = kC4DefaultEnumeratorOptions;
+        options.flags |= kC4IncludeBodies;
+        auto e = c4db_enumerateAllDocs(db, &options, &error);
+        REQUIRE(e);
+        while (c4enum_next(e, &error))
+            ++n;
+        c4enum_free(e);
+        CHECK(n == numDocs);
+        st.printReport("Scanning all docs", n, "doc");
+    }
+}
+
+
+N_WAY_TEST_CASE_METHOD(PerfTest, "Index and Sort", "[Perf][C][.slow]") {
+    // Compares building an index, and sorting by an unindexed property, with and without
+    // SQLite's worker threads.
+    static const unsigned kNumDocs = 1000000;
+    {
+        Stopwatch st;
+        TransactionHelper t(db);
+        for (unsigned i = 1; i <= kNumDocs; ++i) {
+            char docID[20], json[100];
+            sprintf(docID, "%07u", i);
+            sprintf(json, "{\"n\":%u,\"name\":\"doc %u\"}", arc4random(), i);
+            C4Error c4err;
+            FLSliceResult body = c4db_encodeJSON(db, c4str(json), &c4err);
+            REQUIRE(body.buf);
+            C4DocPutRequest rq = {};
+            rq.docID = c4str(docID);
+            rq.body = (C4Slice)body;
+            rq.save = true;
+            C4Document *doc = c4doc_put(db, &rq, nullptr, &c4err);
+            REQUIRE(doc != nullptr);
+            c4doc_free(doc);
+            FLSliceResult_Free(body);
+        }
+        st.printReport("Creating docs", kNumDocs, "doc");
+    }
+
+    for (int32_t workerThreads : {-1, 0}) {
+        std::cerr << "---- " << (workerThreads < 0 ? "no worker threads" : "default worker threads")
+                  << " ----\n";
+        C4StorageTuning tuning = c4db_getConfig(db)->tuning;
+        tuning.workerThreads = workerThreads;
+        C4Error error;
+        REQUIRE(c4db_setStorageTuning(db, &tuning, &error));
+
+        Stopwatch st;
+        REQUIRE(c4db_createIndex(db, C4STR("byN"), C4STR("[[\".n\"]]"), kC4ValueIndex,
+                                 nullptr, &error));
+        st.printReport("Creating index", kNumDocs, "doc");
+        REQUIRE(c4db_deleteIndex(db, C4STR("byN"), &error));
+
+        Stopwatch st2;
+        C4Query *query = c4query_new(db, C4STR("{\"WHAT\": [\".name\"], \"ORDER_BY\": [[\".n\"]]}"),
+                                     &error);
+        REQUIRE(query);
+        auto e = c4query_run(query, nullptr, kC4SliceNull, &error);
+        REQUIRE(e);
+        unsigned n = 0;
+        while (c4queryenum_next(e, &error))
+            ++n;
+        c4queryenum_free(e);
+        c4query_free(query);
+        CHECK(n == kNumDocs);
+        st2.printReport("Sorted query", n, "row");
+    }
+}
+
+
 N_WAY_TEST_CASE_METHOD(PerfTest, "Import names", "[Perf][C][.slow]") {
     // Download https://github.com/arangodb/example-datasets/raw/master/RandomUsers/names_300000.json
     // to C/tests/data/ before running this test.
@@ -192,6 +283,23 @@ N_WAY_TEST_CASE_METHOD(PerfTest, "Import names", "[Perf][C][.slow]") {
 }
 
 
+N_WAY_TEST_CASE_METHOD(PerfTest, "Import names bulk", "[Perf][C][.slow]") {
+    // Compares importing names_300000.json (see above) one doc at a time with c4doc_put, and
+    // in batches with c4db_putNewDocs.
+    if (!isRevTrees()) return;
+    Stopwatch st;
+    auto numDocs = importJSONLines(sFixturesDir + "names_300000.json", 60.0, false);
+    st.printReport("Importing with c4doc_put", numDocs, "doc");
+
+    deleteAndRecreateDB();
+    Stopwatch st2;
+    auto numBulkDocs = importJSONLines(sFixturesDir + "names_300000.json", 60.0, false, true);
+    st2.printReport("Importing with c4db_putNewDocs", numBulkDocs, "doc");
+    CHECK(numBulkDocs == numDocs);
+    CHECK(c4db_getDocumentCount(db) == numDocs);
+}
+
+
 N_WAY_TEST_CASE_METHOD(PerfTest, "Import geoblocks", "[Perf][C][.slow]") {
     // Download https://github.com/arangodb/example-datasets/raw/master/IPRanges/geoblocks.json
     // to C/tests/data/ before running this test.
@@ -649,6 +649,52 @@ N_WAY_TEST_CASE_METHOD(QueryTest, "Query refresh", "[Query][C][!throws]") {
     c4queryenum_free(refreshed);
 }
 
+N_WAY_TEST_CASE_METHOD(QueryTest, "Query observer", "[Query][C]") {
+    compile(json5("['=', ['.', 'contact', 'address', 'state'], 'CA']"));
+    C4Error error;
+    int callbackCount = 0;
+    auto callback = [](C4QueryObserver *obs, void *context) {
+        ++*(int*)context;
+    };
+    C4QueryObserver *obs = c4queryobs_create(query, kC4SliceNull, callback, &callbackCount, &error);
+    REQUIRE(obs);
+
+    C4QueryRowChange changes[10];
+    CHECK(c4queryobs_getChanges(obs, changes, 10, &error) == 0);
+    CHECK(error.code == 0);
+
+    // Add a doc that matches:
+    createFleeceRev(db, C4STR("added_later"), C4STR("1-aaaa"),
+                    C4STR("{\"contact\":{\"address\":{\"state\":\"CA\"}}}"));
+    CHECK(callbackCount == 1);
+    REQUIRE(c4queryobs_getChanges(obs, changes, 10, &error) == 1);
+    CHECK(changes[0].type == kC4RowInserted);
+    CHECK(changes[0].newIndex == 8);
+
+    // Add a doc that doesn't match:
+    createFleeceRev(db, C4STR("not_in_CA"), C4STR("1-aaaa"),
+                    C4STR("{\"contact\":{\"address\":{\"state\":\"NY\"}}}"));
+    CHECK(callbackCount == 2);
+    CHECK(c4queryobs_getChanges(obs, changes, 10, &error) == 0);
+    CHECK(error.code == 0);
+
+    // Move a doc out of CA:
+    createFleeceRev(db, C4STR("0000015"), C4STR("2-ffff"),
+                    C4STR("{\"contact\":{\"address\":{\"state\":\"NY\"}}}"));
+    CHECK(callbackCount == 3);
+    REQUIRE(c4queryobs_getChanges(obs, changes, 10, &error) == 1);
+    CHECK(changes[0].type == kC4RowRemoved);
+    CHECK(changes[0].oldIndex == 1);
+
+    auto e = c4queryobs_getEnumerator(obs, &error);
+    REQUIRE(e);
+    CHECK(c4queryenum_getRowCount(e, &error) == 8);
+    REQUIRE(c4queryenum_seek(e, 7, &error));
+    CHECK(FLValue_AsString(FLArrayIterator_GetValueAt(&e->columns, 0)) == "added_later"_sl);
+    c4queryenum_free(e);
+    c4queryobs_free(obs);
+}
+
 N_WAY_TEST_CASE_METHOD(QueryTest, "Delete index", "[Query][C][!throws]") {
     C4Error err;
     C4String names[2] = { C4STR("length"), C4STR("byStreet") };
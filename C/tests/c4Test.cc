@@ -590,12 +590,27 @@ unsigned C4Test::importJSONFile(string path, string idPrefix, double timeout, bo
 
 
 // Read a file that contains a JSON document per line. Every line becomes a document.
-unsigned C4Test::importJSONLines(string path, double timeout, bool verbose) {
+unsigned C4Test::importJSONLines(string path, double timeout, bool verbose, bool bulk) {
     C4Log("Reading %s ...  ", path.c_str());
     fleece::Stopwatch st;
     unsigned numDocs = 0;
     {
         TransactionHelper t(db);
+        // In bulk mode, docs are collected here and saved 1000 at a time by c4db_putNewDocs:
+        vector<string> docIDs;
+        vector<FLSliceResult> bodies;
+        auto flush = [&]() {
+            vector<C4NewDocument> newDocs(docIDs.size());
+            for (size_t i = 0; i < docIDs.size(); ++i)
+                newDocs[i] = {c4str(docIDs[i].c_str()), (C4Slice)bodies[i], 0};
+            C4Error c4err;
+            REQUIRE(c4db_putNewDocs(db, newDocs.data(), newDocs.size(), false, &c4err));
+            for (auto &body : bodies)
+                FLSliceResult_Free(body);
+            docIDs.clear();
+            bodies.clear();
+        };
+
         readFileByLines(path, [&](FLSlice line)
         {
             C4Error c4err;
@@ -605,15 +620,22 @@ unsigned C4Test::importJSONLines(string path, double timeout, bool verbose) {
             char docID[20];
             sprintf(docID, "%07u", numDocs+1);
 
-            // Save document:
-            C4DocPutRequest rq = {};
-            rq.docID = c4str(docID);
-            rq.body = (C4Slice)body;
-            rq.save = true;
-            C4Document *doc = c4doc_put(db, &rq, nullptr, &c4err);
-            REQUIRE(doc != nullptr);
-            c4doc_free(doc);
-            FLSliceResult_Free(body);
+            if (bulk) {
+                docIDs.push_back(docID);
+                bodies.push_back(body);
+                if (docIDs.size() == 1000)
+                    flush();
+            } else {
+                // Save document:
+                C4DocPutRequest rq = {};
+                rq.docID = c4str(docID);
+                rq.body = (C4Slice)body;
+                rq.save = true;
+                C4Document *doc = c4doc_put(db, &rq, nullptr, &c4err);
+                REQUIRE(doc != nullptr);
+                c4doc_free(doc);
+                FLSliceResult_Free(body);
+            }
             ++numDocs;
             if (numDocs % 1000 == 0 && st.elapsed() >= timeout) {
                 C4Warn("Stopping JSON import after %.3f sec  ", st.elapsed());
@@ -623,6 +645,8 @@ unsigned C4Test::importJSONLines(string path, double timeout, bool verbose) {
                 C4Log("%u  ", numDocs);
             return true;
         });
+        if (!docIDs.empty())
+            flush();
         C4Log("Committing...");
     }
     if (verbose) st.printReport("Importing", numDocs, "doc");
@@ -203,7 +203,8 @@ public:
                             double timeout =15.0,
                             bool verbose =false);
     bool readFileByLines(std::string path, std::function<bool(FLSlice)>);
-    unsigned importJSONLines(std::string path, double timeout =15.0, bool verbose =false);
+    unsigned importJSONLines(std::string path, double timeout =15.0, bool verbose =false,
+                             bool bulk =false);
     
     // Some handy constants to use
     static const C4Slice kDocID;    // "mydoc"
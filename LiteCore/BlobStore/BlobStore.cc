@@ -207,7 +207,7 @@ namespace litecore {
     
     void BlobStore::deleteAllExcept(const unordered_set<string> &inUse) {
         _dir.forEachFile([&inUse](const FilePath &path) {
-            if(find(inUse.cbegin(), inUse.cend(), path.fileName()) == inUse.cend()) {
+            if(inUse.find(path.fileName()) == inUse.end()) {
                 path.del();
             }
         });
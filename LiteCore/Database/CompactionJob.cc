@@ -0,0 +1,220 @@
+//
+// CompactionJob.cc
+//
+// Copyright (c) 2018 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "CompactionJob.hh"
+#include "Database.hh"
+#include "DataFile.hh"
+#include "BlobStore.hh"
+#include "FilePath.hh"
+#include "Logging.hh"
+#include <algorithm>
+
+namespace c4Internal {
+
+    // Maximum number of database pages freed per step
+    static const unsigned kPagesPerStep = 1000;
+
+    // Maximum number of documents added to the blob reference index per step
+    static const size_t kDocsPerStep = 200;
+
+    // Maximum number of blob files examined per step
+    static const size_t kBlobsPerStep = 200;
+
+
+    // The job opens its own connection, without the features it doesn't need:
+    static C4DatabaseConfig jobConfig(C4DatabaseConfig config) {
+        config.flags &= ~(kC4DB_Create | kC4DB_BackgroundMaintenance);
+        config.flags |= kC4DB_NonObservable;
+        return config;
+    }
+
+
+    CompactionJob::CompactionJob(Database *db, Callback callback)
+    :_path(db->path().path())
+    ,_config(jobConfig(db->config))
+    ,_callback(callback)
+    {
+        _progress.phase = kVacuuming;
+    }
+
+
+    CompactionJob::~CompactionJob() {
+        cancel();
+        if (_thread.joinable())
+            _thread.join();
+    }
+
+
+    void CompactionJob::start() {
+        lock_guard<mutex> lock(_mutex);
+        if (_progress.running || _progress.phase == kFinished)
+            return;
+        if (_thread.joinable())
+            _thread.join();             // The previous run's thread has stopped, or is stopping
+        _canceled = false;
+        _progress.running = true;
+        _progress.error = {};
+        _thread = thread([this]{ run(); });
+    }
+
+
+    void CompactionJob::cancel() {
+        lock_guard<mutex> lock(_mutex);
+        _canceled = true;
+    }
+
+
+    void CompactionJob::wait() {
+        unique_lock<mutex> lock(_mutex);
+        _cond.wait(lock, [this]{ return !_progress.running; });
+    }
+
+
+    CompactionJob::Progress CompactionJob::progress() const {
+        lock_guard<mutex> lock(_mutex);
+        return _progress;
+    }
+
+
+    void CompactionJob::notify(const Progress &progress) {
+        if (_callback) {
+            try {
+                _callback(progress);
+            } catch (...) {
+                Warn("CompactionJob: Exception in callback");
+            }
+        }
+    }
+
+
+    // Body of the job's thread.
+    void CompactionJob::run() {
+        Log("Compacting database %s ...", _path.c_str());
+        C4Error error {};
+        try {
+            Retained<Database> db = new Database(_path, _config);
+            bool more = true;
+            while (more) {
+                {
+                    lock_guard<mutex> lock(_mutex);
+                    if (_canceled)
+                        break;
+                }
+                more = step(*db);
+                if (more)
+                    notify(progress());
+            }
+            db->close();
+        } catch (const exception &x) {
+            recordException(x, &error);
+        }
+
+        Progress final = progress();
+        final.running = false;
+        final.error = error;
+        if (final.phase == kFinished)
+            Log("Finished compacting database %s: freed %llu pages, deleted %llu blobs",
+                _path.c_str(), (unsigned long long)final.pagesFreed,
+                (unsigned long long)final.blobsDeleted);
+        else
+            Log("Stopped compacting database %s", _path.c_str());
+        notify(final);
+        {
+            lock_guard<mutex> lock(_mutex);
+            _progress = final;
+        }
+        _cond.notify_all();
+    }
+
+
+    // Performs one bounded unit of work; returns false when the job is finished.
+    bool CompactionJob::step(Database &db) {
+        switch (_progress.phase) {
+            case kVacuuming: {
+                unsigned freed = db.dataFile()->compactStep(kPagesPerStep);
+                if (freed == 0) {
+                    // Only blobs that exist before the deletion phase are candidates; any added
+                    // later may be about to be referenced by a doc not yet saved.
+                    _blobFiles.clear();
+                    db.blobStore()->dir().forEachFile([&](const FilePath &path) {
+                        _blobFiles.push_back(path.fileName());
+                    });
+                    _nextBlob = 0;
+                }
+                lock_guard<mutex> lock(_mutex);
+                _progress.pagesFreed += freed;
+                if (freed == 0)
+                    _progress.phase = kScanningDocs;
+                return true;
+            }
+            case kScanningDocs: {
+                // Only needed once, for a database file created before the blob reference index;
+                // after that every write path keeps the index up to date:
+                bool more = false;
+                uint64_t scanned = 0;
+                if (!db.blobRefsIndexed()) {
+                    db.beginTransaction();
+                    try {
+                        more = db.indexBlobRefs(_nextDocID, kDocsPerStep, scanned);
+                    } catch (...) {
+                        db.endTransaction(false);
+                        throw;
+                    }
+                    db.endTransaction(true);
+                }
+                lock_guard<mutex> lock(_mutex);
+                _progress.docsScanned += scanned;
+                if (!more)
+                    _progress.phase = kDeletingBlobs;
+                return true;
+            }
+            case kDeletingBlobs: {
+                // Hold the file lock so no document can start using a blob as it's deleted:
+                db.beginTransaction();
+                uint64_t scanned = 0, deleted = 0;
+                try {
+                    FilePath dir = db.blobStore()->dir();
+                    size_t end = min(_nextBlob + kBlobsPerStep, _blobFiles.size());
+                    for (; _nextBlob < end; ++_nextBlob) {
+                        const string &name = _blobFiles[_nextBlob];
+                        ++scanned;
+                        if (!db.blobIsReferenced(name) && dir[name].del())
+                            ++deleted;
+                    }
+                } catch (...) {
+                    db.endTransaction(false);
+                    throw;
+                }
+                db.endTransaction(false);
+
+                lock_guard<mutex> lock(_mutex);
+                _progress.blobsScanned += scanned;
+                _progress.blobsDeleted += deleted;
+                if (_nextBlob >= _blobFiles.size()) {
+                    _progress.phase = kFinished;
+                    return false;
+                }
+                return true;
+            }
+            case kFinished:
+                return false;
+        }
+        return false;
+    }
+
+}
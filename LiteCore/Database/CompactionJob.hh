@@ -0,0 +1,96 @@
+//
+// CompactionJob.hh
+//
+// Copyright (c) 2018 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "c4Internal.hh"
+#include "c4Database.h"
+#include "c4Private.h"
+#include "RefCounted.hh"
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace c4Internal {
+    class Database;
+
+
+    /** Compacts a database on a background thread: frees unused pages of the file, then deletes
+        blobs no longer referenced by any document. It uses its own connection to the database
+        and works in small steps, each in a short transaction (or none), so the database can be
+        read and written normally meanwhile. It can be canceled between steps and resumed later;
+        its state is kept in this object, not in the database. */
+    class CompactionJob : public RefCounted, C4InstanceCounted {
+    public:
+        enum Phase {
+            kVacuuming,             ///< Freeing unused pages of the database file
+            kScanningDocs,          ///< Indexing blob references, if the file predates that
+            kDeletingBlobs,         ///< Deleting unreferenced blobs
+            kFinished               ///< Done
+        };
+
+        struct Progress {
+            Phase    phase;
+            bool     running;       ///< False when finished, canceled, or stopped by an error
+            uint64_t pagesFreed;    ///< Database pages returned to the filesystem
+            uint64_t docsScanned;   ///< Documents added to the blob reference index
+            uint64_t blobsScanned;  ///< Blob files examined
+            uint64_t blobsDeleted;  ///< Blob files deleted
+            C4Error  error;         ///< The error that stopped the job, if any
+        };
+
+        /** Called on the job's thread after every step, and when it stops. */
+        using Callback = std::function<void(const Progress&)>;
+
+        CompactionJob(Database* NONNULL, Callback);
+
+        /** Starts the job, or resumes it after it was canceled or stopped by an error.
+            Does nothing if it's already running or finished. */
+        void start();
+
+        /** Asks the job to stop after its current step. Doesn't wait for that to happen. */
+        void cancel();
+
+        /** Blocks until the job's thread stops. */
+        void wait();
+
+        Progress progress() const;
+
+    protected:
+        virtual ~CompactionJob();
+
+    private:
+        void run();
+        bool step(Database&);
+        void notify(const Progress&);
+
+        std::string const           _path;              // Path of the database bundle
+        C4DatabaseConfig const      _config;            // Config to open my own connection with
+        Callback const              _callback;
+        mutable std::mutex          _mutex;             // Guards _progress, _canceled
+        std::condition_variable     _cond;              // Notified when the thread stops
+        std::thread                 _thread;
+        bool                        _canceled {false};
+        Progress                    _progress { };
+        std::string                 _nextDocID;         // Where blob reference indexing resumes
+        std::vector<std::string>    _blobFiles;         // Blobs that existed before deletion began
+        size_t                      _nextBlob {0};      // Index in _blobFiles to resume at
+    };
+
+}
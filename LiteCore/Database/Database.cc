@@ -26,10 +26,13 @@
 #include "SequenceTracker.hh"
 #include "Fleece.hh"
 #include "BlobStore.hh"
+#include "VersionedDocument.hh"
+#include "RevTreePruner.hh"
 #include "Upgrader.hh"
 #include "forestdb_endian.h"
 #include "SecureRandomize.hh"
 #include "make_unique.h"
+#include <algorithm>
 
 
 namespace c4Internal {
@@ -40,6 +43,19 @@ namespace c4Internal {
     static const slice kMaxRevTreeDepthKey = "maxRevTreeDepth"_sl;
     static uint32_t kDefaultMaxRevTreeDepth = 20;
 
+    // The blob reference index consists of two KeyStores. The first maps a docID to the filenames of the blobs
+    // its revisions reference, separated by newlines; the second maps a blob's filename to the
+    // number of documents referencing it. Blobs with no references have no record.
+    static const string kBlobDocsStoreName = "blobDocs";
+    static const string kBlobRefsStoreName = "blobRefs";
+    static const KeyStore::Capabilities kBlobIndexCapabilities = {false};   // no sequences
+
+    // Key in the info store of the record marking that all documents have been indexed:
+    static const slice kBlobRefsIndexedKey = "blobRefsIndexed"_sl;
+
+    // Number of docs indexed per transaction by compact(), so writers aren't locked out long:
+    static const size_t kBlobRefsIndexBatchSize = 1000;
+
     const slice Database::kPublicUUIDKey = "publicUUID"_sl;
     const slice Database::kPrivateUUIDKey = "privateUUID"_sl;
 
@@ -92,6 +108,12 @@ namespace c4Internal {
     }
 
 
+    // Converts the C API's tuning struct to the DataFile one.
+    static DataFile::Tuning storageTuning(const C4StorageTuning &t) {
+        return {t.cacheSize, t.mmapSize, t.journalSizeLimit, t.pageSize, t.workerThreads};
+    }
+
+
     // subroutine of Database constructor that creates its _db
     /*static*/ DataFile* Database::newDataFile(const FilePath &path,
                                                const C4DatabaseConfig &config,
@@ -104,6 +126,8 @@ namespace c4Internal {
         options.create = (config.flags & kC4DB_Create) != 0;
         options.writeable = (config.flags & kC4DB_ReadOnly) == 0;
         options.useDocumentKeys = (config.flags & kC4DB_SharedKeys) != 0;
+        options.backgroundMaintenance = (config.flags & kC4DB_BackgroundMaintenance) != 0;
+        options.upgradeFormat = (config.flags & kC4DB_UpgradeFormat) != 0;
 
         options.encryptionAlgorithm = (EncryptionAlgorithm)config.encryptionKey.algorithm;
         if (options.encryptionAlgorithm != kNoEncryption) {
@@ -115,6 +139,8 @@ namespace c4Internal {
 #endif
         }
 
+        options.tuning = storageTuning(config.tuning);
+
         switch (config.versioning) {
             case kC4RevisionTrees:
                 options.fleeceAccessor = TreeDocumentFactory::fleeceAccessor();
@@ -171,6 +197,9 @@ namespace c4Internal {
             doc.setBodyAsUInt((uint64_t)config.versioning);
             Transaction t(*_db);
             info.write(doc, t);
+            Record indexed(kBlobRefsIndexedKey);    // There are no docs yet to index
+            indexed.setBodyAsUInt(1);
+            info.write(indexed, t);
             (void)generateUUID(kPublicUUIDKey, t);
             (void)generateUUID(kPrivateUUIDKey, t);
             t.commit();
@@ -188,7 +217,13 @@ namespace c4Internal {
             default:                error::_throw(error::InvalidParameter);
         }
         _documentFactory.reset(factory);
-}
+
+        if (config.versioning == kC4RevisionTrees && !(config.flags & kC4DB_ReadOnly)) {
+            _revTreePruner.reset(new RevTreePruner(this));
+            if (config.flags & kC4DB_BackgroundMaintenance)
+                _revTreePruner->start();
+        }
+    }
 
 
     Database::~Database() {
@@ -201,12 +236,16 @@ namespace c4Internal {
 
     void Database::close() {
         mustNotBeInTransaction();
+        if (_revTreePruner)
+            _revTreePruner->stop();
         _db->close();
     }
 
 
     void Database::deleteDatabase() {
         mustNotBeInTransaction();
+        if (_revTreePruner)
+            _revTreePruner->stop();
         FilePath bundle = path().dir();
         _db->deleteDataFile();
         bundle.delRecursive();
@@ -247,57 +286,186 @@ namespace c4Internal {
         return factory->deleteFile(path);
     }
 
-    unordered_set<string> Database::collectBlobs() {
-        RecordEnumerator::Options options;
-        options.onlyBlobs = true;
-        RecordEnumerator e(defaultKeyStore(), options);
-        unordered_set<string> usedDigests;
-        while (e.next()) {
-            auto doc = documentFactory().newDocumentInstance(*e);
-            doc->selectCurrentRevision();
-            do {
-                if(!doc->loadSelectedRevBody()) {
-                    continue;
-                }
-                
-                const Dict* body = Value::fromTrustedData(doc->selectedRev.body)->asDict();
-                auto sk = _db->documentKeys();
-
-                // Iterate over blobs:
-                Document::findBlobReferences(body, sk, [&](const Dict *blob) {
-                    blobKey key;
-                    if (Document::dictIsBlob(blob, key, sk))    // get the key
+    void Database::collectBlobs(const Record &rec, unordered_set<string> &usedDigests) {
+        auto doc = documentFactory().newDocumentInstance(rec);
+        doc->selectCurrentRevision();
+        do {
+            if(!doc->loadSelectedRevBody()) {
+                continue;
+            }
+            collectBlobsInRevision(doc->selectedRev.body, usedDigests);
+        } while(doc->selectNextRevision());
+        
+        delete doc;
+    }
+
+    void Database::collectBlobsInRevision(slice revBody, unordered_set<string> &usedDigests) {
+        const Dict* body = Value::fromTrustedData(revBody)->asDict();
+        auto sk = _db->documentKeys();
+
+        // Iterate over blobs:
+        Document::findBlobReferences(body, sk, [&](const Dict *blob) {
+            blobKey key;
+            if (Document::dictIsBlob(blob, key, sk))    // get the key
+                usedDigests.insert(key.filename());
+            return true;
+        });
+
+        // Now look for old-style _attachments:
+        auto attachments = body->get(slice(kC4LegacyAttachmentsProperty), sk);
+        if (attachments) {
+            blobKey key;
+            for (Dict::iterator i(attachments->asDict()); i; ++i) {
+                auto att = i.value()->asDict();
+                if (att) {
+                    const Value* digest = att->get("digest"_sl, sk);
+                    if (digest && key.readFromBase64(digest->asString())) {
                         usedDigests.insert(key.filename());
-                    return true;
-                });
-
-                // Now look for old-style _attachments:
-                auto attachments = body->get(slice(kC4LegacyAttachmentsProperty), sk);
-                if (attachments) {
-                    blobKey key;
-                    for (Dict::iterator i(attachments->asDict()); i; ++i) {
-                        auto att = i.value()->asDict();
-                        if (att) {
-                            const Value* digest = att->get("digest"_sl, sk);
-                            if (digest && key.readFromBase64(digest->asString())) {
-                                usedDigests.insert(key.filename());
-                            }
-                        }
                     }
                 }
-            } while(doc->selectNextRevision());
-            
-            delete doc;
+            }
         }
-        
-        return usedDigests;
     }
 
     void Database::compact() {
         mustNotBeInTransaction();
         dataFile()->compact();
-        unordered_set<string> digestsInUse = collectBlobs();
-        blobStore()->deleteAllExcept(digestsInUse);
+
+        // Every way of saving or purging a document keeps the blob reference index up to date,
+        // so it's trusted once it covers all of them. A file created by an older version has to
+        // be indexed first, which only happens once:
+        if (!blobRefsIndexed()) {
+            LogTo(DBLog, "Indexing blob references...");
+            string afterDocID;
+            uint64_t docsIndexed = 0;
+            bool more;
+            do {
+                beginTransaction();
+                try {
+                    more = indexBlobRefs(afterDocID, kBlobRefsIndexBatchSize, docsIndexed);
+                } catch (...) {
+                    endTransaction(false);
+                    throw;
+                }
+                endTransaction(true);
+            } while (more);
+            LogTo(DBLog, "Indexed blob references of %llu docs", (unsigned long long)docsIndexed);
+        }
+
+        // Hold the file lock so no document can start using a blob as it's deleted:
+        beginTransaction();
+        try {
+            blobStore()->dir().forEachFile([&](const FilePath &path) {
+                if (!blobIsReferenced(path.fileName()))
+                    path.del();
+            });
+        } catch (...) {
+            endTransaction(false);
+            throw;
+        }
+        endTransaction(false);
+    }
+
+
+#pragma mark - BLOB REFERENCE INDEX:
+
+
+    void Database::updateBlobRefs(slice docID, const unordered_set<string> &digests) {
+        KeyStore &blobDocs = _db->getKeyStore(kBlobDocsStoreName, kBlobIndexCapabilities);
+        Record rec = blobDocs.get(docID);
+        unordered_set<string> oldDigests;
+        string list = rec.body().asString();
+        for (size_t pos = 0; pos < list.size(); ) {
+            size_t end = min(list.find('\n', pos), list.size());
+            oldDigests.insert(list.substr(pos, end - pos));
+            pos = end + 1;
+        }
+        if (digests == oldDigests)
+            return;
+
+        for (auto &digest : oldDigests)
+            if (digests.find(digest) == digests.end())
+                adjustBlobRef(digest, -1);
+        for (auto &digest : digests)
+            if (oldDigests.find(digest) == oldDigests.end())
+                adjustBlobRef(digest, +1);
+
+        if (digests.empty()) {
+            blobDocs.del(docID, transaction());
+        } else {
+            string newList;
+            for (auto &digest : digests) {
+                if (!newList.empty())
+                    newList += '\n';
+                newList += digest;
+            }
+            blobDocs.set(docID, slice(newList), transaction());
+        }
+    }
+
+
+    void Database::adjustBlobRef(const string &filename, int delta) {
+        KeyStore &blobRefs = _db->getKeyStore(kBlobRefsStoreName, kBlobIndexCapabilities);
+        Record rec = blobRefs.get(slice(filename));
+        int64_t count = (int64_t)rec.bodyAsUInt() + delta;
+        if (count > 0) {
+            rec.setBodyAsUInt(count);
+            blobRefs.write(rec, transaction());
+        } else if (rec.exists()) {
+            blobRefs.del(rec, transaction());
+        }
+    }
+
+
+    bool Database::blobIsReferenced(const string &filename) {
+        KeyStore &blobRefs = _db->getKeyStore(kBlobRefsStoreName, kBlobIndexCapabilities);
+        return blobRefs.get(slice(filename), kMetaOnly).exists();
+    }
+
+
+    bool Database::blobRefsIndexed() {
+        auto &info = _db->getKeyStore(DataFile::kInfoKeyStoreName);
+        return info.get(kBlobRefsIndexedKey, kMetaOnly).exists();
+    }
+
+
+    bool Database::indexBlobRefs(string &afterDocID, size_t limit, uint64_t &docsIndexed) {
+        // Documents saved since the index was added to LiteCore are already in it, but
+        // re-indexing them is harmless since updateBlobRefs only writes what's changed.
+        auto &info = _db->getKeyStore(DataFile::kInfoKeyStoreName);
+        if (info.get(kBlobRefsIndexedKey, kMetaOnly).exists())
+            return false;
+
+        RecordEnumerator::Options options;
+        options.onlyBlobs = true;
+        options.startKey = slice(afterDocID);
+        if (limit > 0)
+            options.limit = limit + 1;      // +1 because startKey is the last doc already indexed
+        size_t rows = 0, n = 0;
+        {
+            RecordEnumerator e(defaultKeyStore(), options);
+            while (e.next()) {
+                ++rows;
+                slice docID = e.record().key();
+                if (n == 0 && !afterDocID.empty() && docID == slice(afterDocID))
+                    continue;
+                if (limit > 0 && n == limit)
+                    break;
+                unordered_set<string> digests;
+                collectBlobs(e.record(), digests);
+                updateBlobRefs(docID, digests);
+                afterDocID = docID.asString();
+                ++n;
+                ++docsIndexed;
+            }
+        }
+        if (limit > 0 && rows == options.limit)
+            return true;
+
+        Record marker(kBlobRefsIndexedKey);
+        marker.setBodyAsUInt(1);
+        info.write(marker, transaction());
+        return false;
     }
 
 
@@ -309,6 +477,11 @@ namespace c4Internal {
 
         mustNotBeInTransaction();
 
+        // The pruner's connection uses the old key, so stop it until the rekey is done:
+        bool pruning = _revTreePruner && _revTreePruner->running();
+        if (pruning)
+            _revTreePruner->stop();
+
         // Create a new BlobStore and copy/rekey the blobs into it:
         BlobStore *realBlobStore = blobStore();
         path().subdirectoryNamed("Attachments_temp").delRecursive();
@@ -321,10 +494,14 @@ namespace c4Internal {
                               slice(newKey->bytes, kEncryptionKeySize[newKey->algorithm]));
         } catch (...) {
             newStore->deleteStore();
+            if (pruning)
+                _revTreePruner->start();
             throw;
         }
 
         ((C4DatabaseConfig&)config).encryptionKey = *newKey;
+        if (pruning)
+            _revTreePruner->start();
 
         // Finally replace the old BlobStore with the new one:
         newStore->moveTo(*realBlobStore);
@@ -332,6 +509,12 @@ namespace c4Internal {
     }
 
 
+    void Database::setStorageTuning(const C4StorageTuning &tuning) {
+        dataFile()->setTuning(storageTuning(tuning));
+        ((C4DatabaseConfig&)config).tuning = tuning;
+    }
+
+
 #pragma mark - ACCESSORS:
 
 
@@ -361,9 +544,13 @@ namespace c4Internal {
         KeyStore &info = _db->getKeyStore(DataFile::kInfoKeyStoreName);
         Record rec = info.get(kMaxRevTreeDepthKey);
         if (depth != rec.bodyAsUInt()) {
+            uint32_t oldDepth = maxRevTreeDepth();
             rec.setBodyAsUInt(depth);
             Transaction t(*_db);
             info.write(rec, t);
+            // If trees are now to be shallower, all documents need pruning again:
+            if (depth < oldDepth)
+                info.del(RevTreePruner::kPrunedSequenceKey, t);
             t.commit();
         }
         _maxRevTreeDepth = depth;
@@ -540,7 +727,12 @@ namespace c4Internal {
 
     
     bool Database::purgeDocument(slice docID) {
-        return defaultKeyStore().del(docID, transaction());
+        if (!defaultKeyStore().del(docID, transaction()))
+            return false;
+        if (config.versioning == kC4RevisionTrees)
+            VersionedDocument::deleteRevisionBodies(defaultKeyStore(), docID, transaction());
+        updateBlobRefs(docID, {});
+        return true;
     }
 
 
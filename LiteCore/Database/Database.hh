@@ -41,6 +41,7 @@ namespace litecore {
 namespace c4Internal {
     class Document;
     class DocumentFactory;
+    class RevTreePruner;
 
 
     /** A top-level LiteCore database. */
@@ -60,6 +61,9 @@ namespace c4Internal {
         uint32_t maxRevTreeDepth();
         void setMaxRevTreeDepth(uint32_t depth);
 
+        /** Re-reads maxRevTreeDepth, in case another connection changed it. */
+        uint32_t reloadMaxRevTreeDepth()                {_maxRevTreeDepth = 0; return maxRevTreeDepth();}
+
         struct UUID {
             uint8_t bytes[16];
         };
@@ -71,8 +75,37 @@ namespace c4Internal {
 
         void rekey(const C4EncryptionKey *newKey);
 
+        void setStorageTuning(const C4StorageTuning&);
+
         void compact();
 
+        /** Adds the filenames of the blobs referenced by any revision of a document to `digests`. */
+        void collectBlobs(const Record&, std::unordered_set<std::string> &digests);
+
+        /** Adds the filenames of the blobs referenced by a revision body to `digests`. */
+        void collectBlobsInRevision(slice body, std::unordered_set<std::string> &digests);
+
+        //////// Blob reference index:
+        // Maps each blob (by filename) to the number of documents that reference it, so unused
+        // blobs can be found without reading every document. It's updated whenever a document
+        // with blobs is saved or purged.
+
+        /** Records that a document now references exactly the blobs in `digests`.
+            Must be called in a transaction. */
+        void updateBlobRefs(slice docID, const std::unordered_set<std::string> &digests);
+
+        /** True if any document references the blob with this filename. */
+        bool blobIsReferenced(const std::string &filename);
+
+        /** True if the index covers all documents. (It doesn't in a database file created by an
+            older version, until indexBlobRefs has finished.) */
+        bool blobRefsIndexed();
+
+        /** Adds existing documents to the index, at most `limit` (0 for all) in docID order
+            starting after `afterDocID`, which is updated. Returns false when done, after marking
+            the index complete. Must be called in a transaction. */
+        bool indexBlobRefs(std::string &afterDocID, size_t limit, uint64_t &docsIndexed);
+
         const C4DatabaseConfig config;
 
         Transaction& transaction() const;
@@ -108,6 +141,10 @@ namespace c4Internal {
 
         BlobStore* blobStore();
 
+        /** Prunes documents' rev trees; its thread runs if the database was opened with
+            kC4DB_BackgroundMaintenance. Null if the database doesn't use rev trees. */
+        RevTreePruner* revTreePruner()                      {return _revTreePruner.get();}
+
         void lockClientMutex()                              {_clientMutex.lock();}
         void unlockClientMutex()                            {_clientMutex.unlock();}
 
@@ -133,8 +170,7 @@ namespace c4Internal {
         UUID generateUUID(slice key, Transaction&, bool overwrite =false);
 
         std::unique_ptr<BlobStore> createBlobStore(const std::string &dirname, C4EncryptionKey);
-        std::unordered_set<std::string> collectBlobs();
-        void removeUnusedBlobs(const std::unordered_set<std::string> &used);
+        void adjustBlobRef(const std::string &filename, int delta);
 
         unique_ptr<DataFile>        _db;                    // Underlying DataFile
         Transaction*                _transaction {nullptr}; // Current Transaction, or null
@@ -145,6 +181,7 @@ namespace c4Internal {
         unique_ptr<BlobStore>       _blobStore;
         uint32_t                    _maxRevTreeDepth {0};
         recursive_mutex             _clientMutex;
+        unique_ptr<RevTreePruner>   _revTreePruner;         // Prunes rev trees
     };
 
 
@@ -177,6 +214,9 @@ namespace c4Internal {
         alloc_slice revIDFromVersion(slice version) override;
         bool isFirstGenRevID(slice revID) override;
         static DataFile::FleeceAccessor fleeceAccessor();
+
+        /** Adds new documents without instantiating them; implementation of c4db_putNewDocs. */
+        void putNewDocs(const C4NewDocument docs[], size_t count, bool overwrite);
     };
 
 }
@@ -142,7 +142,7 @@ namespace c4Internal {
             error::_throw(error::Unimplemented);
         }
 
-        virtual bool removeSelectedRevBody() noexcept {
+        virtual bool removeSelectedRevBody() {
             return false;
         }
 
@@ -0,0 +1,284 @@
+//
+// RevTreePruner.cc
+//
+// Copyright (c) 2018 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "RevTreePruner.hh"
+#include "Database.hh"
+#include "DataFile.hh"
+#include "Record.hh"
+#include "RecordEnumerator.hh"
+#include "RevTreeView.hh"
+#include "VersionedDocument.hh"
+#include "Error.hh"
+#include "Logging.hh"
+#include <chrono>
+#include <vector>
+
+namespace c4Internal {
+    using namespace fleece;
+
+    const slice RevTreePruner::kPrunedSequenceKey = "prunedSequence"_sl;
+
+    // Maximum number of documents visited per transaction
+    static const size_t kDocsPerStep = 100;
+
+    // The thread pauses this long between transactions...
+    static const auto kStepInterval = chrono::milliseconds(100);
+    // ...and skips a step if another Transaction on the file ended less than this many seconds ago:
+    static const double kMinIdleTime = 0.05;
+    // When there's nothing to do, it checks again this often:
+    static const auto kIdleInterval = chrono::seconds(1);
+
+
+    // The thread opens its own connection, without the features it doesn't need:
+    static C4DatabaseConfig threadConfig(C4DatabaseConfig config) {
+        config.flags &= ~(kC4DB_Create | kC4DB_BackgroundMaintenance);
+        config.flags |= kC4DB_NonObservable;
+        return config;
+    }
+
+
+    // True if a revision that's only on closed conflict branches still has a body, which
+    // RevTree::removeClosedBranchBodies would remove. (It may be kept for a remote anyway.)
+    static bool closedBranchHasBody(const RevTreeView &view) {
+        vector<unsigned> parents;
+        parents.reserve(view.count());
+        for (auto &info : view)
+            parents.push_back(info.parentIndex);
+        vector<bool> onOpenBranch(view.count(), false);
+        for (auto &info : view) {
+            if (info.isLeaf() && !(info.flags & Rev::kClosed)) {
+                for (unsigned i = info.index; i != RevTreeView::kNoRev && !onOpenBranch[i];
+                        i = parents[i])
+                    onOpenBranch[i] = true;
+            }
+        }
+        for (auto &info : view) {
+            if (!info.isLeaf() && !onOpenBranch[info.index] && info.isBodyAvailable())
+                return true;
+        }
+        return false;
+    }
+
+
+    // Prunes one document, if it needs it, adding to `stats`. Must be called in a transaction.
+    static void pruneDocument(Database &db, const Record &rec, unsigned maxDepth,
+                              RevTreePruner::Stats &stats)
+    {
+        // Check cheaply, without decoding the tree, whether there's anything to do. That includes
+        // moving non-current bodies out of the record, in a file upgraded from an older version:
+        KeyStore &store = db.defaultKeyStore();
+        bool canMoveBodies = VersionedDocument::storesBodiesExternally(store);
+        RevTreeView view(rec.body(), rec.sequence());
+        bool hasClosedBranch = false, hasInlineBodies = false;
+        for (auto &info : view) {
+            if (info.flags & Rev::kClosed)
+                hasClosedBranch = true;
+            if (info.index > 0 && info.body.buf && canMoveBodies)
+                hasInlineBodies = true;
+        }
+        bool hasClosedBranchBody = hasClosedBranch && closedBranchHasBody(view);
+        if (view.count() <= maxDepth && !hasClosedBranchBody && !hasInlineBodies)
+            return;
+
+        VersionedDocument doc(store, rec);
+        auto storedSize = [&]() {
+            uint64_t size = 0;
+            for (auto rev : doc.allRevisions()) {
+                if (rev->isBodyExternal())
+                    size += VersionedDocument::revisionBodySize(store, doc.docID(), rev->revID);
+            }
+            return size;
+        };
+        uint64_t sizeBefore = rec.body().size + storedSize();
+
+        unsigned revsPruned = doc.prune(maxDepth);
+        unsigned bodiesRemoved = hasClosedBranchBody ? doc.removeClosedBranchBodies() : 0;
+        if (revsPruned == 0 && bodiesRemoved == 0) {
+            if (!hasInlineBodies)
+                return;
+            doc.setChanged();                   // Saving moves the bodies out
+        }
+        if (doc.save(db.transaction()) == VersionedDocument::kConflict) {
+            Warn("RevTreePruner: Couldn't save pruned doc '%.*s'", SPLAT(rec.key()));
+            return;
+        }
+        // (Pruning doesn't add a revision, so the doc keeps its sequence and nobody is notified.)
+
+        Record saved = store.get(rec.key());
+        uint64_t sizeAfter = saved.body().size + storedSize();
+        if (rec.flags() & DocumentFlags::kHasAttachments) {
+            unordered_set<string> digests;
+            db.collectBlobs(saved, digests);
+            db.updateBlobRefs(rec.key(), digests);
+        }
+
+        ++stats.docsPruned;
+        stats.revsPruned += revsPruned;
+        stats.bodiesRemoved += bodiesRemoved;
+        if (sizeAfter < sizeBefore)
+            stats.bytesReclaimed += sizeBefore - sizeAfter;
+    }
+
+
+    RevTreePruner::RevTreePruner(Database *db)
+    :_db(db)
+    { }
+
+
+    RevTreePruner::~RevTreePruner() {
+        stop();
+    }
+
+
+    void RevTreePruner::start() {
+        if (_running)
+            return;
+        _path = _db->path().path();
+        _config = threadConfig(_db->config);
+        _stopping = false;
+        _running = true;
+        _thread = thread([this]{ run(); });
+    }
+
+
+    void RevTreePruner::stop() {
+        if (!_thread.joinable())
+            return;
+        {
+            lock_guard<mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _cond.notify_all();
+        _thread.join();
+        _running = false;
+        _keepingUp = false;
+    }
+
+
+    void RevTreePruner::pruneAll() {
+        while (step(*_db, kDocsPerStep))
+            ;
+    }
+
+
+    RevTreePruner::Stats RevTreePruner::stats() const {
+        lock_guard<mutex> lock(_mutex);
+        return _stats;
+    }
+
+
+    // True if any document was saved after the last one visited. Doesn't need a transaction.
+    bool RevTreePruner::hasWork(Database &db) {
+        auto &info = db.getKeyStore(DataFile::kInfoKeyStoreName);
+        sequence_t pruned = info.get(kPrunedSequenceKey).bodyAsUInt();
+        return db.lastSequence() > pruned;
+    }
+
+
+    // Visits up to `limit` documents in one transaction; returns false when there are no more.
+    bool RevTreePruner::step(Database &db, size_t limit) {
+        Stats stats { };
+        bool more;
+        db.beginTransaction();
+        try {
+            auto &info = db.getKeyStore(DataFile::kInfoKeyStoreName);
+            sequence_t since = info.get(kPrunedSequenceKey).bodyAsUInt();
+            unsigned maxDepth = db.reloadMaxRevTreeDepth();
+
+            // Read the records first, since pruning rewrites them:
+            vector<Record> records;
+            {
+                RecordEnumerator::Options options;
+                options.includeDeleted = true;
+                options.limit = limit;
+                RecordEnumerator e(db.defaultKeyStore(), since, options);
+                while (e.next())
+                    records.push_back(e.record());
+            }
+            for (auto &rec : records) {
+                ++stats.docsScanned;
+                try {
+                    pruneDocument(db, rec, maxDepth, stats);
+                } catch (const error &x) {
+                    // Don't let one bad doc stop the pruner from ever getting past it:
+                    if (x.domain != error::LiteCore || x.code != error::CorruptRevisionData)
+                        throw;
+                    Warn("RevTreePruner: Skipping doc '%.*s' with corrupt rev tree",
+                         SPLAT(rec.key()));
+                }
+            }
+            if (!records.empty()) {
+                Record cursor(kPrunedSequenceKey);
+                cursor.setBodyAsUInt(records.back().sequence());
+                info.write(cursor, db.transaction());
+            }
+            more = (records.size() == limit);
+        } catch (...) {
+            db.endTransaction(false);
+            throw;
+        }
+        db.endTransaction(true);
+
+        lock_guard<mutex> lock(_mutex);
+        _stats.docsScanned += stats.docsScanned;
+        _stats.docsPruned += stats.docsPruned;
+        _stats.revsPruned += stats.revsPruned;
+        _stats.bodiesRemoved += stats.bodiesRemoved;
+        _stats.bytesReclaimed += stats.bytesReclaimed;
+        return more;
+    }
+
+
+    // Body of the background thread.
+    void RevTreePruner::run() {
+        Retained<Database> db;
+        chrono::milliseconds pause {0};             // Start right away
+        while (true) {
+            {
+                unique_lock<mutex> lock(_mutex);
+                if (_cond.wait_for(lock, pause, [this]{return _stopping;}))
+                    break;
+            }
+            try {
+                if (!db)
+                    db = new Database(_path, _config);
+                if (db->dataFile()->idleTime() < kMinIdleTime) {
+                    pause = kStepInterval;          // Let the app's writers go first
+                } else if (hasWork(*db) && step(*db, kDocsPerStep)) {
+                    pause = kStepInterval;
+                    _keepingUp = true;
+                } else {
+                    pause = kIdleInterval;
+                    _keepingUp = true;
+                }
+            } catch (const exception &x) {
+                Warn("RevTreePruner: Pruning %s failed: %s", _path.c_str(), x.what());
+                _keepingUp = false;                 // Saving docs will have to prune them
+                pause = kIdleInterval;
+            }
+        }
+        if (db) {
+            try {
+                db->close();
+            } catch (const exception &x) {
+                Warn("RevTreePruner: Closing %s failed: %s", _path.c_str(), x.what());
+            }
+        }
+    }
+
+}
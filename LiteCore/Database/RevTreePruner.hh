@@ -0,0 +1,93 @@
+//
+// RevTreePruner.hh
+//
+// Copyright (c) 2018 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "c4Internal.hh"
+#include "c4Database.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace c4Internal {
+    class Database;
+
+
+    /** Prunes documents' revision trees to the database's maxRevTreeDepth, and removes the bodies
+        of revisions on closed conflict branches, so that saving a document doesn't have to.
+        In a file upgraded from an older version it also moves the bodies of documents'
+        non-current revisions out of their records (see VersionedDocument.)
+        It visits documents in sequence order, resuming after the last one it visited (which is
+        recorded in the database, so a lower maxRevTreeDepth makes it start over), a few at a time,
+        each batch in its own short transaction.
+        While started, it runs on a background thread with its own connection to the database,
+        yielding to writers; pruneAll() does the same work on the owning Database's connection. */
+    class RevTreePruner {
+    public:
+        struct Stats {
+            uint64_t docsScanned;       ///< Documents examined
+            uint64_t docsPruned;        ///< Documents whose trees were rewritten
+            uint64_t revsPruned;        ///< Revisions removed from trees
+            uint64_t bodiesRemoved;     ///< Bodies removed from closed conflict branches
+            uint64_t bytesReclaimed;    ///< Decrease in size of the trees and revision bodies
+        };
+
+        explicit RevTreePruner(Database* NONNULL);
+        ~RevTreePruner();
+
+        /** Starts the background thread, if it isn't running. */
+        void start();
+
+        /** Stops the background thread, waiting for its current batch to finish. */
+        void stop();
+
+        /** Is the background thread running? */
+        bool running() const                {return _running;}
+
+        /** Is the background thread running, and did its last attempt at a step succeed? Only
+            then can saving a document leave pruning to it. */
+        bool keepingUp() const              {return _keepingUp;}
+
+        /** Prunes every document saved since the last one visited, on the calling thread.
+            Counts towards stats() like the background thread's work. */
+        void pruneAll();
+
+        /** Totals of the work done so far, by the thread and by pruneAll(). */
+        Stats stats() const;
+
+        /** Key in the info store of the sequence of the last document visited. */
+        static const slice kPrunedSequenceKey;
+
+    private:
+        bool hasWork(Database&);
+        bool step(Database&, size_t limit);
+        void run();
+
+        Database* const             _db;                // The Database that owns me
+        std::string                 _path;              // Path of the database bundle
+        C4DatabaseConfig            _config;            // Config to open the thread's connection
+        mutable std::mutex          _mutex;             // Guards _stopping, _stats
+        std::condition_variable     _cond;              // Notified when the thread should stop
+        std::thread                 _thread;
+        std::atomic<bool>           _running {false};
+        std::atomic<bool>           _keepingUp {false}; // False after a step fails
+        bool                        _stopping {false};
+        Stats                       _stats { };
+    };
+
+}
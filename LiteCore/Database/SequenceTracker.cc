@@ -115,6 +115,19 @@ namespace litecore {
     }
 
 
+    void SequenceTracker::documentsChanged(const Change changes[], size_t count) {
+        Assert(inTransaction());
+        // (After the first change is added, no placeholder is right before the latest change,
+        // so _documentChanged won't notify any database observers for the rest.)
+        for (size_t i = 0; i < count; ++i) {
+            auto &change = changes[i];
+            Assert(change.sequence > _lastSequence);
+            _lastSequence = change.sequence;
+            _documentChanged(change.docID, change.revID, change.sequence, change.bodySize);
+        }
+    }
+
+
     void SequenceTracker::_documentChanged(const alloc_slice &docID,
                                            const alloc_slice &revID,
                                            sequence_t sequence,
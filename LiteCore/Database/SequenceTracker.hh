@@ -56,6 +56,12 @@ namespace litecore {
                              sequence_t sequence,
                              uint64_t bodySize);
 
+        struct Change;
+
+        /** Registers a batch of changes, in sequence order. Database observers are notified once,
+            when the first change is added. */
+        void documentsChanged(const Change changes[], size_t count);
+
         /** Copy the other tracker's transaction's changes into myself as committed & external */
         void addExternalTransaction(const SequenceTracker &from);
 
@@ -23,7 +23,10 @@
 #include "Database.hh"
 #include "Record.hh"
 #include "RawRevTree.hh"
+#include "RevTreeView.hh"
 #include "VersionedDocument.hh"
+#include "RevTreePruner.hh"
+#include "SequenceTracker.hh"
 #include "StringUtil.hh"
 #include "SecureRandomize.hh"
 #include "SecureDigest.hh"
@@ -35,21 +38,28 @@
 
 namespace c4Internal {
 
+    // While a RevTreePruner is running, saving a doc only prunes its tree once it's this many
+    // times deeper than the database's maxRevTreeDepth, and then all the way down to it:
+    static const unsigned kDeferredPruneFactor = 2;
+
+
+    /** A Document whose revisions are stored in a RevTree. Until the tree is modified it's read
+        through a RevTreeView, which avoids decoding it; the first change decodes it into a
+        VersionedDocument, which is used from then on. */
     class TreeDocument : public Document {
     public:
         TreeDocument(Database* database, C4Slice docID)
-        :Document(database),
-         _versionedDoc(database->defaultKeyStore(), docID),
-         _selectedRev(nullptr)
+        :Document(database)
+        ,_rec(docID)
         {
+            database->defaultKeyStore().read(_rec);
             init();
         }
 
 
         TreeDocument(Database *database, const Record &doc)
-        :Document(database),
-         _versionedDoc(database->defaultKeyStore(), doc),
-         _selectedRev(nullptr)
+        :Document(database)
+        ,_rec(doc)
         {
             init();
         }
@@ -57,11 +67,16 @@ namespace c4Internal {
 
         TreeDocument(const TreeDocument &other)
         :Document(other)
-        ,_versionedDoc(other._versionedDoc)
-        ,_selectedRev(nullptr)
+        ,_rec(other._rec)
+        ,_view(other._view)
+        ,_selectedInfo(other._selectedInfo)
+        ,_savedWithBlobs(other._savedWithBlobs)
         {
-            if (other._selectedRev)
-                _selectedRev = _versionedDoc[other._selectedRev->revID];
+            if (other._versionedDoc) {
+                _versionedDoc.reset(new VersionedDocument(*other._versionedDoc));
+                if (other._selectedRev)
+                    _selectedRev = (*_versionedDoc)[other._selectedRev->revID];
+            }
         }
 
 
@@ -71,60 +86,111 @@ namespace c4Internal {
 
 
         void init() {
-            docID = _docIDBuf = _versionedDoc.docID();
-            flags = (C4DocumentFlags)_versionedDoc.flags();
-            if (_versionedDoc.exists())
+            docID = _docIDBuf = _rec.key();
+            flags = (C4DocumentFlags)_rec.flags();
+            _savedWithBlobs = (_rec.flags() & DocumentFlags::kHasAttachments) != 0;
+            if (_rec.exists())
                 flags = (C4DocumentFlags)(flags | kDocExists);
+            if (revsInRecord())
+                _view = RevTreeView(_rec.body(), _rec.sequence());
 
             initRevID();
             selectCurrentRevision();
         }
 
         void initRevID() {
-            if (_versionedDoc.revID().size > 0) {
-                _revIDBuf = _versionedDoc.revID().expanded();
+            const Record &rec = record();
+            if (rec.version().size > 0) {
+                _revIDBuf = revid(rec.version()).expanded();
             } else {
                 _revIDBuf = nullslice;
             }
             revID = _revIDBuf;
-            sequence = _versionedDoc.sequence();
+            sequence = rec.sequence();
+        }
+
+        const Record& record() const {
+            return _versionedDoc ? _versionedDoc->record() : _rec;
+        }
+
+        // False if _rec was read without its body (as by an enumerator's meta-only option)
+        bool revsInRecord() const {
+            return _rec.body().buf || _rec.bodySize() == 0;
+        }
+
+        // Decodes the revision tree into a VersionedDocument, which from then on is used instead
+        // of _view. Called before anything modifies the tree.
+        VersionedDocument& versionedDoc() {
+            if (!_versionedDoc) {
+                _versionedDoc.reset(new VersionedDocument(_db->defaultKeyStore(), _rec));
+                if (_selectedInfo.exists() && _versionedDoc->revsAvailable())
+                    _selectedRev = _versionedDoc->get(_selectedInfo.index);
+            }
+            return *_versionedDoc;
         }
 
         bool exists() override {
-            return _versionedDoc.exists();
+            return record().exists();
         }
 
         bool revisionsLoaded() const noexcept override {
-            return _versionedDoc.revsAvailable();
+            return _versionedDoc ? _versionedDoc->revsAvailable() : revsInRecord();
         }
 
         void loadRevisions() override {
-            if (!_versionedDoc.revsAvailable()) {
-                _versionedDoc.read();
-                selectRevision(_versionedDoc.currentRevision());
+            if (_versionedDoc) {
+                if (!_versionedDoc->revsAvailable()) {
+                    _versionedDoc->read();
+                    selectRevision(_versionedDoc->currentRevision());
+                }
+            } else if (!revsInRecord()) {
+                _db->defaultKeyStore().read(_rec);
+                _view = RevTreeView(_rec.body(), _rec.sequence());
+                selectRevision(_view.current());
             }
         }
 
+        bool hasSelection() const noexcept {
+            return _versionedDoc ? (_selectedRev != nullptr) : _selectedInfo.exists();
+        }
+
         bool hasRevisionBody() noexcept override {
             if (!revisionsLoaded())
                 Warn("c4doc_hasRevisionBody called on doc loaded without kC4IncludeBodies");
-            return _selectedRev && _selectedRev->isBodyAvailable();
+            if (_versionedDoc)
+                return _selectedRev && _selectedRev->isBodyAvailable();
+            return _selectedInfo.exists() && _selectedInfo.isBodyAvailable();
         }
 
         bool loadSelectedRevBody() override {
             loadRevisions();
+            if (!selectedRev.body.buf) {
+                alloc_slice body = readSelectedExternalBody();
+                if (body) {
+                    _loadedBody = body;
+                    selectedRev.body = _loadedBody;
+                }
+            }
             return selectedRev.body.buf != nullptr;
         }
 
+        // Reads the selected revision's body if it's stored outside the tree; else returns null.
+        alloc_slice readSelectedExternalBody() {
+            if (_versionedDoc) {
+                if (_selectedRev && _selectedRev->isBodyExternal())
+                    return _versionedDoc->readBodyOfRevision(_selectedRev);
+            } else if (_selectedInfo.exists() && _selectedInfo.bodyExternal) {
+                return VersionedDocument::readRevisionBody(_db->defaultKeyStore(), _rec.key(),
+                                                           _selectedInfo.revID);
+            }
+            return nullslice;
+        }
+
         bool selectRevision(const Rev *rev) noexcept {   // doesn't throw
             _selectedRev = rev;
-            _loadedBody = nullslice;
+            _selectedInfo = RevTreeView::Info();
             if (rev) {
-                _selectedRevIDBuf = rev->revID.expanded();
-                selectedRev.revID = _selectedRevIDBuf;
-                selectedRev.flags = (C4RevisionFlags)rev->flags;
-                selectedRev.sequence = rev->sequence;
-                selectedRev.body = rev->body();
+                fillSelectedRev(rev->revID, rev->flags, rev->sequence, rev->body());
                 return true;
             } else {
                 clearSelectedRevision();
@@ -132,50 +198,125 @@ namespace c4Internal {
             }
         }
 
+        bool selectRevision(const RevTreeView::Info &info) noexcept {   // doesn't throw
+            _selectedRev = nullptr;
+            _selectedInfo = info;
+            if (info.exists()) {
+                auto revFlags = info.flags;
+                if (info.index == 0 && (_rec.flags() & DocumentFlags::kSynced))
+                    revFlags = (Rev::Flags)(revFlags | Rev::kKeepBody); // see VersionedDocument::decode
+                fillSelectedRev(info.revID, revFlags, info.sequence, info.body);
+                return true;
+            } else {
+                clearSelectedRevision();
+                return false;
+            }
+        }
+
+        void fillSelectedRev(revid revID, Rev::Flags revFlags, sequence_t seq, slice body) noexcept {
+            _loadedBody = nullslice;
+            _selectedRevIDBuf = revID.expanded();
+            selectedRev.revID = _selectedRevIDBuf;
+            selectedRev.flags = (C4RevisionFlags)revFlags;
+            selectedRev.sequence = seq;
+            selectedRev.body = body;
+            if (!body.buf) {
+                // A non-current revision's body may be stored apart from the tree; if so, read it
+                // now, so selectedRev.body means what it always has. (If that fails, the body is
+                // left null, and loadSelectedRevBody will try again and report the error.)
+                try {
+                    _loadedBody = readSelectedExternalBody();
+                    selectedRev.body = _loadedBody;
+                } catch (const std::exception &x) {
+                    Warn("TreeDocument: Couldn't read body of revision: %s", x.what());
+                }
+            }
+        }
+
         bool selectRevision(C4Slice revID, bool withBody) override {
             if (revID.buf) {
                 loadRevisions();
-                const Rev *rev = _versionedDoc[revidBuffer(revID)];
-                if (!selectRevision(rev))
+                revidBuffer rev(revID);
+                bool found = _versionedDoc ? selectRevision((*_versionedDoc)[rev])
+                                           : selectRevision(_view.get(rev));
+                if (!found)
                     return false;
                 if (withBody)
                     loadSelectedRevBody();
             } else {
-                selectRevision(nullptr);
+                selectRevision((const Rev*)nullptr);
             }
             return true;
         }
 
         bool selectCurrentRevision() noexcept override { // doesn't throw
-            if (_versionedDoc.revsAvailable()) {
-                selectRevision(_versionedDoc.currentRevision());
+            if (_versionedDoc && _versionedDoc->revsAvailable()) {
+                selectRevision(_versionedDoc->currentRevision());
+                return true;
+            } else if (!_versionedDoc && revsInRecord()) {
+                selectRevision(_view.current());
                 return true;
             } else {
                 _selectedRev = nullptr;
+                _selectedInfo = RevTreeView::Info();
                 Document::selectCurrentRevision();
                 return false;
             }
         }
 
+        // Reads a revision from _view, for the methods that can't throw. The view only validates
+        // the rest of the tree when it first reads past the current revision, so if the tree is
+        // corrupt this logs it and returns no revision.
+        RevTreeView::Info viewRevision(unsigned index) noexcept {
+            try {
+                return _view.get(index);
+            } catch (const std::exception &x) {
+                Warn("TreeDocument: Couldn't read revision tree of '%.*s': %s",
+                     SPLAT(docID), x.what());
+                return RevTreeView::Info();
+            }
+        }
+
         bool selectParentRevision() noexcept override {
             if (!revisionsLoaded())
                 Warn("Trying to access revision tree of doc loaded without kC4IncludeBodies");
-            if (_selectedRev)
-                selectRevision(_selectedRev->parent);
-            return _selectedRev != nullptr;
+            if (_versionedDoc) {
+                if (_selectedRev)
+                    selectRevision(_selectedRev->parent);
+            } else if (_selectedInfo.exists()) {
+                selectRevision(viewRevision(_selectedInfo.parentIndex));
+            }
+            return hasSelection();
         }
 
         bool selectNextRevision() noexcept override {    // does not throw
             if (!revisionsLoaded())
                 Warn("Trying to access revision tree of doc loaded without kC4IncludeBodies");
-            if (_selectedRev)
-                selectRevision(_selectedRev->next());
-            return _selectedRev != nullptr;
+            if (_versionedDoc) {
+                if (_selectedRev)
+                    selectRevision(_selectedRev->next());
+            } else if (_selectedInfo.exists()) {
+                selectRevision(viewRevision(_selectedInfo.index + 1));
+            }
+            return hasSelection();
         }
 
         bool selectNextLeafRevision(bool includeDeleted) noexcept override {
             if (!revisionsLoaded())
                 Warn("Trying to access revision tree of doc loaded without kC4IncludeBodies");
+            if (!_versionedDoc) {
+                if (!_selectedInfo.exists())
+                    return false;
+                for (unsigned i = _selectedInfo.index + 1; ; ++i) {
+                    auto info = viewRevision(i);
+                    if (!info.exists())
+                        return false;
+                    if (info.isLeaf() && (includeDeleted || !info.isDeleted())) {
+                        selectRevision(info);
+                        return true;
+                    }
+                }
+            }
             auto rev = _selectedRev;
             if (!rev)
                 return false;
@@ -189,8 +330,25 @@ namespace c4Internal {
         }
 
         bool selectCommonAncestorRevision(slice revID1, slice revID2) override {
-            const Rev *rev1 = _versionedDoc[revidBuffer(revID1)];
-            const Rev *rev2 = _versionedDoc[revidBuffer(revID2)];
+            if (!_versionedDoc) {
+                auto rev1 = _view.get(revidBuffer(revID1));
+                auto rev2 = _view.get(revidBuffer(revID2));
+                if (!rev1.exists() || !rev2.exists())
+                    error::_throw(error::NotFound);
+                while (rev1.index != rev2.index) {
+                    int d = (int)rev1.revID.generation() - (int)rev2.revID.generation();
+                    if (d >= 0)
+                        rev1 = _view.get(rev1.parentIndex);
+                    if (d <= 0)
+                        rev2 = _view.get(rev2.parentIndex);
+                    if (!rev1.exists() || !rev2.exists())
+                        return false;
+                }
+                selectRevision(rev1);
+                return true;
+            }
+            const Rev *rev1 = (*_versionedDoc)[revidBuffer(revID1)];
+            const Rev *rev2 = (*_versionedDoc)[revidBuffer(revID2)];
             if (!rev1 || !rev2)
                 error::_throw(error::NotFound);
             while (rev1 != rev2) {
@@ -207,40 +365,58 @@ namespace c4Internal {
         }
 
         alloc_slice remoteAncestorRevID(C4RemoteID remote) override {
-            auto rev = _versionedDoc.latestRevisionOnRemote(remote);
+            if (!_versionedDoc) {
+                unsigned index = _view.latestRevisionOnRemote(remote);
+                if (remote == RevTree::kDefaultRemoteID && (_rec.flags() & DocumentFlags::kSynced))
+                    index = 0;      // see VersionedDocument::decode
+                auto info = _view.get(index);
+                return info.exists() ? info.revID.expanded() : alloc_slice();
+            }
+            auto rev = _versionedDoc->latestRevisionOnRemote(remote);
             return rev ? rev->revID.expanded() : alloc_slice();
         }
 
         void setRemoteAncestorRevID(C4RemoteID remote) override {
-            _versionedDoc.setLatestRevisionOnRemote(remote, _selectedRev);
+            auto &vdoc = versionedDoc();
+            vdoc.setLatestRevisionOnRemote(remote, _selectedRev);
         }
 
         void updateFlags() {
-            flags = (C4DocumentFlags)_versionedDoc.flags() | kDocExists;
+            flags = (C4DocumentFlags)versionedDoc().flags() | kDocExists;
             initRevID();
         }
 
-        bool removeSelectedRevBody() noexcept override {
+        bool removeSelectedRevBody() override {
+            auto &vdoc = versionedDoc();
             if (!_selectedRev)
                 return false;
-            _versionedDoc.removeBody(_selectedRev);
+            vdoc.removeBody(_selectedRev);
             return true;
         }
 
         bool save(unsigned maxRevTreeDepth) override {
             requireValidDocID();
-            if (maxRevTreeDepth == 0)
+            auto &vdoc = versionedDoc();
+            if (maxRevTreeDepth == 0) {
                 maxRevTreeDepth = _db->maxRevTreeDepth();
-            _versionedDoc.prune(maxRevTreeDepth);
-            switch (_versionedDoc.save(_db->transaction())) {
+                auto pruner = _db->revTreePruner();
+                if (pruner && pruner->keepingUp()
+                        && vdoc.size() <= kDeferredPruneFactor * maxRevTreeDepth)
+                    maxRevTreeDepth = 0;            // Leave it to the pruner
+            }
+            if (maxRevTreeDepth > 0)
+                vdoc.prune(maxRevTreeDepth);
+            switch (vdoc.save(_db->transaction())) {
                 case litecore::VersionedDocument::kConflict:
                     return false;
                 case litecore::VersionedDocument::kNoNewSequence:
+                    savedBlobRefs();
                     return true;
                 case litecore::VersionedDocument::kNewSequence:
+                    savedBlobRefs();
                     selectedRev.flags &= ~kRevNew;
-                    if (_versionedDoc.sequence() > sequence) {
-                        sequence = _versionedDoc.sequence();
+                    if (vdoc.sequence() > sequence) {
+                        sequence = vdoc.sequence();
                         if (selectedRev.sequence == 0)
                             selectedRev.sequence = sequence;
                         _db->saved(this);
@@ -249,17 +425,34 @@ namespace c4Internal {
             }
         }
 
+        // Updates the database's blob reference index after saving, if this doc has (or had) any
+        // revisions with blobs.
+        void savedBlobRefs() {
+            if (!_savedWithBlobs && !_versionedDoc->hasAttachments())
+                return;
+            unordered_set<string> digests;
+            for (auto rev : _versionedDoc->allRevisions()) {
+                if (rev->body())
+                    _db->collectBlobsInRevision(rev->body(), digests);
+                else if (rev->isBodyExternal() && rev->hasAttachments())
+                    _db->collectBlobsInRevision(_versionedDoc->readBodyOfRevision(rev), digests);
+            }
+            _db->updateBlobRefs(_versionedDoc->docID(), digests);
+            _savedWithBlobs = _versionedDoc->hasAttachments();
+        }
+
         int32_t purgeRevision(C4Slice revID) override {
+            auto &vdoc = versionedDoc();
             int32_t total;
             if (revID.buf)
-                total = _versionedDoc.purge(revidBuffer(revID));
+                total = vdoc.purge(revidBuffer(revID));
             else
-                total = _versionedDoc.purgeAll();
+                total = vdoc.purgeAll();
             if (total > 0) {
-                _versionedDoc.updateMeta();
+                vdoc.updateMeta();
                 updateFlags();
                 if (_selectedRevIDBuf == slice(revID))
-                    selectRevision(_versionedDoc.currentRevision());
+                    selectRevision(vdoc.currentRevision());
             }
             return total;
         }
@@ -267,9 +460,10 @@ namespace c4Internal {
         void resolveConflict(C4String winningRevID, C4String losingRevID,
                              C4Slice mergedBody, C4RevisionFlags mergedFlags) override
         {
+            auto &vdoc = versionedDoc();
             // Validate the revIDs:
-            auto winningRev = _versionedDoc[revidBuffer(winningRevID)];
-            auto losingRev = _versionedDoc[revidBuffer(losingRevID)];
+            auto winningRev = vdoc[revidBuffer(winningRevID)];
+            auto losingRev = vdoc[revidBuffer(losingRevID)];
             if (!winningRev || !losingRev)
                 error::_throw(error::NotFound);
             if (!winningRev->isLeaf() || !losingRev->isLeaf())
@@ -277,8 +471,8 @@ namespace c4Internal {
             if (winningRev == losingRev)
                 error::_throw(error::InvalidParameter);
 
-            _versionedDoc.markBranchAsConflict(winningRev, false);
-            _versionedDoc.markBranchAsConflict(losingRev, false);
+            vdoc.markBranchAsConflict(winningRev, false);
+            vdoc.markBranchAsConflict(losingRev, false);
 
             // Add a tombstone as a child of losingRev:
             if (!losingRev->isClosed()) {
@@ -310,22 +504,23 @@ namespace c4Internal {
             Assert(rq.historyCount >= 1);
             int32_t commonAncestor = -1;
             loadRevisions();
+            auto &vdoc = versionedDoc();
             vector<revidBuffer> revIDBuffers(rq.historyCount);
             for (size_t i = 0; i < rq.historyCount; i++)
                 revIDBuffers[i].parse(rq.history[i]);
 
-            auto priorCurrentRev = _versionedDoc.currentRevision();
-            commonAncestor = _versionedDoc.insertHistory(revIDBuffers,
+            auto priorCurrentRev = vdoc.currentRevision();
+            commonAncestor = vdoc.insertHistory(revIDBuffers,
                                                          rq.body,
                                                          (Rev::Flags)rq.revFlags,
                                                          (rq.remoteDBID != 0));
             if (commonAncestor < 0)
                 error::_throw(error::BadRevisionID); // Bad revision history (non-consecutive)
-            auto newRev = _versionedDoc[revidBuffer(rq.history[0])];
+            auto newRev = vdoc[revidBuffer(rq.history[0])];
             DebugAssert(newRev);
 
             if (rq.remoteDBID) {
-                auto oldRev = _versionedDoc.latestRevisionOnRemote(rq.remoteDBID);
+                auto oldRev = vdoc.latestRevisionOnRemote(rq.remoteDBID);
                 if (oldRev && !oldRev->isAncestorOf(newRev)) {
                     // Server has "switched branches": its current revision is now on a different
                     // branch than it used to be, either due to revs added to this branch, or
@@ -333,13 +528,13 @@ namespace c4Internal {
                     Assert(newRev->isConflict());
                     const char *effect;
                     if (oldRev->isConflict()) {
-                        _versionedDoc.purge(oldRev->revID);
+                        vdoc.purge(oldRev->revID);
                         effect = "purging old branch";
                     } else if (oldRev == priorCurrentRev) {
-                        _versionedDoc.markBranchAsConflict(newRev, false);
-                        _versionedDoc.purge(oldRev->revID);
+                        vdoc.markBranchAsConflict(newRev, false);
+                        vdoc.purge(oldRev->revID);
                         effect = "making new branch main & purging old";
-                        Assert(_versionedDoc.currentRevision() == newRev);
+                        Assert(vdoc.currentRevision() == newRev);
                     } else {
                         effect = "doing nothing";
                     }
@@ -347,7 +542,7 @@ namespace c4Internal {
                           SPLAT(docID), SPLAT(oldRev->revID.expanded()),
                           SPLAT(newRev->revID.expanded()), effect);
                 }
-                _versionedDoc.setLatestRevisionOnRemote(rq.remoteDBID, newRev);
+                vdoc.setLatestRevisionOnRemote(rq.remoteDBID, newRev);
             }
 
             if (!saveNewRev(rq, newRev, (commonAncestor > 0 || rq.remoteDBID)))
@@ -359,13 +554,14 @@ namespace c4Internal {
         bool putNewRevision(const C4DocPutRequest &rq) override {
             if (rq.remoteDBID != 0)
                 error::_throw(error::InvalidParameter, "remoteDBID cannot be used when existing=false");
+            auto &vdoc = versionedDoc();
             bool deletion = (rq.revFlags & kRevDeleted) != 0;
             revidBuffer encodedNewRevID = generateDocRevID(rq.body, selectedRev.revID, deletion);
             slice body = rq.body;
             if (!body)
                 body = slice{fleece::Dict::kEmpty, 2};
             int httpStatus;
-            auto newRev = _versionedDoc.insert(encodedNewRevID,
+            auto newRev = vdoc.insert(encodedNewRevID,
                                                body,
                                                (Rev::Flags)rq.revFlags,
                                                _selectedRev,
@@ -394,7 +590,7 @@ namespace c4Internal {
                 if (!save(rq.maxRevTreeDepth))
                     return false;
             } else {
-                _versionedDoc.updateMeta();
+                versionedDoc().updateMeta();
             }
             updateFlags();
             return true;
@@ -431,8 +627,12 @@ namespace c4Internal {
 
 
     private:
-        VersionedDocument _versionedDoc;
-        const Rev *_selectedRev;
+        Record _rec;                    // The record as read; superseded by _versionedDoc's
+        RevTreeView _view;              // Reads _rec's tree, until _versionedDoc exists
+        RevTreeView::Info _selectedInfo;// Selected revision in _view
+        unique_ptr<VersionedDocument> _versionedDoc;    // The decoded tree, once it's modified
+        const Rev *_selectedRev {nullptr};              // Selected revision in _versionedDoc
+        bool _savedWithBlobs;           // Did the saved doc have any revisions with blobs?
     };
 
 
@@ -459,6 +659,111 @@ namespace c4Internal {
         return revID.hasPrefix(slice("1-", 2));
     }
 
+
+    // Number of documents written by each KeyStore::insertBatch call in putNewDocs
+    static const size_t kNewDocsBatchSize = 1000;
+
+    // Each doc's rev tree is encoded directly, instead of creating a TreeDocument and a
+    // VersionedDocument for it, and the records are added in batches.
+    void TreeDocumentFactory::putNewDocs(const C4NewDocument docs[], size_t count, bool overwrite) {
+        Database *db = database();
+        KeyStore &store = db->defaultKeyStore();
+        Transaction &t = db->transaction();
+        auto encoding = VersionedDocument::encodingFor(store);
+        bool observable = (db->config.flags & kC4DB_NonObservable) == 0;
+
+        // Check all the docs before writing any, so a failure doesn't leave some of them written:
+        unordered_set<string> docIDs;
+        for (size_t i = 0; i < count; ++i) {
+            auto &doc = docs[i];
+            if (!Document::isValidDocID(doc.docID))
+                error::_throw(error::BadDocID);
+            if (doc.revFlags & kRevDeleted)
+                error::_throw(error::InvalidParameter,
+                              "Can't create a new already-deleted document");
+            db->validateRevisionBody(doc.body);
+            if (!overwrite) {
+                if (!docIDs.insert(slice(doc.docID).asString()).second
+                        || store.get(doc.docID, kMetaOnly).exists())
+                    error::_throw(error::Conflict);
+            }
+        }
+
+        vector<revidBuffer> revIDs;
+        vector<alloc_slice> trees;
+        vector<KeyStore::NewRecord> records;
+        vector<SequenceTracker::Change> changes;
+        for (size_t start = 0; start < count; start += kNewDocsBatchSize) {
+            size_t n = min(count - start, kNewDocsBatchSize);
+            const C4NewDocument *batch = &docs[start];
+            revIDs.clear();
+            trees.clear();
+            records.clear();
+            revIDs.reserve(n);      // (NewRecords point into these, so they mustn't reallocate)
+            trees.reserve(n);
+            for (size_t i = 0; i < n; ++i) {
+                auto &doc = batch[i];
+                slice body = doc.body;
+                if (!body)
+                    body = slice{fleece::Dict::kEmpty, 2};
+                auto revFlags = (Rev::Flags)(doc.revFlags & (kRevHasAttachments | kRevKeepBody));
+                revIDs.push_back(TreeDocument::generateDocRevID(doc.body, nullslice, false));
+                trees.push_back(RawRevision::encodeNewTree(revIDs.back(), body, revFlags,
+                                                           encoding));
+                DocumentFlags docFlags = DocumentFlags::kNone;
+                if (revFlags & Rev::kHasAttachments)
+                    docFlags = DocumentFlags::kHasAttachments;
+                records.push_back({doc.docID, revIDs.back(), trees.back(), docFlags, 0});
+            }
+
+            store.insertBatch(records.data(), n, t);
+            for (auto &tree : trees)
+                VersionedDocument::upgradeFileFor(store, tree, false, t);
+
+            vector<size_t> existing;
+            for (size_t i = 0; i < n; ++i) {
+                auto &rec = records[i];
+                if (rec.sequence == 0) {
+                    // A document with this ID already exists (which was checked for above, unless
+                    // overwriting):
+                    if (!overwrite)
+                        error::_throw(error::Conflict);
+                    existing.push_back(i);
+                } else if (rec.flags & DocumentFlags::kHasAttachments) {
+                    unordered_set<string> digests;
+                    db->collectBlobsInRevision(RawRevision::getCurrentRevBody(rec.body), digests);
+                    db->updateBlobRefs(rec.key, digests);
+                }
+            }
+
+            if (observable) {
+                changes.clear();
+                for (auto &rec : records) {
+                    if (rec.sequence > 0)
+                        changes.push_back({alloc_slice(rec.key), revid(rec.version).expanded(),
+                                           rec.sequence,
+                                           (uint32_t)RawRevision::getCurrentRevBody(rec.body).size});
+                }
+                lock_guard<mutex> lock(db->sequenceTracker().mutex());
+                db->sequenceTracker().documentsChanged(changes.data(), changes.size());
+            }
+
+            // Add each existing doc's new revision as a child of its current one, as c4doc_update
+            // would, so its history is kept. (Saving it notifies observers.)
+            for (size_t i : existing) {
+                auto &doc = batch[i];
+                unique_ptr<Document> existingDoc(newDocumentInstance(doc.docID));
+                C4DocPutRequest rq = {};
+                rq.docID = doc.docID;
+                rq.body = doc.body;
+                rq.revFlags = doc.revFlags & (kRevHasAttachments | kRevKeepBody);
+                rq.save = true;
+                if (!existingDoc->putNewRevision(rq))
+                    error::_throw(error::Conflict);
+            }
+        }
+    }
+
 } // end namespace c4Internal
 
 
@@ -490,3 +795,22 @@ unsigned c4rev_getGeneration(C4Slice revID) noexcept {
     }catchExceptions()
     return 0;
 }
+
+
+bool c4db_putNewDocs(C4Database *database,
+                     const C4NewDocument docs[],
+                     size_t count,
+                     bool overwrite,
+                     C4Error *outError) noexcept
+{
+    if (!database->mustUseVersioning(kC4RevisionTrees, outError))
+        return false;
+    if (!database->mustBeInTransaction(outError))
+        return false;
+    try {
+        auto &factory = (TreeDocumentFactory&)database->documentFactory();
+        factory.putNewDocs(docs, count, overwrite);
+        return true;
+    } catchError(outError)
+    return false;
+}
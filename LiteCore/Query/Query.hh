@@ -24,6 +24,7 @@
 
 namespace litecore {
     class QueryEnumerator;
+    class LiveQuery;
 
 
     /** Abstract base class of compiled database queries.
@@ -50,10 +51,17 @@ namespace litecore {
 
         struct Options {
             alloc_slice paramBindings;
+            bool streaming {false};     ///< Read rows lazily instead of all at once
         };
 
         virtual QueryEnumerator* createEnumerator(const Options* =nullptr) =0;
 
+        /** Runs the query and returns an object that keeps its results up to date as documents
+            change. May not be supported by all implementations. */
+        virtual LiveQuery* createLiveQuery(const Options* =nullptr) {
+            error::_throw(error::UnsupportedOperation);
+        }
+
     protected:
         Query(KeyStore &keyStore) noexcept
         :_keyStore(keyStore)
@@ -90,9 +98,47 @@ namespace litecore {
             that will return the new results. Otherwise returns null. */
         virtual QueryEnumerator* refresh() =0;
 
+        /** Stops the enumeration early, freeing any resources (like a live statement) it holds.
+            After this, `next` returns false. */
+        virtual void close() noexcept                           { }
+
     protected:
         // The implementation of fullTextTerms() should populate this and return a reference:
         FullTextTerms _fullTextTerms;
     };
 
+
+    /** Holds the latest results of a query and updates them incrementally, given the IDs of the
+        documents that have changed, reporting the differences row by row.
+        Abstract class created by Query::createLiveQuery. */
+    class LiveQuery {
+    public:
+        /** A difference between the previous and the current results. Indexes of removed rows
+            refer to the previous results, and those of inserted rows to the current ones. */
+        struct RowChange {
+            enum Type : uint8_t {
+                kInserted,      ///< Row is new, at `newIndex`
+                kRemoved,       ///< Row at `oldIndex` is gone
+                kMoved,         ///< Row moved from `oldIndex` to `newIndex` (and may have changed)
+                kUpdated,       ///< Row's values changed, but it kept its position
+            };
+
+            Type type;
+            int64_t oldIndex;   ///< Index in the previous results, or -1 if inserted
+            int64_t newIndex;   ///< Index in the current results, or -1 if removed
+        };
+
+        virtual ~LiveQuery() =default;
+
+        /** Brings the results up to date after the given documents have changed, and appends
+            the differences to `changes`. Returns true if the results changed. */
+        virtual bool update(const std::vector<alloc_slice> &changedDocIDs,
+                            std::vector<RowChange> &changes) =0;
+
+        virtual uint64_t rowCount() const =0;
+
+        /** Returns an enumerator over the current results. */
+        virtual QueryEnumerator* createEnumerator() =0;
+    };
+
 }
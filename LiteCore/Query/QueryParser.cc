@@ -136,6 +136,7 @@ namespace litecore {
     
     static string propertyFromOperands(Array::iterator &operands);
     static string propertyFromNode(const Value *node);
+    static bool usesVariableProperty(const Value *node);
 
 
 #pragma mark - QUERY PARSER TOP LEVEL:
@@ -147,8 +148,10 @@ namespace litecore {
         _parameters.clear();
         _variables.clear();
         _ftsTables.clear();
+        _geoTables.clear();
         _1stCustomResultCol = 0;
-        _isAggregateQuery = _aggregatesOK = false;
+        _isAggregateQuery = _aggregatesOK = _inResultList = false;
+        _hasOrderBy = _hasLimit = _hasOffset = false;
     }
 
 
@@ -268,11 +271,11 @@ namespace litecore {
         }
 
         // ORDER_BY clause:
-        writeSelectListClause(operands, "ORDER_BY"_sl, " ORDER BY ", true);
+        _hasOrderBy = (writeSelectListClause(operands, "ORDER_BY"_sl, " ORDER BY ", true) > 0);
 
         // LIMIT, OFFSET clauses:
-        writeOrderOrLimitClause(operands, "LIMIT"_sl,  "LIMIT");
-        writeOrderOrLimitClause(operands, "OFFSET"_sl, "OFFSET");
+        _hasLimit  = writeOrderOrLimitClause(operands, "LIMIT"_sl,  "LIMIT");
+        _hasOffset = writeOrderOrLimitClause(operands, "OFFSET"_sl, "OFFSET");
     }
 
 
@@ -292,9 +295,11 @@ namespace litecore {
         _context.push_back(&kExpressionListOperation); // suppresses parens around arg list
         Array::iterator items(list);
         _aggregatesOK = aggregatesOK;
-        if (key == "WHAT"_sl)
+        if (key == "WHAT"_sl) {
+            _inResultList = true;
             handleOperation(&kResultListOperation, kResultListOperation.op, items);
-        else
+            _inResultList = false;
+        } else
             writeColumnList(items);
         _aggregatesOK = false;
         _context.pop_back();
@@ -317,6 +322,14 @@ namespace litecore {
             }
             writeNotDeletedTest(0);
         }
+        if (!_docIDFilter.empty()) {
+            _sql << (where || !_includeDeleted ? " AND " : " WHERE ");
+            if (_aliases.empty())
+                _sql << _tableName;
+            else
+                _sql << '"' << _aliases[0] << '"';
+            _sql << ".key = " << _docIDFilter;
+        }
     }
 
 
@@ -331,24 +344,33 @@ namespace litecore {
     }
 
 
-    void QueryParser::writeCreateIndex(const string &name, const Array *expressions) {
+    void QueryParser::writeCreateIndex(const string &name,
+                                       const Array *expressions,
+                                       const Value *where)
+    {
         reset();
         _sql << "CREATE INDEX \"" << name << "\" ON " << _tableName << " ";
         Array::iterator iter(expressions);
         writeColumnList(iter);
-        // TODO: Add 'WHERE' clause for use with SQLite 3.15+
+        if (where) {
+            // Makes it a partial index:
+            _sql << " WHERE ";
+            parseNode(where);
+            require(_parameters.empty(), "Index WHERE clause cannot use query parameters");
+        }
     }
 
 
-    void QueryParser::writeOrderOrLimitClause(const Dict *operands,
+    bool QueryParser::writeOrderOrLimitClause(const Dict *operands,
                                               slice jsonKey,
                                               const char *sqlKeyword) {
         auto value = getCaseInsensitive(operands, jsonKey);
-        if (value) {
-            _sql << " " << sqlKeyword << " MAX(0, ";
-            parseNode(value);
-            _sql << ")";
-        }
+        if (!value)
+            return false;
+        _sql << " " << sqlKeyword << " MAX(0, ";
+        parseNode(value);
+        _sql << ")";
+        return true;
     }
 
 
@@ -717,6 +739,52 @@ namespace litecore {
     }
 
 
+    // Handles geo-index tests, which look up the doc in the R*Tree table of a geo index:
+    //   ["WITHIN_BOX", indexName, minLat, minLon, maxLat, maxLon]
+    //   ["WITHIN_RADIUS", indexName, lat, lon, meters]
+    // (Boxes that cross the 180th meridian aren't supported; radii can cross it.)
+    void QueryParser::geoOp(slice op, Array::iterator& operands) {
+        require(_aliases.empty(), "%.*s can't be used with FROM aliases", SPLAT(op));
+        string geoTable = geoTableName(operands[0]);
+        if (find(_geoTables.begin(), _geoTables.end(), geoTable) == _geoTables.end())
+            _geoTables.push_back(geoTable);
+
+        auto arg = [&](unsigned i) {
+            _sql << '(';
+            parseNode(operands[i]);
+            _sql << ')';
+        };
+
+        // R*Tree coordinates are 32-bit floats rounded outwards, so test whether each doc's box
+        // overlaps the query's instead of whether it's contained in it:
+        _sql << _tableName << ".rowid IN (SELECT id FROM \"" << geoTable << "\" WHERE ";
+        if (op.caseEquivalent("WITHIN_BOX"_sl)) {
+            _sql << "maxLat >= ";   arg(1);
+            _sql << " AND minLat <= "; arg(3);
+            _sql << " AND maxLon >= "; arg(2);
+            _sql << " AND minLon <= "; arg(4);
+        } else {
+            // The circle's bounding box may extend past longitude 180 or -180; the part that
+            // does wraps around to the other side, so it's searched again shifted by 360
+            // degrees each way. (Those ranges are empty if it doesn't cross.)
+            const char* const shifts[3] = {"", " + 360", " - 360"};
+            for (int i = 0; i < 3; ++i) {
+                if (i > 0)
+                    _sql << " UNION ALL SELECT id FROM \"" << geoTable << "\" WHERE ";
+                _sql << "maxLat >= ";   arg(1); _sql << " - geo_lat_span("; arg(3); _sql << ")";
+                _sql << " AND minLat <= "; arg(1); _sql << " + geo_lat_span("; arg(3); _sql << ")";
+                _sql << " AND maxLon >= "; arg(2);
+                _sql << " - geo_lon_span("; arg(1); _sql << ", "; arg(3); _sql << ")" << shifts[i];
+                _sql << " AND minLon <= "; arg(2);
+                _sql << " + geo_lon_span("; arg(1); _sql << ", "; arg(3); _sql << ")" << shifts[i];
+                _sql << " AND geo_distance((minLat + maxLat) / 2, (minLon + maxLon) / 2, ";
+                arg(1); _sql << ", "; arg(2); _sql << ") <= "; arg(3);
+            }
+        }
+        _sql << ')';
+    }
+
+
     // Handles "ANY var IN array SATISFIES expr" (and EVERY, and ANY AND EVERY)
     void QueryParser::anyEveryOp(slice op, Array::iterator& operands) {
         auto var = (string)requiredString(operands[0], "ANY/EVERY first parameter");
@@ -733,6 +801,17 @@ namespace litecore {
 
         //OPT: If expr is `var = value`, can generate `fl_contains(array, value)` instead 
 
+        // If the array has an index, iterate its table of elements instead of the doc body.
+        // The table only has the elements' values, so it can't be used if the predicate looks at
+        // properties nested inside them.
+        string unnestTable;
+        if (_aliases.empty() && property.find('"') == string::npos
+                             && !usesVariableProperty(operands[2])) {
+            unnestTable = unnestedTableName(property);
+            if (_unnestedTables.count(unnestTable) == 0)
+                unnestTable.clear();
+        }
+
         if (anyAndEvery) {
             _sql << '(';
             writePropertyGetter(kCountFnName, property);
@@ -741,13 +820,22 @@ namespace litecore {
 
         if (every)
             _sql << "NOT ";
-        _sql << "EXISTS (SELECT 1 FROM ";
-        writePropertyGetter(kEachFnName, property);
+        if (unnestTable.empty()) {
+            _sql << "EXISTS (SELECT 1 FROM ";
+            writePropertyGetter(kEachFnName, property);
+        } else {
+            // Like geoOp, look up the matching docs in the index instead of testing each doc
+            // with a correlated subquery, so SQLite can search the index on the element values:
+            _sql << _tableName << ".rowid IN (SELECT docid FROM \"" << unnestTable << '"';
+        }
         _sql << " AS _" << var << " WHERE ";
+        bool parens = every || !unnestTable.empty();
         if (every)
-            _sql << "NOT (";
+            _sql << "NOT ";
+        if (parens)
+            _sql << '(';
         parseNode(operands[2]);
-        if (every)
+        if (parens)
             _sql << ')';
         _sql << ')';
         if (anyAndEvery)
@@ -993,6 +1081,32 @@ namespace litecore {
     }
 
 
+    // Returns true if an expression accesses a property of an ANY/EVERY variable, like "?x.name"
+    static bool usesVariableProperty(const Value *node) {
+        Array::iterator i(node->asArray());
+        if (i.count() == 0)
+            return false;
+        slice op = i[0]->asString();
+        if (op.size > 0 && op[0] == '?') {
+            if (op.size > 1) {
+                if (op.findByte('.') || op.findByte('[') || i.count() > 1)
+                    return true;
+            } else if (i.count() > 2) {
+                return true;
+            } else if (i.count() == 2) {
+                slice var = i[1]->asString();
+                if (var.findByte('.') || var.findByte('['))
+                    return true;
+            }
+        }
+        for (++i; i; ++i) {
+            if (usesVariableProperty(i.value()))
+                return true;
+        }
+        return false;
+    }
+
+
     // If the first operand is a property operation, writes it using the given SQL function name
     // and returns true; else returns false.
     bool QueryParser::writeNestedPropertyOpIfAny(slice fnName, Array::iterator &operands) {
@@ -1047,6 +1161,10 @@ namespace litecore {
             if(!property.empty()) {
                 _sql << ", ";
                 writeSQLString(_sql, slice(property));
+                // In a result column, pass the row's sequence so the doc root can be memoized.
+                // (Not elsewhere, since expressions in WHERE etc. have to match index SQL.)
+                if (_inResultList && fn == kValueFnName)
+                    _sql << ", " << tableName << "sequence";
             }
             _sql << ")";
         }
@@ -1098,6 +1216,41 @@ namespace litecore {
         return _tableName + "::" + indexName;
     }
 
+    string QueryParser::geoTableName(const Value *key) const {
+        slice indexName = requiredString(key, "geo index name");
+        return geoTableName(string(indexName));
+    }
+
+    string QueryParser::geoTableName(const string &indexName) const {
+        require(!indexName.empty() && indexName.find('"') == string::npos,
+                "geo index name may not contain double-quotes nor be empty");
+        return _tableName + "::" + indexName;
+    }
+
+    // The table that an array index on a property stores the elements of the array in.
+    string QueryParser::unnestedTableName(const Value *arrayExpression) const {
+        string property = propertyFromNode(arrayExpression);
+        require(!property.empty(), "array index expression must be a property");
+        return unnestedTableName(property);
+    }
+
+    string QueryParser::unnestedTableName(const string &property) const {
+        require(property.find('"') == string::npos,
+                "array index property may not contain double-quotes");
+        return _tableName + ":unnest:" + property;
+    }
+
+    // SQL for a call to fl_each that iterates the elements of an array property.
+    /*static*/ string QueryParser::eachExpressionSQL(const Value *arrayExpression,
+                                                     const char *bodyColumnName)
+    {
+        string property = propertyFromNode(arrayExpression);
+        require(!property.empty(), "array index expression must be a property");
+        QueryParser qp("XXX", bodyColumnName);
+        qp.writePropertyGetter(kEachFnName, property);
+        return qp.SQL();
+    }
+
     size_t QueryParser::FTSPropertyIndex(const Value *matchLHS, bool canAdd) {
         string key = FTSTableName(matchLHS);
         auto i = find(_ftsTables.begin(), _ftsTables.end(), key);
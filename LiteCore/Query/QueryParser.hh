@@ -44,12 +44,20 @@ namespace litecore {
 
         void setBaseResultColumns(const std::vector<std::string>& c){_baseResultColumns = c;}
 
+        /** Limits the query to the document whose docID is bound to the given SQL parameter. */
+        void setDocIDFilter(const std::string &sqlParam)            {_docIDFilter = sqlParam;}
+
+        /** Tells the parser which array-index tables exist, so that ANY/EVERY can use them. */
+        void setUnnestedTables(const std::set<std::string> &tables) {_unnestedTables = tables;}
+
         void parse(const fleece::Value*);
         void parseJSON(slice);
 
         void parseJustExpression(const fleece::Value *expression);
 
-        void writeCreateIndex(const std::string &name, const fleece::Array *expressions);
+        void writeCreateIndex(const std::string &name,
+                              const fleece::Array *expressions,
+                              const fleece::Value *where =nullptr);
 
         static void writeSQLString(std::ostream &out, slice str);
 
@@ -57,15 +65,27 @@ namespace litecore {
 
         const std::set<std::string>& parameters()                   {return _parameters;}
         const std::vector<std::string>& ftsTablesUsed() const       {return _ftsTables;}
+        const std::vector<std::string>& geoTablesUsed() const       {return _geoTables;}
         unsigned firstCustomResultColumn() const                    {return _1stCustomResultCol;}
 
         bool isAggregateQuery() const                               {return _isAggregateQuery;}
+        bool isJoin() const                                         {return _aliases.size() > 1;}
+        bool hasOrderBy() const                                     {return _hasOrderBy;}
+        bool hasLimit() const                                       {return _hasLimit;}
+        bool hasOffset() const                                      {return _hasOffset;}
 
         static std::string expressionSQL(const fleece::Value*, const char *bodyColumnName = "body");
         std::string FTSTableName(const fleece::Value *key) const;
         std::string FTSTableName(const std::string &property) const;
         static std::string FTSColumnName(const fleece::Value *expression);
 
+        std::string geoTableName(const fleece::Value *key) const;
+        std::string geoTableName(const std::string &indexName) const;
+        std::string unnestedTableName(const fleece::Value *arrayExpression) const;
+        std::string unnestedTableName(const std::string &property) const;
+        static std::string eachExpressionSQL(const fleece::Value *arrayExpression,
+                                             const char *bodyColumnName = "body");
+
     private:
         struct Operation;
         static const Operation kOperationList[];
@@ -94,7 +114,7 @@ namespace litecore {
         void parseFromClause(const fleece::Value *from);
         void writeFromClause(const fleece::Value *from);
         int parseJoinType(fleece::slice);
-        void writeOrderOrLimitClause(const fleece::Dict *operands,
+        bool writeOrderOrLimitClause(const fleece::Dict *operands,
                                      fleece::slice jsonKey,
                                      const char *keyword);
 
@@ -108,6 +128,7 @@ namespace litecore {
         void collateOp(slice, fleece::Array::iterator&);
         void inOp(slice, fleece::Array::iterator&);
         void matchOp(slice, fleece::Array::iterator&);
+        void geoOp(slice, fleece::Array::iterator&);
         void anyEveryOp(slice, fleece::Array::iterator&);
         void parameterOp(slice, fleece::Array::iterator&);
         void propertyOp(slice, fleece::Array::iterator&);
@@ -137,14 +158,19 @@ namespace litecore {
         std::string _bodyColumnName;
         std::vector<std::string> _aliases;      // Aliased table/join names
         std::vector<std::string> _baseResultColumns;
+        std::string _docIDFilter;               // SQL parameter to match docID against
         std::stringstream _sql;
         std::vector<const Operation*> _context;
         std::set<std::string> _parameters;
         std::set<std::string> _variables;
         std::vector<std::string> _ftsTables;
+        std::vector<std::string> _geoTables;
+        std::set<std::string> _unnestedTables;  // Array-index tables that exist
         unsigned _1stCustomResultCol {0};
         bool _aggregatesOK {false};
+        bool _inResultList {false};             // Writing the WHAT clause?
         bool _isAggregateQuery {false};
+        bool _hasOrderBy {false}, _hasLimit {false}, _hasOffset {false};
         static constexpr bool _includeDeleted {false};  // In future add an accessor to set this
         Collation _collation;
         bool _collationUsed {true};
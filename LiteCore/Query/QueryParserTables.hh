@@ -63,6 +63,8 @@ namespace litecore {
         {"NOT IN"_sl,  2, 9,  3,  &QueryParser::inOp},
         {"LIKE"_sl,    2, 2,  3,  &QueryParser::infixOp},
         {"MATCH"_sl,   2, 2,  3,  &QueryParser::matchOp},
+        {"WITHIN_BOX"_sl,    5, 5,  3,  &QueryParser::geoOp},
+        {"WITHIN_RADIUS"_sl, 4, 4,  3,  &QueryParser::geoOp},
         {"BETWEEN"_sl, 3, 3,  3,  &QueryParser::betweenOp},
         {"EXISTS"_sl,  1, 1,  8,  &QueryParser::existsOp},
 
@@ -150,6 +152,9 @@ namespace litecore {
         {"tan"_sl,              1, 1},
         {"trunc"_sl,            1, 2},
 
+        // Geospatial:
+        {"geo_distance"_sl,     4, 4},
+
         // Patterns:
         {"regexp_contains"_sl,  2, 2},
         {"regexp_like"_sl,      2, 2},
@@ -31,11 +31,12 @@ namespace litecore {
     // Core SQLite functions for accessing values inside Fleece blobs.
 
 
-    // fl_value(body, propertyPath) -> propertyValue
+    // fl_value(body, propertyPath [, sequence]) -> propertyValue
+    // (Given the row's sequence, the doc root is memoized for the row; see DocRootCache.)
     static void fl_value(sqlite3_context* ctx, int argc, sqlite3_value **argv) noexcept {
         try {
             const Value *val;
-            if (!evaluatePathFromArgs(ctx, argv, true, &val))
+            if (!evaluatePathFromArgs(ctx, argv, true, &val, (argc > 2 ? argv[2] : nullptr)))
                 return;
             setResultFromValue(ctx, val);
         } catch (const std::exception &) {
@@ -226,6 +227,7 @@ namespace litecore {
     const SQLiteFunctionSpec kFleeceFunctionsSpec[] = {
         { "fl_root",           1, fl_root },
         { "fl_value",          2, fl_value },
+        { "fl_value",          3, fl_value },
         { "fl_nested_value",   2, fl_nested_value },
         { "fl_exists",         2, fl_exists },
         { "fl_count",          2, fl_count },
@@ -24,6 +24,7 @@
 #include "Logging.hh"
 #include <SQLiteCpp/Exception.h>
 #include <sqlite3.h>
+#include <atomic>
 
 using namespace fleece;
 using namespace std;
@@ -31,22 +32,66 @@ using namespace std;
 namespace litecore {
 
 
-    const Value* fleeceDocRoot(sqlite3_context* ctx, sqlite3_value *arg) noexcept {
+    static atomic<uint64_t> sTotalDocRootsDerived {0}, sTotalDocRootsReused {0};
+
+
+    void DocRootCache::enable() noexcept {
+        sqlite3_mutex_enter(_dbMutex);      // (a no-op if the mutex is null)
+        _enabled = true;
+    }
+
+
+    void DocRootCache::disable() noexcept {
+        _enabled = false;
+        _sequence = 0;
+        _body = nullslice;
+        _root = nullptr;
+        sTotalDocRootsDerived += _derived;
+        sTotalDocRootsReused += _reused;
+        _derived = _reused = 0;
+        sqlite3_mutex_leave(_dbMutex);
+    }
+
+
+    DocRootCache::Stats DocRootCache::stats() noexcept {
+        return {sTotalDocRootsDerived, sTotalDocRootsReused};
+    }
+
+
+    const Value* fleeceDocRoot(sqlite3_context* ctx, sqlite3_value *arg,
+                               sqlite3_value *sequenceArg) noexcept
+    {
         auto type = sqlite3_value_type(arg);
         if (type == SQLITE_NULL)
             return Dict::kEmpty;             // No 'body' column; may be deleted doc
         Assert(type == SQLITE_BLOB);
         Assert(sqlite3_value_subtype(arg) == 0);
-        slice fleece = valueAsSlice(arg);
+        slice body = valueAsSlice(arg);
         auto funcCtx = (fleeceFuncContext*)sqlite3_user_data(ctx);
-        fleece = funcCtx->accessor(fleece);
-        if (!fleece)
-            return Dict::kEmpty;             // No current revision body; may be deleted rev
-        const Value *root = Value::fromTrustedData(fleece);
-        if (!root) {
-            Warn("Invalid Fleece data in SQLite table");
-            sqlite3_result_error(ctx, "invalid Fleece data", -1);
-            sqlite3_result_error_code(ctx, SQLITE_MISMATCH);
+        auto cache = funcCtx->rootCache.get();
+        int64_t sequence = 0;
+        if (cache && sequenceArg) {
+            sequence = sqlite3_value_int64(sequenceArg);
+            if (auto root = cache->get(sequence, body))
+                return root;
+        }
+        const Value *root;
+        slice fleece = funcCtx->accessor(body);
+        if (!fleece) {
+            root = Dict::kEmpty;             // No current revision body; may be deleted rev
+        } else {
+            root = Value::fromTrustedData(fleece);
+            if (!root) {
+                Warn("Invalid Fleece data in SQLite table");
+                sqlite3_result_error(ctx, "invalid Fleece data", -1);
+                sqlite3_result_error_code(ctx, SQLITE_MISMATCH);
+                return nullptr;
+            }
+        }
+        if (cache) {
+            cache->countDerived();
+            if (sequenceArg)
+                cache->set(sequence, body, root);
         }
         return root;
     }
@@ -102,8 +147,11 @@ namespace litecore {
     }
 
 
-    bool evaluatePathFromArgs(sqlite3_context *ctx, sqlite3_value **argv, bool isDocBody, const Value* *outValue) {
-        const Value *val = isDocBody ? fleeceDocRoot(ctx, argv[0]) : fleeceParam(ctx, argv[0]);
+    bool evaluatePathFromArgs(sqlite3_context *ctx, sqlite3_value **argv, bool isDocBody,
+                              const Value* *outValue, sqlite3_value *sequenceArg)
+    {
+        const Value *val = isDocBody ? fleeceDocRoot(ctx, argv[0], sequenceArg)
+                                     : fleeceParam(ctx, argv[0]);
         if (!val)
             return false;
 
@@ -205,6 +253,7 @@ namespace litecore {
     static void registerFunctionSpecs(sqlite3 *db,
                                       DataFile::FleeceAccessor accessor,
                                       fleece::SharedKeys *sharedKeys,
+                                      const shared_ptr<DocRootCache> &rootCache,
                                       const SQLiteFunctionSpec functions[])
     {
         if (!accessor)
@@ -214,7 +263,8 @@ namespace litecore {
                                                 fn->name,
                                                 fn->argCount,
                                                 SQLITE_UTF8 | SQLITE_DETERMINISTIC,
-                                                new fleeceFuncContext{accessor, sharedKeys},
+                                                new fleeceFuncContext{accessor, sharedKeys,
+                                                                      rootCache},
                                                 fn->function, fn->stepCallback, fn->finalCallback,
                                                 [](void *param) {delete (fleeceFuncContext*)param;});
             if (rc != SQLITE_OK)
@@ -225,11 +275,12 @@ namespace litecore {
 
     void RegisterSQLiteFunctions(sqlite3 *db,
                                  DataFile::FleeceAccessor accessor,
-                                 fleece::SharedKeys *sharedKeys)
+                                 fleece::SharedKeys *sharedKeys,
+                                 shared_ptr<DocRootCache> rootCache)
     {
-        registerFunctionSpecs(db, accessor, sharedKeys, kFleeceFunctionsSpec);
-        registerFunctionSpecs(db, accessor, sharedKeys, kRankFunctionsSpec);
-        registerFunctionSpecs(db, accessor, sharedKeys, kN1QLFunctionsSpec);
+        registerFunctionSpecs(db, accessor, sharedKeys, rootCache, kFleeceFunctionsSpec);
+        registerFunctionSpecs(db, accessor, sharedKeys, rootCache, kRankFunctionsSpec);
+        registerFunctionSpecs(db, accessor, sharedKeys, rootCache, kN1QLFunctionsSpec);
         RegisterFleeceEachFunctions(db, accessor, sharedKeys);
     }
 
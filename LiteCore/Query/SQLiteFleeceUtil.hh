@@ -20,6 +20,7 @@
 #include "Base.hh"
 #include "Fleece.hh"
 #include <sqlite3.h>
+#include <memory>
 
 
 namespace litecore {
@@ -33,10 +34,77 @@ namespace litecore {
         kFleeceIntUnsigned,             // Integer is unsigned
     };
 
+    // Memoizes the document root that fleeceDocRoot derives from a row's body, so that a query
+    // accessing several properties only runs the FleeceAccessor once per row. There's one per
+    // connection, shared by all its registered functions.
+    // Only calls that are given the row's sequence use it (the QueryParser passes it to fl_value
+    // in result columns), since the address of the body blob alone doesn't identify a row: SQLite
+    // reuses buffers between rows. A root is reused only for the same sequence and the same body
+    // address and size, so the buffer it points into still holds that row's body.
+    // Memoization is enabled only within a Scope, around a single step of a statement. A Scope
+    // holds the connection's mutex, the one SQLite holds while calling the functions, so that a
+    // statement stepped on another thread can't see the memo enabled by this one.
+    class DocRootCache {
+    public:
+        explicit DocRootCache(sqlite3 *db) noexcept         :_dbMutex(sqlite3_db_mutex(db)) { }
+
+        class Scope {
+        public:
+            explicit Scope(DocRootCache *cache) noexcept     :_cache(cache) {
+                if (_cache) _cache->enable();
+            }
+            ~Scope() {
+                if (_cache) _cache->disable();
+            }
+        private:
+            DocRootCache *_cache;
+        };
+
+        const fleece::Value* get(int64_t sequence, slice body) noexcept {
+            if (_enabled && _root && sequence == _sequence
+                         && body.buf == _body.buf && body.size == _body.size) {
+                ++_reused;
+                return _root;
+            }
+            return nullptr;
+        }
+
+        void set(int64_t sequence, slice body, const fleece::Value *root) noexcept {
+            if (_enabled) {
+                _sequence = sequence;
+                _body = body;
+                _root = root;
+            }
+        }
+
+        void countDerived() noexcept                        {++_derived;}
+
+        struct Stats {
+            uint64_t derived;       // Number of times a doc root was derived from a body
+            uint64_t reused;        // Number of times a memoized doc root was reused
+        };
+
+        /** Totals for all connections, for measuring the memoization in benchmarks. */
+        static Stats stats() noexcept;
+
+    private:
+        void enable() noexcept;
+        void disable() noexcept;
+
+        sqlite3_mutex* const _dbMutex;              // Connection's mutex (null if single-thread)
+        bool _enabled {false};
+        int64_t _sequence {0};                      // Sequence of the row _root came from
+        slice _body;                                // Body that _root was derived from
+        const fleece::Value *_root {nullptr};
+        uint64_t _derived {0}, _reused {0};         // Counts not yet added to the totals
+    };
+
+
     // What the user_data of a registered function points to
     struct fleeceFuncContext {
         DataFile::FleeceAccessor accessor;
         fleece::SharedKeys *sharedKeys;
+        std::shared_ptr<DocRootCache> rootCache;
     };
 
 
@@ -53,8 +121,10 @@ namespace litecore {
     }
 
     // Takes 'body' column value from arg, and returns the current revision's body as a Value*.
+    // If `sequenceArg` is given it's the row's sequence, and the root is memoized for the row.
     // On error returns nullptr (and sets the SQLite result error.)
-    const fleece::Value* fleeceDocRoot(sqlite3_context* ctx, sqlite3_value *arg) noexcept;
+    const fleece::Value* fleeceDocRoot(sqlite3_context* ctx, sqlite3_value *arg,
+                                       sqlite3_value *sequenceArg =nullptr) noexcept;
 
     // Interprets the arg, which must be a blob, as a Fleece value and returns it as a Value*.
     // On error returns nullptr (and sets the SQLite result error.)
@@ -66,10 +136,12 @@ namespace litecore {
 
     // Takes document body from arg 0 and path string from arg 1, and evaluates the path.
     // Stores result, which may be nullptr if path wasn't found, in *outValue.
+    // `sequenceArg` is passed to fleeceDocRoot.
     // Returns true on success, false on error.
     bool evaluatePathFromArgs(sqlite3_context *ctx, sqlite3_value **argv,
                             bool isDocBody,
-                            const fleece::Value* *outValue);
+                            const fleece::Value* *outValue,
+                            sqlite3_value *sequenceArg =nullptr);
 
     // Sets the function result based on a Value*
     void setResultFromValue(sqlite3_context*, const fleece::Value*) noexcept;
@@ -27,6 +27,7 @@
 #include "SQLiteCpp/SQLiteCpp.h"
 #include "Fleece.hh"
 #include <sstream>
+#include <tuple>
 
 extern "C" {
 #include "sqlite3_unicodesn_tokenizer.h"
@@ -49,21 +50,35 @@ namespace litecore {
     }
 
 
-    // Parses the JSON index-spec expression into an Array:
-    static pair<alloc_slice, const Array*> parseIndexExpr(slice expression,
-                                                          KeyStore::IndexType type)
+    // Parses the JSON index-spec expression into an Array of expressions, plus an optional
+    // WHERE expression. The spec is either an array of expressions, or a dictionary whose
+    // "WHAT" is that array and whose "WHERE" limits which records are indexed.
+    static tuple<alloc_slice, const Array*, const Value*> parseIndexExpr(slice expression,
+                                                                     KeyStore::IndexType type)
     {
         alloc_slice expressionFleece;
         const Array *params = nullptr;
+        const Value *where = nullptr;
         try {
             expressionFleece = JSONConverter::convertJSON(expression);
             auto f = Value::fromTrustedData(expressionFleece);
-            if (f)
-                params = f->asArray();
+            if (f) {
+                auto dict = f->asDict();
+                if (dict) {
+                    auto what = dict->get("WHAT"_sl);
+                    if (what)
+                        params = what->asArray();
+                    where = dict->get("WHERE"_sl);
+                } else {
+                    params = f->asArray();
+                }
+            }
         } catch (const FleeceException &) { }
         if (!params || params->count() == 0)
             error::_throw(error::InvalidQuery);
-        return {expressionFleece, params};
+        if (where && type != KeyStore::kValueIndex)
+            error::_throw(error::InvalidQuery, "Only value indexes can have a WHERE clause");
+        return make_tuple(expressionFleece, params, where);
     }
 
 
@@ -75,15 +90,19 @@ namespace litecore {
         auto indexNameStr = string(indexName);
         alloc_slice expressionFleece;
         const Array *params;
-        tie(expressionFleece, params) = parseIndexExpr(expression, type);
+        const Value *where;
+        tie(expressionFleece, params, where) = parseIndexExpr(expression, type);
 
         Transaction t(db());
         switch (type) {
-            case kValueIndex:    createValueIndex(indexNameStr, params, options); break;
+            case kValueIndex:    createValueIndex(indexNameStr, params, where, options); break;
             case kFullTextIndex: createFTSIndex(indexNameStr, params, options); break;
+            case kGeoIndex:      createGeoIndex(indexNameStr, params, options); break;
+            case kArrayIndex:    createArrayIndex(indexNameStr, params, options); break;
             default:             error::_throw(error::Unimplemented);
         }
         t.commit();
+        db().invalidateQueryCache();    // Queries may use the new index
     }
 
 
@@ -107,13 +126,15 @@ namespace litecore {
     }
 
 
-    // Creates a value index.
+    // Creates a value index. If `where` is non-null it's a partial index, of only the records
+    // that match it; SQLite will use it for queries whose WHERE clause includes the same test.
     void SQLiteKeyStore::createValueIndex(string indexName,
                                           const Array *params,
+                                          const Value *where,
                                           const IndexOptions *options)
     {
         QueryParser qp(tableName());
-        qp.writeCreateIndex(indexName, params);
+        qp.writeCreateIndex(indexName, params, where);
         _createIndex(kValueIndex, indexName, indexName, qp.SQL());
     }
 
@@ -205,13 +226,123 @@ namespace litecore {
     }
 
 
+    // Creates a geo index, an R*Tree table of the latitude and longitude of each record, kept up
+    // to date by triggers. Records whose coordinates aren't both numbers aren't indexed.
+    void SQLiteKeyStore::createGeoIndex(string indexName,
+                                        const Array *params,
+                                        const IndexOptions *options)
+    {
+        if (params->count() != 2)
+            error::_throw(error::InvalidQuery, "geo index must have latitude and longitude");
+        auto geoTableName = QueryParser(tableName()).geoTableName(indexName);
+        string lat = QueryParser::expressionSQL(params->get(0), "new.body");
+        string lon = QueryParser::expressionSQL(params->get(1), "new.body");
+
+        string insert = CONCAT("INSERT INTO \"" << geoTableName << "\" "
+                               "(id, minLat, maxLat, minLon, maxLon) "
+                               "SELECT new.rowid, " << lat << ", " << lat << ", "
+                                                    << lon << ", " << lon);
+        string where = CONCAT(" WHERE isnumber(" << lat << ") AND isnumber(" << lon << ")");
+
+        // The R*Tree table's SQL doesn't include the coordinates' expressions; the insert
+        // trigger's does. So if the existing index has different ones, replace it:
+        if (!triggerExists(geoTableName, "ins", "INSERT", insert + where))
+            _deleteIndex(indexName);
+
+        // Create the R*Tree table, but if an identical one already exists, return:
+        string sql = CONCAT("CREATE VIRTUAL TABLE \"" << geoTableName << "\" "
+                            "USING rtree(id, minLat, maxLat, minLon, maxLon)");
+        if (!_createIndex(kGeoIndex, geoTableName, indexName, sql))
+            return;
+
+        // Index the existing records:
+        db().exec(CONCAT(insert << " FROM kv_" << name() << " AS new" << where));
+
+        // Set up triggers to keep the R*Tree up to date:
+        string del = CONCAT("DELETE FROM \"" << geoTableName << "\" WHERE id = old.rowid");
+        createTrigger(geoTableName, "ins", "INSERT", insert + where);
+        createTrigger(geoTableName, "del", "DELETE", del);
+        createTrigger(geoTableName, "upd", "UPDATE OF body", del + "; " + insert + where);
+    }
+
+
+    // Creates an array index. The elements of the array property are stored in a separate table,
+    // one row per element, which is kept up to date by triggers; the index is on that table.
+    void SQLiteKeyStore::createArrayIndex(string indexName,
+                                          const Array *params,
+                                          const IndexOptions *options)
+    {
+        if (params->count() != 1)
+            error::_throw(error::InvalidQuery, "array index must have a single property");
+        auto unnestTable = QueryParser(tableName()).unnestedTableName(params->get(0));
+        string sql = CONCAT("CREATE INDEX \"" << indexName << "\" ON \"" << unnestTable
+                            << "\" (value)");
+
+        // If an identical index already exists, return:
+        {
+            SQLite::Statement check(db(), "SELECT sql FROM sqlite_master "
+                                          "WHERE name = ? AND type = 'index'");
+            check.bind(1, indexName);
+            if (check.executeStep() && check.getColumn(0).getString() == sql)
+                return;
+        }
+        _deleteIndex(indexName);
+
+        if (!db().tableExists(unnestTable)) {
+            db().exec(CONCAT("CREATE TABLE \"" << unnestTable << "\" (docid INTEGER NOT NULL, value)"));
+            db().exec(CONCAT("CREATE INDEX \"" << unnestTable << "::docid\" ON \"" << unnestTable
+                             << "\" (docid)"));
+
+            // Index the existing records:
+            string each = QueryParser::eachExpressionSQL(params->get(0), "new.body");
+            db().exec(CONCAT("INSERT INTO \"" << unnestTable << "\" (docid, value) "
+                             "SELECT new.rowid, _each.value FROM kv_" << name() << " AS new, "
+                             << each << " AS _each"));
+
+            // Set up triggers to keep the table up to date
+            string insert = CONCAT("INSERT INTO \"" << unnestTable << "\" (docid, value) "
+                                   "SELECT new.rowid, _each.value FROM " << each << " AS _each");
+            string del = CONCAT("DELETE FROM \"" << unnestTable << "\" WHERE docid = old.rowid");
+            createTrigger(unnestTable, "ins", "INSERT", insert);
+            createTrigger(unnestTable, "del", "DELETE", del);
+            createTrigger(unnestTable, "upd", "UPDATE OF body", del + "; " + insert);
+        }
+        db().exec(sql);
+    }
+
+
     void SQLiteKeyStore::_deleteIndex(slice name) {
         // Delete any expression index:
         validateIndexName(name);
         string indexName = (string)name;
+        string unnestTable;
+        {
+            SQLite::Statement getTable(db(), "SELECT tbl_name FROM sqlite_master "
+                                             "WHERE type = 'index' AND name = ?");
+            getTable.bind(1, indexName);
+            if (getTable.executeStep()) {
+                string table = getTable.getColumn(0).getString();
+                if (hasPrefix(table, tableName() + ":unnest:"))
+                    unnestTable = table;
+            }
+        }
         db().exec(CONCAT("DROP INDEX IF EXISTS \"" << indexName << "\""));
 
-        // Delete any FTS index:
+        // Delete an array index's table once no index uses it:
+        if (!unnestTable.empty()) {
+            SQLite::Statement others(db(), "SELECT count(*) FROM sqlite_master "
+                                           "WHERE type = 'index' AND tbl_name = ? AND name != ?");
+            others.bind(1, unnestTable);
+            others.bind(2, unnestTable + "::docid");
+            if (others.executeStep() && others.getColumn(0).getInt() == 0) {
+                db().exec(CONCAT("DROP TABLE IF EXISTS \"" << unnestTable << "\""));
+                dropTrigger(unnestTable, "ins");
+                dropTrigger(unnestTable, "upd");
+                dropTrigger(unnestTable, "del");
+            }
+        }
+
+        // Delete any FTS or geo index:
         QueryParser qp(tableName());
         auto ftsTableName = qp.FTSTableName(indexName);
         db().exec(CONCAT("DROP TABLE IF EXISTS \"" << ftsTableName << "\""));
@@ -225,6 +356,7 @@ namespace litecore {
         Transaction t(db());
         _deleteIndex(name);
         t.commit();
+        db().invalidateQueryCache();    // Queries may use the deleted index
     }
 
 
@@ -242,7 +374,8 @@ namespace litecore {
 
         SQLite::Statement getFTS(db(), "SELECT name FROM sqlite_master WHERE type='table' "
                                             "AND name like ? || '::%' "
-                                            "AND sql LIKE 'CREATE VIRTUAL TABLE % USING fts%'");
+                                            "AND (sql LIKE 'CREATE VIRTUAL TABLE % USING fts%' "
+                                            "OR sql LIKE 'CREATE VIRTUAL TABLE % USING rtree%')");
         getFTS.bind(1, tableNameStr);
         while(getFTS.executeStep()) {
             string ftsName = getFTS.getColumn(0).getString();
@@ -250,11 +383,35 @@ namespace litecore {
             enc.writeString(ftsName);
         }
 
+        SQLite::Statement getArray(db(), "SELECT name FROM sqlite_master WHERE type='index' "
+                                            "AND tbl_name like ? || ':unnest:%' "
+                                            "AND name NOT LIKE '%::docid'");
+        getArray.bind(1, tableNameStr);
+        while(getArray.executeStep()) {
+            enc.writeString(getArray.getColumn(0).getString());
+        }
+
         enc.endArray();
         return enc.extractOutput();
     }
 
 
+    // The tables of array indexes on this KeyStore.
+    set<string> SQLiteKeyStore::unnestedTables() const {
+        set<string> tables;
+        string prefix = tableName() + ":unnest:";
+        SQLite::Statement getTables(db(), "SELECT name FROM sqlite_master WHERE type='table' "
+                                             "AND name like ? || '%'");
+        getTables.bind(1, prefix);
+        while(getTables.executeStep()) {
+            string table = getTables.getColumn(0).getString();
+            if (hasPrefix(table, prefix))
+                tables.insert(table);
+        }
+        return tables;
+    }
+
+
     void SQLiteKeyStore::createSequenceIndex() {
         if (!_createdSeqIndex) {
             Assert(_capabilities.sequences);
@@ -26,7 +26,10 @@
 #include "function_ref.hh"
 #include <regex>
 #include <cmath>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 
 #ifdef _MSC_VER
 #undef min
@@ -638,20 +641,93 @@ namespace litecore {
 #pragma mark - REGULAR EXPRESSIONS:
 
 
+    // The regex engine; everything below goes through this alias, so it can be swapped for
+    // another engine with a compatible search API.
+    using Regex = std::regex;
+
+    static constexpr size_t kMaxCachedRegexes = 64;
+
+
+    // Compiles a pattern, using a process-wide cache so that a pattern that varies between rows
+    // (i.e. isn't a constant in the query) isn't recompiled for every row that repeats it.
+    // When the cache fills up it's simply cleared; patterns that are actually constant never get
+    // here more than once per statement, since they're cached as auxdata.
+    static shared_ptr<const Regex> compileRegex(slice pattern) {
+        static mutex sMutex;
+        static unordered_map<string, shared_ptr<const Regex>> sCache;
+
+        string key = pattern.asString();
+        {
+            lock_guard<mutex> lock(sMutex);
+            auto i = sCache.find(key);
+            if (i != sCache.end())
+                return i->second;
+        }
+        shared_ptr<const Regex> r = make_shared<Regex>(key);     // may throw regex_error
+        lock_guard<mutex> lock(sMutex);
+        if (sCache.size() >= kMaxCachedRegexes)
+            sCache.clear();
+        sCache.emplace(key, r);
+        return r;
+    }
+
+
+    // Returns the compiled regex for the pattern in argv[1]. If the pattern is a constant, SQLite
+    // keeps the compiled form as auxdata for the life of the statement. Returns nullptr (after
+    // setting the function's result) if the pattern is NULL/non-string or invalid.
+    static shared_ptr<const Regex> regexArgument(sqlite3_context* ctx,
+                                                 sqlite3_value **argv) noexcept
+    {
+        auto cached = (shared_ptr<const Regex>*)sqlite3_get_auxdata(ctx, 1);
+        if (cached)
+            return *cached;
+        slice pattern = stringArgument(argv[1]);
+        if (!pattern.buf) {
+            sqlite3_result_null(ctx);
+            return nullptr;
+        }
+        try {
+            auto r = compileRegex(pattern);
+            sqlite3_set_auxdata(ctx, 1, new shared_ptr<const Regex>(r), [](void *auxdata) {
+                delete (shared_ptr<const Regex>*)auxdata;
+            });
+            return r;
+        } catch (const regex_error&) {
+            string msg = "invalid regular expression: " + pattern.asString();
+            sqlite3_result_error(ctx, msg.c_str(), -1);
+        } catch (const bad_alloc&) {
+            sqlite3_result_error_nomem(ctx);
+        }
+        return nullptr;
+    }
+
+
     static void regexp_like(sqlite3_context* ctx, int argc, sqlite3_value **argv) noexcept {
         auto arg0 = stringArgument(argv[0]);
-        auto arg1 = stringArgument(argv[1]);
-        regex r((char *)arg1.buf);
-        int result = regex_search((char *)arg0.buf, r) ? 1 : 0;
+        auto r = regexArgument(ctx, argv);
+        if (!r)
+            return;
+        if (!arg0.buf) {
+            sqlite3_result_null(ctx);
+            return;
+        }
+        auto begin = (const char*)arg0.buf;
+        int result = regex_search(begin, begin + arg0.size, *r) ? 1 : 0;
         sqlite3_result_int(ctx, result);
     }
 
     static void regexp_position(sqlite3_context* ctx, int argc, sqlite3_value **argv) noexcept {
         auto arg0 = stringArgument(argv[0]);
-        auto arg1 = stringArgument(argv[1]);
-        regex r((char *)arg1.buf);
+        auto r = regexArgument(ctx, argv);
+        if (!r)
+            return;
+        if (!arg0.buf) {
+            sqlite3_result_null(ctx);
+            return;
+        }
+        auto begin = (const char*)arg0.buf;
         cmatch pattern_match;
-        if(!regex_search((char *)arg0.buf, pattern_match, r)) {
+        if(!regex_search(begin, begin + arg0.size, pattern_match, *r)) {
             sqlite3_result_int64(ctx, -1);
             return;
         }
@@ -660,8 +736,10 @@ namespace litecore {
     }
 
     static void regexp_replace(sqlite3_context* ctx, int argc, sqlite3_value **argv) noexcept {
+        auto r = regexArgument(ctx, argv);
+        if (!r)
+            return;
         auto expression = stringArgument(argv[0]).asString();
-        auto pattern = stringArgument(argv[1]);
         auto repl = stringArgument(argv[2]).asString();
         string result;
         auto out = back_inserter(result);
@@ -670,8 +748,7 @@ namespace litecore {
             n = sqlite3_value_int(argv[3]);
         }
 
-        regex r((char *)pattern.buf);
-        auto iter = sregex_iterator(expression.begin(), expression.end(), r);
+        auto iter = sregex_iterator(expression.begin(), expression.end(), *r);
         auto last_iter = iter;
         auto stop = sregex_iterator();
         if(iter == stop) {
@@ -792,6 +869,53 @@ namespace litecore {
     }
 
 
+#pragma mark - GEOSPATIAL:
+
+
+    static constexpr double kEarthRadiusMeters = 6371008.8;     // Mean radius
+    static constexpr double kMetersPerDegree = kEarthRadiusMeters * M_PI / 180;
+
+    // geo_distance(lat1, lon1, lat2, lon2) returns the great-circle distance in meters between
+    // two points given in degrees, using the haversine formula.
+    static void geo_distance(sqlite3_context* ctx, int argc, sqlite3_value **argv) {
+        for (int i = 0; i < 4; ++i) {
+            if (!isNumeric(ctx, argv[i]))
+                return;
+        }
+        double lat1 = sqlite3_value_double(argv[0]) * M_PI / 180;
+        double lon1 = sqlite3_value_double(argv[1]) * M_PI / 180;
+        double lat2 = sqlite3_value_double(argv[2]) * M_PI / 180;
+        double lon2 = sqlite3_value_double(argv[3]) * M_PI / 180;
+        double sinLat = sin((lat2 - lat1) / 2), sinLon = sin((lon2 - lon1) / 2);
+        double a = sinLat * sinLat + cos(lat1) * cos(lat2) * sinLon * sinLon;
+        sqlite3_result_double(ctx, 2 * kEarthRadiusMeters * asin(min(1.0, sqrt(a))));
+    }
+
+    // geo_lat_span(meters) returns the number of degrees of latitude spanned by `meters`.
+    static void geo_lat_span(sqlite3_context* ctx, int argc, sqlite3_value **argv) {
+        if (isNumeric(ctx, argv[0]))
+            sqlite3_result_double(ctx, sqlite3_value_double(argv[0]) / kMetersPerDegree);
+    }
+
+    // geo_lon_span(lat, meters) returns the number of degrees of longitude spanned by `meters`
+    // anywhere within `meters` of latitude `lat`. Degrees of longitude are shortest at the
+    // latitude furthest from the equator, so that's where it's computed. Near the poles this is
+    // the entire 360 degrees.
+    static void geo_lon_span(sqlite3_context* ctx, int argc, sqlite3_value **argv) {
+        if (!isNumeric(ctx, argv[0]) || !isNumeric(ctx, argv[1]))
+            return;
+        double meters = sqlite3_value_double(argv[1]);
+        double lat = fabs(sqlite3_value_double(argv[0])) + meters / kMetersPerDegree;
+        double span = 360;
+        if (lat < 90) {
+            double c = cos(lat * M_PI / 180);
+            if (c > 1e-9)
+                span = min(span, meters / (kMetersPerDegree * c));
+        }
+        sqlite3_result_double(ctx, span);
+    }
+
+
 #pragma mark - TYPE TESTS & CONVERSIONS:
 
 
@@ -1218,6 +1342,10 @@ namespace litecore {
         { "tan",               1, fl_tan },
         { "trunc",             1, fl_trunc },
         { "trunc",             2, fl_trunc },
+
+        { "geo_distance",      4, geo_distance },
+        { "geo_lat_span",      1, geo_lat_span },
+        { "geo_lon_span",      2, geo_lon_span },
         { }
     };
 
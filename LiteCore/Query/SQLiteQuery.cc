@@ -19,6 +19,7 @@
 #include "SQLiteKeyStore.hh"
 #include "SQLiteDataFile.hh"
 #include "SQLite_Internal.hh"
+#include "SQLiteFleeceUtil.hh"
 #include "Logging.hh"
 #include "Query.hh"
 #include "QueryParser.hh"
@@ -31,6 +32,10 @@
 #include <sqlite3.h>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 
 using namespace std;
 using namespace fleece;
@@ -38,6 +43,7 @@ using namespace fleece;
 namespace litecore {
 
     class SQLiteQueryEnumerator;
+    class SQLiteStreamingQueryEnumerator;
 
 
     // Implicit columns in full-text query result:
@@ -46,15 +52,23 @@ namespace litecore {
         kFTSOffsetsCol
     };
 
+    // SQL parameter that a live query binds the docID of a changed document to:
+    static const char* const kDocIDParam = ":docID";
+
+    // Maximum number of idle compiled statements a query keeps for reuse:
+    static const size_t kMaxIdleStatements = 4;
+
 
     class SQLiteQuery : public Query, Logging {
     public:
         SQLiteQuery(SQLiteKeyStore &keyStore, slice selectorExpression)
         :Query(keyStore)
         ,Logging(QueryLog)
+        ,_expression(selectorExpression)
         {
             log("Compiling JSON query: %.*s", SPLAT(selectorExpression));
             QueryParser qp(keyStore.tableName());
+            qp.setUnnestedTables(keyStore.unnestedTables());
             qp.parseJSON(selectorExpression);
 
             _parameters = qp.parameters();
@@ -70,11 +84,16 @@ namespace litecore {
                 if (!keyStore.db().tableExists(ftsTable))
                     error::_throw(error::NoSuchIndex, "'match' test requires a full-text index");
             }
+            for (auto &geoTable : qp.geoTablesUsed()) {
+                if (!keyStore.db().tableExists(geoTable))
+                    error::_throw(error::NoSuchIndex, "geo test requires a geo index");
+            }
 
-            string sql = qp.SQL();
-            log("Compiled as %s", sql.c_str());
-            LogTo(SQL, "Compiled {Query#%u}: %s", _objectRef, sql.c_str());
-            _statement.reset(keyStore.compile(sql));
+            _sql = qp.SQL();
+            log("Compiled as %s", _sql.c_str());
+            LogTo(SQL, "Compiled {Query#%u}: %s", _objectRef, _sql.c_str());
+            _statement.reset(keyStore.compile(_sql));
+            _idleStatements.push_back(_statement);
             
             _1stCustomResultColumn = qp.firstCustomResultColumn();
             _isAggregate = qp.isAggregateQuery();
@@ -85,6 +104,10 @@ namespace litecore {
             return keyStore().lastSequence();
         }
 
+        SQLiteDataFile& dataFile() const {
+            return (SQLiteDataFile&)keyStore().dataFile();
+        }
+
 
         alloc_slice getMatchedText(const FullTextTerm &term) override {
             // Get the expression that generated the text
@@ -92,6 +115,9 @@ namespace litecore {
                 error::_throw(error::NoSuchIndex);
             string expr = _ftsTables[0];    // TODO: Support for multiple matches in a query
 
+            // A cached query may be shared by several threads, so the statement is created and
+            // used under a lock:
+            lock_guard<mutex> lock(_matchedTextMutex);
             if (!_matchedTextStatement) {
                 auto &df = (SQLiteDataFile&) keyStore().dataFile();
                 string sql = "SELECT * FROM \"" + expr + "\" WHERE docid=?";
@@ -133,23 +159,56 @@ namespace litecore {
 
         virtual QueryEnumerator* createEnumerator(const Options *options) override;
         SQLiteQueryEnumerator* createEnumerator(const Options *options, sequence_t lastSeq);
+        SQLiteStreamingQueryEnumerator* createStreamingEnumerator(const Options *options,
+                                                                  sequence_t lastSeq);
+
+        virtual LiveQuery* createLiveQuery(const Options *options) override;
 
         unsigned objectRef() const                  {return _objectRef;}
+        slice expression() const                    {return _expression;}
 
         set<string> _parameters;
         vector<string> _ftsTables;
         unsigned _1stCustomResultColumn;
         bool _isAggregate;
 
-        shared_ptr<SQLite::Statement> statement() {return _statement;}
+        // Each running enumerator checks out its own compiled statement, so that the query can be
+        // run by several enumerators (and threads) at once. Returns an idle statement, or
+        // compiles a new one if all are in use.
+        // If the enumerator has borrowed a pooled reader connection, the statement comes from
+        // that reader's cache instead, and isn't returned to this pool.
+        shared_ptr<SQLite::Statement> checkOutStatement(SQLiteDataFile::Reader *reader) {
+            if (reader)
+                return reader->compile(_sql);
+            lock_guard<mutex> lock(_poolMutex);
+            if (!_idleStatements.empty()) {
+                auto statement = move(_idleStatements.back());
+                _idleStatements.pop_back();
+                return statement;
+            }
+            logVerbose("All statements are in use; compiling another");
+            return shared_ptr<SQLite::Statement>(((SQLiteKeyStore&)keyStore()).compile(_sql));
+        }
+
+        // Puts a statement (which must have been reset) back in the pool.
+        void returnStatement(shared_ptr<SQLite::Statement> statement) {
+            lock_guard<mutex> lock(_poolMutex);
+            if (_idleStatements.size() < kMaxIdleStatements)
+                _idleStatements.push_back(move(statement));
+        }
 
     protected:
         ~SQLiteQuery() =default;
         string loggingClassName() const override    {return "Query";}
 
     private:
-        shared_ptr<SQLite::Statement> _statement;
-        unique_ptr<SQLite::Statement> _matchedTextStatement;
+        alloc_slice _expression;
+        string _sql;
+        shared_ptr<SQLite::Statement> _statement;               // The first statement compiled
+        vector<shared_ptr<SQLite::Statement>> _idleStatements;  // Statements not in use
+        mutex _poolMutex;
+        unique_ptr<SQLite::Statement> _matchedTextStatement;    // Guarded by _matchedTextMutex
+        mutex _matchedTextMutex;
     };
 
 
@@ -170,6 +229,25 @@ namespace litecore {
         }
 
     protected:
+        // Parses the FTS offsets column of a row into a list of FullTextTerms.
+        static void parseFullTextTerms(const Array *row, QueryEnumerator::FullTextTerms &terms) {
+            terms.clear();
+            uint64_t dataSource = row->get(kFTSRowidCol)->asInt();
+            // The offsets() function returns a string of space-separated numbers in groups of 4.
+            string offsets = row->get(kFTSOffsetsCol)->asString().asString();
+            const char *termStr = offsets.c_str();
+            while (*termStr) {
+                uint32_t n[4];
+                for (int i = 0; i < 4; ++i) {
+                    char *next;
+                    n[i] = (uint32_t)strtol(termStr, &next, 10);
+                    termStr = next;
+                }
+                terms.push_back({dataSource, n[0], n[1], n[2], n[3]});
+                // {rowid, key #, term #, byte offset, byte length}
+            }
+        }
+
         Retained<SQLiteQuery> _query;
         Query::Options _options;
         sequence_t _lastSequence;       // DB's lastSequence at the time the query ran
@@ -265,21 +343,7 @@ namespace litecore {
         }
 
         const FullTextTerms& fullTextTerms() override {
-            _fullTextTerms.clear();
-            uint64_t dataSource = _iter->asArray()->get(kFTSRowidCol)->asInt();
-            // The offsets() function returns a string of space-separated numbers in groups of 4.
-            string offsets = _iter->asArray()->get(kFTSOffsetsCol)->asString().asString();
-            const char *termStr = offsets.c_str();
-            while (*termStr) {
-                uint32_t n[4];
-                for (int i = 0; i < 4; ++i) {
-                    char *next;
-                    n[i] = (uint32_t)strtol(termStr, &next, 10);
-                    termStr = next;
-                }
-                _fullTextTerms.push_back({dataSource, n[0], n[1], n[2], n[3]});
-                // {rowid, key #, term #, byte offset, byte length}
-            }
+            parseFullTextTerms(_iter->asArray(), _fullTextTerms);
             return _fullTextTerms;
         }
 
@@ -299,9 +363,14 @@ namespace litecore {
     // which is then used as the data source of a SQLiteQueryEnum.
     class SQLiteQueryRunner : public SQLiteQueryEnumBase {
     public:
-        SQLiteQueryRunner(SQLiteQuery *query, const Query::Options *options, sequence_t lastSequence)
+        SQLiteQueryRunner(SQLiteQuery *query, const Query::Options *options, sequence_t lastSequence,
+                          shared_ptr<SQLite::Statement> statement =nullptr,
+                          SQLiteDataFile::ReaderRef reader =nullptr)
         :SQLiteQueryEnumBase(query, options, lastSequence)
-        ,_statement(query->statement())
+        ,_reader(reader)
+        ,_statement(statement ? statement : query->checkOutStatement(reader.get()))
+        ,_pooled(!statement && !reader)
+        ,_rootCache(reader ? reader->docRootCache() : query->dataFile().docRootCache())
         {
             _statement->clearBindings();
             _unboundParameters = _query->_parameters;
@@ -322,6 +391,8 @@ namespace litecore {
             try {
                 _statement->reset();
             } catch (...) { }
+            if (_pooled)
+                _query->returnStatement(move(_statement));
         }
 
         void bindParameters(slice json) {
@@ -367,6 +438,16 @@ namespace litecore {
             }
         }
 
+        bool step() {
+            DocRootCache::Scope scope(_rootCache.get());
+            return _statement->executeStep();
+        }
+
+        slice textColumn(int i) {
+            SQLite::Column col = _statement->getColumn(i);
+            return slice(col.getText(), (size_t)col.getBytes());
+        }
+
         bool encodeColumn(Encoder &enc, int i) {
             SQLite::Column col = _statement->getColumn(i);
             switch (col.getType()) {
@@ -397,25 +478,35 @@ namespace litecore {
             return true;
         }
 
+        // Writes the current row (starting at column `firstCol`) as a Fleece array, and returns a
+        // bit-map of which columns are missing/undefined.
+        uint64_t encodeRow(Encoder &enc, int firstCol =0) {
+            int nCols = _statement->getColumnCount();
+            uint64_t missingCols = 0;
+            enc.beginArray(nCols - firstCol);
+            for (int i = firstCol; i < nCols; ++i) {
+                if (!encodeColumn(enc, i) && i - firstCol < 64)
+                    missingCols |= (1 << (i - firstCol));
+            }
+            enc.endArray();
+            return missingCols;
+        }
+
         // Collects all the (remaining) rows into a Fleece array of arrays,
         // and returns an enumerator impl that will replay them.
-        SQLiteQueryEnumerator* fastForward() {
+        // If `includeCurrentRow` is true, the row the statement is already on is recorded first.
+        SQLiteQueryEnumerator* fastForward(bool includeCurrentRow =false) {
             Stopwatch st;
-            int nCols = _statement->getColumnCount();
             uint64_t rowCount = 0;
             Encoder enc;
             enc.beginArray();
-            while (_statement->executeStep()) {
-                uint64_t missingCols = 0;
-                enc.beginArray(nCols);
-                for (int i = 0; i < nCols; ++i) {
-                    if (!encodeColumn(enc, i) && i < 64)
-                        missingCols |= (1 << i);
-                }
-                enc.endArray();
+            bool haveRow = includeCurrentRow || step();
+            while (haveRow) {
+                uint64_t missingCols = encodeRow(enc);
                 // Add an integer containing a bit-map of which columns are missing/undefined:
                 enc.writeUInt(missingCols);
                 ++rowCount;
+                haveRow = step();
             }
             enc.endArray();
             alloc_slice recording = enc.extractOutput();
@@ -424,15 +515,480 @@ namespace litecore {
         }
 
     private:
+        SQLiteDataFile::ReaderRef _reader;      // Connection _statement runs on, if not the main one
         shared_ptr<SQLite::Statement> _statement;
+        bool _pooled;                           // Was _statement checked out from the query?
+        shared_ptr<DocRootCache> _rootCache;    // Memo of doc roots on _statement's connection
         set<string> _unboundParameters;
     };
 
 
 
+    // Query enumerator that reads rows lazily from a live SQLite statement, encoding only the
+    // current row into Fleece. The statement keeps the connection's read snapshot open until
+    // it reaches the end or the enumerator is closed.
+    // Random access (seek, getRowCount) records the remaining rows into a SQLiteQueryEnumerator,
+    // which then takes over; rows that were already read can't be revisited.
+    class SQLiteStreamingQueryEnumerator : public QueryEnumerator, SQLiteQueryEnumBase, Logging {
+    public:
+        SQLiteStreamingQueryEnumerator(SQLiteQuery *query,
+                                       const Query::Options *options,
+                                       sequence_t lastSequence,
+                                       unique_ptr<SQLiteQueryRunner> runner)
+        :SQLiteQueryEnumBase(query, options, lastSequence)
+        ,Logging(QueryLog)
+        ,_runner(move(runner))
+        {
+            // Step to the first row while the caller's read-only transaction is still open, so
+            // the active statement holds on to the same snapshot that lastSequence came from.
+            _rowPending = _runner->step();
+            if (!_rowPending)
+                _runner.reset();
+            log("Created streaming enumerator on {Query#%u}", query->objectRef());
+        }
+
+        ~SQLiteStreamingQueryEnumerator() {
+            close();
+            log("Deleted");
+        }
+
+        virtual int64_t getRowCount() const override {
+            const_cast<SQLiteStreamingQueryEnumerator*>(this)->record();
+            return (int64_t)_recordedBase + (_recorded ? _recorded->getRowCount() : 0);
+        }
+
+        virtual void seek(uint64_t rowIndex) override {
+            record();
+            if (rowIndex < _recordedBase)
+                error::_throw(error::UnsupportedOperation,
+                              "Streaming query enumerator can't seek back to a row already read");
+            if (!_recorded)
+                error::_throw(error::InvalidParameter);
+            _recorded->seek(rowIndex - _recordedBase);
+            _onRecordedRow = true;
+        }
+
+        bool next() override {
+            if (_recorded) {
+                _onRecordedRow = true;
+                return _recorded->next();
+            }
+            if (!_runner)
+                return false;
+            if (_rowPending) {
+                _rowPending = false;
+            } else if (!_runner->step()) {
+                logVerbose("END");
+                releaseStatement();
+                _row = nullptr;
+                return false;
+            }
+            readRow();
+            return true;
+        }
+
+        Array::iterator columns() const noexcept override {
+            if (_onRecordedRow)
+                return _recorded->columns();
+            Array::iterator i(_row);
+            i += _query->_1stCustomResultColumn;
+            return i;
+        }
+
+        uint64_t missingColumns() const noexcept override {
+            if (_onRecordedRow)
+                return _recorded->missingColumns();
+            return _missingColumns;
+        }
+
+        QueryEnumerator* refresh() override {
+            // While my statement is active it pins the connection's read snapshot, so record the
+            // remaining rows first, to let the new query see the current state of the database.
+            record();
+            // Rows already read weren't kept, so there's nothing to compare the new results to;
+            // any change to the database produces a new enumerator.
+            return _query->createStreamingEnumerator(&_options, _lastSequence);
+        }
+
+        bool hasFullText() const override {
+            return !_query->_ftsTables.empty();
+        }
+
+        const FullTextTerms& fullTextTerms() override {
+            if (_onRecordedRow)
+                return _recorded->fullTextTerms();
+            parseFullTextTerms(_row, _fullTextTerms);
+            return _fullTextTerms;
+        }
+
+        void close() noexcept override {
+            releaseStatement();
+            _recorded.reset();
+            _onRecordedRow = false;
+            _rowPending = false;
+            _row = nullptr;
+        }
+
+    protected:
+        string loggingClassName() const override    {return "QueryEnum";}
+
+    private:
+        // Encodes the statement's current row, replacing the previous one.
+        void readRow() {
+            _missingColumns = _runner->encodeRow(_encoder);
+            _rowData = _encoder.extractOutput();
+            _encoder.reset();
+            _row = Value::fromTrustedData(_rowData)->asArray();
+            ++_rowsRead;
+            if (willLog(LogLevel::Verbose)) {
+                SharedKeys* sharedKeys = _query->keyStore().dataFile().documentKeys();
+                alloc_slice json = _row->toJSON(sharedKeys);
+                logVerbose("--> %.*s", SPLAT(json));
+            }
+        }
+
+        // Records all the rows not yet read into Fleece, and releases the statement.
+        // The current row remains valid until the next call to next() or seek().
+        void record() {
+            if (_recorded)
+                return;
+            _recordedBase = _rowsRead;
+            if (!_runner)
+                return;
+            _recorded.reset(_runner->fastForward(_rowPending));
+            _rowPending = false;
+            releaseStatement();
+        }
+
+        // Resets the statement, ending its read snapshot, and lets the query reuse it.
+        void releaseStatement() noexcept {
+            _runner.reset();
+        }
+
+        unique_ptr<SQLiteQueryRunner> _runner;              // Live statement, or null when done
+        unique_ptr<SQLiteQueryEnumerator> _recorded;        // Recording of rows after _recordedBase
+        uint64_t _recordedBase {0};                         // Row index of 1st recorded row
+        uint64_t _rowsRead {0};                             // Number of rows streamed so far
+        Encoder _encoder;
+        alloc_slice _rowData;                               // Encoded current row
+        const Array* _row {nullptr};
+        uint64_t _missingColumns {0};
+        bool _rowPending {false};                           // Statement is on an unread row
+        bool _onRecordedRow {false};                        // Current row comes from _recorded
+    };
+
+
+
+#pragma mark - LIVE QUERY:
+
+
+    // Keeps a query's results in memory, each row tagged with the docID it came from, and updates
+    // them when documents change:
+    // - Simple queries are patched by re-running them on just the changed documents;
+    // - Queries with ORDER_BY or LIMIT are checked the same way, but are re-run (once) if any
+    //   changed document was in the results or now matches;
+    // - Aggregate, JOIN, OFFSET and full-text queries are re-run after every change, and their
+    //   rows are identified by their contents instead of by docID.
+    class SQLiteLiveQuery : public LiveQuery, Logging {
+    public:
+        SQLiteLiveQuery(SQLiteQuery *query, const Query::Options *options)
+        :Logging(QueryLog)
+        ,_query(query)
+        {
+            if (options)
+                _options = *options;
+            _options.streaming = false;
+
+            auto &keyStore = (SQLiteKeyStore&)query->keyStore();
+            auto unnestedTables = keyStore.unnestedTables();
+            QueryParser qp(keyStore.tableName());
+            qp.setUnnestedTables(unnestedTables);
+            qp.setBaseResultColumns({"key"});
+            qp.parseJSON(query->expression());
+            if (qp.isAggregateQuery() || qp.isJoin() || qp.hasOffset()
+                                      || !qp.ftsTablesUsed().empty()) {
+                _mode = kRerun;
+            } else {
+                _mode = (qp.hasOrderBy() || qp.hasLimit()) ? kRerunIfAffected : kPatch;
+                _allStatement.reset(keyStore.compile(qp.SQL()));
+
+                QueryParser docQP(keyStore.tableName());
+                docQP.setUnnestedTables(unnestedTables);
+                docQP.setBaseResultColumns({"key"});
+                docQP.setDocIDFilter(kDocIDParam);
+                docQP.parseJSON(query->expression());
+                _docStatement.reset(keyStore.compile(docQP.SQL()));
+            }
+
+            ReadOnlyTransaction t(keyStore.dataFile());
+            _lastSequence = _query->lastSequence();
+            _rows = runAll();
+            log("Created on {Query#%u} with %zu rows; update mode %d",
+                query->objectRef(), _rows.size(), _mode);
+        }
+
+        ~SQLiteLiveQuery() {
+            log("Deleted");
+        }
+
+        bool update(const vector<alloc_slice> &changedDocIDs,
+                    vector<RowChange> &changes) override
+        {
+            Stopwatch st;
+            ReadOnlyTransaction t(_query->keyStore().dataFile());
+            sequence_t curSeq = _query->lastSequence();
+            vector<Row> newRows;
+            if (_mode == kRerun) {
+                newRows = runAll();
+            } else if (!patch(changedDocIDs, newRows)) {
+                logVerbose("%zu changed docs don't affect results", changedDocIDs.size());
+                _lastSequence = curSeq;
+                return false;
+            } else if (_mode == kRerunIfAffected) {
+                newRows = runAll();
+            }
+            auto n = changes.size();
+            diff(_rows, newRows, changes);
+            _rows = move(newRows);
+            _lastSequence = curSeq;
+            log("Updated after %zu changed docs: %zu row changes, %zu rows (%.3fms)",
+                changedDocIDs.size(), changes.size() - n, _rows.size(), st.elapsed()*1000);
+            return changes.size() > n;
+        }
+
+        uint64_t rowCount() const override {
+            return _rows.size();
+        }
+
+        QueryEnumerator* createEnumerator() override {
+            Stopwatch st;
+            Encoder enc;
+            enc.beginArray(2 * _rows.size());
+            for (auto &row : _rows) {
+                enc.writeValue(Value::fromTrustedData(row.data));
+                enc.writeUInt(row.missingColumns);
+            }
+            enc.endArray();
+            return new SQLiteQueryEnumerator(_query, &_options, _lastSequence, enc.extractOutput(),
+                                             _rows.size(), st.elapsed());
+        }
+
+    protected:
+        string loggingClassName() const override    {return "LiveQuery";}
+
+    private:
+        enum Mode {kPatch, kRerunIfAffected, kRerun};
+
+        struct Row {
+            alloc_slice docID;              // Null if rows are identified by their contents
+            alloc_slice data;               // Fleece array of column values
+            uint64_t missingColumns {0};
+
+            slice key() const               {return docID.buf ? slice(docID) : slice(data);}
+        };
+
+        // Runs the entire query.
+        vector<Row> runAll() {
+            SQLiteQueryRunner runner(_query, &_options, _lastSequence, _allStatement);
+            vector<Row> rows;
+            while (runner.step())
+                rows.push_back(readRow(runner));
+            return rows;
+        }
+
+        // Reads the current row. Column 0 of _allStatement and _docStatement is the docID.
+        Row readRow(SQLiteQueryRunner &runner) {
+            Row row;
+            int firstCol = 0;
+            if (_mode != kRerun) {
+                row.docID = alloc_slice(runner.textColumn(0));
+                firstCol = 1;
+            }
+            Encoder enc;
+            row.missingColumns = runner.encodeRow(enc, firstCol);
+            row.data = enc.extractOutput();
+            return row;
+        }
+
+        // Re-runs the query on each changed document. Returns false if none of them were or are
+        // in the results. Otherwise, in kPatch mode, stores the patched results in `newRows`.
+        bool patch(const vector<alloc_slice> &changedDocIDs, vector<Row> &newRows) {
+            unordered_map<slice, size_t, fleece::sliceHash> oldIndex;
+            for (size_t i = 0; i < _rows.size(); ++i)
+                oldIndex[_rows[i].docID] = i;
+
+            bool affected = false;
+            vector<bool> removed(_rows.size(), false);
+            vector<Row> added;
+            if (_mode == kPatch)
+                newRows = _rows;
+            unordered_set<slice, fleece::sliceHash> seen;
+            SQLiteQueryRunner runner(_query, &_options, _lastSequence, _docStatement);
+            for (auto &docID : changedDocIDs) {
+                if (!seen.insert(docID).second)
+                    continue;
+                _docStatement->bindNoCopy(kDocIDParam, (const char*)docID.buf, (int)docID.size);
+                bool matches = runner.step();
+                Row row;
+                if (matches)
+                    row = readRow(runner);
+                _docStatement->reset();
+
+                auto i = oldIndex.find(docID);
+                if (!matches && i == oldIndex.end())
+                    continue;
+                affected = true;
+                if (_mode != kPatch)
+                    break;
+                if (i == oldIndex.end())
+                    added.push_back(move(row));
+                else if (matches)
+                    newRows[i->second] = move(row);
+                else
+                    removed[i->second] = true;
+            }
+
+            if (affected && _mode == kPatch) {
+                // Rows of a query without ORDER_BY have no defined order, so new ones go at the end:
+                size_t dst = 0;
+                for (size_t src = 0; src < newRows.size(); ++src) {
+                    if (!removed[src])
+                        newRows[dst++] = move(newRows[src]);
+                }
+                newRows.resize(dst);
+                for (auto &row : added)
+                    newRows.push_back(move(row));
+            }
+            return affected;
+        }
+
+        // Appends the differences between two sets of results to `changes`. Rows are matched
+        // up by their keys; of the matched rows, those not in the longest subsequence that kept
+        // its relative order are reported as moved.
+        static void diff(const vector<Row> &oldRows, const vector<Row> &newRows,
+                         vector<RowChange> &changes)
+        {
+            // Match each new row with an old row having the same key, in order:
+            unordered_map<slice, vector<size_t>, fleece::sliceHash> oldByKey;
+            for (size_t i = oldRows.size(); i-- > 0; )
+                oldByKey[oldRows[i].key()].push_back(i);
+            vector<int64_t> newToOld(newRows.size(), -1);
+            vector<bool> oldMatched(oldRows.size(), false);
+            vector<size_t> matched;                 // Indexes of matched new rows
+            for (size_t j = 0; j < newRows.size(); ++j) {
+                auto i = oldByKey.find(newRows[j].key());
+                if (i != oldByKey.end() && !i->second.empty()) {
+                    newToOld[j] = i->second.back();
+                    i->second.pop_back();
+                    oldMatched[newToOld[j]] = true;
+                    matched.push_back(j);
+                }
+            }
+
+            for (size_t i = 0; i < oldRows.size(); ++i) {
+                if (!oldMatched[i])
+                    changes.push_back({RowChange::kRemoved, (int64_t)i, -1});
+            }
+
+            // Longest increasing subsequence of the matched rows' old indexes:
+            vector<size_t> tails;                   // Index in `matched` of each run's last item
+            vector<int64_t> prev(matched.size(), -1);
+            for (size_t m = 0; m < matched.size(); ++m) {
+                int64_t oldIdx = newToOld[matched[m]];
+                auto pos = lower_bound(tails.begin(), tails.end(), oldIdx,
+                                       [&](size_t t, int64_t value) {
+                                           return newToOld[matched[t]] < value;
+                                       });
+                if (pos != tails.begin())
+                    prev[m] = *(pos - 1);
+                if (pos == tails.end())
+                    tails.push_back(m);
+                else
+                    *pos = m;
+            }
+            vector<bool> inOrder(matched.size(), false);
+            for (int64_t m = tails.empty() ? -1 : (int64_t)tails.back(); m >= 0; m = prev[m])
+                inOrder[m] = true;
+
+            size_t m = 0;
+            for (size_t j = 0; j < newRows.size(); ++j) {
+                int64_t i = newToOld[j];
+                if (i < 0) {
+                    changes.push_back({RowChange::kInserted, -1, (int64_t)j});
+                } else {
+                    if (!inOrder[m])
+                        changes.push_back({RowChange::kMoved, i, (int64_t)j});
+                    else if (oldRows[i].data != newRows[j].data
+                                || oldRows[i].missingColumns != newRows[j].missingColumns)
+                        changes.push_back({RowChange::kUpdated, i, (int64_t)j});
+                    ++m;
+                }
+            }
+        }
+
+        Retained<SQLiteQuery> _query;
+        Query::Options _options;
+        Mode _mode;
+        shared_ptr<SQLite::Statement> _allStatement;    // Query, with docID as 1st column
+        shared_ptr<SQLite::Statement> _docStatement;    // Same, limited to a single docID
+        vector<Row> _rows;                              // Current results
+        sequence_t _lastSequence {0};                   // DB's lastSequence as of _rows
+    };
+
+
+    LiveQuery* SQLiteQuery::createLiveQuery(const Options *options) {
+        return new SQLiteLiveQuery(this, options);
+    }
+
+
     // The factory method that creates a SQLite Query.
+    // Compiled queries are cached by the DataFile, keyed by the expression in canonical form
+    // (no whitespace, and object keys sorted), so compiling the same query again is cheap.
+    // The key includes the schema version, so a query compiled before an index was created or
+    // deleted (through any connection, or another process) isn't reused afterwards.
     Retained<Query> SQLiteKeyStore::compileQuery(slice selectorExpression) {
-        return new SQLiteQuery(*this, selectorExpression);
+        string cacheKey;
+        try {
+            alloc_slice fleeceData = JSONConverter::convertJSON(selectorExpression);
+            alloc_slice canonical = Value::fromTrustedData(fleeceData)->toJSON();
+            cacheKey = name() + ":" + to_string(db().schemaVersion()) + ":" + (string)canonical;
+        } catch (const FleeceException &) {
+            // Invalid JSON; let the QueryParser report the error.
+            return new SQLiteQuery(*this, selectorExpression);
+        }
+
+        Retained<Query> query = db().cachedQuery(cacheKey);
+        if (!query) {
+            query = new SQLiteQuery(*this, selectorExpression);
+            db().cacheQuery(cacheKey, query.get());
+        }
+        return query;
+    }
+
+
+    // Runs `fn` inside a read-only transaction, to ensure that the result of lastSequence() will
+    // be consistent with the query results. The transaction is on the pooled reader connection
+    // if one is given, else on the main connection.
+    template <class FN>
+    static auto withReadOnlyTransaction(SQLiteDataFile &df, SQLiteDataFile::Reader *reader,
+                                        FN fn) -> decltype(fn())
+    {
+        if (reader) {
+            reader->beginReadOnlyTransaction();
+            try {
+                auto result = fn();
+                reader->endReadOnlyTransaction();
+                return result;
+            } catch (...) {
+                try {
+                    reader->endReadOnlyTransaction();
+                } catch (...) { }
+                throw;
+            }
+        } else {
+            ReadOnlyTransaction t(df);
+            return fn();
+        }
     }
 
 
@@ -441,18 +997,36 @@ namespace litecore {
     SQLiteQueryEnumerator* SQLiteQuery::createEnumerator(const Options *options,
                                                          sequence_t lastSeq)
     {
-        // Start a read-only transaction, to ensure that the result of lastSequence() will be
-        // consistent with the query results.
-        ReadOnlyTransaction t(keyStore().dataFile());
+        auto reader = dataFile().borrowReader();
+        return withReadOnlyTransaction(dataFile(), reader.get(), [&]() -> SQLiteQueryEnumerator* {
+            sequence_t curSeq = reader ? reader->lastSequence(keyStore().name()) : lastSequence();
+            if (lastSeq > 0 && lastSeq == curSeq)
+                return nullptr;
+            SQLiteQueryRunner recorder(this, options, curSeq, nullptr, reader);
+            return recorder.fastForward();
+        });
+    }
 
-        sequence_t curSeq = lastSequence();
-        if (lastSeq > 0 && lastSeq == curSeq)
-            return nullptr;
-        SQLiteQueryRunner recorder(this, options, curSeq);
-        return recorder.fastForward();
+    // Same as above, but creates an enumerator that reads rows lazily. The enumerator keeps the
+    // reader connection (if any) until it's done with its statement.
+    SQLiteStreamingQueryEnumerator* SQLiteQuery::createStreamingEnumerator(const Options *options,
+                                                                           sequence_t lastSeq)
+    {
+        auto reader = dataFile().borrowReader();
+        return withReadOnlyTransaction(dataFile(), reader.get(),
+                                       [&]() -> SQLiteStreamingQueryEnumerator* {
+            sequence_t curSeq = reader ? reader->lastSequence(keyStore().name()) : lastSequence();
+            if (lastSeq > 0 && lastSeq == curSeq)
+                return nullptr;
+            unique_ptr<SQLiteQueryRunner> runner(new SQLiteQueryRunner(this, options, curSeq,
+                                                                       nullptr, reader));
+            return new SQLiteStreamingQueryEnumerator(this, options, curSeq, move(runner));
+        });
     }
 
     QueryEnumerator* SQLiteQuery::createEnumerator(const Options *options) {
+        if (options && options->streaming)
+            return createStreamingEnumerator(options, 0);
         return createEnumerator(options, 0);
     }
 
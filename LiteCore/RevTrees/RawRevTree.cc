@@ -20,6 +20,7 @@
 #include "RevTree.hh"
 #include "Error.hh"
 #include "varint.hh"
+#include <algorithm>
 
 using namespace std;
 using namespace fleece;
@@ -27,19 +28,13 @@ using namespace fleece;
 
 namespace litecore {
 
-#pragma pack(1)
-    struct RemoteEntry {
-        uint16_t remoteDBID_BE;
-        uint16_t revIndex_BE;
-    };
-#pragma pack()
-
-
     std::deque<Rev> RawRevision::decodeTree(slice raw_tree,
                                             RevTree::RemoteRevMap &remoteMap,
                                             RevTree* owner,
                                             sequence_t curSeq)
     {
+        if (isV2(raw_tree))
+            return decodeTreeV2(raw_tree, remoteMap, owner, curSeq);
         const RawRevision *rawRev = (const RawRevision*)raw_tree.buf;
         unsigned count = rawRev->count();
         if (count > UINT16_MAX)
@@ -72,8 +67,12 @@ namespace litecore {
 
 
     alloc_slice RawRevision::encodeTree(const vector<Rev*> &revs,
-                                        const RevTree::RemoteRevMap &remoteMap)
+                                        const RevTree::RemoteRevMap &remoteMap,
+                                        RevTree::Encoding encoding)
     {
+        if (encoding == RevTree::kEncodingV2 && canEncodeV2(revs))
+            return encodeTreeV2(revs, remoteMap);
+
         // Allocate output buffer:
         size_t totalSize = sizeof(uint32_t);  // start with space for trailing 0 size
         for (Rev *rev : revs)
@@ -101,11 +100,25 @@ namespace litecore {
     }
 
 
+    alloc_slice RawRevision::encodeNewTree(revid revID, slice body, Rev::Flags flags,
+                                           RevTree::Encoding encoding)
+    {
+        Rev rev;
+        rev.owner = nullptr;
+        rev.parent = nullptr;
+        rev.revID = revID;
+        rev.sequence = 0;       // i.e. the Record's sequence
+        rev.flags = (Rev::Flags)(flags | Rev::kLeaf);
+        rev._body = body;
+        return encodeTree({&rev}, RevTree::RemoteRevMap(), encoding);
+    }
+
+
     size_t RawRevision::sizeToWrite(const Rev &rev) {
         return offsetof(RawRevision, revID)
              + rev.revID.size
              + SizeOfVarInt(rev.sequence)
-             + rev._body.size;
+             + (rev._external ? 0 : rev._body.size);
     }
 
     RawRevision* RawRevision::copyFrom(const Rev &rev) {
@@ -116,13 +129,16 @@ namespace litecore {
         this->parentIndex_BE = (uint16_t)_enc16(rev.parent ? rev.parent->index() : kNoParent);
 
         uint8_t dstFlags = rev.flags & ~kNonPersistentFlags;
-        if (rev._body)
+        if (rev._external)
+            dstFlags |= RawRevision::kHasExternalData;
+        else if (rev._body)
             dstFlags |= RawRevision::kHasData;
         this->flags = (Rev::Flags)dstFlags;
 
         void *dstData = offsetby(&this->revID[0], rev.revID.size);
         dstData = offsetby(dstData, PutUVarInt(dstData, rev.sequence));
-        memcpy(dstData, rev._body.buf, rev._body.size);
+        if (!rev._external)
+            memcpy(dstData, rev._body.buf, rev._body.size);
 
         return (RawRevision*)offsetby(this, revSize);
     }
@@ -143,6 +159,7 @@ namespace litecore {
             dst._body = slice(data, end);
         else
             dst._body = nullslice;
+        dst._external = (this->flags & RawRevision::kHasExternalData) != 0;
     }
 
 
@@ -157,4 +174,289 @@ namespace litecore {
         }
     }
 
+
+
+#pragma mark - V2 ENCODING:
+
+
+    // Reads a varint from the start of `in`, throwing if it's missing or malformed.
+    static inline uint64_t readVarInt(slice &in) {
+        uint64_t n;
+        if (!ReadUVarInt(&in, &n))
+            error::_throw(error::CorruptRevisionData);
+        return n;
+    }
+
+
+    // The v2 encoding stores generations relative to the parent's, so it can't represent a
+    // revision-vector revID, or a rev whose generation isn't greater than its parent's.
+    bool RawRevision::canEncodeV2(const vector<Rev*> &revs) {
+        for (Rev *rev : revs) {
+            if (rev->revID.size == 0 || rev->revID.isClock())
+                return false;
+            if (rev->parent && rev->revID.generation() <= rev->parent->revID.generation())
+                return false;
+        }
+        return true;
+    }
+
+
+    alloc_slice RawRevision::encodeTreeV2(const vector<Rev*> &revs,
+                                          const RevTree::RemoteRevMap &remoteMap)
+    {
+        sequence_t maxSeq = 0;
+        for (Rev *rev : revs)
+            maxSeq = max(maxSeq, rev->sequence);
+
+        size_t totalSize = 1 + SizeOfVarInt(revs.size()) + SizeOfVarInt(maxSeq);
+        for (size_t i = 0; i < revs.size(); ++i)
+            totalSize += encodeRevV2(*revs[i], maxSeq, (i == 0), nullptr);
+        for (auto &remote : remoteMap)
+            totalSize += SizeOfVarInt(remote.first) + SizeOfVarInt(remote.second->index());
+
+        alloc_slice result(totalSize);
+        auto dst = (uint8_t*)result.buf;
+        *dst++ = kV2Marker;
+        dst += PutUVarInt(dst, revs.size());
+        dst += PutUVarInt(dst, maxSeq);
+        for (size_t i = 0; i < revs.size(); ++i)
+            dst += encodeRevV2(*revs[i], maxSeq, (i == 0), dst);
+        for (auto &remote : remoteMap) {
+            dst += PutUVarInt(dst, remote.first);
+            dst += PutUVarInt(dst, remote.second->index());
+        }
+        Assert(dst == result.end());
+        return result;
+    }
+
+
+    // Writes a rev in v2 form to `dst` and returns its size; if `dst` is null, just returns size.
+    size_t RawRevision::encodeRevV2(const Rev &rev, sequence_t maxSeq, bool absoluteGen,
+                                    uint8_t *dst)
+    {
+        slice digest;
+        uint64_t gen = rev.revID.getGenAndDigest(digest);
+        uint64_t parentField = 0;
+        if (rev.parent) {
+            parentField = rev.parent->index() + 1;
+            if (!absoluteGen)
+                gen -= rev.parent->revID.generation();
+        }
+        uint64_t seqField = rev.sequence ? (maxSeq - rev.sequence + 1) : 0;
+
+        uint8_t flags = rev.flags & ~kNonPersistentFlags;
+        bool writeBody = false;
+        if (rev._external) {
+            flags |= RawRevision::kHasExternalData;
+        } else if (rev._body) {
+            flags |= RawRevision::kHasData;
+            writeBody = true;
+        }
+
+        size_t size = 1 + SizeOfVarInt(parentField) + SizeOfVarInt(gen)
+                        + SizeOfVarInt(digest.size) + digest.size + SizeOfVarInt(seqField);
+        if (writeBody)
+            size += SizeOfVarInt(rev._body.size) + rev._body.size;
+        if (!dst)
+            return size;
+
+        uint8_t *out = dst;
+        *out++ = flags;
+        out += PutUVarInt(out, parentField);
+        out += PutUVarInt(out, gen);
+        out += PutUVarInt(out, digest.size);
+        memcpy(out, digest.buf, digest.size);
+        out += digest.size;
+        out += PutUVarInt(out, seqField);
+        if (writeBody) {
+            out += PutUVarInt(out, rev._body.size);
+            memcpy(out, rev._body.buf, rev._body.size);
+            out += rev._body.size;
+        }
+        Assert(out == dst + size);
+        return size;
+    }
+
+
+    std::deque<Rev> RawRevision::decodeTreeV2(slice in,
+                                              RevTree::RemoteRevMap &remoteMap,
+                                              RevTree* owner,
+                                              sequence_t curSeq)
+    {
+        uint64_t count;
+        sequence_t maxSeq;
+        in = readHeaderV2(in, count, maxSeq);
+
+        // First pass reads the revs; generations are relative to parents, which may come later.
+        deque<Rev> revs(count);
+        vector<uint64_t> gens(count);
+        vector<uint32_t> parents(count);
+        vector<slice> digests(count);
+        size_t revIDsSize = 0;
+        Fields raw;
+        for (unsigned i = 0; i < count; ++i) {
+            Rev &rev = revs[i];
+            readRevV2(in, maxSeq, raw);
+            if (raw.parentIndex != kNoParent && (raw.parentIndex >= count || raw.parentIndex == i))
+                error::_throw(error::CorruptRevisionData);
+            parents[i] = (raw.parentIndex == kNoParent) ? 0 : raw.parentIndex + 1;
+            rev.parent = parents[i] ? &revs[raw.parentIndex] : nullptr;
+            gens[i] = raw.gen;
+            digests[i] = raw.digest;
+            rev.sequence = raw.sequence ? raw.sequence : curSeq;
+            rev.flags = (Rev::Flags)(raw.flags & ~kPersistentOnlyFlags);
+            rev._external = (raw.flags & RawRevision::kHasExternalData) != 0;
+            rev._body = raw.body;
+            rev.owner = owner;
+        }
+
+        // Resolve the absolute generations, walking up each unresolved chain of ancestors.
+        // (The first rev's generation is already absolute.)
+        vector<bool> resolved(count);
+        if (count > 0)
+            resolved[0] = true;
+        vector<unsigned> chain;
+        for (unsigned i = 0; i < count; ++i) {
+            for (unsigned j = i; !resolved[j]; j = parents[j] - 1) {
+                chain.push_back(j);
+                if (chain.size() > count)
+                    error::_throw(error::CorruptRevisionData);      // parent cycle
+                if (parents[j] == 0)
+                    break;
+            }
+            while (!chain.empty()) {
+                unsigned j = chain.back();
+                chain.pop_back();
+                if (parents[j])
+                    gens[j] += gens[parents[j] - 1];
+                resolved[j] = true;
+            }
+            revIDsSize += SizeOfVarInt(gens[i]) + digests[i].size;
+        }
+
+        // Reconstitute the revIDs into one buffer owned by the tree:
+        alloc_slice revIDs(revIDsSize);
+        auto dst = (uint8_t*)revIDs.buf;
+        for (unsigned i = 0; i < count; ++i) {
+            auto start = dst;
+            dst += PutUVarInt(dst, gens[i]);
+            memcpy(dst, digests[i].buf, digests[i].size);
+            dst += digests[i].size;
+            revs[i].revID = revid(start, dst - start);
+        }
+        owner->_insertedData.push_back(revIDs);
+
+        RevTree::RemoteID remoteID;
+        unsigned revIndex;
+        while (readRemoteV2(in, remoteID, revIndex)) {
+            if (revIndex >= count)
+                error::_throw(error::CorruptRevisionData);
+            remoteMap[remoteID] = &revs[revIndex];
+        }
+        return revs;
+    }
+
+
+    // Finds the body of the first (current) rev without decoding the tree.
+    slice RawRevision::getCurrentRevBodyV2(slice in) noexcept {
+        try {
+            uint64_t count;
+            sequence_t maxSeq;
+            in = readHeaderV2(in, count, maxSeq);
+            if (count == 0)
+                return nullslice;
+            Fields raw;
+            readRevV2(in, maxSeq, raw);
+            return raw.body;
+        } catch (...) {
+            return nullslice;
+        }
+    }
+
+
+#pragma mark - READING IN PLACE:
+
+
+    slice RawRevision::readHeaderV2(slice in, uint64_t &count, sequence_t &maxSeq) {
+        if (!isV2(in))
+            error::_throw(error::CorruptRevisionData);
+        in.moveStart(1);
+        count = readVarInt(in);
+        maxSeq = readVarInt(in);
+        if (count > UINT16_MAX)
+            error::_throw(error::CorruptRevisionData);
+        return in;
+    }
+
+
+    bool RawRevision::readRevV1(slice &in, Fields &raw) {
+        const size_t headerSize = offsetof(RawRevision, revID);
+        auto rev = (const RawRevision*)in.buf;
+        if (in.size < sizeof(uint32_t))
+            error::_throw(error::CorruptRevisionData);
+        if (!rev->isValid()) {
+            in.moveStart(sizeof(uint32_t));
+            return false;
+        }
+        size_t size = _dec32(rev->size_BE);
+        if (in.size < headerSize || size < headerSize + rev->revIDLen || size > in.size)
+            error::_throw(error::CorruptRevisionData);
+        slice revData(in.buf, size);
+        in.moveStart(size);
+        auto parent = _dec16(rev->parentIndex_BE);
+        raw.parentIndex = parent;
+        raw.gen = 0;
+        raw.digest = slice(rev->revID, rev->revIDLen);
+        raw.flags = rev->flags;
+        slice data(raw.digest.end(), revData.end());
+        size_t n = GetUVarInt(data, &raw.sequence);
+        if (n == 0)
+            error::_throw(error::CorruptRevisionData);
+        data.moveStart(n);
+        raw.body = (raw.flags & RawRevision::kHasData) ? data : nullslice;
+        return true;
+    }
+
+
+    void RawRevision::readRevV2(slice &in, sequence_t maxSeq, Fields &raw) {
+        if (in.size == 0)
+            error::_throw(error::CorruptRevisionData);
+        raw.flags = in[0];
+        in.moveStart(1);
+        uint64_t parent = readVarInt(in);
+        if (parent > UINT16_MAX)
+            error::_throw(error::CorruptRevisionData);
+        raw.parentIndex = parent ? (unsigned)(parent - 1) : kNoParent;
+        raw.gen = readVarInt(in);
+        uint64_t digestSize = readVarInt(in);
+        if (digestSize > in.size)
+            error::_throw(error::CorruptRevisionData);
+        raw.digest = slice(in.buf, (size_t)digestSize);
+        in.moveStart((size_t)digestSize);
+        uint64_t seq = readVarInt(in);
+        if (seq > maxSeq)
+            error::_throw(error::CorruptRevisionData);
+        raw.sequence = seq ? (maxSeq - seq + 1) : 0;
+        raw.body = nullslice;
+        if (raw.flags & RawRevision::kHasData) {
+            uint64_t bodySize = readVarInt(in);
+            if (bodySize > in.size)
+                error::_throw(error::CorruptRevisionData);
+            raw.body = slice(in.buf, (size_t)bodySize);
+            in.moveStart((size_t)bodySize);
+        }
+    }
+
+
+    bool RawRevision::readRemoteV2(slice &in, RevTree::RemoteID &remoteID, unsigned &revIndex) {
+        if (in.size == 0)
+            return false;
+        uint64_t remote = readVarInt(in), index = readVarInt(in);
+        if (remote == 0 || remote > UINT16_MAX || index > UINT16_MAX)
+            error::_throw(error::CorruptRevisionData);
+        remoteID = (RevTree::RemoteID)remote;
+        revIndex = (unsigned)index;
+        return true;
+    }
+
 }
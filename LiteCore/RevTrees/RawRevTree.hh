@@ -29,11 +29,30 @@ namespace litecore {
 
 #pragma pack(1)
 
+    // Entry in the list of remote revisions that follows the revs in a v1 tree
+    struct RemoteEntry {
+        uint16_t remoteDBID_BE;
+        uint16_t revIndex_BE;
+    };
+
     // Layout of a single revision in encoded form. Rev tree is stored as a sequence of these
     // followed by a 32-bit zero.
     // Revs are stored in decending priority, with the current leaf rev(s) coming first.
     // Following the revs is a series of (remote DB ID, revision index) pairs that mark which
     // revision is the current one for every remote database.
+    //
+    // The v2 encoding (RevTree::kEncodingV2) is more compact. It starts with the byte kV2Marker,
+    // which can't begin a v1 tree, then the number of revs and the highest rev sequence as
+    // varints. Each rev is then:
+    //      uint8       flags
+    //      varint      parent's index + 1, or 0 if none
+    //      varint      generation, minus the parent's generation if there is a parent
+    //                  (except in the first rev, so the current revID can be read directly)
+    //      varint      digest length, followed by the digest (the revID minus its generation)
+    //      varint      highest sequence - sequence + 1, or 0 if the sequence is unknown
+    //   if HasData flag:
+    //      varint      body length, followed by the body
+    // followed by (remote DB ID, revision index) pairs as varints.
     class RawRevision {
     public:
         static std::deque<Rev> decodeTree(slice raw_tree,
@@ -42,21 +61,63 @@ namespace litecore {
                                           sequence_t curSeq);
 
         static alloc_slice encodeTree(const std::vector<Rev*> &revs,
-                                      const RevTree::RemoteRevMap &remoteMap);
+                                      const RevTree::RemoteRevMap &remoteMap,
+                                      RevTree::Encoding =RevTree::kEncodingV1);
+
+        /** Encodes a tree containing just one (leaf) revision, without creating a RevTree. */
+        static alloc_slice encodeNewTree(revid, slice body, Rev::Flags, RevTree::Encoding);
+
+        /** True if the tree is in the v2 encoding. */
+        static bool isV2(slice raw_tree) noexcept {
+            return raw_tree.size > 0 && raw_tree[0] == kV2Marker;
+        }
 
         static inline slice getCurrentRevBody(slice raw_tree) noexcept {
+            if (isV2(raw_tree))
+                return getCurrentRevBodyV2(raw_tree);
             const RawRevision *rawRev = (const RawRevision*)raw_tree.buf;
             return rawRev->body();
         }
 
+        //////// Reading revisions in place:
+
+        /** The fields of a revision as stored, read in place from an encoded tree. In v1,
+            `digest` is the entire revID and `gen` is 0; in v2, `gen` is relative to the parent's
+            generation, except in the first revision. */
+        struct Fields {
+            uint8_t     flags;              // Includes kHasData and kHasExternalData
+            unsigned    parentIndex;        // kNoParent if none
+            uint64_t    gen;
+            slice       digest;
+            sequence_t  sequence;           // 0 if unknown (i.e. the Record's)
+            slice       body;               // Null unless kHasData
+        };
+
+        /** Reads the header of a v2 tree, returning the rest of it (the revs and remotes.) */
+        static slice readHeaderV2(slice raw_tree, uint64_t &count, sequence_t &maxSeq);
+
+        /** Reads the rev at the start of `in`, and moves `in` past it. Returns false at the
+            trailing zero that ends a v1 tree's revs, after moving past that too. */
+        static bool readRevV1(slice &in, Fields&);
+        static void readRevV2(slice &in, sequence_t maxSeq, Fields&);
+
+        /** Reads the remote entry at the start of the remotes of a v2 tree, and moves `in` past
+            it. Returns false at the end. */
+        static bool readRemoteV2(slice &in, RevTree::RemoteID&, unsigned &revIndex);
+
+        // The above throw CorruptRevisionData if the data is malformed or truncated.
+
     private:
         static const uint16_t kNoParent = UINT16_MAX;
+        static const uint8_t kV2Marker = 0xFF;  // (A v1 tree would need a rev over 4GB in size)
 
         // Private RevisionFlags bits used in encoded form:
         enum : uint8_t {
             kHasData = 0x80,  /**< Does this raw rev contain JSON/Fleece data? */
+            kHasExternalData = 0x04, /**< Is the body stored outside the tree? (Reuses the bit of
+                                          Rev::kNew, which is never saved.) */
             kNonPersistentFlags  = (Rev::kNew),         // Not saved to disk
-            kPersistentOnlyFlags = (kHasData),          // Only used on disk, not in memory
+            kPersistentOnlyFlags = (kHasData | kHasExternalData), // Only used on disk, not in memory
         };
 
         uint32_t        size_BE;        // Total size of this tree rev (big-endian)
@@ -68,6 +129,7 @@ namespace litecore {
         // varint       sequence
         // if HasData flag:
         //    char      data[];         // Contains the revision body (JSON)
+        // (if HasExternalData flag, the body is stored elsewhere by the VersionedDocument)
 
         bool isValid() const {
             return size_BE != 0;
@@ -89,6 +151,19 @@ namespace litecore {
         static size_t sizeToWrite(const Rev&);
         void copyTo(Rev &dst, const std::deque<Rev>&) const;
         RawRevision* copyFrom(const Rev &rev);
+
+        static bool canEncodeV2(const std::vector<Rev*> &revs);
+        static alloc_slice encodeTreeV2(const std::vector<Rev*> &revs,
+                                        const RevTree::RemoteRevMap &remoteMap);
+        static size_t encodeRevV2(const Rev&, sequence_t maxSeq, bool absoluteGen,
+                                  uint8_t *dst);
+        static std::deque<Rev> decodeTreeV2(slice raw_tree,
+                                            RevTree::RemoteRevMap &remoteMap,
+                                            RevTree *owner NONNULL,
+                                            sequence_t curSeq);
+        static slice getCurrentRevBodyV2(slice raw_tree) noexcept;
+
+        friend class RevTreeView;
     };
 
 #pragma pack()
@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unordered_set>
 #if DEBUG
 #include <iostream>
 #include <sstream>
@@ -80,9 +81,9 @@ namespace litecore {
         }
     }
 
-    alloc_slice RevTree::encode() {
+    alloc_slice RevTree::encode(Encoding encoding) {
         sort();
-        return RawRevision::encodeTree(_revs, _remoteRevs);
+        return RawRevision::encodeTree(_revs, _remoteRevs, encoding);
     }
 
 #if DEBUG
@@ -178,13 +179,18 @@ namespace litecore {
     }
 
     bool RevTree::isBodyOfRevisionAvailable(const Rev* rev) const {
-        return rev->_body.buf != nullptr; // VersionedDocument overrides this
+        return rev->isBodyAvailable();
     }
 
     alloc_slice RevTree::readBodyOfRevision(const Rev* rev) const {
         if (rev->_body.buf != nullptr)
             return alloc_slice(rev->_body);
-        return alloc_slice(); // VersionedDocument overrides this
+        return alloc_slice(); // VersionedDocument overrides this to read external bodies
+    }
+
+    void RevTree::setLoadedBody(const Rev *rev, alloc_slice body) {
+        _insertedData.push_back(body);
+        const_cast<Rev*>(rev)->_body = _insertedData.back();
     }
 
     bool RevTree::confirmLeaf(Rev* testRev) {
@@ -363,7 +369,7 @@ namespace litecore {
     }
 
     void RevTree::removeBody(const Rev* rev) {
-        if (rev->body()) {
+        if (rev->isBodyAvailable()) {
             const_cast<Rev*>(rev)->removeBody();
             _changed = true;
         }
@@ -372,13 +378,38 @@ namespace litecore {
     // Remove bodies of already-saved revs that are no longer leaves:
     void RevTree::removeNonLeafBodies() {
         for (Rev *rev : _revs) {
-            if (rev->_body.size > 0 && !(rev->flags & (Rev::kLeaf | Rev::kNew | Rev::kKeepBody))) {
+            if ((rev->_body.size > 0 || rev->_external)
+                    && !(rev->flags & (Rev::kLeaf | Rev::kNew | Rev::kKeepBody))) {
                 rev->removeBody();
                 _changed = true;
             }
         }
     }
 
+    unsigned RevTree::removeClosedBranchBodies() {
+        // Find the revisions on open branches, and the current remote revisions:
+        std::unordered_set<const Rev*> keep;
+        for (Rev *rev : _revs) {
+            if (rev->isLeaf() && !rev->isClosed()) {
+                for (const Rev *anc = rev; anc && keep.insert(anc).second; anc = anc->parent)
+                    ;
+            }
+        }
+        for (auto &r : _remoteRevs)
+            keep.insert(r.second);
+
+        unsigned n = 0;
+        for (Rev *rev : _revs) {
+            if (!rev->isLeaf() && !keep.count(rev) && rev->isBodyAvailable()) {
+                rev->removeBody();
+                ++n;
+            }
+        }
+        if (n > 0)
+            _changed = true;
+        return n;
+    }
+
     unsigned RevTree::prune(unsigned maxDepth) {
         Assert(maxDepth > 0);
         if (_revs.size() <= maxDepth)
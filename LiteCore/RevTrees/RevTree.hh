@@ -37,8 +37,9 @@ namespace litecore {
         revid           revID;      /**< Revision ID (compressed) */
         sequence_t      sequence;   /**< DB sequence number that this revision has/had */
 
-        slice body() const          {return _body;}
-        bool isBodyAvailable() const{return _body.buf != nullptr;}
+        slice body() const          {return _body;}             /**< Null if not loaded */
+        bool isBodyAvailable() const{return _body.buf != nullptr || _external;}
+        bool isBodyExternal() const {return _external;}          /**< Stored outside the tree? */
 
         bool isLeaf() const         {return (flags & kLeaf) != 0;}
         bool isDeleted() const      {return (flags & kDeleted) != 0;}
@@ -71,17 +72,19 @@ namespace litecore {
 
     private:
         slice       _body;          /**< Revision body (JSON), or empty if not stored in this tree*/
+        bool        _external {false}; /**< Is the body stored outside the tree? (See VersionedDocument) */
 
         void addFlag(Flags f)           {flags = (Flags)(flags | f);}
         void clearFlag(Flags f)         {flags = (Flags)(flags & ~f);}
         void removeBody()               {clearFlag((Flags)(kKeepBody | kHasAttachments));
-                                         _body = nullslice;}
+                                         _body = nullslice; _external = false;}
         bool isMarkedForPurge() const   {return (flags & kPurge) != 0;}
 #if DEBUG
         void dump(std::ostream&);
 #endif
         friend class RevTree;
         friend class RawRevision;
+        friend class VersionedDocument;
     };
 
 
@@ -95,7 +98,13 @@ namespace litecore {
 
         void decode(slice raw_tree, sequence_t seq);
 
-        alloc_slice encode();
+        /** Binary encodings of a tree; see RawRevTree.hh. Either one can be decoded. */
+        enum Encoding {
+            kEncodingV1 = 1,        ///< Original; readable by all versions of LiteCore
+            kEncodingV2,            ///< Compact: varints, digest-only revIDs, delta sequences
+        };
+
+        alloc_slice encode(Encoding =kEncodingV1);
 
         size_t size() const                             {return _revs.size();}
         const Rev* get(unsigned index) const;
@@ -144,6 +153,11 @@ namespace litecore {
 
         void removeNonLeafBodies();
 
+        /** Removes the bodies of revisions that are only on closed conflict branches (except the
+            closing tombstones), since they're no longer needed as merge bases. Returns the number
+            of bodies removed. */
+        unsigned removeClosedBranchBodies();
+
         /** Removes a leaf revision and any of its ancestors that aren't shared with other leaves. */
         int purge(revid);
         int purgeAll();
@@ -161,13 +175,20 @@ namespace litecore {
         const Rev* latestRevisionOnRemote(RemoteID);
         void setLatestRevisionOnRemote(RemoteID, const Rev*);
 
+        //////// Bodies:
+
+        virtual bool isBodyOfRevisionAvailable(const Rev* r NONNULL) const;
+
+        /** Returns a revision's body, reading it from storage if it's not in memory. */
+        virtual alloc_slice readBodyOfRevision(const Rev* r NONNULL) const;
+
 #if DEBUG
         void dump();
 #endif
 
     protected:
-        virtual bool isBodyOfRevisionAvailable(const Rev* r NONNULL) const;
-        virtual alloc_slice readBodyOfRevision(const Rev* r NONNULL) const;
+        /** Sets the body of a revision that was read from storage, retaining the data. */
+        void setLoadedBody(const Rev* NONNULL, alloc_slice body);
 #if DEBUG
         virtual void dump(std::ostream&);
 #endif
@@ -0,0 +1,239 @@
+//
+// RevTreeView.cc
+//
+// Copyright (c) 2018 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "RevTreeView.hh"
+#include "RawRevTree.hh"
+#include "Error.hh"
+#include "Logging.hh"
+
+using namespace std;
+using namespace fleece;
+
+
+namespace litecore {
+
+    const unsigned RevTreeView::kNoRev;
+
+
+    RevTreeView::RevTreeView(slice raw_tree, sequence_t curSeq)
+    :_raw(raw_tree)
+    ,_curSeq(curSeq)
+    {
+        if (_raw.size == 0) {
+            _indexed = true;
+            return;
+        }
+        // Read just the current revision, which comes first:
+        RawRevision::Fields raw;
+        slice in;
+        if (RawRevision::isV2(_raw)) {
+            _v2 = true;
+            uint64_t count;
+            _revs = in = RawRevision::readHeaderV2(_raw, count, _maxSeq);
+            _count = (unsigned)count;
+            if (_count == 0)
+                return;
+            RawRevision::readRevV2(in, _maxSeq, raw);
+        } else {
+            _revs = in = _raw;
+            if (!RawRevision::readRevV1(in, raw))
+                return;
+        }
+        _current = makeInfo(0, (const uint8_t*)_revs.buf, raw.gen);
+    }
+
+
+    unsigned RevTreeView::count() const {
+        if (!_v2)
+            positions();
+        return _count;
+    }
+
+
+    // Finds where each rev starts, and in v2 its generation, validating the tree.
+    void RevTreeView::index() const {
+        _positions.clear();
+        slice in = _revs;
+        unsigned count = 0, maxParent = 0;
+        RawRevision::Fields raw;
+        if (_v2) {
+            _positions.reserve(_count);
+            vector<unsigned> parents;
+            parents.reserve(_count);
+            for (; count < _count; ++count) {
+                auto start = (const uint8_t*)in.buf;
+                RawRevision::readRevV2(in, _maxSeq, raw);
+                if (raw.parentIndex == count)
+                    error::_throw(error::CorruptRevisionData);
+                unsigned parent = kNoRev;
+                if (raw.parentIndex != RawRevision::kNoParent) {
+                    parent = raw.parentIndex;
+                    maxParent = max(maxParent, parent + 1);
+                }
+                _positions.push_back({start, raw.gen});
+                parents.push_back(parent);
+            }
+            if (maxParent > count)
+                error::_throw(error::CorruptRevisionData);
+            resolveGenerations(parents);
+            _remotes = in;
+            RevTree::RemoteID remoteID;
+            unsigned revIndex;
+            while (RawRevision::readRemoteV2(in, remoteID, revIndex)) {
+                if (revIndex >= count)
+                    error::_throw(error::CorruptRevisionData);
+            }
+        } else {
+            while (true) {
+                auto start = (const uint8_t*)in.buf;
+                if (!RawRevision::readRevV1(in, raw))
+                    break;
+                if (raw.parentIndex != RawRevision::kNoParent)
+                    maxParent = max(maxParent, raw.parentIndex + 1);
+                if (++count > UINT16_MAX)
+                    error::_throw(error::CorruptRevisionData);
+                _positions.push_back({start, 0});
+            }
+            if (maxParent > count)
+                error::_throw(error::CorruptRevisionData);
+            _remotes = in;
+            if (_remotes.size % sizeof(RemoteEntry) != 0)
+                error::_throw(error::CorruptRevisionData);
+            for (auto entry = (const RemoteEntry*)_remotes.buf; entry < _remotes.end(); ++entry) {
+                if (entry->remoteDBID_BE == 0 || _dec16(entry->revIndex_BE) >= count)
+                    error::_throw(error::CorruptRevisionData);
+            }
+            _count = count;
+        }
+        _indexed = true;
+    }
+
+
+    // In v2 a generation is stored relative to the parent's, except in rev 0 where it's absolute.
+    // Replaces each in _positions with the absolute one, by adding those of its ancestors up to
+    // rev 0 or a root. Parents are found in `parents`, so this takes linear time.
+    void RevTreeView::resolveGenerations(const vector<unsigned> &parents) const {
+        enum : uint8_t {kRelative, kResolving, kAbsolute};
+        vector<uint8_t> state(_count, kRelative);
+        if (_count > 0)
+            state[0] = kAbsolute;
+        vector<unsigned> chain;
+        for (unsigned i = 0; i < _count; ++i) {
+            // Walk up to the nearest ancestor whose generation is absolute:
+            unsigned p = i;
+            while (p != kNoRev && state[p] != kAbsolute) {
+                if (state[p] == kResolving)
+                    error::_throw(error::CorruptRevisionData);      // parent links form a cycle
+                state[p] = kResolving;
+                chain.push_back(p);
+                p = parents[p];
+            }
+            // ...then add generations on the way back down:
+            uint64_t gen = (p == kNoRev) ? 0 : _positions[p].gen;
+            for (auto c = chain.rbegin(); c != chain.rend(); ++c) {
+                gen += _positions[*c].gen;
+                _positions[*c].gen = gen;
+                state[*c] = kAbsolute;
+            }
+            chain.clear();
+        }
+    }
+
+
+    RevTreeView::Info RevTreeView::makeInfo(unsigned index, const uint8_t *pos,
+                                            uint64_t gen) const
+    {
+        RawRevision::Fields raw;
+        slice in(pos, _raw.end());
+        if (_v2)
+            RawRevision::readRevV2(in, _maxSeq, raw);
+        else
+            RawRevision::readRevV1(in, raw);
+        Info info;
+        info.index = index;
+        info.parentIndex = (raw.parentIndex == RawRevision::kNoParent) ? kNoRev : raw.parentIndex;
+        info.flags = (Rev::Flags)(raw.flags & ~RawRevision::kPersistentOnlyFlags);
+        info.sequence = raw.sequence ? raw.sequence : _curSeq;
+        info.body = raw.body;
+        info.bodyExternal = (raw.flags & RawRevision::kHasExternalData) != 0;
+        try {
+            if (_v2)
+                info.revID = revidBuffer((unsigned)gen, raw.digest, kDigestType);
+            else
+                info.revID = revid(raw.digest);
+        } catch (...) {
+            Warn("RevTreeView: RevID of revision %u is too long", index);
+        }
+        return info;
+    }
+
+
+    RevTreeView::Info RevTreeView::get(unsigned index) const {
+        if (index == 0)
+            return _current;
+        auto &pos = positions();
+        if (index >= _count)
+            return Info();
+        return makeInfo(index, pos[index].pos, pos[index].gen);
+    }
+
+
+    RevTreeView::Info RevTreeView::get(revid revID) const {
+        if (revID.size == 0 || (_v2 && revID.isClock()))
+            return Info();
+        slice digest = revID;
+        uint64_t gen = 0;
+        if (_v2)
+            gen = revID.getGenAndDigest(digest);
+        auto &pos = positions();
+        RawRevision::Fields raw;
+        for (unsigned i = 0; i < _count; ++i) {
+            if (_v2 && pos[i].gen != gen)
+                continue;
+            slice in(pos[i].pos, _raw.end());
+            if (_v2)
+                RawRevision::readRevV2(in, _maxSeq, raw);
+            else
+                RawRevision::readRevV1(in, raw);
+            if (raw.digest == digest)
+                return makeInfo(i, pos[i].pos, pos[i].gen);
+        }
+        return Info();
+    }
+
+
+    unsigned RevTreeView::latestRevisionOnRemote(RevTree::RemoteID remote) const {
+        positions();
+        if (_v2) {
+            slice in = _remotes;
+            RevTree::RemoteID remoteID;
+            unsigned revIndex;
+            while (RawRevision::readRemoteV2(in, remoteID, revIndex)) {
+                if (remoteID == remote)
+                    return revIndex;
+            }
+        } else {
+            for (auto entry = (const RemoteEntry*)_remotes.buf; entry < _remotes.end(); ++entry) {
+                if (_dec16(entry->remoteDBID_BE) == remote)
+                    return _dec16(entry->revIndex_BE);
+            }
+        }
+        return kNoRev;
+    }
+
+}
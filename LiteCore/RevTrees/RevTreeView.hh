@@ -0,0 +1,124 @@
+//
+// RevTreeView.hh
+//
+// Copyright (c) 2018 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "RevTree.hh"
+#include "RevID.hh"
+#include <climits>
+#include <vector>
+
+namespace litecore {
+
+    /** A read-only view of an encoded RevTree (either encoding) that reads revisions in place,
+        without decoding the tree. Only the current revision is read up front; the first access
+        to any other indexes the tree, making one small array of where each revision starts
+        (and, in the v2 encoding, its generation.) Revisions are identified by index, in the
+        same order as in a decoded RevTree, so index 0 is the current revision.
+        The encoded data must remain valid while the view, or any Info from it, is in use. */
+    class RevTreeView {
+    public:
+        static const unsigned kNoRev = UINT_MAX;
+
+        /** A revision read from the tree. Its body points into the encoded data. */
+        struct Info {
+            unsigned    index       {kNoRev};   ///< Index in the tree, or kNoRev if none
+            unsigned    parentIndex {kNoRev};   ///< Parent's index, or kNoRev if none
+            revidBuffer revID;
+            Rev::Flags  flags       {(Rev::Flags)0};
+            sequence_t  sequence    {0};
+            slice       body;                   ///< Null if not stored in the tree
+            bool        bodyExternal {false};   ///< Is the body stored outside the tree?
+
+            bool exists() const         {return index != kNoRev;}
+            bool isLeaf() const         {return (flags & Rev::kLeaf) != 0;}
+            bool isDeleted() const      {return (flags & Rev::kDeleted) != 0;}
+            bool isBodyAvailable() const {return body.buf != nullptr || bodyExternal;}
+        };
+
+        RevTreeView() { }
+
+        /** Reads the encoded tree's header and current revision, throwing CorruptRevisionData
+            if they're malformed. The rest of the tree is validated when it's indexed, so the
+            other accessors can throw that too.
+            `curSeq` is the Record's sequence, given to revisions whose sequence is unknown. */
+        RevTreeView(slice raw_tree, sequence_t curSeq);
+
+        unsigned count() const;
+        bool empty() const                      {return !_current.exists();}
+
+        /** The current revision; takes constant time, and doesn't throw. */
+        const Info& current() const             {return _current;}
+
+        /** The revision at an index, or a nonexistent Info if it's out of range. */
+        Info get(unsigned index) const;
+
+        /** The revision with a revID, or a nonexistent Info if there isn't one. */
+        Info get(revid) const;
+
+        /** The index of the revision that's current on a remote database, or kNoRev. */
+        unsigned latestRevisionOnRemote(RevTree::RemoteID) const;
+
+        /** Iterates over the revisions in order; `begin` can start at any index. */
+        class iterator {
+        public:
+            const Info& operator*() const       {return _info;}
+            const Info* operator->() const      {return &_info;}
+            iterator& operator++()              {_info = _view->get(_info.index + 1); return *this;}
+            bool operator!= (const iterator &i) const {return _info.index != i._info.index;}
+        private:
+            friend class RevTreeView;
+            iterator(const RevTreeView *view, unsigned index)
+            :_view(view), _info(index == kNoRev ? Info() : view->get(index)) { }
+            const RevTreeView* _view;
+            Info               _info;
+        };
+
+        iterator begin(unsigned index =0) const {return iterator(this, index);}
+        iterator end() const                    {return iterator(this, kNoRev);}
+
+    private:
+        // Where a rev starts in the encoded data, and its (absolute) generation (v2 only.)
+        struct Position {
+            const uint8_t* pos;
+            uint64_t       gen;
+        };
+
+        const std::vector<Position>& positions() const {
+            if (!_indexed)
+                index();
+            return _positions;
+        }
+        void index() const;
+        void resolveGenerations(const std::vector<unsigned> &parents) const;
+        Info makeInfo(unsigned index, const uint8_t *pos, uint64_t gen) const;
+
+        slice           _raw;
+        bool            _v2 {false};
+        sequence_t      _maxSeq {0};            // v2 only
+        sequence_t      _curSeq {0};
+        slice           _revs;                  // The encoded revs, and what follows them
+        Info            _current;
+
+        // Set by index():
+        mutable bool                  _indexed {false};
+        mutable unsigned              _count {0};     // (In v2 it's read from the header)
+        mutable slice                 _remotes;       // The remote-revision entries
+        mutable std::vector<Position> _positions;     // Indexed by rev index
+    };
+
+}
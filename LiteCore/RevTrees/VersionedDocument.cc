@@ -17,15 +17,33 @@
 //
 
 #include "VersionedDocument.hh"
+#include "RawRevTree.hh"
 #include "Record.hh"
 #include "KeyStore.hh"
+#include "DataFile.hh"
+#include "RecordEnumerator.hh"
 #include "Error.hh"
+#include "Logging.hh"
+#include "StringUtil.hh"
 #include "varint.hh"
 #include <ostream>
 
 namespace litecore {
     using namespace fleece;
 
+    // Name of the KeyStore holding non-current revision bodies is that of the document KeyStore
+    // plus this suffix. Its keys are the docID's length as a varint, the docID, and the
+    // (expanded) revID; so the keys of one doc's bodies start with a prefix no other doc's do.
+    static const char* const kBodyStoreSuffix = "_revbodies";
+
+    // Files at this DataFile::fileVersion or later store trees in the compact encoding
+    static const int kMinFileVersionForV2 = 2;
+
+    // ...and store non-current revision bodies outside the tree. (Older versions of LiteCore
+    // refuse to open such files; they'd take the tree's flag for an external body as Rev::kNew.)
+    static const int kMinFileVersionForExternalBodies = 2;
+
+
     VersionedDocument::VersionedDocument(KeyStore& db, slice docID)
     :_db(db), _rec(docID)
     {
@@ -42,6 +60,7 @@ namespace litecore {
     :RevTree(other)
     ,_db(other._db)
     ,_rec(other._rec)
+    ,_externalRevIDs(other._externalRevIDs)
     { }
 
     void VersionedDocument::read() {
@@ -66,6 +85,7 @@ namespace litecore {
         } else if (_rec.bodySize() > 0) {
             _unknown = true;        // i.e. rec was read as meta-only
         }
+        rememberExternalBodies();
     }
 
     bool VersionedDocument::updateMeta() {
@@ -102,29 +122,169 @@ namespace litecore {
         updateMeta();
         sequence_t seq = _rec.sequence();
         bool createSequence;
-        if (currentRevision()) {
+        auto current = (Rev*)currentRevision();
+        if (current) {
             removeNonLeafBodies();
-            auto newBody = encode();
+
+            // Only the current revision's body goes in the record; the others with bodies are
+            // stored separately, if the file allows. (In a file from an older version this moves
+            // them out of the record, a doc at a time as each is saved.)
+            bool inlinedCurrent = current->_external;
+            if (inlinedCurrent) {
+                if (!current->_body)
+                    setLoadedBody(current, readBodyOfRevision(current));
+                current->_external = false;
+            }
+            std::vector<const Rev*> newlyExternal;
+            if (storesBodiesExternally(_db)) {
+                for (Rev *rev : allRevisions()) {
+                    if (rev != current && rev->_body && !rev->_external) {
+                        rev->_external = true;
+                        newlyExternal.push_back(rev);
+                    }
+                }
+            }
+
+            auto newBody = encode(encodingFor(_db));
             createSequence = seq == 0 || hasNewRevisions();
             // (Don't call _rec.setBody(), because it'd invalidate all the inner pointers from
             // Revs into the existing body buffer.)
             seq = _db.set(_rec.key(), _rec.version(), newBody, _rec.flags(),
                           transaction, &seq, createSequence);
-            if (!seq)
+            if (!seq) {
+                for (auto rev : newlyExternal)
+                    const_cast<Rev*>(rev)->_external = false;
+                current->_external = inlinedCurrent;
                 return kConflict;               // Conflict
+            }
             _rec.updateSequence(seq);
             _rec.setExists();
+            upgradeFileFor(_db, newBody, !newlyExternal.empty(), transaction);
+            saveRevisionBodies(newlyExternal, transaction);
             if (createSequence)
                 saved(seq);
         } else {
             createSequence = false;
             if (seq && !_db.del(_rec.key(), transaction, seq))
                 return kConflict;
+            saveRevisionBodies({}, transaction);
         }
         _changed = false;
         return createSequence ? kNewSequence : kNoNewSequence;
     }
 
+
+    /*static*/ RevTree::Encoding VersionedDocument::encodingFor(const KeyStore &store) {
+        int version = store.dataFile().writableFileVersion();
+        return version >= kMinFileVersionForV2 ? kEncodingV2 : kEncodingV1;
+    }
+
+
+    /*static*/ bool VersionedDocument::storesBodiesExternally(const KeyStore &store) {
+        return store.dataFile().writableFileVersion() >= kMinFileVersionForExternalBodies;
+    }
+
+
+    /*static*/ void VersionedDocument::upgradeFileFor(KeyStore &store, slice encodedTree,
+                                                      bool externalBodies, Transaction &t)
+    {
+        DataFile &file = store.dataFile();
+        if (RawRevision::isV2(encodedTree))
+            file.upgradeFileVersion(kMinFileVersionForV2, t);
+        if (externalBodies)
+            file.upgradeFileVersion(kMinFileVersionForExternalBodies, t);
+    }
+
+
+#pragma mark - EXTERNAL BODIES:
+
+
+    KeyStore& VersionedDocument::bodyStore(const KeyStore &docStore) {
+        return docStore.dataFile().getKeyStore(docStore.name() + kBodyStoreSuffix,
+                                               KeyStore::Capabilities{false});
+    }
+
+    // The prefix of the keys of a document's bodies.
+    static std::string bodyKeyPrefix(slice docID) {
+        uint8_t size[kMaxVarintLen64];
+        std::string prefix((const char*)size, PutUVarInt(size, docID.size));
+        prefix.append((const char*)docID.buf, docID.size);
+        return prefix;
+    }
+
+    alloc_slice VersionedDocument::bodyKey(slice docID, revid revID) {
+        return alloc_slice(bodyKeyPrefix(docID) + (std::string)revID.expanded());
+    }
+
+    alloc_slice VersionedDocument::readBodyOfRevision(const Rev *rev) const {
+        if (rev->_body.buf || !rev->_external)
+            return RevTree::readBodyOfRevision(rev);
+        return readRevisionBody(_db, docID(), rev->revID);
+    }
+
+    /*static*/ alloc_slice VersionedDocument::readRevisionBody(const KeyStore &docStore,
+                                                             slice docID, revid revID)
+    {
+        Record bodyRec = bodyStore(docStore).get(bodyKey(docID, revID));
+        if (!bodyRec.exists()) {
+            Warn("VersionedDocument: Body of '%.*s' rev %s is missing",
+                 SPLAT(docID), ((std::string)revID.expanded()).c_str());
+        }
+        return bodyRec.body();
+    }
+
+    /*static*/ size_t VersionedDocument::revisionBodySize(const KeyStore &docStore,
+                                                          slice docID, revid revID)
+    {
+        return bodyStore(docStore).get(bodyKey(docID, revID), kMetaOnly).bodySize();
+    }
+
+    // Records which revisions' bodies are currently in the body store.
+    void VersionedDocument::rememberExternalBodies() {
+        _externalRevIDs.clear();
+        for (Rev *rev : allRevisions()) {
+            if (rev->_external)
+                _externalRevIDs.emplace_back(rev->revID);
+        }
+    }
+
+    // Writes the bodies that have been moved out of the record, and deletes those of revisions
+    // that have been pruned or purged, or whose bodies have been removed or moved back in.
+    void VersionedDocument::saveRevisionBodies(const std::vector<const Rev*> &newlyExternal,
+                                               Transaction &t)
+    {
+        if (newlyExternal.empty() && _externalRevIDs.empty())
+            return;
+        KeyStore &store = bodyStore(_db);
+        for (auto rev : newlyExternal)
+            store.set(bodyKey(docID(), rev->revID), rev->_body, t);
+        for (auto &revID : _externalRevIDs) {
+            auto rev = get(revid(revID));
+            if (!rev || !rev->_external)
+                store.del(bodyKey(docID(), revid(revID)), t);
+        }
+        rememberExternalBodies();
+    }
+
+    /*static*/ void VersionedDocument::deleteRevisionBodies(KeyStore &docStore, slice docID,
+                                                            Transaction &t)
+    {
+        KeyStore &store = bodyStore(docStore);
+        std::string prefix = bodyKeyPrefix(docID);
+        RecordEnumerator::Options options;
+        options.prefix = slice(prefix);
+        options.contentOptions = kMetaOnly;
+        std::vector<alloc_slice> keys;
+        {
+            RecordEnumerator e(store, options);
+            while (e.next())
+                keys.push_back(e.record().key());
+        }
+        for (auto &key : keys)
+            store.del(key, t);
+    }
+
+
 #if DEBUG
     void VersionedDocument::dump(std::ostream& out) {
         out << "\"" << (std::string)docID() << "\" / " << (std::string)revID();
@@ -19,12 +19,17 @@
 #pragma once
 #include "RevTree.hh"
 #include "Record.hh"
+#include <vector>
 
 namespace litecore {
     class KeyStore;
     class Transaction;
 
-    /** Manages storage of a serialized RevTree in a Record. */
+    /** Manages storage of a serialized RevTree in a Record.
+        Only the current revision's body is stored in the Record; the bodies of other revisions
+        (conflicting leaves, and ancestors marked kKeepBody) are stored in a separate KeyStore,
+        keyed by docID and revID, and read when first needed. (In a file written by an older
+        version they're in the Record, until the doc is saved after the file is upgraded.) */
     class VersionedDocument : public RevTree {
     public:
 
@@ -58,6 +63,34 @@ namespace litecore {
 
         bool updateMeta();
 
+        alloc_slice readBodyOfRevision(const Rev* NONNULL) const override;
+
+        /** Marks the document as changed, so the next save() will rewrite it. */
+        void setChanged()           {_changed = true;}
+
+        /** The encoding in which trees are stored in a KeyStore, which depends on the version of
+            its file. */
+        static Encoding encodingFor(const KeyStore&);
+
+        /** True if non-current revision bodies are stored outside the Record in a KeyStore,
+            which depends on the version of its file. */
+        static bool storesBodiesExternally(const KeyStore&);
+
+        /** Upgrades the version of a KeyStore's file, if necessary, when an encoded tree (with
+            bodies stored outside it, if `externalBodies`) has been written to it. */
+        static void upgradeFileFor(KeyStore&, slice encodedTree, bool externalBodies,
+                                   Transaction&);
+
+        /** Reads the separately-stored body of a revision, without needing to decode the tree. */
+        static alloc_slice readRevisionBody(const KeyStore &docStore, slice docID, revid);
+
+        /** The size of the separately-stored body of a revision, or 0 if there isn't one. */
+        static size_t revisionBodySize(const KeyStore &docStore, slice docID, revid);
+
+        /** Deletes the separately-stored revision bodies of a document; call this when purging
+            its Record without going through a VersionedDocument. */
+        static void deleteRevisionBodies(KeyStore &docStore, slice docID, Transaction&);
+
 #if DEBUG
         void dump()          {RevTree::dump();}
 #endif
@@ -68,8 +101,14 @@ namespace litecore {
 
     private:
         void decode();
+        static KeyStore& bodyStore(const KeyStore &docStore);
+        static alloc_slice bodyKey(slice docID, revid);
+        void saveRevisionBodies(const std::vector<const Rev*> &newlyExternal, Transaction&);
+        void rememberExternalBodies();
 
         KeyStore&       _db;
         Record          _rec;
+        std::vector<alloc_slice> _externalRevIDs;   // Revs whose bodies are in the body store
+
     };
 }
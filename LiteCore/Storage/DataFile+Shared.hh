@@ -11,6 +11,7 @@
 #include "c4Private.h"        // C4InstanceCounted
 #include <mutex>              // std::mutex, std::unique_lock
 #include <condition_variable> // std::condition_variable
+#include <chrono>
 #include <unordered_map>
 
 
@@ -106,19 +107,60 @@ namespace litecore {
         }
 
 
-        void setTransaction(Transaction* t) {
+        void setTransaction(Transaction* t, DataFile *dataFile) {
             Assert(t);
             unique_lock<mutex> lock(_transactionMutex);
-            while (_transaction != nullptr)
-                _transactionCond.wait(lock);
+            if (_transaction != nullptr || _lockedWithoutTransaction) {
+                ++_waitingWriters[dataFile];
+                while (_transaction != nullptr || _lockedWithoutTransaction)
+                    _transactionCond.wait(lock);
+                if (--_waitingWriters[dataFile] == 0)
+                    _waitingWriters.erase(dataFile);
+            }
             _transaction = t;
         }
 
 
+        // Are any threads waiting in setTransaction() to begin a Transaction on this DataFile?
+        bool hasWaitingWriters(DataFile *dataFile) {
+            unique_lock<mutex> lock(_transactionMutex);
+            return _waitingWriters.find(dataFile) != _waitingWriters.end();
+        }
+
+
+        // Takes the transaction lock without a Transaction (see DataFile::tryWithFileLock), but
+        // only if nobody holds it or is waiting for it; returns false if it's busy.
+        bool tryLockWithoutTransaction() {
+            unique_lock<mutex> lock(_transactionMutex);
+            if (_transaction != nullptr || _lockedWithoutTransaction || !_waitingWriters.empty())
+                return false;
+            _lockedWithoutTransaction = true;
+            return true;
+        }
+
+        void unlockWithoutTransaction() {
+            unique_lock<mutex> lock(_transactionMutex);
+            Assert(_lockedWithoutTransaction);
+            _lockedWithoutTransaction = false;
+            _transactionCond.notify_one();
+        }
+
+
+        // Seconds since the last Transaction on the file ended, or 0 if one is in progress or
+        // any thread is waiting to begin one.
+        double idleTime() {
+            unique_lock<mutex> lock(_transactionMutex);
+            if (_transaction != nullptr || _lockedWithoutTransaction || !_waitingWriters.empty())
+                return 0.0;
+            return chrono::duration<double>(chrono::steady_clock::now() - _lastTransactionEnd).count();
+        }
+
+
         void unsetTransaction(Transaction* t) {
             unique_lock<mutex> lock(_transactionMutex);
             Assert(t && _transaction == t);
             _transaction = nullptr;
+            _lastTransactionEnd = chrono::steady_clock::now();
             _transactionCond.notify_one();
         }
 
@@ -160,6 +202,9 @@ namespace litecore {
         mutex              _transactionMutex;       // Mutex for transactions
         condition_variable _transactionCond;        // For waiting on the mutex
         Transaction*       _transaction {nullptr};  // Currently active Transaction object
+        bool               _lockedWithoutTransaction {false}; // Held by tryLockWithoutTransaction
+        unordered_map<DataFile*, unsigned> _waitingWriters; // Threads waiting in setTransaction
+        chrono::steady_clock::time_point _lastTransactionEnd {chrono::steady_clock::now()};
         vector<DataFile*>  _dataFiles;              // Open DataFiles on this File
         unordered_map<string, Retained<RefCounted>> _sharedObjects;
         bool               _condemned {false};      // Prevents db from being opened or deleted
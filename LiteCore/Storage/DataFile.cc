@@ -30,6 +30,9 @@
 #include <errno.h>
 #include <dirent.h>
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
 #include <thread>
 
 #include "SQLiteDataFile.hh"
@@ -108,6 +111,8 @@ namespace litecore {
     :_path(path)
     ,_options(options ? *options : Options::defaults)
     {
+        if (_options.groupCommit)
+            _groupCommit.reset(new GroupCommit);
         // Do this last so I'm fully constructed before other threads can see me (#425)
         _shared = Shared::forPath(path, this);
     }
@@ -122,6 +127,8 @@ namespace litecore {
 
 
     void DataFile::close() {
+        if (_groupCommit && isOpen())
+            withFileLock([]{ });        // commits any pending group (see Transaction constructor)
         for (auto& i : _keyStores) {
             i.second->close();
         }
@@ -148,6 +155,16 @@ namespace litecore {
     }
 
 
+    void DataFile::setTuning(const Tuning &tuning) {
+        _options.tuning = tuning;
+    }
+
+
+    double DataFile::idleTime() const {
+        return _shared->idleTime();
+    }
+
+
     void DataFile::forOtherDataFiles(function_ref<void(DataFile*)> fn) {
         _shared->forOpenDataFiles(this, fn);
     }
@@ -269,6 +286,13 @@ namespace litecore {
     }
 
 
+    int DataFile::writableFileVersion() const {
+        if (_options.upgradeFormat && _options.writeable)
+            return kCurrentFileVersion;
+        return fileVersion();
+    }
+
+
     SharedKeys* DataFile::documentKeys() const {
         auto keys = _documentKeys.get();
         if (!keys && _options.useDocumentKeys) {
@@ -284,31 +308,50 @@ namespace litecore {
 
     
     void DataFile::beginTransactionScope(Transaction* t) {
-        Assert(!_inTransaction);
+        // (With group commit, other threads may be using this DataFile, so only check this one.)
+        if (_groupCommit)
+            Assert(_transactionThread != this_thread::get_id());
+        else
+            Assert(!_inTransaction);
         checkOpen();
-        _shared->setTransaction(t);
+        _shared->setTransaction(t, this);
         _inTransaction = true;
+        _transactionThread = this_thread::get_id();
+        // Another DataFile on this file may have an open group; commit it so its database-level
+        // transaction doesn't block mine:
+        _shared->forOpenDataFiles(this, [](DataFile *other) {
+            if (other->_groupCommit)
+                other->commitGroup(false);
+        });
     }
 
-    void DataFile::transactionBegan(Transaction*) {
-        if (_documentKeys)
+    // With group commit the shared keys' transaction spans the whole group, not each member;
+    // see beginGroupMember() and commitGroup().
+    void DataFile::transactionBegan(Transaction* t) {
+        if (_documentKeys && !t->_grouped)
             _documentKeys->transactionBegan();
     }
 
-    void DataFile::transactionEnding(Transaction*, bool committing) {
+    void DataFile::transactionEnding(Transaction* t, bool committing) {
         if (_documentKeys) {
             if (committing)
                 _documentKeys->save();
-            else
+            else if (!t->_grouped)
                 _documentKeys->revert();
+            // (An aborted group member can't revert the keys, since earlier members in the group
+            // may have saved keys past the last commit. Its extra keys are harmless: they'll be
+            // saved by the next member that commits, or reverted if the group doesn't commit.)
         }
     }
     
     void DataFile::endTransactionScope(Transaction* t) {
-        _shared->unsetTransaction(t);
+        // Reset my state before unlocking, since with group commit another thread may be
+        // waiting to begin a Transaction on this same DataFile:
+        _transactionThread = thread::id();
         _inTransaction = false;
-        if (_documentKeys)
+        if (_documentKeys && !t->_grouped)
             _documentKeys->transactionEnded();
+        _shared->unsetTransaction(t);
     }
 
 
@@ -328,6 +371,21 @@ namespace litecore {
     }
 
 
+    bool DataFile::tryWithFileLock(function_ref<void(void)> fn) {
+        checkOpen();
+        if (!_shared->tryLockWithoutTransaction())
+            return false;
+        try {
+            fn();
+        } catch (...) {
+            _shared->unlockWithoutTransaction();
+            throw;
+        }
+        _shared->unlockWithoutTransaction();
+        return true;
+    }
+
+
     Transaction::Transaction(DataFile* db)
     :Transaction(db, true)
     { }
@@ -340,9 +398,17 @@ namespace litecore {
         if (active) {
             LogToAt(DBLog, Verbose, "DataFile: begin transaction");
             Signpost::begin(Signpost::transaction, uint32_t(size_t(this)));
-            _db._beginTransaction(this);
+            if (_db._groupCommit) {
+                _db.beginGroupMember(this);
+                _grouped = true;
+            } else {
+                _db._beginTransaction(this);
+            }
             _active = true;
             _db.transactionBegan(this);
+        } else if (_db._groupCommit) {
+            // Whatever runs under the file lock shouldn't find itself inside a pending group:
+            _db.commitGroup(false);
         }
     }
 
@@ -352,7 +418,10 @@ namespace litecore {
         _db.transactionEnding(this, true);
         _active = false;
         LogToAt(DBLog, Verbose, "DataFile: commit transaction");
-        _db._endTransaction(this, true);
+        if (_grouped)
+            _db.endGroupMember(this, true);
+        else
+            _db._endTransaction(this, true);
         Signpost::end(Signpost::transaction, uint32_t(size_t(this)));
     }
 
@@ -362,7 +431,10 @@ namespace litecore {
         _db.transactionEnding(this, false);
         _active = false;
         LogTo(DBLog, "DataFile: abort transaction");
-        _db._endTransaction(this, false);
+        if (_grouped)
+            _db.endGroupMember(this, false);
+        else
+            _db._endTransaction(this, false);
         Signpost::end(Signpost::transaction, uint32_t(size_t(this)));
     }
 
@@ -372,7 +444,159 @@ namespace litecore {
             LogTo(DBLog, "DataFile: Transaction exiting scope without explicit commit; aborting");
             abort();
         }
-        _db.endTransactionScope(this);
+        if (_inScope)
+            _db.endTransactionScope(this);
+    }
+
+
+#pragma mark - GROUP COMMIT:
+
+
+    // With group commit, each Transaction on a DataFile is a nested transaction (savepoint) inside
+    // one database-level transaction shared by a group of them. When a Transaction commits while
+    // another thread is waiting to begin one on the same DataFile, it leaves the group open and
+    // lets that thread in, then waits for the group to be committed. The group is committed by
+    // the last Transaction to finish with nobody waiting behind it, or when it grows too old or
+    // too large. Either way every member's commit() returns only after the group's commit.
+
+    // Max time a group stays open, i.e. the longest a commit() waits for other Transactions:
+    static constexpr auto kGroupCommitWindow = chrono::milliseconds(5);
+
+    // Max number of Transactions committed in one group:
+    static constexpr unsigned kMaxGroupCommitMembers = 100;
+
+
+    struct DataFile::GroupCommit {
+        struct Batch {
+            bool          committed {false};    // Set when the database transaction has ended
+            exception_ptr error;                // Exception from committing it, if any
+        };
+
+        std::mutex                  mutex;
+        condition_variable          cond;
+        shared_ptr<Batch>           batch;          // Batch whose db transaction is open, if any
+        unsigned                    members {0};    // Number of committed Transactions in batch
+        chrono::steady_clock::time_point deadline;  // When the open batch must be committed
+    };
+
+
+    // Called by a Transaction's constructor, while it holds the file lock.
+    void DataFile::beginGroupMember(Transaction *t) {
+        auto &g = *_groupCommit;
+        bool beginGroup;
+        {
+            lock_guard<std::mutex> lock(g.mutex);
+            beginGroup = !g.batch;
+        }
+        _beginGroupMember(t, beginGroup);
+        if (beginGroup) {
+            if (_documentKeys)
+                _documentKeys->transactionBegan();
+            lock_guard<std::mutex> lock(g.mutex);
+            g.batch = make_shared<GroupCommit::Batch>();
+            g.members = 0;
+            g.deadline = chrono::steady_clock::now() + kGroupCommitWindow;
+        }
+    }
+
+
+    // Called by a Transaction's commit() or abort(), while it holds the file lock.
+    void DataFile::endGroupMember(Transaction *t, bool commit) {
+        auto &g = *_groupCommit;
+        shared_ptr<GroupCommit::Batch> batch;
+        chrono::steady_clock::time_point deadline;
+        bool keepOpen;
+        try {
+            _endGroupMember(t, commit);
+        } catch (...) {
+            // My changes were rolled back, including the shared keys I saved, which the other
+            // members' changes may be using; so the group can't be committed either:
+            commitGroup(false, current_exception());
+            throw;
+        }
+        keepOpen = _shared->hasWaitingWriters(this);
+        {
+            lock_guard<std::mutex> lock(g.mutex);
+            if (commit)
+                ++g.members;
+            batch = g.batch;
+            deadline = g.deadline;
+            keepOpen = keepOpen && g.members < kMaxGroupCommitMembers
+                                && chrono::steady_clock::now() < deadline;
+        }
+        if (!keepOpen) {
+            commitGroup(commit);
+            return;
+        } else if (!commit) {
+            return;         // The members still waiting for the group will see it committed
+        }
+
+        // Let the next writer in, then wait for the group to be committed:
+        endTransactionScope(t);
+        t->_inScope = false;
+        unique_lock<std::mutex> lock(g.mutex);
+        while (!batch->committed) {
+            if (g.cond.wait_until(lock, deadline) == cv_status::timeout && !batch->committed) {
+                // Nobody has committed the group in time, so do it myself:
+                lock.unlock();
+                beginTransactionScope(t);
+                bool stillOpen;
+                {
+                    lock_guard<std::mutex> lock2(g.mutex);
+                    stillOpen = (g.batch == batch);
+                }
+                if (stillOpen)
+                    commitGroup(false);
+                endTransactionScope(t);
+                lock.lock();
+            }
+        }
+        if (batch->error)
+            rethrow_exception(batch->error);
+    }
+
+
+    // Ends the open group's database transaction, if any, and wakes up its waiting members.
+    // Must be called while holding the file lock. If the commit fails, the members are given the
+    // exception, and it's rethrown if `rethrow` is true. If `abortError` is given, the group is
+    // rolled back instead, and the members are given that exception.
+    void DataFile::commitGroup(bool rethrow, exception_ptr abortError) {
+        auto &g = *_groupCommit;
+        shared_ptr<GroupCommit::Batch> batch;
+        bool anyMembers;
+        {
+            lock_guard<std::mutex> lock(g.mutex);
+            if (!g.batch)
+                return;
+            batch = move(g.batch);
+            anyMembers = (g.members > 0);
+            g.members = 0;
+        }
+        exception_ptr error = abortError;
+        try {
+            // If every member aborted there's nothing to commit:
+            _endGroup(anyMembers && !error);
+        } catch (...) {
+            error = current_exception();
+            try {
+                _endGroup(false);
+            } catch (...) { }
+        }
+        if (_documentKeys) {
+            // The members saved the shared keys as they committed, but they're only persistent
+            // if the group was:
+            if (error || !anyMembers)
+                _documentKeys->revert();
+            _documentKeys->transactionEnded();
+        }
+        {
+            lock_guard<std::mutex> lock(g.mutex);
+            batch->committed = true;
+            batch->error = error;
+        }
+        g.cond.notify_all();
+        if (error && rethrow)
+            rethrow_exception(error);
     }
 
 
@@ -24,7 +24,10 @@
 #include <vector>
 #include <unordered_map>
 #include <atomic> // for std::atomic_uint
+#include <exception>
 #include <functional> // for std::function
+#include <memory>
+#include <thread>
 #ifdef check
 #undef check
 #endif
@@ -47,14 +50,27 @@ namespace litecore {
         // Callback that takes a record body and returns the portion of it containing Fleece data
         typedef slice (*FleeceAccessor)(slice recordBody);
 
+        /** Storage-engine cache and I/O settings. A zero field means "use the engine's default". */
+        struct Tuning {
+            int64_t cacheSize;          ///< Page cache size per connection, in bytes
+            int64_t mmapSize;           ///< Bytes of file to memory-map; negative disables mmap
+            int64_t journalSizeLimit;   ///< Max size of journal after a commit; negative = no limit
+            int32_t pageSize;           ///< Page size of a new file, in bytes (power of 2)
+            int32_t workerThreads;      ///< Extra threads for sorting/indexing; negative = none
+        };
+
         struct Options {
             KeyStore::Capabilities keyStores;
             bool                create         :1;      ///< Should the db be created if it doesn't exist?
             bool                writeable      :1;      ///< If false, db is opened read-only
             bool                useDocumentKeys:1;      ///< Use SharedKeys for Fleece docs
+            bool                groupCommit    :1;      ///< Fold concurrent Transactions into one commit
+            bool                backgroundMaintenance:1;///< Checkpoint/vacuum/optimize when idle
+            bool                upgradeFormat  :1;      ///< Let an older file take newer formats
             EncryptionAlgorithm encryptionAlgorithm;    ///< What encryption (if any)
             alloc_slice         encryptionKey;          ///< Encryption key, if encrypting
             FleeceAccessor      fleeceAccessor;         ///< Fn to get Fleece from Record body
+            Tuning              tuning;                 ///< Cache/mmap/page-size settings
 
             static const Options defaults;
         };
@@ -79,9 +95,33 @@ namespace litecore {
 
         virtual void compact() =0;
 
+        /** Does one bounded step of compaction, freeing up to `maxPages` unused pages of the file.
+            Returns the number of pages freed; 0 means there's nothing left to do. */
+        virtual unsigned compactStep(unsigned maxPages)     {compact(); return 0;}
+
         virtual void rekey(EncryptionAlgorithm, slice newKey);
 
+        /** Changes the cache/mmap/journal settings of an open file. Settings that can only be
+            applied when a file is created (like the page size) are ignored. */
+        virtual void setTuning(const Tuning&);
+
         FleeceAccessor fleeceAccessor() const               {return _options.fleeceAccessor;}
+
+        /** The file's format version. Newer versions may store data in encodings that older
+            versions of LiteCore can't read, so they're only used in files whose version allows
+            them. A new file is created at kCurrentFileVersion; an existing one keeps its version
+            unless it's opened with the `upgradeFormat` option, and even then it's only upgraded
+            by the first write that needs it (see upgradeFileVersion.) */
+        virtual int fileVersion() const                     {return kCurrentFileVersion;}
+        static const int kCurrentFileVersion = 2;
+
+        /** The newest format version data may be written in: kCurrentFileVersion if the file can
+            be upgraded, else its fileVersion. */
+        int writableFileVersion() const;
+
+        /** Raises the file's version to `version`, if it's lower, before data that needs it is
+            written. Must be called in a transaction; if that's aborted, so is the upgrade. */
+        virtual void upgradeFileVersion(int version, Transaction&)    { }
         fleece::SharedKeys* documentKeys() const;
 
         void* owner()                                       {return _owner;}
@@ -92,6 +132,34 @@ namespace litecore {
         /** Private API to run a raw (e.g. SQL) query, for diagnostic purposes only */
         virtual fleece::alloc_slice rawQuery(const std::string &query) =0;
 
+        /** Counters of the cache of compiled queries (see KeyStore::compileQuery.) */
+        struct QueryCacheStats {
+            uint64_t hits;                  ///< Number of queries found in the cache
+            uint64_t misses;                ///< Number of queries that had to be compiled
+            size_t   count;                 ///< Number of compiled queries currently cached
+        };
+
+        virtual QueryCacheStats queryCacheStats() const     {return {0, 0, 0};}
+
+        /** Counters of the work done by background maintenance (see Options::backgroundMaintenance.) */
+        struct MaintenanceStats {
+            uint64_t runs;                  ///< Number of times maintenance ran
+            uint64_t deferred;              ///< Number of times it yielded to a busy file
+            uint64_t checkpoints;           ///< Number of WAL checkpoints that copied pages
+            uint64_t pagesCheckpointed;     ///< Number of WAL pages copied into the file
+            uint64_t vacuumSteps;           ///< Number of incremental vacuum steps
+            uint64_t pagesVacuumed;         ///< Number of free pages returned to the filesystem
+            uint64_t optimizes;             ///< Number of times the query planner's stats were updated
+        };
+
+        using MaintenanceObserver = std::function<void(const MaintenanceStats&)>;
+
+        virtual MaintenanceStats maintenanceStats() const   {return { };}
+
+        /** Registers a function to be called, on the maintenance thread, after each maintenance
+            run that did something. Pass nullptr to remove it. */
+        virtual void setMaintenanceObserver(MaintenanceObserver)  { }
+
         //////// KEY-STORES:
 
         static const std::string kDefaultKeyStoreName;
@@ -171,9 +239,23 @@ namespace litecore {
         /** Override to commit or abort a database transaction. */
         virtual void _endTransaction(Transaction* t NONNULL, bool commit) =0;
 
+        /** Override to begin a Transaction nested inside a group commit's database transaction,
+            after first beginning that if `beginGroup` is true. */
+        virtual void _beginGroupMember(Transaction* t NONNULL, bool beginGroup) =0;
+
+        /** Override to commit or abort a Transaction nested inside a group commit. */
+        virtual void _endGroupMember(Transaction* t NONNULL, bool commit) =0;
+
+        /** Override to commit or abort a group commit's database transaction. */
+        virtual void _endGroup(bool commit) =0;
+
         /** Is this DataFile object currently in a transaction? */
         bool inTransaction() const                      {return _inTransaction;}
 
+        /** Seconds since the last Transaction on the file (by any DataFile) ended, or 0 if one is
+            in progress or waiting to begin. */
+        double idleTime() const;
+
         /** Override to begin a read-only transaction. */
         virtual void beginReadOnlyTransaction() =0;
 
@@ -185,6 +267,13 @@ namespace litecore {
             is in a transaction, nor starts a transaction while the function is running. */
         void withFileLock(function_ref<void(void)> fn);
 
+        /** Like withFileLock, but if a Transaction on the file is in progress or waiting to begin,
+            it returns false at once instead of waiting. It doesn't touch this object's transaction
+            state, so it can be called on any thread; it's meant for writes made on a separate
+            connection to the file, such as background maintenance, which have to yield to
+            Transactions instead of overlapping them. */
+        bool tryWithFileLock(function_ref<void(void)> fn);
+
         void setOptions(const Options &o)               {_options = o;}
 
         void forOpenKeyStores(function_ref<void(KeyStore&)> fn);
@@ -193,6 +282,7 @@ namespace litecore {
 
     private:
         class Shared;
+        struct GroupCommit;
         friend class KeyStore;
         friend class Transaction;
         friend class ReadOnlyTransaction;
@@ -207,6 +297,9 @@ namespace litecore {
         void transactionEnding(Transaction*, bool committing);
         void endTransactionScope(Transaction*);
         Transaction& transaction();
+        void beginGroupMember(Transaction*);
+        void endGroupMember(Transaction*, bool commit);
+        void commitGroup(bool rethrow, std::exception_ptr abortError =nullptr);
 
         DataFile(const DataFile&) = delete;
         DataFile& operator=(const DataFile&) = delete;
@@ -218,6 +311,8 @@ namespace litecore {
         std::unordered_map<std::string, std::unique_ptr<KeyStore>> _keyStores;// Opened KeyStores
         std::unique_ptr<fleece::PersistentSharedKeys> _documentKeys;
         bool                    _inTransaction {false};         // Am I in a Transaction?
+        std::atomic<std::thread::id> _transactionThread {std::thread::id()}; // Thread in Transaction
+        std::unique_ptr<GroupCommit> _groupCommit;              // Group-commit state, if enabled
         std::atomic<void*>      _owner {nullptr};               // App-defined object that owns me
     };
 
@@ -225,7 +320,10 @@ namespace litecore {
     /** Grants exclusive write access to a DataFile while in scope.
         The transaction is committed when the object exits scope, unless abort() was called.
         Only one Transaction object can be created on a database file at a time.
-        Not just per DataFile object; per database _file_. */
+        Not just per DataFile object; per database _file_.
+        If the DataFile was opened with the `groupCommit` option, Transactions on it from different
+        threads may share a single database-level commit; commit() still doesn't return until the
+        changes are durable, and throws if that commit failed. */
     class Transaction {
     public:
         explicit Transaction(DataFile*);
@@ -246,6 +344,8 @@ namespace litecore {
 
         DataFile&   _db;        // The DataFile
         bool _active;           // Is there an open transaction at the db level?
+        bool _grouped {false};  // Am I part of a group commit?
+        bool _inScope {true};   // Do I still hold the file's transaction lock?
     };
 
 
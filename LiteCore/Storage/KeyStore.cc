@@ -47,6 +47,14 @@ namespace litecore {
         fn(get(seq));
     }
 
+    vector<Record> KeyStore::getMany(const vector<slice> &keys, ContentOptions options) const {
+        vector<Record> recs;
+        recs.reserve(keys.size());
+        for (auto key : keys)
+            recs.push_back(get(key, options));
+        return recs;
+    }
+
     void KeyStore::readBody(Record &rec) const {
         if (!rec.body()) {
             Record fullDoc = rec.sequence() ? get(rec.sequence())
@@ -67,6 +75,18 @@ namespace litecore {
         rec.updateSequence(seq);
     }
 
+    size_t KeyStore::insertBatch(NewRecord records[], size_t count, Transaction &t) {
+        size_t added = 0;
+        const sequence_t noSequence = 0;
+        for (size_t i = 0; i < count; ++i) {
+            NewRecord &rec = records[i];
+            rec.sequence = set(rec.key, rec.version, rec.body, rec.flags, t, &noSequence);
+            if (rec.sequence)
+                ++added;
+        }
+        return added;
+    }
+
     bool KeyStore::setDocumentFlag(slice key, sequence_t sequence, DocumentFlags, Transaction&) {
         error::_throw(error::Unimplemented);
     }
@@ -21,6 +21,7 @@
 #include "RefCounted.hh"
 #include "RecordEnumerator.hh"
 #include "function_ref.hh"
+#include <vector>
 
 namespace litecore {
 
@@ -73,6 +74,12 @@ namespace litecore {
         /** Reads a record whose key() is already set. */
         virtual bool read(Record &rec, ContentOptions options = kDefaultContent) const =0;
 
+        /** Reads several records at once; this is faster than calling get() for each.
+            The Records are in the same order as the keys. Those that don't exist in the
+            store have only their key set (`exists()` is false.) */
+        virtual std::vector<Record> getMany(const std::vector<slice> &keys,
+                                            ContentOptions = kDefaultContent) const;
+
         /** Reads the body of a Record that's already been read with kMetaonly.
             Does nothing if the record's body is non-null. */
         virtual void readBody(Record &rec) const;
@@ -98,6 +105,18 @@ namespace litecore {
 
         void write(Record&, Transaction&, const sequence_t *replacingSequence =nullptr);
 
+        /** A record to be added by insertBatch. */
+        struct NewRecord {
+            slice           key, version, body;
+            DocumentFlags   flags;
+            sequence_t      sequence;       ///< Set by insertBatch; 0 if the key already existed
+        };
+
+        /** Adds records that don't exist yet, each with a new sequence, more efficiently than
+            calling set() for each. Records whose keys already exist are left alone, and their
+            `sequence` set to 0. Returns the number of records added. */
+        virtual size_t insertBatch(NewRecord records[], size_t count, Transaction&);
+
         virtual bool del(slice key, Transaction&, sequence_t replacingSequence =0) =0;
         bool del(const Record &rec, Transaction &t)                 {return del(rec.key(), t);}
 
@@ -109,7 +128,8 @@ namespace litecore {
         enum IndexType {
             kValueIndex,         ///< Regular index of property value
             kFullTextIndex,      ///< Full-text index
-            kGeoIndex,           ///< Geo index of GeoJSON values
+            kGeoIndex,           ///< Geo index of latitude/longitude values
+            kArrayIndex,         ///< Index of the values in an array property
         };
 
         struct IndexOptions {
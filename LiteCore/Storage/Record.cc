@@ -29,10 +29,11 @@ namespace litecore {
         setKey(key);
     }
 
+    // A copy always owns its data, even if the original borrowed it:
     Record::Record(const Record &d)
-    :_key(d._key),
-     _version(d._version),
-     _body(d._body),
+    :_key(d.key()),
+     _version(d.version()),
+     _body(d.body()),
      _bodySize(d._bodySize),
      _sequence(d._sequence),
      _flags(d._flags),
@@ -40,14 +41,22 @@ namespace litecore {
     { }
 
     Record::Record(Record &&d) noexcept
-    :_key(move(d._key)),
-     _version(move(d._version)),
-     _body(move(d._body)),
-     _bodySize(d._bodySize),
+    :_bodySize(d._bodySize),
      _sequence(d._sequence),
      _flags(d._flags),
      _exists(d._exists)
-    { }
+    {
+        d.ownAll();
+        _key = move(d._key);
+        _version = move(d._version);
+        _body = move(d._body);
+    }
+
+    void Record::ownAll() const {
+        owned(_key, _borrowedKey);
+        owned(_version, _borrowedVersion);
+        owned(_body, _borrowedBody);
+    }
 
     void Record::clearMetaAndBody() noexcept {
         setVersion(nullslice);
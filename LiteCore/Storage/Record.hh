@@ -39,7 +39,13 @@ namespace litecore {
     }
 
     /** The unit of storage in a DataFile: a key, version and body (all opaque blobs);
-        and some extra metadata like flags and a sequence number. */
+        and some extra metadata like flags and a sequence number.
+
+        A Record can also _borrow_ its key, version and body from memory it doesn't own, such as
+        the current row of a database query; see borrowKey() etc. Accessing a borrowed field as an
+        alloc_slice, or copying the Record, copies the data; the xxxSlice() accessors don't.
+        Since that copy changes the Record, a Record isn't thread-safe even when const: threads
+        mustn't share one without locking unless it owns all its fields (e.g. it's been copied.) */
     class Record {
     public:
         Record()                              { }
@@ -47,9 +53,17 @@ namespace litecore {
         Record(const Record&);
         Record(Record&&) noexcept;
 
-        const alloc_slice& key() const          {return _key;}
-        const alloc_slice& version() const      {return _version;}
-        const alloc_slice& body() const         {return _body;}
+        const alloc_slice& key() const          {return owned(_key, _borrowedKey);}
+        const alloc_slice& version() const      {return owned(_version, _borrowedVersion);}
+        const alloc_slice& body() const         {return owned(_body, _borrowedBody);}
+
+        /** These return the same data as key(), version() and body() but never copy it. If the
+            field is borrowed, the slice is only valid until the memory it points to goes away
+            (for a RecordEnumerator, until the next call to next().) */
+        slice keySlice() const                  {return _borrowedKey.buf ? _borrowedKey : _key;}
+        slice versionSlice() const              {return _borrowedVersion.buf ? _borrowedVersion
+                                                                             : _version;}
+        slice bodySlice() const                 {return _borrowedBody.buf ? _borrowedBody : _body;}
 
         size_t bodySize() const                 {return _bodySize;}
 
@@ -63,11 +77,20 @@ namespace litecore {
         bool exists() const                     {return _exists;}
 
         template <typename T>
-            void setKey(const T &key)           {_key = key;}
+            void setKey(const T &key)           {_borrowedKey = nullslice; _key = key;}
         template <typename T>
-            void setVersion(const T &vers)      {_version = vers;}
+            void setVersion(const T &vers)      {_borrowedVersion = nullslice; _version = vers;}
         template <typename T>
-            void setBody(const T &body)         {_body = body; _bodySize = _body.size;}
+            void setBody(const T &body)         {_borrowedBody = nullslice; _body = body;
+                                                 _bodySize = _body.size;}
+
+        /** Sets a field to point to memory owned by someone else, without copying it.
+            The caller must ensure the Record isn't used after that memory is invalidated,
+            unless the field has been copied by then by accessing it as an alloc_slice. */
+        void borrowKey(slice key)               {_key = nullslice; _borrowedKey = key;}
+        void borrowVersion(slice vers)          {_version = nullslice; _borrowedVersion = vers;}
+        void borrowBody(slice body)             {_body = nullslice; _borrowedBody = body;
+                                                 _bodySize = body.size;}
 
         uint64_t bodyAsUInt() const noexcept;
         void setBodyAsUInt(uint64_t) noexcept;
@@ -79,7 +102,8 @@ namespace litecore {
         void clearMetaAndBody() noexcept;
 
         void updateSequence(sequence_t s)       {_sequence = s;}
-        void setUnloadedBodySize(size_t size)   {_body = nullslice; _bodySize = size;}
+        void setUnloadedBodySize(size_t size)   {_borrowedBody = nullslice; _body = nullslice;
+                                                 _bodySize = size;}
         void setExists()                        {_exists = true;}
 
     private:
@@ -87,7 +111,18 @@ namespace litecore {
         friend class Transaction;
         friend class RecordEnumerator;
 
-        alloc_slice     _key, _version, _body;  // The key, metadata and body of the record
+        // Copies a borrowed field into its alloc_slice:
+        static const alloc_slice& owned(alloc_slice &field, slice &borrowed) {
+            if (borrowed.buf) {
+                field = borrowed;
+                borrowed = nullslice;
+            }
+            return field;
+        }
+        void ownAll() const;
+
+        mutable alloc_slice _key, _version, _body;  // The key, metadata and body of the record
+        mutable slice   _borrowedKey, _borrowedVersion, _borrowedBody; // Fields not (yet) copied
         size_t          _bodySize {0};          // Size of body, if body wasn't loaded
         sequence_t      _sequence {0};          // Sequence number (if KeyStore supports sequences)
         DocumentFlags   _flags {DocumentFlags::kNone};// Document flags (deleted, conflicted, etc.)
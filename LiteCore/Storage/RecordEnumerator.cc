@@ -37,7 +37,9 @@ namespace litecore {
     :descending(false),
      includeDeleted(false),
      onlyBlobs(false),
-     contentOptions(kDefaultContent)
+     contentOptions(kDefaultContent),
+     skip(0),
+     limit(0)
     { }
 
 
@@ -71,20 +73,15 @@ namespace litecore {
 
 
     bool RecordEnumerator::next() {
-        if (!_impl) {
+        if (!_impl)
             return false;
-        } else if (!_impl->next()) {
+        _record.clear();            // It may borrow memory that stepping the impl invalidates
+        if (!_impl->next() || !_impl->read(_record)) {
             close();
             return false;
-        } else {
-            _record.clear();
-            if (!_impl->read(_record)) {
-                close();
-                return false;
-            }
-            LogToAt(EnumLog, Debug, "enum:     --> [%s]", _record.key().hexCString());
-            return true;
         }
+        LogToAt(EnumLog, Debug, "enum:     --> [%s]", _record.keySlice().hexCString());
+        return true;
     }
 
 }
@@ -47,8 +47,16 @@ namespace litecore {
             bool           includeDeleted :1;   ///< Include deleted records?
             bool           onlyBlobs      :1;   ///< Only include records which contain linked binary data
             ContentOptions contentOptions :4;   ///< Load record bodies?
-
-            /** Default options have all flags false, and kDefaultContent */
+            slice          startKey;            ///< First key to include (inclusive), if non-null
+            slice          endKey;              ///< Last key to include (inclusive), if non-null
+            slice          prefix;              ///< Only include keys with this prefix, if non-null
+            uint64_t       skip;                ///< Number of initial records to skip
+            uint64_t       limit;               ///< Max number of records to return; 0 = no limit
+
+            /** Default options have all flags false, kDefaultContent, and no key range or limit.
+                startKey and endKey are in iteration order, so if `descending` is set, startKey
+                should be the greater of the two. The slices must remain valid until the
+                enumerator is created. */
             Options();
         };
 
@@ -74,18 +82,20 @@ namespace litecore {
             destructor might not be called soon enough.) */
         void close() noexcept;
 
-        /** The current record. */
+        /** The current record. It may borrow its data from the storage engine, in which case
+            slices from keySlice() etc. are only valid until the next call to next(). */
         const Record& record() const      {return _record;}
 
         // Can treat an enumerator as a record pointer:
-        operator const Record*() const    {return _record.key().buf ? &_record : nullptr;}
-        const Record* operator->() const  {return _record.key().buf ? &_record : nullptr;}
+        operator const Record*() const    {return _record.keySlice().buf ? &_record : nullptr;}
+        const Record* operator->() const  {return _record.keySlice().buf ? &_record : nullptr;}
 
         /** Internal implementation of enumerator; each storage type must subclass it. */
         class Impl {
         public:
             virtual ~Impl()                         { }
             virtual bool next() =0;
+            /** Reads the current row. The Record may borrow memory that's valid until next(). */
             virtual bool read(Record&) =0;
         };
 
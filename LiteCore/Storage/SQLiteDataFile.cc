@@ -19,6 +19,8 @@
 #include "SQLiteDataFile.hh"
 #include "SQLiteKeyStore.hh"
 #include "SQLite_Internal.hh"
+#include "SQLiteFleeceUtil.hh"
+#include "Query.hh"
 #include "Record.hh"
 #include "UnicodeCollator.hh"
 #include "Error.hh"
@@ -32,6 +34,10 @@
 #include <mutex>
 #include <sqlite3.h>
 #include <sstream>
+#include <list>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
 #include <thread>
 
@@ -54,31 +60,53 @@ namespace litecore {
 
     static const int64_t MB = 1024 * 1024;
 
-    // Min/max user_version of db files I can read
+    // Min/max user_version of db files in the original format (DataFile::fileVersion 1).
+    // Older versions of LiteCore open any file in this range.
     static const int kMinUserVersion = 201;
-    static const int kMaxUserVersion = 299;
+    static const int kMaxV1UserVersion = 299;
 
-    // SQLite page size
-    static const int64_t kPageSize = 4096;
+    // In later formats user_version is this plus the fileVersion, so older versions refuse them
+    static const int kUserVersionBase = 300;
+
+    // SQLite page size (default for new files)
+    static const int32_t kPageSize = 4096;
 
     // SQLite cache size (per connection)
-    static const size_t kCacheSize = 10 * MB;
+    static const int64_t kCacheSize = 10 * MB;
 
     // Maximum size WAL journal will be left at after a commit
     static const int64_t kJournalSize = 5 * MB;
 
     // Amount of file to memory-map
 #if TARGET_OS_OSX || TARGET_OS_SIMULATOR
-    static const int kMMapSize =  -1;    // Avoid possible file corruption hazard on macOS
+    static const int64_t kMMapSize =  -1;    // Avoid possible file corruption hazard on macOS
 #else
-    static const int kMMapSize = 50 * MB;
+    static const int64_t kMMapSize = 50 * MB;
 #endif
 
+    // Most extra threads SQLite will use for sorting, by default
+    static const int32_t kMaxWorkerThreads = 4;
+
     // If this fraction of the database is composed of free pages, vacuum it
     static const float kVacuumFractionThreshold = 0.25;
     // If the database has many bytes of free space, vacuum it
     static const int64_t kVacuumSizeThreshold = 50 * MB;
 
+    // Background maintenance checks this often whether the file is idle...
+    static const auto kMaintenanceInterval = chrono::seconds(1);
+    // ...and runs only if no Transaction has ended for this many seconds:
+    static const double kMaintenanceIdleTime = 1.0;
+    // Maximum number of free pages released by one background vacuum step
+    static const int kVacuumPagesPerStep = 256;
+    // Minimum time between background runs of PRAGMA optimize
+    static const auto kOptimizeInterval = chrono::hours(1);
+
+    // Maximum number of idle read-only connections kept open in the pool
+    static const size_t kMaxIdleReaders = 4;
+
+    // Maximum number of compiled queries to cache
+    static const size_t kQueryCacheSize = 256;
+
     // Database busy timeout; generally not needed since we have other arbitration that keeps
     // multiple threads from trying to start transactions at once, but another process might
     // open the database and grab the write lock.
@@ -160,6 +188,7 @@ namespace litecore {
 
     SQLiteDataFile::SQLiteDataFile(const FilePath &path, const Options *options)
     :DataFile(path, options)
+    ,_queryCache(new QueryCache)
     {
         reopen();
     }
@@ -171,7 +200,12 @@ namespace litecore {
 
 
     void SQLiteDataFile::reopen() {
+        stopMaintenance();
         DataFile::reopen();
+        invalidateQueryCache();     // Cached queries were compiled on the previous connection
+        closeReaders();
+        _readerPool = make_shared<ReaderPool>();
+        _readerPool->tuning = options().tuning;
         int sqlFlags = options().writeable ? SQLite::OPEN_READWRITE : SQLite::OPEN_READONLY;
         if (options().create)
             sqlFlags |= SQLite::OPEN_CREATE;
@@ -179,15 +213,14 @@ namespace litecore {
                                                sqlFlags,
                                                kBusyTimeoutSecs * 1000);
 
-        if (!decrypt())
+        if (!decrypt(*_sqlDb))
             error::_throw(error::UnsupportedEncryption);
 
-        if (sqlite3_libversion_number() < 003012) {
+        if (options().tuning.pageSize > 0 || sqlite3_libversion_number() < 3012000) {
             // Prior to 3.12, the default page size was 1024, which is less than optimal.
             // Note that setting the page size has to be done before any other command that touches
-            // the database file.
-            // The cache_size value is negative to tell SQLite it's in KB (hence the /1024.)
-            _exec(format("PRAGMA page_size=%lld", (long long)kPageSize));
+            // the database file. It has no effect on an existing file.
+            _exec(format("PRAGMA page_size=%d", effectiveTuning(options().tuning).pageSize));
         }
 
         withFileLock([this]{
@@ -203,42 +236,103 @@ namespace litecore {
                      );
                 // Create the default KeyStore's table:
                 (void)defaultKeyStore();
-                _exec("PRAGMA user_version=201; "
-                      "END;");
-            } else if (userVersion < kMinUserVersion) {
-                error::_throw(error::DatabaseTooOld);
-            } else if (userVersion > kMaxUserVersion) {
-                error::_throw(error::DatabaseTooNew);
+                _exec(format("PRAGMA user_version=%d; "
+                             "END;", kUserVersionBase + kCurrentFileVersion));
+                _fileVersion = kCurrentFileVersion;
+            } else {
+                // An older file keeps its version until something is written that needs a newer
+                // one; see upgradeFileVersion.
+                _fileVersion = fileVersionOf(userVersion);
             }
+            _committedFileVersion = _fileVersion;
         });
 
-        _exec(format("PRAGMA cache_size=%d; "            // Memory cache
-                     "PRAGMA mmap_size=%d; "             // Memory-mapped reads
-                     "PRAGMA synchronous=normal; "       // Speeds up commits
-                     "PRAGMA journal_size_limit=%lld; "  // Limit WAL disk usage
-                     "PRAGMA case_sensitive_like=true",  // Case sensitive LIKE, for N1QL compat
-                     -(int)kCacheSize/1024, kMMapSize, (long long)kJournalSize));
+        configureConnection(*_sqlDb, _collationContexts, _docRootCache);
+        applyTuning(*_sqlDb, options().tuning);
+
+        if (options().backgroundMaintenance && options().writeable)
+            startMaintenance();
+    }
+
+
+    // Fills in the default value of any Tuning field that's zero.
+    DataFile::Tuning SQLiteDataFile::effectiveTuning(Tuning tuning) {
+        if (tuning.cacheSize == 0)
+            tuning.cacheSize = kCacheSize;
+        if (tuning.mmapSize == 0)
+            tuning.mmapSize = kMMapSize;
+        if (tuning.journalSizeLimit == 0)
+            tuning.journalSizeLimit = kJournalSize;
+        if (tuning.pageSize == 0)
+            tuning.pageSize = kPageSize;
+        if (tuning.workerThreads == 0) {
+            // Leave one core for the calling thread, which does its share of the sorting:
+            int32_t cores = (int32_t)thread::hardware_concurrency();
+            tuning.workerThreads = max(0, min(cores - 1, kMaxWorkerThreads));
+        }
+        return tuning;
+    }
+
+
+    // Sets the per-connection cache, mmap, journal and worker-thread settings. These can be
+    // changed at any time.
+    void SQLiteDataFile::applyTuning(SQLite::Database &sqlDb, const Tuning &tuning) {
+        Tuning t = effectiveTuning(tuning);
+        // The cache_size value is negative to tell SQLite it's in KB (hence the /1024.)
+        // A negative mmap_size would mean "SQLite's default", so disable mmap explicitly.
+        string pragmas = format("PRAGMA cache_size=%lld; "          // Memory cache
+                                "PRAGMA mmap_size=%lld; "           // Memory-mapped reads
+                                "PRAGMA journal_size_limit=%lld",   // Limit WAL disk usage
+                                -max(1LL, (long long)t.cacheSize / 1024),
+                                max(0LL, (long long)t.mmapSize),
+                                (long long)t.journalSizeLimit);
+        LogTo(SQL, "%s", pragmas.c_str());
+        sqlDb.exec(pragmas);
+
+        // Number of extra threads SQLite can use for large sorts (ORDER BY, CREATE INDEX):
+        sqlite3_limit(sqlDb.getHandle(), SQLITE_LIMIT_WORKER_THREADS, max(0, t.workerThreads));
+    }
+
+
+    void SQLiteDataFile::setTuning(const Tuning &tuning) {
+        checkOpen();
+        LogTo(DBLog, "Changing storage tuning of %s", filePath().path().c_str());
+        withFileLock([&]{
+            applyTuning(*_sqlDb, tuning);
+        });
+        DataFile::setTuning(tuning);
+        // Pooled readers pick up the new settings the next time they're borrowed:
+        lock_guard<mutex> lock(_readerPool->poolMutex);
+        _readerPool->tuning = tuning;
+        ++_readerPool->tuningGeneration;
+    }
+
+
+    // Sets up a newly opened connection: pragmas, and the custom functions, collations and
+    // tokenizer that queries depend on. Used for the main connection and for pooled readers.
+    void SQLiteDataFile::configureConnection(SQLite::Database &sqlDb,
+                                             CollationContextVector &collationContexts,
+                                             shared_ptr<DocRootCache> &docRootCache) const
+    {
+        // (The cache, mmap, journal and thread settings are applied afterwards by applyTuning.)
+        const char *pragmas = "PRAGMA synchronous=normal; "         // Speeds up commits
+                              "PRAGMA case_sensitive_like=true";    // Case sensitive LIKE, for N1QL compat
+        LogTo(SQL, "%s", pragmas);
+        sqlDb.exec(pragmas);
 
 #if DEBUG
         // Deliberately make unordered queries unpredictable, to expose any LiteCore code that
         // unintentionally relies on ordering:
         if (arc4random() % 1)
-            _sqlDb->exec("PRAGMA reverse_unordered_selects=1");
+            sqlDb.exec("PRAGMA reverse_unordered_selects=1");
 #endif
 
-        // Configure number of extra threads to be used by SQLite:
-        int maxThreads = 0;
-#if TARGET_OS_OSX
-        maxThreads = 2;
-        // TODO: Configure for other platforms
-#endif
-        auto sqlite = _sqlDb->getHandle();
-        if (maxThreads > 0)
-            sqlite3_limit(sqlite, SQLITE_LIMIT_WORKER_THREADS, maxThreads);
+        auto sqlite = sqlDb.getHandle();
 
         // Register collators, custom functions, and the FTS tokenizer:
-        RegisterSQLiteUnicodeCollations(sqlite, _collationContexts);
-        RegisterSQLiteFunctions(sqlite, fleeceAccessor(), documentKeys());
+        RegisterSQLiteUnicodeCollations(sqlite, collationContexts);
+        docRootCache = make_shared<DocRootCache>(sqlite);
+        RegisterSQLiteFunctions(sqlite, fleeceAccessor(), documentKeys(), docRootCache);
         int rc = register_unicodesn_tokenizer(sqlite);
         if (rc != SQLITE_OK)
             Warn("Unable to register FTS tokenizer: SQLite err %d", rc);
@@ -251,7 +345,10 @@ namespace litecore {
 
 
     void SQLiteDataFile::close() {
+        stopMaintenance();
+        invalidateQueryCache();     // Cached queries hold statements open
         DataFile::close(); // closes all the KeyStores
+        closeReaders();
         _getLastSeqStmt.reset();
         _setLastSeqStmt.reset();
         if (_sqlDb) {
@@ -277,10 +374,11 @@ namespace litecore {
             _sqlDb.reset();
         }
         _collationContexts.clear();
+        _docRootCache.reset();
     }
 
 
-    bool SQLiteDataFile::decrypt() {
+    bool SQLiteDataFile::decrypt(SQLite::Database &sqlDb) const {
         auto alg = options().encryptionAlgorithm;
         if (!factory().encryptionEnabled(alg))
             return false;
@@ -294,14 +392,14 @@ namespace litecore {
         }
         // Calling sqlite3_key_v2 even with a null key (no encryption) reserves space in the db
         // header for a nonce, which will enable secure rekeying in the future.
-        int rc = sqlite3_key_v2(_sqlDb->getHandle(), nullptr, key.buf, (int)key.size);
+        int rc = sqlite3_key_v2(sqlDb.getHandle(), nullptr, key.buf, (int)key.size);
         if (rc != SQLITE_OK) {
             error::_throw(error::UnsupportedEncryption,
                           "Unable to set encryption key (SQLite error %d)", rc);
         }
 
         // Verify that encryption key is correct (or db is unencrypted, if no key given):
-        _exec("SELECT count(*) FROM sqlite_master");
+        sqlDb.exec("SELECT count(*) FROM sqlite_master");
 #endif
         return true;
     }
@@ -328,6 +426,7 @@ namespace litecore {
         
         if (newKey.size != kEncryptionKeySize[alg])
             error::_throw(error::InvalidParameter);
+        stopMaintenance();      // its connection uses the old key; reopen() restarts it
         int rekeyResult = 0;
         if(alg == kNoEncryption) {
             rekeyResult = sqlite3_rekey_v2(_sqlDb->getHandle(), nullptr, nullptr, 0);
@@ -366,6 +465,7 @@ namespace litecore {
     void SQLiteDataFile::_beginTransaction(Transaction*) {
         checkOpen();
         _exec("BEGIN");
+        claimMainConnection();
     }
 
 
@@ -375,20 +475,126 @@ namespace litecore {
             ((SQLiteKeyStore&)ks).transactionWillEnd(commit);
         });
 
-        exec(commit ? "COMMIT" : "ROLLBACK");
+        releaseMainConnection();
+        try {
+            exec(commit ? "COMMIT" : "ROLLBACK");
+        } catch (...) {
+            fileVersionRolledBack();
+            throw;
+        }
+        if (commit)
+            _committedFileVersion = _fileVersion;
+        else
+            fileVersionRolledBack();
+    }
+
+
+    // Group commit: each Transaction is a savepoint within the group's transaction.
+    void SQLiteDataFile::_beginGroupMember(Transaction*, bool beginGroup) {
+        checkOpen();
+        if (beginGroup)
+            _exec("BEGIN");
+        try {
+            _exec("SAVEPOINT groupMember");
+        } catch (...) {
+            if (beginGroup)
+                _exec("ROLLBACK");
+            throw;
+        }
+        claimMainConnection();
+    }
+
+
+    void SQLiteDataFile::_endGroupMember(Transaction *t, bool commit) {
+        forOpenKeyStores([commit](KeyStore &ks) {
+            ((SQLiteKeyStore&)ks).transactionWillEnd(commit);
+        });
+
+        releaseMainConnection();
+        if (commit) {
+            try {
+                _exec("RELEASE SAVEPOINT groupMember");
+                return;
+            } catch (...) {
+                // Don't leave my changes in the group for someone else to commit:
+                _exec("ROLLBACK TO SAVEPOINT groupMember");
+                _exec("RELEASE SAVEPOINT groupMember");
+                fileVersionRolledBack();
+                throw;
+            }
+        }
+        _exec("ROLLBACK TO SAVEPOINT groupMember");
+        _exec("RELEASE SAVEPOINT groupMember");
+        fileVersionRolledBack();
+    }
+
+
+    void SQLiteDataFile::_endGroup(bool commit) {
+        _exec(commit ? "COMMIT" : "ROLLBACK");
+        if (commit)
+            _committedFileVersion = _fileVersion;
+        else
+            fileVersionRolledBack();
+    }
+
+
+    // Maps a file's user_version to its DataFile::fileVersion.
+    /*static*/ int SQLiteDataFile::fileVersionOf(int userVersion) {
+        if (userVersion < kMinUserVersion)
+            error::_throw(error::DatabaseTooOld);
+        else if (userVersion <= kMaxV1UserVersion)
+            return 1;
+        else if (userVersion > kUserVersionBase + kCurrentFileVersion
+                    || userVersion < kUserVersionBase + 2)
+            error::_throw(error::DatabaseTooNew);
+        return userVersion - kUserVersionBase;
+    }
+
+
+    // The user_version is written in the transaction that first writes data needing the new
+    // format, so a file that's never written in it can still be opened by older versions.
+    void SQLiteDataFile::upgradeFileVersion(int version, Transaction&) {
+        if (version <= _fileVersion)
+            return;
+        Assert(inTransaction());
+        Assert(version <= writableFileVersion());
+        _exec(format("PRAGMA user_version=%d", kUserVersionBase + version));
+        _fileVersion = version;
+        LogTo(DBLog, "Upgraded %s to file version %d", filePath().path().c_str(), version);
+    }
+
+
+    // Called after a rollback (of a transaction or a group member's savepoint), which may have
+    // undone an upgrade of user_version.
+    void SQLiteDataFile::fileVersionRolledBack() {
+        if (_fileVersion != _committedFileVersion)
+            _fileVersion = fileVersionOf((int)intQuery("PRAGMA user_version"));
     }
 
 
     void SQLiteDataFile::beginReadOnlyTransaction() {
         checkOpen();
         _exec("SAVEPOINT roTransaction");
+        claimMainConnection();
     }
 
     void SQLiteDataFile::endReadOnlyTransaction() {
+        releaseMainConnection();
         _exec("RELEASE SAVEPOINT roTransaction");
     }
 
 
+    // While a transaction is open on the main connection, reads have to go through that
+    // connection too, instead of a pooled reader; see borrowReader().
+    void SQLiteDataFile::claimMainConnection() {
+        ++_mainConnectionUsers;
+    }
+
+    void SQLiteDataFile::releaseMainConnection() {
+        --_mainConnectionUsers;
+    }
+
+
     int SQLiteDataFile::_exec(const string &sql) {
         LogTo(SQL, "%s", sql.c_str());
         return _sqlDb->exec(sql);
@@ -416,6 +622,12 @@ namespace litecore {
     }
 
 
+    int64_t SQLiteDataFile::schemaVersion() {
+        checkOpen();
+        return intQuery("PRAGMA schema_version");
+    }
+
+
     SQLite::Statement& SQLiteDataFile::compile(const unique_ptr<SQLite::Statement>& ref,
                                                const char *sql) const
     {
@@ -446,6 +658,8 @@ namespace litecore {
 
     
     sequence_t SQLiteDataFile::lastSequence(const string& keyStoreName) const {
+        if (auto reader = borrowReader())
+            return reader->lastSequence(keyStoreName);
         sequence_t seq = 0;
         compile(_getLastSeqStmt, "SELECT lastSeq FROM kvmeta WHERE name=?");
         UsingStatement u(_getLastSeqStmt);
@@ -465,19 +679,191 @@ namespace litecore {
     }
 
 
+#pragma mark - READER POOL:
+
+
+    struct SQLiteDataFile::ReaderPool {
+        std::mutex                  poolMutex;
+        vector<unique_ptr<Reader>>  idle;       // Readers not currently borrowed
+        bool                        open {true};
+        Tuning                      tuning { };             // Current storage tuning
+        unsigned                    tuningGeneration {0};   // Incremented by setTuning
+    };
+
+
+    SQLiteDataFile::ReaderRef SQLiteDataFile::borrowReader() const {
+        checkOpen();
+        if (_mainConnectionUsers > 0)
+            return nullptr;
+        auto pool = _readerPool;
+        unique_ptr<Reader> reader;
+        Tuning tuning;
+        unsigned tuningGeneration;
+        {
+            lock_guard<mutex> lock(pool->poolMutex);
+            if (!pool->idle.empty()) {
+                reader = move(pool->idle.back());
+                pool->idle.pop_back();
+            }
+            tuning = pool->tuning;
+            tuningGeneration = pool->tuningGeneration;
+        }
+        bool newReader = !reader;
+        if (newReader)
+            reader = openReader();
+        if (newReader || reader->_tuningGeneration != tuningGeneration) {
+            applyTuning(*reader->_sqlDb, tuning);
+            reader->_tuningGeneration = tuningGeneration;
+        }
+        // The deleter puts the Reader back in the pool, unless the pool is full or closed:
+        return ReaderRef(reader.release(), [pool](Reader *r) {
+            unique_ptr<Reader> returned(r);
+            lock_guard<mutex> lock(pool->poolMutex);
+            if (pool->open && pool->idle.size() < kMaxIdleReaders)
+                pool->idle.push_back(move(returned));
+        });
+    }
+
+
+    unique_ptr<SQLiteDataFile::Reader> SQLiteDataFile::openReader() const {
+        LogVerbose(DBLog, "Opening read-only connection to %s", filePath().path().c_str());
+        unique_ptr<Reader> reader(new Reader);
+        reader->_sqlDb = make_unique<SQLite::Database>(filePath().path().c_str(),
+                                                       SQLite::OPEN_READONLY,
+                                                       kBusyTimeoutSecs * 1000);
+        if (!decrypt(*reader->_sqlDb))
+            error::_throw(error::UnsupportedEncryption);
+        configureConnection(*reader->_sqlDb, reader->_collationContexts, reader->_docRootCache);
+        return reader;
+    }
+
+
+    void SQLiteDataFile::closeReaders() {
+        if (!_readerPool)
+            return;
+        // Borrowed Readers will be closed when they're returned:
+        lock_guard<mutex> lock(_readerPool->poolMutex);
+        _readerPool->open = false;
+        _readerPool->idle.clear();
+    }
+
+
+    SQLiteDataFile::Reader::~Reader() {
+        _statements.clear();    // Statements have to be finalized before the db is closed
+    }
+
+
+    shared_ptr<SQLite::Statement> SQLiteDataFile::Reader::compile(const string &sql) {
+        auto &stmt = _statements[sql];
+        if (!stmt) {
+            try {
+                stmt = make_shared<SQLite::Statement>(*_sqlDb, sql);
+            } catch (const SQLite::Exception &x) {
+                _statements.erase(sql);
+                Warn("SQLite error compiling statement \"%s\": %s", sql.c_str(), x.what());
+                throw;
+            }
+        }
+        return stmt;
+    }
+
+
+    sequence_t SQLiteDataFile::Reader::lastSequence(const string& keyStoreName) {
+        sequence_t seq = 0;
+        auto stmt = compile("SELECT lastSeq FROM kvmeta WHERE name=?");
+        UsingStatement u(*stmt);
+        stmt->bindNoCopy(1, keyStoreName);
+        if (stmt->executeStep())
+            seq = (int64_t)stmt->getColumn(0);
+        return seq;
+    }
+
+
+    void SQLiteDataFile::Reader::beginReadOnlyTransaction() {
+        LogTo(SQL, "SAVEPOINT roTransaction");
+        _sqlDb->exec("SAVEPOINT roTransaction");
+    }
+
+    void SQLiteDataFile::Reader::endReadOnlyTransaction() {
+        LogTo(SQL, "RELEASE SAVEPOINT roTransaction");
+        _sqlDb->exec("RELEASE SAVEPOINT roTransaction");
+    }
+
+
+#pragma mark - QUERY CACHE:
+
+
+    // LRU cache of compiled queries, keyed by KeyStore name and canonical query expression.
+    struct SQLiteDataFile::QueryCache {
+        using Entry = pair<string, Retained<Query>>;
+
+        std::mutex                                      cacheMutex;
+        list<Entry>                                     entries;    // Most recently used first
+        unordered_map<string, list<Entry>::iterator>    index;      // Maps key to its entry
+        uint64_t                                        hits {0}, misses {0};
+    };
+
+
+    Retained<Query> SQLiteDataFile::cachedQuery(const string &key) {
+        lock_guard<mutex> lock(_queryCache->cacheMutex);
+        auto i = _queryCache->index.find(key);
+        if (i == _queryCache->index.end()) {
+            ++_queryCache->misses;
+            return nullptr;
+        }
+        ++_queryCache->hits;
+        auto &entries = _queryCache->entries;
+        entries.splice(entries.begin(), entries, i->second);
+        return i->second->second;
+    }
+
+
+    void SQLiteDataFile::cacheQuery(const string &key, Query *query) {
+        lock_guard<mutex> lock(_queryCache->cacheMutex);
+        if (_queryCache->index.find(key) != _queryCache->index.end())
+            return;     // Another thread compiled the same query first
+        auto &entries = _queryCache->entries;
+        entries.emplace_front(key, query);
+        _queryCache->index[key] = entries.begin();
+        if (entries.size() > kQueryCacheSize) {
+            _queryCache->index.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+
+
+    void SQLiteDataFile::invalidateQueryCache() {
+        lock_guard<mutex> lock(_queryCache->cacheMutex);
+        if (!_queryCache->entries.empty())
+            LogVerbose(DBLog, "Clearing cache of %zu compiled queries", _queryCache->entries.size());
+        _queryCache->index.clear();
+        _queryCache->entries.clear();
+    }
+
+
+    DataFile::QueryCacheStats SQLiteDataFile::queryCacheStats() const {
+        lock_guard<mutex> lock(_queryCache->cacheMutex);
+        return {_queryCache->hits, _queryCache->misses, _queryCache->entries.size()};
+    }
+
+
+#pragma mark - HOUSEKEEPING:
+
+
     void SQLiteDataFile::optimizeAndVacuum() {
         // <https://sqlite.org/pragma.html#pragma_optimize>
         // <https://blogs.gnome.org/jnelson/2015/01/06/sqlite-vacuum-and-auto_vacuum/>
         try {
             int64_t pageCount = intQuery("PRAGMA page_count");
             int64_t freePages = intQuery("PRAGMA freelist_count");
+            int64_t pageSize = intQuery("PRAGMA page_size");
             LogVerbose(DBLog, "Pre-close housekeeping: %lld of %lld pages free (%.0f%%)",
                        (long long)freePages, (long long)pageCount, (float)freePages / pageCount);
 
             _exec("PRAGMA optimize");
 
             if ((pageCount > 0 && (float)freePages / pageCount >= kVacuumFractionThreshold)
-                    || (freePages * kPageSize >= kVacuumSizeThreshold)) {
+                    || (freePages * pageSize >= kVacuumSizeThreshold)) {
                 Log("Vacuuming database '%s'...", filePath().dirName().c_str());
                 _exec("PRAGMA incremental_vacuum");
             }
@@ -487,12 +873,189 @@ namespace litecore {
     }
 
 
+#pragma mark - BACKGROUND MAINTENANCE:
+
+
+    struct SQLiteDataFile::Maintenance {
+        std::mutex              mutex;
+        condition_variable      cond;
+        std::thread             thread;
+        bool                    stop {false};
+        MaintenanceStats        stats { };
+        MaintenanceObserver     observer;
+    };
+
+
+    void SQLiteDataFile::startMaintenance() {
+        if (!_maintenance)
+            _maintenance.reset(new Maintenance);
+        _maintenance->stop = false;
+        _maintenance->thread = thread([this]{ maintenanceLoop(); });
+    }
+
+
+    void SQLiteDataFile::stopMaintenance() {
+        if (!_maintenance || !_maintenance->thread.joinable())
+            return;
+        {
+            lock_guard<mutex> lock(_maintenance->mutex);
+            _maintenance->stop = true;
+        }
+        _maintenance->cond.notify_all();
+        _maintenance->thread.join();
+    }
+
+
+    DataFile::MaintenanceStats SQLiteDataFile::maintenanceStats() const {
+        if (!_maintenance)
+            return { };
+        lock_guard<mutex> lock(_maintenance->mutex);
+        return _maintenance->stats;
+    }
+
+
+    void SQLiteDataFile::setMaintenanceObserver(MaintenanceObserver observer) {
+        if (!_maintenance)
+            _maintenance.reset(new Maintenance);
+        lock_guard<mutex> lock(_maintenance->mutex);
+        _maintenance->observer = observer;
+    }
+
+
+    // Body of the maintenance thread. It has its own read-write connection, and doesn't start a
+    // run unless the file has been idle for a while. The vacuum and optimize steps write to the
+    // file, so they run under the file lock, like a Transaction: if a Transaction is in progress
+    // or waiting, the step is skipped rather than letting the two overlap. (Otherwise a deferred
+    // BEGIN on the main connection could find its snapshot stale and fail.) The connection has
+    // no busy timeout, so if another process holds the file it gets SQLITE_BUSY and skips too.
+    void SQLiteDataFile::maintenanceLoop() {
+        Maintenance &m = *_maintenance;
+        CollationContextVector collationContexts;
+        shared_ptr<DocRootCache> docRootCache;
+        unique_ptr<SQLite::Database> sqlDb;
+        int64_t walFrames = 0, walCheckpointed = 0;
+        auto nextOptimize = chrono::steady_clock::now() + kOptimizeInterval;
+
+        while (true) {
+            {
+                unique_lock<mutex> lock(m.mutex);
+                if (m.cond.wait_for(lock, kMaintenanceInterval, [&]{return m.stop;}))
+                    break;
+            }
+
+            MaintenanceStats run { };
+            if (idleTime() < kMaintenanceIdleTime) {
+                run.deferred = 1;
+            } else {
+                try {
+                    if (!sqlDb) {
+                        sqlDb = make_unique<SQLite::Database>(filePath().path().c_str(),
+                                                              SQLite::OPEN_READWRITE, 0);
+                        if (!decrypt(*sqlDb))
+                            error::_throw(error::UnsupportedEncryption);
+                        configureConnection(*sqlDb, collationContexts, docRootCache);
+                        applyTuning(*sqlDb, options().tuning);
+                    }
+                    run.runs = 1;
+
+                    // Copy committed WAL pages into the file, without waiting for readers:
+                    SQLite::Statement checkpoint(*sqlDb, "PRAGMA wal_checkpoint(PASSIVE)");
+                    if (checkpoint.executeStep() && checkpoint.getColumn(0).getInt() == 0) {
+                        int64_t frames = checkpoint.getColumn(1).getInt64();
+                        int64_t checkpointed = checkpoint.getColumn(2).getInt64();
+                        if (frames < walFrames)
+                            walCheckpointed = 0;        // WAL was restarted since last time
+                        if (checkpointed > walCheckpointed) {
+                            run.checkpoints = 1;
+                            run.pagesCheckpointed = checkpointed - walCheckpointed;
+                        }
+                        walFrames = frames;
+                        walCheckpointed = checkpointed;
+                    }
+                    checkpoint.reset();
+
+                    bool locked = tryWithFileLock([&]{
+                        // Release a bounded number of free pages:
+                        int64_t pageCount = sqlDb->execAndGet("PRAGMA page_count").getInt64();
+                        int64_t freePages = sqlDb->execAndGet("PRAGMA freelist_count").getInt64();
+                        if (freePages >= kVacuumPagesPerStep
+                                || (pageCount > 0 && (float)freePages / pageCount >= kVacuumFractionThreshold)) {
+                            sqlDb->exec(format("PRAGMA incremental_vacuum(%d)", kVacuumPagesPerStep));
+                            int64_t nowFree = sqlDb->execAndGet("PRAGMA freelist_count").getInt64();
+                            run.vacuumSteps = 1;
+                            run.pagesVacuumed = (uint64_t)max(0LL, (long long)(freePages - nowFree));
+                        }
+
+                        if (chrono::steady_clock::now() >= nextOptimize) {
+                            sqlDb->exec("PRAGMA optimize");
+                            run.optimizes = 1;
+                            nextOptimize = chrono::steady_clock::now() + kOptimizeInterval;
+                        }
+                    });
+                    if (!locked)
+                        run.deferred = 1;           // A Transaction got in first; try again later
+                } catch (const SQLite::Exception &x) {
+                    int err = x.getErrorCode();
+                    if (err == SQLITE_BUSY || err == SQLITE_LOCKED)
+                        run.deferred = 1;           // A writer got in first; try again later
+                    else
+                        Warn("Background maintenance of %s failed: %s",
+                             filePath().path().c_str(), x.what());
+                } catch (const exception &x) {
+                    Warn("Background maintenance of %s failed: %s",
+                         filePath().path().c_str(), x.what());
+                }
+            }
+
+            MaintenanceStats stats;
+            MaintenanceObserver observer;
+            {
+                lock_guard<mutex> lock(m.mutex);
+                m.stats.runs += run.runs;
+                m.stats.deferred += run.deferred;
+                m.stats.checkpoints += run.checkpoints;
+                m.stats.pagesCheckpointed += run.pagesCheckpointed;
+                m.stats.vacuumSteps += run.vacuumSteps;
+                m.stats.pagesVacuumed += run.pagesVacuumed;
+                m.stats.optimizes += run.optimizes;
+                stats = m.stats;
+                observer = m.observer;
+            }
+            if (run.checkpoints || run.vacuumSteps || run.optimizes) {
+                LogVerbose(DBLog, "Background maintenance of %s: checkpointed %llu pages, "
+                           "vacuumed %llu pages%s", filePath().path().c_str(),
+                           (unsigned long long)run.pagesCheckpointed,
+                           (unsigned long long)run.pagesVacuumed,
+                           (run.optimizes ? ", optimized" : ""));
+                if (observer)
+                    observer(stats);
+            }
+        }
+    }
+
+
     void SQLiteDataFile::compact() {
         checkOpen();
         optimizeAndVacuum();
     }
 
 
+    unsigned SQLiteDataFile::compactStep(unsigned maxPages) {
+        checkOpen();
+        int64_t freed = 0;
+        withFileLock([&]{
+            int64_t freePages = intQuery("PRAGMA freelist_count");
+            if (freePages > 0) {
+                _exec(format("PRAGMA incremental_vacuum(%u)", maxPages));
+                freed = freePages - intQuery("PRAGMA freelist_count");
+            }
+            if (freed <= 0)
+                _exec("PRAGMA optimize");       // Last step; update the query planner's stats
+        });
+        return (unsigned)max(freed, (int64_t)0);
+    }
+
+
     alloc_slice SQLiteDataFile::rawQuery(const string &query) {
         SQLite::Statement stmt(*_sqlDb, query);
         int nCols = stmt.getColumnCount();
@@ -20,6 +20,8 @@
 
 #include "DataFile.hh"
 #include "UnicodeCollator.hh"
+#include <atomic>
+#include <unordered_map>
 
 namespace SQLite {
     class Database;
@@ -31,6 +33,8 @@ namespace SQLite {
 namespace litecore {
 
     class SQLiteKeyStore;
+    class Query;
+    class DocRootCache;
 
 
     /** SQLite implementation of Database. */
@@ -43,11 +47,18 @@ namespace litecore {
         bool isOpen() const noexcept override;
         void close() override;
         void compact() override;
+        unsigned compactStep(unsigned maxPages) override;
+        void setTuning(const Tuning&) override;
+        int fileVersion() const override                    {return _fileVersion;}
+        void upgradeFileVersion(int version, Transaction&) override;
 
         static void shutdown() { }
 
         operator SQLite::Database&() {return *_sqlDb;}
 
+        /** The main connection's memo of document roots, used by the query functions. */
+        std::shared_ptr<DocRootCache> docRootCache() const  {return _docRootCache;}
+
 #if 0 //UNUSED:
         std::vector<std::string> allKeyStoreNames() override;
 #endif
@@ -56,6 +67,11 @@ namespace litecore {
 
         fleece::alloc_slice rawQuery(const std::string &query) override;
 
+        QueryCacheStats queryCacheStats() const override;
+
+        MaintenanceStats maintenanceStats() const override;
+        void setMaintenanceObserver(MaintenanceObserver) override;
+
         class Factory : public DataFile::Factory {
         public:
             Factory();
@@ -70,11 +86,52 @@ namespace litecore {
         static Factory& sqliteFactory();
         virtual Factory& factory() const override   {return SQLiteDataFile::sqliteFactory();};
 
+
+        /** A read-only connection to the same file, borrowed from the data file's pool, plus the
+            statements that have been compiled on it. A Reader is used by one thread at a time. */
+        class Reader {
+        public:
+            ~Reader();
+
+            operator SQLite::Database&()                {return *_sqlDb;}
+
+            std::shared_ptr<DocRootCache> docRootCache() const  {return _docRootCache;}
+
+            /** Returns a statement compiled on this connection; it's cached for reuse. */
+            std::shared_ptr<SQLite::Statement> compile(const std::string &sql);
+
+            sequence_t lastSequence(const std::string& keyStoreName);
+
+            void beginReadOnlyTransaction();
+            void endReadOnlyTransaction();
+
+        private:
+            friend class SQLiteDataFile;
+            Reader() =default;
+
+            CollationContextVector _collationContexts;
+            std::shared_ptr<DocRootCache> _docRootCache;
+            std::unique_ptr<SQLite::Database> _sqlDb;
+            std::unordered_map<std::string, std::shared_ptr<SQLite::Statement>> _statements;
+            unsigned _tuningGeneration {0};     // ReaderPool::tuningGeneration last applied
+        };
+
+        using ReaderRef = std::shared_ptr<Reader>;
+
+        /** Borrows an idle read-only connection from the pool, opening one if necessary; it's
+            returned to the pool when the last reference goes away. Returns nullptr while this
+            DataFile has a Transaction (or ReadOnlyTransaction) open, on whatever thread, since
+            reads then have to use the main connection to see its uncommitted changes. */
+        ReaderRef borrowReader() const;
+
     protected:
         void reopen() override;
         void rekey(EncryptionAlgorithm, slice newKey) override;
         void _beginTransaction(Transaction*) override;
         void _endTransaction(Transaction*, bool commit) override;
+        void _beginGroupMember(Transaction*, bool beginGroup) override;
+        void _endGroupMember(Transaction*, bool commit) override;
+        void _endGroup(bool commit) override;
         void beginReadOnlyTransaction() override;
         void endReadOnlyTransaction() override;
         KeyStore* newKeyStore(const std::string &name, KeyStore::Capabilities) override;
@@ -90,17 +147,49 @@ namespace litecore {
         int exec(const std::string &sql);
         int execWithLock(const std::string &sql);
         int64_t intQuery(const char *query);
+
+        // SQLite's schema cookie, which changes whenever any connection alters the schema:
+        int64_t schemaVersion();
         void optimizeAndVacuum();
 
+        // Cache of compiled queries, used by SQLiteKeyStore::compileQuery:
+        Retained<Query> cachedQuery(const std::string &key);
+        void cacheQuery(const std::string &key, Query*);
+        void invalidateQueryCache();
+
     private:
         friend class SQLiteKeyStore;
 
-        bool decrypt();
+        struct ReaderPool;
+        struct QueryCache;
+        struct Maintenance;
+
+        bool decrypt(SQLite::Database&) const;
+        void configureConnection(SQLite::Database&, CollationContextVector&,
+                                 std::shared_ptr<DocRootCache>&) const;
+        static Tuning effectiveTuning(Tuning);
+        static void applyTuning(SQLite::Database&, const Tuning&);
+        std::unique_ptr<Reader> openReader() const;
+        void closeReaders();
+        void claimMainConnection();
+        void releaseMainConnection();
+        void startMaintenance();
+        void stopMaintenance();
+        void maintenanceLoop();
         int _exec(const std::string &sql);
+        static int fileVersionOf(int userVersion);
+        void fileVersionRolledBack();
 
         std::unique_ptr<SQLite::Database>    _sqlDb;         // SQLite database object
         std::unique_ptr<SQLite::Statement>   _getLastSeqStmt, _setLastSeqStmt;
         CollationContextVector _collationContexts;
+        std::shared_ptr<DocRootCache>        _docRootCache;
+        std::shared_ptr<ReaderPool>          _readerPool;    // Idle read-only connections
+        std::unique_ptr<QueryCache>          _queryCache;    // Compiled queries, by expression
+        std::unique_ptr<Maintenance>         _maintenance;   // Background maintenance thread
+        std::atomic<int>                     _mainConnectionUsers {0};
+        std::atomic<int>                     _fileVersion {0};   // Derived from user_version
+        int                                  _committedFileVersion {0};  // ...as last committed
     };
 
 }
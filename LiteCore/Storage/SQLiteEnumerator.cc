@@ -27,39 +27,84 @@
 #include "SQLiteCpp/SQLiteCpp.h"
 #include <sstream>
 #include <iostream>
+#include <vector>
 
 using namespace std;
 using namespace fleece;
 
 namespace litecore {
 
+    // Max number of idle statements with the same SQL to keep for reuse on the main connection
+    static constexpr size_t kMaxIdleEnumStatements = 4;
+
+
    class SQLiteEnumerator : public RecordEnumerator::Impl {
     public:
-        SQLiteEnumerator(SQLite::Statement *stmt, bool descending, ContentOptions content)
-        :_stmt(stmt),
+        SQLiteEnumerator(shared_ptr<SQLiteKeyStore::EnumStatementPool> pool, const string &sql,
+                         shared_ptr<SQLite::Statement> stmt, ContentOptions content,
+                         SQLiteDataFile::ReaderRef reader)
+        :_pool(pool),
+         _sql(sql),
+         _reader(reader),
+         _stmt(stmt),
          _content(content)
         {
-            LogTo(SQL, "Enumerator: %s", _stmt->getQuery().c_str());
+            LogTo(SQL, "Enumerator: %s", _sql.c_str());
+        }
+
+        ~SQLiteEnumerator() {
+            // Recycle the statement. One compiled on a Reader is already cached by the Reader.
+            // If the KeyStore has been closed since, the statement is finalized instead.
+            try {
+                _stmt->reset();
+            } catch (...) {
+                return;
+            }
+            if (!_reader) {
+                lock_guard<mutex> lock(_pool->mutex);
+                if (_pool->open && _pool->idle.count(_sql) < kMaxIdleEnumStatements)
+                    _pool->idle.emplace(_sql, move(_stmt));
+            }
         }
 
         virtual bool next() override {
             return _stmt->executeStep();
         }
 
+        // The Record borrows the row's data instead of copying it; that's safe because
+        // RecordEnumerator::next() clears the Record before it calls next() to step the
+        // statement again.
         virtual bool read(Record &rec) override {
             rec.updateSequence((int64_t)_stmt->getColumn(0));
             rec.setFlags((DocumentFlags)(int)_stmt->getColumn(1));
-            rec.setKey(SQLiteKeyStore::columnAsSlice(_stmt->getColumn(2)));
-            SQLiteKeyStore::setRecordMetaAndBody(rec, *_stmt.get(), _content);
+            rec.borrowKey(SQLiteKeyStore::columnAsSlice(_stmt->getColumn(2)));
+            SQLiteKeyStore::setRecordMetaAndBody(rec, *_stmt.get(), _content, true);
             return true;
         }
 
     private:
-        unique_ptr<SQLite::Statement> _stmt;
+        shared_ptr<SQLiteKeyStore::EnumStatementPool> _pool;  // Where _stmt goes when done
+        string _sql;
+        SQLiteDataFile::ReaderRef _reader;      // Connection _stmt runs on, if not the main one
+        shared_ptr<SQLite::Statement> _stmt;
         ContentOptions _content;
     };
 
 
+    shared_ptr<SQLite::Statement> SQLiteKeyStore::checkOutEnumStatement(const string &sql) {
+        {
+            lock_guard<mutex> lock(_enumStmts->mutex);
+            auto i = _enumStmts->idle.find(sql);
+            if (i != _enumStmts->idle.end()) {
+                auto stmt = move(i->second);
+                _enumStmts->idle.erase(i);
+                return stmt;
+            }
+        }
+        return shared_ptr<SQLite::Statement>(compile(sql));
+    }
+
+
     void SQLiteKeyStore::selectFrom(stringstream& in, RecordEnumerator::Options options) {
         in << "SELECT sequence, flags, key, version";
         if (options.contentOptions & kMetaOnly)
@@ -72,6 +117,23 @@ namespace litecore {
     void SQLiteKeyStore::writeSQLOptions(stringstream &sql, RecordEnumerator::Options options) {
         if (options.descending)
             sql << " DESC";
+        if (options.limit > 0 || options.skip > 0)
+            sql << " LIMIT ? OFFSET ?";     // (parameters, so the statement can be reused)
+    }
+
+
+    // Returns the smallest string greater than every string that starts with `prefix`,
+    // or an empty string if there is none (i.e. the prefix is all 0xFF bytes.)
+    static string prefixUpperBound(slice prefix) {
+        string bound = prefix.asString();
+        while (!bound.empty()) {
+            if ((uint8_t)bound.back() < 0xFF) {
+                bound.back() = (char)((uint8_t)bound.back() + 1);
+                break;
+            }
+            bound.pop_back();
+        }
+        return bound;
     }
 
 
@@ -82,31 +144,58 @@ namespace litecore {
         if (bySequence && _db.options().writeable)
             createSequenceIndex();
 
+        // Key constraints are expressed as comparisons on the `key` column, so SQLite can satisfy
+        // them (and the LIMIT) by seeking in the primary-key index instead of scanning:
+        vector<string> keyBindings;
+        auto keyCompare = [&](const char *op, string key) {
+            keyBindings.push_back(move(key));
+            return string("key ") + op + " ?";
+        };
+
+        vector<string> conditions;
+        if (bySequence)
+            conditions.push_back("sequence > ?");
+        if (!options.includeDeleted)
+            conditions.push_back("(flags & 1) != 1");
+        if (options.onlyBlobs)
+            conditions.push_back("(flags & 4) != 0");
+        // (startKey and endKey follow the iteration order, unless that's by sequence.)
+        bool reverseKeys = options.descending && !bySequence;
+        if (options.startKey)
+            conditions.push_back(keyCompare(reverseKeys ? "<=" : ">=",
+                                            options.startKey.asString()));
+        if (options.endKey)
+            conditions.push_back(keyCompare(reverseKeys ? ">=" : "<=",
+                                            options.endKey.asString()));
+        if (options.prefix.size > 0) {
+            conditions.push_back(keyCompare(">=", options.prefix.asString()));
+            string upper = prefixUpperBound(options.prefix);
+            if (!upper.empty())
+                conditions.push_back(keyCompare("<", upper));
+        }
+
         stringstream sql;
         selectFrom(sql, options);
-        bool writeAnd = false;
-        if (bySequence) {
-            sql << " WHERE sequence > ?";
-            writeAnd = true;
-        } else {
-            if (!options.includeDeleted || options.onlyBlobs)
-                sql << " WHERE ";
-        }
-        if (!options.includeDeleted) {
-            if (writeAnd) sql << " AND "; else writeAnd = true;
-            sql << "(flags & 1) != 1";
-        }
-        if (options.onlyBlobs) {
-            if(writeAnd) sql << " AND "; // else writeAnd = true;
-            sql << "(flags & 4) != 0";
-        }
+        for (size_t i = 0; i < conditions.size(); ++i)
+            sql << (i == 0 ? " WHERE " : " AND ") << conditions[i];
         sql << (bySequence ? " ORDER BY sequence" : " ORDER BY key");
         writeSQLOptions(sql, options);
 
-        auto stmt = new SQLite::Statement(db(), sql.str());        // TODO: Cache a statement
+        // Enumerate on a pooled read-only connection if possible, so other threads can read too.
+        // Either way the compiled statement is reused by later enumerators with the same SQL.
+        string sqlStr = sql.str();
+        auto reader = db().borrowReader();
+        auto stmt = reader ? reader->compile(sqlStr) : checkOutEnumStatement(sqlStr);
+        int param = 1;
         if (bySequence)
-            stmt->bind(1, (long long)since);
-        return new SQLiteEnumerator(stmt, options.descending, options.contentOptions);
+            stmt->bind(param++, (long long)since);
+        for (auto &key : keyBindings)
+            stmt->bind(param++, key);       // (copies the string)
+        if (options.limit > 0 || options.skip > 0) {
+            stmt->bind(param++, options.limit > 0 ? (long long)options.limit : -1); // -1 = no limit
+            stmt->bind(param++, (long long)options.skip);
+        }
+        return new SQLiteEnumerator(_enumStmts, sqlStr, stmt, options.contentOptions, reader);
     }
 
 }
@@ -79,6 +79,8 @@ namespace litecore {
         _getBySeqStmt.reset();
         _getByOffStmt.reset();
         _getMetaBySeqStmt.reset();
+        _getManyStmt.reset();
+        _getManyMetaStmt.reset();
         _setStmt.reset();
         _insertStmt.reset();
         _replaceStmt.reset();
@@ -87,6 +89,12 @@ namespace litecore {
         _delByBothStmt.reset();
         _backupStmt.reset();
         _setFlagStmt.reset();
+        {
+            lock_guard<mutex> lock(_enumStmts->mutex);
+            _enumStmts->open = false;
+            _enumStmts->idle.clear();
+        }
+        _enumStmts = make_shared<EnumStatementPool>();     // in case the KeyStore is reopened
         KeyStore::close();
     }
 
@@ -122,15 +130,25 @@ namespace litecore {
     }
 
 
+    // Compiles a read-only statement on a pooled reader connection, if one was borrowed;
+    // else on the main connection.
+    SQLite::Statement& SQLiteKeyStore::compile(SQLiteDataFile::Reader *reader,
+                                               const unique_ptr<SQLite::Statement>& ref,
+                                               const char *sqlTemplate) const
+    {
+        if (reader)
+            return *reader->compile(subst(sqlTemplate));
+        return compile(ref, sqlTemplate);
+    }
+
+
     uint64_t SQLiteKeyStore::recordCount() const {
-        if (!_recCountStmt) {
-            stringstream sql;
-            sql << "SELECT count(*) FROM kv_" << _name << " WHERE (flags & 1) != 1";
-            compile(_recCountStmt, sql.str().c_str());
-        }
-        UsingStatement u(_recCountStmt);
-        if (_recCountStmt->executeStep()) {
-            auto count = (int64_t)_recCountStmt->getColumn(0);
+        auto reader = db().borrowReader();
+        auto &stmt = compile(reader.get(), _recCountStmt,
+                             "SELECT count(*) FROM kv_@ WHERE (flags & 1) != 1");
+        UsingStatement u(stmt);
+        if (stmt.executeStep()) {
+            auto count = (int64_t)stmt.getColumn(0);
             return count;
         }
         return 0;
@@ -170,61 +188,174 @@ namespace litecore {
     }
 
 
-    // OPT: Would be nice to avoid copying key/vers/body here; this would require Record to
-    // know that the pointers are ephemeral, and create copies if they're accessed as
-    // alloc_slice (not just slice).
-
-
-    // Gets flags from col 1, version from col 3, and body (or its length) from col 4
+    // Gets flags from col 1, version from col 3, and body (or its length) from col 4.
+    // If `borrow` is true, the Record points into the statement's current row instead of copying
+    // it, so it mustn't be used after the statement is stepped or reset.
     /*static*/ void SQLiteKeyStore::setRecordMetaAndBody(Record &rec,
                                                          SQLite::Statement &stmt,
-                                                         ContentOptions options)
+                                                         ContentOptions options,
+                                                         bool borrow)
     {
         rec.setExists();
         rec.setFlags((DocumentFlags)(int)stmt.getColumn(1));
-        rec.setVersion(columnAsSlice(stmt.getColumn(3)));
+        if (borrow)
+            rec.borrowVersion(columnAsSlice(stmt.getColumn(3)));
+        else
+            rec.setVersion(columnAsSlice(stmt.getColumn(3)));
         if (options & kMetaOnly)
             rec.setUnloadedBodySize((ssize_t)stmt.getColumn(4));
+        else if (borrow)
+            rec.borrowBody(columnAsSlice(stmt.getColumn(4)));
         else
             rec.setBody(columnAsSlice(stmt.getColumn(4)));
     }
     
 
     bool SQLiteKeyStore::read(Record &rec, ContentOptions options) const {
+        return readRow(rec, options, false, [](const Record&) { });
+    }
+
+
+    void SQLiteKeyStore::get(slice key, ContentOptions options,
+                             function_ref<void(const Record&)> fn)
+    {
+        Record rec;
+        rec.borrowKey(key);
+        readRow(rec, options, true, fn);
+    }
+
+
+    // Reads the row with key rec.key() into `rec`, then calls `fn` while the row is current.
+    bool SQLiteKeyStore::readRow(Record &rec, ContentOptions options, bool borrow,
+                                 function_ref<void(const Record&)> fn) const
+    {
+        auto reader = db().borrowReader();
         auto &stmt = (options & kMetaOnly)
-            ? compile(_getMetaByKeyStmt,
+            ? compile(reader.get(), _getMetaByKeyStmt,
                       "SELECT sequence, flags, 0, version, length(body) FROM kv_@ WHERE key=?")
-            : compile(_getByKeyStmt,
+            : compile(reader.get(), _getByKeyStmt,
                       "SELECT sequence, flags, 0, version, body FROM kv_@ WHERE key=?");
-        stmt.bindNoCopy(1, (const char*)rec.key().buf, (int)rec.key().size);
+        slice key = rec.keySlice();
+        stmt.bindNoCopy(1, (const char*)key.buf, (int)key.size);
         UsingStatement u(stmt);
-        if (!stmt.executeStep())
-            return false;
+        bool found = stmt.executeStep();
+        if (found) {
+            sequence_t seq = (int64_t)stmt.getColumn(0);
+            rec.updateSequence(seq);
+            setRecordMetaAndBody(rec, stmt, options, borrow);
+        }
+        fn(rec);
+        return found;
+    }
+
 
-        sequence_t seq = (int64_t)stmt.getColumn(0);
-        rec.updateSequence(seq);
-        setRecordMetaAndBody(rec, stmt, options);
-        return true;
+    // Number of keys getMany looks up with each statement. A shorter batch is padded by repeating
+    // its first key, so that a single compiled statement serves every batch.
+    static constexpr size_t kGetManyBatchSize = 32;
+
+    static string getManySQL(bool metaOnly) {
+        stringstream sql;
+        sql << "SELECT sequence, flags, key, version, " << (metaOnly ? "length(body)" : "body")
+            << " FROM kv_@ WHERE key IN (?";
+        for (size_t i = 1; i < kGetManyBatchSize; ++i)
+            sql << ",?";
+        sql << ")";
+        return sql.str();
+    }
+
+
+    vector<Record> SQLiteKeyStore::getMany(const vector<slice> &keys,
+                                           ContentOptions options) const
+    {
+        vector<Record> recs;
+        recs.reserve(keys.size());
+        for (auto key : keys)
+            recs.emplace_back(key);
+        if (keys.empty())
+            return recs;
+
+        static const string kGetManySQL = getManySQL(false), kGetManyMetaSQL = getManySQL(true);
+        auto reader = db().borrowReader();
+        auto &stmt = (options & kMetaOnly)
+            ? compile(reader.get(), _getManyMetaStmt, kGetManyMetaSQL.c_str())
+            : compile(reader.get(), _getManyStmt, kGetManySQL.c_str());
+
+        auto readBatches = [&]() {
+            for (size_t start = 0; start < keys.size(); start += kGetManyBatchSize) {
+                size_t end = min(start + kGetManyBatchSize, keys.size());
+                UsingStatement u(stmt);
+                for (size_t i = 0; i < kGetManyBatchSize; ++i) {
+                    slice key = keys[(start + i < end) ? start + i : start];
+                    stmt.bindNoCopy((int)i + 1, (const char*)key.buf, (int)key.size);
+                }
+                while (stmt.executeStep()) {
+                    // Rows come back in index order, so match each to its request(s):
+                    slice key = columnAsSlice(stmt.getColumn(2));
+                    for (size_t i = start; i < end; ++i) {
+                        if (keys[i] == key) {
+                            recs[i].updateSequence((int64_t)stmt.getColumn(0));
+                            setRecordMetaAndBody(recs[i], stmt, options);
+                        }
+                    }
+                }
+            }
+        };
+
+        if (reader && keys.size() > kGetManyBatchSize) {
+            // Read all the batches from the same snapshot of the database:
+            reader->beginReadOnlyTransaction();
+            try {
+                readBatches();
+                reader->endReadOnlyTransaction();
+            } catch (...) {
+                try {
+                    reader->endReadOnlyTransaction();
+                } catch (...) { }
+                throw;
+            }
+        } else {
+            readBatches();
+        }
+        return recs;
     }
 
 
     Record SQLiteKeyStore::get(sequence_t seq /*, ContentOptions options*/) const {
+        Record rec;
+        readRowBySequence(rec, seq, false, [](const Record&) { });
+        return rec;
+    }
+
+
+    void SQLiteKeyStore::get(sequence_t seq, function_ref<void(const Record&)> fn) {
+        Record rec;
+        readRowBySequence(rec, seq, true, fn);
+    }
+
+
+    // Reads the row with sequence `seq` into `rec`, then calls `fn` while the row is current.
+    void SQLiteKeyStore::readRowBySequence(Record &rec, sequence_t seq, bool borrow,
+                                           function_ref<void(const Record&)> fn) const
+    {
         constexpr ContentOptions options = kDefaultContent;  // this used to be a param but not used
         Assert(_capabilities.sequences);
-        Record rec;
+        auto reader = db().borrowReader();
         auto &stmt = (options & kMetaOnly)
-            ? compile(_getMetaBySeqStmt,
+            ? compile(reader.get(), _getMetaBySeqStmt,
                       "SELECT 0, flags, key, version, length(body) FROM kv_@ WHERE sequence=?")
-            : compile(_getBySeqStmt,
+            : compile(reader.get(), _getBySeqStmt,
                       "SELECT 0, flags, key, version, body FROM kv_@ WHERE sequence=?");
         UsingStatement u(stmt);
         stmt.bind(1, (long long)seq);
         if (stmt.executeStep()) {
-            rec.setKey(columnAsSlice(stmt.getColumn(2)));
+            if (borrow)
+                rec.borrowKey(columnAsSlice(stmt.getColumn(2)));
+            else
+                rec.setKey(columnAsSlice(stmt.getColumn(2)));
             rec.updateSequence(seq);
-            setRecordMetaAndBody(rec, stmt, options);
+            setRecordMetaAndBody(rec, stmt, options, borrow);
         }
-        return rec;
+        fn(rec);
     }
 
 
@@ -287,6 +418,38 @@ namespace litecore {
     }
 
 
+    // Like a series of inserts by set(), but compiles, checks and logs just once, and updates
+    // the last sequence once.
+    size_t SQLiteKeyStore::insertBatch(NewRecord records[], size_t count, Transaction&) {
+        Assert(_capabilities.sequences);
+        LogVerbose(DBLog, "KeyStore(%s) insert batch of %zu", name().c_str(), count);
+        compile(_insertStmt,
+                "INSERT OR IGNORE INTO kv_@ (version, body, flags, sequence, key)"
+                " VALUES (?, ?, ?, ?, ?)");
+        SQLite::Statement &stmt = *_insertStmt;
+        sequence_t seq = lastSequence();
+        size_t added = 0;
+        for (size_t i = 0; i < count; ++i) {
+            NewRecord &rec = records[i];
+            stmt.bindNoCopy(1, rec.version.buf, (int)rec.version.size);
+            stmt.bindNoCopy(2, rec.body.buf, (int)rec.body.size);
+            stmt.bind(3, (int)rec.flags);
+            stmt.bind(4, (long long)(seq + 1));
+            stmt.bindNoCopy(5, (const char*)rec.key.buf, (int)rec.key.size);
+            UsingStatement u(stmt);
+            if (stmt.exec() > 0) {
+                rec.sequence = ++seq;
+                ++added;
+            } else {
+                rec.sequence = 0;       // key already exists
+            }
+        }
+        if (added > 0)
+            setLastSequence(seq);
+        return added;
+    }
+
+
     bool SQLiteKeyStore::del(slice key, Transaction&, sequence_t seq) {
         Assert(key);
         SQLite::Statement *stmt;
@@ -324,14 +487,37 @@ namespace litecore {
     }
 
 
+    string SQLiteKeyStore::triggerSQL(const string &triggerName,
+                                      const char *triggerSuffix,
+                                      const char *operation,
+                                      const string &statements) const
+    {
+        return CONCAT("CREATE TRIGGER \"" << triggerName << "::" << triggerSuffix
+                      << "\" AFTER " << operation << " ON kv_" << name()
+                      << " BEGIN " << statements << "; END");
+    }
+
+
     void SQLiteKeyStore::createTrigger(const string &triggerName,
                                        const char *triggerSuffix,
                                        const char *operation,
                                        const string &statements)
     {
-        db().exec(CONCAT("CREATE TRIGGER \"" << triggerName << "::" << triggerSuffix
-                            << "\" AFTER " << operation << " ON kv_" << name()
-                            << " BEGIN " << statements << "; END"));
+        db().exec(triggerSQL(triggerName, triggerSuffix, operation, statements));
+    }
+
+
+    // Returns true if the trigger exists and runs exactly the given statements.
+    bool SQLiteKeyStore::triggerExists(const string &triggerName,
+                                       const char *triggerSuffix,
+                                       const char *operation,
+                                       const string &statements) const
+    {
+        SQLite::Statement check(db(), "SELECT sql FROM sqlite_master "
+                                      "WHERE name = ? AND type = 'trigger'");
+        check.bind(1, triggerName + "::" + triggerSuffix);
+        return check.executeStep() && check.getColumn(0).getString()
+                                    == triggerSQL(triggerName, triggerSuffix, operation, statements);
     }
 
 
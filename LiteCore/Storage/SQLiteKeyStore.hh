@@ -18,6 +18,10 @@
 
 #pragma once
 #include "KeyStore.hh"
+#include "SQLiteDataFile.hh"
+#include <mutex>
+#include <set>
+#include <unordered_map>
 
 namespace fleece {
     class Value;
@@ -31,8 +35,6 @@ namespace SQLite {
 
 namespace litecore {
 
-    class SQLiteDataFile;
-    
 
     /** SQLite implementation of KeyStore; corresponds to a SQL table. */
     class SQLiteKeyStore : public KeyStore {
@@ -42,12 +44,19 @@ namespace litecore {
 
         Record get(sequence_t) const override;
         bool read(Record &rec, ContentOptions options) const override;
+        void get(slice key, ContentOptions, function_ref<void(const Record&)>) override;
+        void get(sequence_t, function_ref<void(const Record&)>) override;
+        using KeyStore::get;
+        std::vector<Record> getMany(const std::vector<slice> &keys,
+                                    ContentOptions options) const override;
 
         sequence_t set(slice key, slice meta, slice value, DocumentFlags,
                        Transaction&,
                        const sequence_t *replacingSequence =nullptr,
                        bool newSequence =true) override;
 
+        size_t insertBatch(NewRecord records[], size_t count, Transaction&) override;
+
         bool del(slice key, Transaction&, sequence_t s) override;
 
         bool setDocumentFlag(slice key, sequence_t, DocumentFlags, Transaction&) override;
@@ -76,6 +85,9 @@ namespace litecore {
         SQLite::Statement* compile(const std::string &sql) const;
         SQLite::Statement& compile(const std::unique_ptr<SQLite::Statement>& ref,
                                    const char *sqlTemplate) const;
+        SQLite::Statement& compile(SQLiteDataFile::Reader*,
+                                   const std::unique_ptr<SQLite::Statement>& ref,
+                                   const char *sqlTemplate) const;
 
         void transactionWillEnd(bool commit);
 
@@ -84,40 +96,73 @@ namespace litecore {
         static slice columnAsSlice(const SQLite::Column &col);
         static void setRecordMetaAndBody(Record &rec,
                                          SQLite::Statement &stmt,
-                                         ContentOptions options);
+                                         ContentOptions options,
+                                         bool borrow =false);
 
     private:
         friend class SQLiteDataFile;
         friend class SQLiteEnumerator;
         friend class SQLiteQuery;
+        friend class SQLiteLiveQuery;
         
         SQLiteKeyStore(SQLiteDataFile&, const std::string &name, KeyStore::Capabilities options);
         SQLiteDataFile& db() const                    {return (SQLiteDataFile&)dataFile();}
         std::string subst(const char *sqlTemplate) const;
         void selectFrom(std::stringstream& in, const RecordEnumerator::Options options);
         void writeSQLOptions(std::stringstream &sql, RecordEnumerator::Options options);
+        std::shared_ptr<SQLite::Statement> checkOutEnumStatement(const std::string &sql);
         void setLastSequence(sequence_t seq);
+        std::string triggerSQL(const std::string &triggerName,
+                               const char *triggerSuffix,
+                               const char *operation,
+                               const std::string &statements) const;
         void createTrigger(const std::string &triggerName,
                            const char *triggerSuffix,
                            const char *operation,
                            const std::string &statements);
+        bool triggerExists(const std::string &triggerName,
+                           const char *triggerSuffix,
+                           const char *operation,
+                           const std::string &statements) const;
         void dropTrigger(const std::string &name, const char *suffix);
         bool _createIndex(IndexType type, const std::string &sqlName,
                           const std::string &liteCoreName, const std::string &sql);
         void createValueIndex(std::string indexName,
                               const fleece::Array *params,
+                              const fleece::Value *where,
                               const IndexOptions *options);
         void createFTSIndex(std::string indexName,
                             const fleece::Array *params,
                             const IndexOptions *options);
+        void createGeoIndex(std::string indexName,
+                            const fleece::Array *params,
+                            const IndexOptions *options);
+        void createArrayIndex(std::string indexName,
+                              const fleece::Array *params,
+                              const IndexOptions *options);
+        std::set<std::string> unnestedTables() const;
+        bool readRow(Record&, ContentOptions, bool borrow,
+                     function_ref<void(const Record&)>) const;
+        void readRowBySequence(Record&, sequence_t, bool borrow,
+                               function_ref<void(const Record&)>) const;
         void _deleteIndex(slice name);
 
         std::unique_ptr<SQLite::Statement> _recCountStmt;
         std::unique_ptr<SQLite::Statement> _getByKeyStmt, _getMetaByKeyStmt, _getByOffStmt;
         std::unique_ptr<SQLite::Statement> _getBySeqStmt, _getMetaBySeqStmt;
+        std::unique_ptr<SQLite::Statement> _getManyStmt, _getManyMetaStmt;
         std::unique_ptr<SQLite::Statement> _setStmt, _insertStmt, _replaceStmt, _updateBodyStmt;
         std::unique_ptr<SQLite::Statement> _backupStmt, _delByKeyStmt, _delBySeqStmt, _delByBothStmt;
         std::unique_ptr<SQLite::Statement> _setFlagStmt;
+        // Idle enumerator statements compiled on the main connection, keyed by their SQL.
+        // Enumerators hold a reference to the pool, since they may outlive the KeyStore;
+        // close() closes it (and starts a new one) so statements returned later are finalized.
+        struct EnumStatementPool {
+            std::unordered_multimap<std::string, std::shared_ptr<SQLite::Statement>> idle;
+            std::mutex mutex;
+            bool open {true};
+        };
+        std::shared_ptr<EnumStatementPool> _enumStmts {std::make_shared<EnumStatementPool>()};
         bool _createdSeqIndex {false};     // Created by-seq index yet?
         bool _lastSequenceChanged {false};
         int64_t _lastSequence {-1};
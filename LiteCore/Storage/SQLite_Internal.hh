@@ -35,6 +35,8 @@ namespace fleece {
 
 namespace litecore {
 
+    class DocRootCache;
+
     extern LogDomain SQL;
 
     void LogStatement(const SQLite::Statement &st);
@@ -58,5 +60,6 @@ namespace litecore {
 
     void RegisterSQLiteFunctions(sqlite3 *db,
                                  DataFile::FleeceAccessor accessor,
-                                 fleece::SharedKeys *sharedKeys);
+                                 fleece::SharedKeys *sharedKeys,
+                                 std::shared_ptr<DocRootCache> rootCache);
 }
@@ -22,6 +22,8 @@
 #include "FilePath.hh"
 #include "Fleece.hh"
 #include "Benchmark.hh"
+#include <atomic>
+#include <thread>
 #ifndef _MSC_VER
 #include <sys/stat.h>
 #endif
@@ -172,6 +174,152 @@ N_WAY_TEST_CASE_METHOD (DataFileTestFixture, "DataFile EnumerateDocsDescending",
 }
 
 
+N_WAY_TEST_CASE_METHOD (DataFileTestFixture, "DataFile EnumerateDocs Range", "[DataFile]") {
+    createNumberedDocs(store);
+
+    auto collectKeys = [&](RecordEnumerator::Options opts) {
+        vector<string> keys;
+        for (RecordEnumerator e(*store, opts); e.next(); )
+            keys.push_back(e->key().asString());
+        return keys;
+    };
+
+    RecordEnumerator::Options opts;
+    SECTION("Key range") {
+        opts.startKey = "rec-050"_sl;
+        opts.endKey = "rec-054"_sl;
+        CHECK(collectKeys(opts) == (vector<string>{"rec-050", "rec-051", "rec-052",
+                                                   "rec-053", "rec-054"}));
+        opts.descending = true;
+        opts.startKey = "rec-054"_sl;
+        opts.endKey = "rec-050"_sl;
+        CHECK(collectKeys(opts) == (vector<string>{"rec-054", "rec-053", "rec-052",
+                                                   "rec-051", "rec-050"}));
+    }
+    SECTION("Prefix") {
+        opts.prefix = "rec-09"_sl;
+        auto keys = collectKeys(opts);
+        REQUIRE(keys.size() == 10);
+        CHECK(keys.front() == "rec-090");
+        CHECK(keys.back() == "rec-099");
+    }
+    SECTION("Skip and limit") {
+        opts.skip = 10;
+        opts.limit = 3;
+        CHECK(collectKeys(opts) == (vector<string>{"rec-011", "rec-012", "rec-013"}));
+        opts.skip = 98;
+        opts.limit = 0;
+        CHECK(collectKeys(opts) == (vector<string>{"rec-099", "rec-100"}));
+    }
+}
+
+
+N_WAY_TEST_CASE_METHOD (DataFileTestFixture, "DataFile EnumerateDocs Statement Reuse", "[DataFile]") {
+    createNumberedDocs(store);
+
+    auto countDocs = [&](RecordEnumerator::Options opts) {
+        int n = 0;
+        for (RecordEnumerator e(*store, opts); e.next(); )
+            ++n;
+        return n;
+    };
+
+    RecordEnumerator::Options opts;
+    opts.limit = 10;
+    for (int pass = 0; pass < 3; ++pass) {
+        // Inside a transaction the main connection is used, and its statements are pooled:
+        Transaction t(db);
+        RecordEnumerator outer(*store, opts);
+        int n = 0;
+        while (outer.next()) {
+            // An enumerator with identical SQL can't share the statement the outer one is using:
+            CHECK(countDocs(opts) == 10);
+            ++n;
+        }
+        CHECK(n == 10);
+        t.abort();
+    }
+
+    // Outside a transaction, enumerators use (and reuse) statements on a pooled reader:
+    for (int pass = 0; pass < 3; ++pass)
+        CHECK(countDocs(opts) == 10);
+    opts.skip = 95;
+    CHECK(countDocs(opts) == 5);
+}
+
+
+N_WAY_TEST_CASE_METHOD (DataFileTestFixture, "DataFile Enumerator Outlives KeyStore Close", "[DataFile]") {
+    createNumberedDocs(store);
+    string name = store->name();
+    {
+        // An enumerator on the main connection that's still open when its KeyStore closes
+        // doesn't return its statement to the closed pool:
+        Transaction t(db);
+        unique_ptr<RecordEnumerator> e(new RecordEnumerator(*store));
+        CHECK(e->next());
+        db->closeKeyStore(name);
+        e.reset();
+        t.abort();
+    }
+    KeyStore &reopened = db->getKeyStore(name);
+    int n = 0;
+    for (RecordEnumerator e(reopened); e.next(); )
+        ++n;
+    CHECK(n == 100);
+}
+
+
+N_WAY_TEST_CASE_METHOD (DataFileTestFixture, "DataFile Borrowed Records", "[DataFile]") {
+    createNumberedDocs(store);
+
+    // Enumerated records borrow their data, and copy it only if it's retained:
+    vector<alloc_slice> keys;
+    vector<Record> copies;
+    int i = 1;
+    for (RecordEnumerator e(*store); e.next(); ++i) {
+        string expectedDocID = stringWithFormat("rec-%03d", i);
+        CHECK(e->keySlice() == slice(expectedDocID));
+        CHECK(e->bodySlice() == slice(expectedDocID));
+        if (i % 10 == 0) {
+            keys.push_back(e->key());
+            copies.push_back(e.record());
+        }
+    }
+    REQUIRE(keys.size() == 10);
+    REQUIRE(copies.size() == 10);
+    for (i = 0; i < 10; ++i) {
+        string expectedDocID = stringWithFormat("rec-%03d", 10 * (i + 1));
+        CHECK(keys[i] == slice(expectedDocID));
+        CHECK(copies[i].key() == slice(expectedDocID));
+        CHECK(copies[i].body() == slice(expectedDocID));
+        CHECK(copies[i].sequence() == (sequence_t)(10 * (i + 1)));
+    }
+
+    // The callback form of get() also borrows:
+    alloc_slice body;
+    store->get("rec-042"_sl, kDefaultContent, [&](const Record &rec) {
+        CHECK(rec.exists());
+        CHECK(rec.sequence() == 42);
+        CHECK(rec.bodySlice() == "rec-042"_sl);
+        body = rec.body();
+    });
+    CHECK(body == "rec-042"_sl);
+
+    bool called = false;
+    store->get("nonexistent"_sl, kDefaultContent, [&](const Record &rec) {
+        CHECK(!rec.exists());
+        CHECK(rec.keySlice() == "nonexistent"_sl);
+        called = true;
+    });
+    CHECK(called);
+
+    store->get(sequence_t(7), [&](const Record &rec) {
+        CHECK(rec.keySlice() == "rec-007"_sl);
+        CHECK(rec.bodySlice() == "rec-007"_sl);
+    });
+}
+
+
 N_WAY_TEST_CASE_METHOD (DataFileTestFixture, "DataFile AbortTransaction", "[DataFile]") {
     // Initial record:
     {
@@ -419,6 +567,142 @@ N_WAY_TEST_CASE_METHOD (DataFileTestFixture, "DataFile Compact", "[DataFile]") {
     db->compact();
 }
 
+
+N_WAY_TEST_CASE_METHOD (DataFileTestFixture, "DataFile Concurrent Readers", "[DataFile]") {
+    createNumberedDocs(store);
+
+    {
+        // While a transaction is open, reads on any thread use the main connection, so they
+        // see the uncommitted change:
+        Transaction t(db);
+        store->set("rec-001"_sl, "changed"_sl, t);
+        REQUIRE(store->get("rec-001"_sl).body() == "changed"_sl);
+        alloc_slice otherBody;
+        thread([&]{
+            otherBody = store->get("rec-001"_sl).body();
+        }).join();
+        REQUIRE(otherBody == "changed"_sl);
+        t.commit();
+    }
+    REQUIRE(store->get("rec-001"_sl).body() == "changed"_sl);
+
+    atomic<int> failures {0};
+    vector<thread> readers;
+    for (int n = 0; n < 4; ++n) {
+        readers.emplace_back([&]{
+            for (int i = 1; i <= 100; ++i) {
+                string docID = stringWithFormat("rec-%03d", i);
+                if (!store->get(slice(docID)).exists())
+                    ++failures;
+            }
+            int count = 0;
+            for (RecordEnumerator e(*store); e.next(); )
+                ++count;
+            if (count != 100)
+                ++failures;
+        });
+    }
+    for (auto &reader : readers)
+        reader.join();
+    CHECK(failures == 0);
+}
+
+N_WAY_TEST_CASE_METHOD (DataFileTestFixture, "DataFile Group Commit", "[DataFile]") {
+    auto options = db->options();
+    options.groupCommit = true;
+    reopenDatabase(&options);
+
+    static constexpr int kWriters = 8, kTransactionsPerWriter = 50;
+    atomic<int> failures {0};
+    vector<thread> writers;
+    for (int n = 0; n < kWriters; ++n) {
+        writers.emplace_back([&, n]{
+            for (int i = 0; i < kTransactionsPerWriter; ++i) {
+                string key = stringWithFormat("rec-%d-%03d", n, i);
+                try {
+                    Transaction t(db);
+                    store->set(slice(key), slice(key), t);
+                    if (i % 10 == 9)
+                        t.abort();          // Every tenth one is rolled back
+                    else
+                        t.commit();
+                } catch (...) {
+                    ++failures;
+                }
+            }
+        });
+    }
+    for (auto &writer : writers)
+        writer.join();
+    CHECK(failures == 0);
+
+    const uint64_t expectedCount = kWriters * (kTransactionsPerWriter - kTransactionsPerWriter/10);
+    CHECK(store->recordCount() == expectedCount);
+    CHECK(store->lastSequence() == expectedCount);
+    CHECK(store->get("rec-3-008"_sl).exists());
+    CHECK(!store->get("rec-3-009"_sl).exists());
+
+    // Everything was committed to the file:
+    reopenDatabase();
+    CHECK(store->recordCount() == expectedCount);
+}
+
+N_WAY_TEST_CASE_METHOD (DataFileTestFixture, "DataFile Background Maintenance", "[DataFile]") {
+    auto options = db->options();
+    options.backgroundMaintenance = true;
+    reopenDatabase(&options);
+
+    atomic<int> notifications {0};
+    db->setMaintenanceObserver([&](const DataFile::MaintenanceStats&) {
+        ++notifications;
+    });
+
+    // Write, then delete, enough data to leave WAL pages to checkpoint and free pages to vacuum:
+    static constexpr int kNumRecords = 500;
+    string body(4000, 'x');
+    {
+        Transaction t(db);
+        for (int i = 0; i < kNumRecords; ++i)
+            store->set(slice(stringWithFormat("rec-%03d", i)), slice(body), t);
+        t.commit();
+    }
+    {
+        Transaction t(db);
+        for (int i = 0; i < kNumRecords; ++i)
+            store->del(slice(stringWithFormat("rec-%03d", i)), t);
+        t.commit();
+    }
+
+    // Maintenance starts once the file has been idle for a second:
+    DataFile::MaintenanceStats stats;
+    for (int tries = 0; tries < 100; ++tries) {
+        stats = db->maintenanceStats();
+        if (stats.vacuumSteps > 0 && stats.checkpoints > 0)
+            break;
+        this_thread::sleep_for(chrono::milliseconds(100));
+    }
+    CHECK(stats.runs > 0);
+    CHECK(stats.checkpoints > 0);
+    CHECK(stats.pagesCheckpointed > 0);
+    CHECK(stats.vacuumSteps > 0);
+    CHECK(stats.pagesVacuumed > 0);
+    CHECK(notifications > 0);
+    db->setMaintenanceObserver(nullptr);
+
+    // It yields while a Transaction is open:
+    {
+        Transaction t(db);
+        auto before = db->maintenanceStats();
+        this_thread::sleep_for(chrono::milliseconds(1500));
+        auto after = db->maintenanceStats();
+        CHECK(after.runs == before.runs);
+        CHECK(after.deferred > before.deferred);
+        t.commit();
+    }
+    CHECK(store->recordCount() == 0);
+}
+
+
 TEST_CASE("CanonicalPath") {
 #ifdef _MSC_VER
     const char* startPath = "C:\\folder\\..\\subfolder\\";
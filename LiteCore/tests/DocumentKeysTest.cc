@@ -124,3 +124,51 @@ TEST_CASE_METHOD(DocumentKeysTestFixture, "Create docs", "[SharedKeys]") {
         REQUIRE(doc->get(bar) == nullptr);
     }
 }
+
+
+TEST_CASE_METHOD(DocumentKeysTestFixture, "Shared keys in failed group commit", "[SharedKeys]") {
+    auto options = db->options();
+    options.groupCommit = true;
+    reopenDatabase(&options);
+
+    // A deferred foreign-key violation is caught only by COMMIT, so it makes the group fail:
+    db->rawQuery("PRAGMA foreign_keys=ON");
+    db->rawQuery("CREATE TABLE parent (id INTEGER PRIMARY KEY)");
+    db->rawQuery("CREATE TABLE child (pid INTEGER REFERENCES parent(id) "
+                 "DEFERRABLE INITIALLY DEFERRED)");
+
+    {
+        Transaction t(db);
+        createDoc("doc1", "{\"foo\": 1}", t);
+        t.commit();
+    }
+    {
+        Transaction t(db);
+        createDoc("doc2", "{\"bar\": 2}", t);
+        db->rawQuery("INSERT INTO child (pid) VALUES (1)");
+        CHECK(db->documentKeys()->byKey() == (vector<alloc_slice>{alloc_slice("foo"), alloc_slice("bar")}));
+        CHECK_THROWS(t.commit());
+    }
+
+    // The group was rolled back, and "bar" with it:
+    CHECK(!store->get("doc2"_sl).exists());
+    CHECK(db->documentKeys()->byKey() == (vector<alloc_slice>{alloc_slice("foo")}));
+
+    {
+        Transaction t(db);
+        createDoc("doc3", "{\"zog\": 3}", t);
+        t.commit();
+    }
+    CHECK(db->documentKeys()->byKey() == (vector<alloc_slice>{alloc_slice("foo"), alloc_slice("zog")}));
+
+    // The keys on disk agree with the ones in memory:
+    reopenDatabase();
+    Dict::key zog("zog"_sl, db->documentKeys());
+    Record r = store->get("doc3"_sl);
+    REQUIRE(r.exists());
+    const Dict *doc = Value::fromData(r.body())->asDict();
+    REQUIRE(doc);
+    const Value *zogVal = doc->get(zog);
+    REQUIRE(zogVal);
+    CHECK(zogVal->asInt() == 3);
+}
@@ -133,6 +133,34 @@ TEST_CASE("QueryParser ANY", "[Query]") {
 }
 
 
+TEST_CASE("QueryParser ANY with array index", "[Query]") {
+    QueryParser qp("kv_default");
+    qp.setUnnestedTables({"kv_default:unnest:names"});
+    alloc_slice fleece = JSONConverter::convertJSON(json5(
+                            "['ANY', 'X', ['.', 'names'], ['=', ['?', 'X'], 'Smith']]"));
+    qp.parseJustExpression(Value::fromTrustedData(fleece));
+    CHECK(qp.SQL() == "kv_default.rowid IN (SELECT docid FROM \"kv_default:unnest:names\" AS _X "
+                      "WHERE (_X.value = 'Smith'))");
+
+    QueryParser qpEvery("kv_default");
+    qpEvery.setUnnestedTables({"kv_default:unnest:names"});
+    fleece = JSONConverter::convertJSON(json5(
+                            "['EVERY', 'X', ['.', 'names'], ['=', ['?', 'X'], 'Smith']]"));
+    qpEvery.parseJustExpression(Value::fromTrustedData(fleece));
+    CHECK(qpEvery.SQL() == "NOT kv_default.rowid IN (SELECT docid FROM \"kv_default:unnest:names\" "
+                           "AS _X WHERE NOT (_X.value = 'Smith'))");
+
+    // Nested properties of the elements aren't in the index table:
+    QueryParser qp2("kv_default");
+    qp2.setUnnestedTables({"kv_default:unnest:names"});
+    fleece = JSONConverter::convertJSON(json5(
+                            "['ANY', 'X', ['.', 'names'], ['=', ['?', 'X', 'last'], 'Smith']]"));
+    qp2.parseJustExpression(Value::fromTrustedData(fleece));
+    CHECK(qp2.SQL() == "EXISTS (SELECT 1 FROM fl_each(body, 'names') AS _X "
+                       "WHERE fl_nested_value(_X.pointer, 'last') = 'Smith')");
+}
+
+
 TEST_CASE("QueryParser ANY complex", "[Query]") {
     CHECK(parseWhere("['ANY', 'X', ['.', 'names'], ['=', ['?', 'X', 'last'], 'Smith']]")
           == "EXISTS (SELECT 1 FROM fl_each(body, 'names') AS _X WHERE fl_nested_value(_X.pointer, 'last') = 'Smith')");
@@ -160,7 +188,7 @@ TEST_CASE("QueryParser SELECT", "[Query]") {
                                   WHERE: ['=', ['.', 'last'], 'Smith'],\
                                DISTINCT: true,\
                                GROUP_BY: [['.', 'first'], ['.', 'age']]}]]")
-          == "EXISTS (SELECT DISTINCT fl_result(max(fl_value(body, 'weight'))) FROM kv_default WHERE (fl_value(body, 'last') = 'Smith') AND (flags & 1) = 0 GROUP BY fl_value(body, 'first'), fl_value(body, 'age'))");
+          == "EXISTS (SELECT DISTINCT fl_result(max(fl_value(body, 'weight', sequence))) FROM kv_default WHERE (fl_value(body, 'last') = 'Smith') AND (flags & 1) = 0 GROUP BY fl_value(body, 'first'), fl_value(body, 'age'))");
 }
 
 
@@ -175,10 +203,10 @@ TEST_CASE("QueryParser SELECT WHAT", "[Query]") {
           == "SELECT fl_result(key) FROM kv_default WHERE (fl_value(body, 'last') = 'Smith') AND (flags & 1) = 0");
     CHECK(parseWhere("['SELECT', {WHAT: [['.first']],\
                                  WHERE: ['=', ['.', 'last'], 'Smith']}]")
-          == "SELECT fl_result(fl_value(body, 'first')) FROM kv_default WHERE (fl_value(body, 'last') = 'Smith') AND (flags & 1) = 0");
+          == "SELECT fl_result(fl_value(body, 'first', sequence)) FROM kv_default WHERE (fl_value(body, 'last') = 'Smith') AND (flags & 1) = 0");
     CHECK(parseWhere("['SELECT', {WHAT: [['.first'], ['length()', ['.middle']]],\
                                  WHERE: ['=', ['.', 'last'], 'Smith']}]")
-          == "SELECT fl_result(fl_value(body, 'first')), fl_result(N1QL_length(fl_value(body, 'middle'))) FROM kv_default WHERE (fl_value(body, 'last') = 'Smith') AND (flags & 1) = 0");
+          == "SELECT fl_result(fl_value(body, 'first', sequence)), fl_result(N1QL_length(fl_value(body, 'middle', sequence))) FROM kv_default WHERE (fl_value(body, 'last') = 'Smith') AND (flags & 1) = 0");
     // Check the "." operator (like SQL "*"):
     CHECK(parseWhere("['SELECT', {WHAT: ['.'], WHERE: ['=', ['.', 'last'], 'Smith']}]")
           == "SELECT fl_result(fl_root(body)) FROM kv_default WHERE (fl_value(body, 'last') = 'Smith') AND (flags & 1) = 0");
@@ -204,7 +232,7 @@ TEST_CASE("QueryParser Join", "[Query]") {
                   FROM: [{as: 'book'}, \
                          {as: 'library', 'on': ['=', ['.book.library'], ['.library._id']]}],\
                  WHERE: ['=', ['.book.author'], ['$AUTHOR']]}")
-          == "SELECT fl_result(fl_value(\"book\".body, 'title')), fl_result(fl_value(\"library\".body, 'name')), fl_result(fl_root(\"library\".body)) FROM kv_default AS \"book\" CROSS JOIN kv_default AS \"library\" ON (fl_value(\"book\".body, 'library') = \"library\".key) AND (\"library\".flags & 1) = 0 WHERE (fl_value(\"book\".body, 'author') = $_AUTHOR) AND (\"book\".flags & 1) = 0");
+          == "SELECT fl_result(fl_value(\"book\".body, 'title', \"book\".sequence)), fl_result(fl_value(\"library\".body, 'name', \"library\".sequence)), fl_result(fl_root(\"library\".body)) FROM kv_default AS \"book\" CROSS JOIN kv_default AS \"library\" ON (fl_value(\"book\".body, 'library') = \"library\".key) AND (\"library\".flags & 1) = 0 WHERE (fl_value(\"book\".body, 'author') = $_AUTHOR) AND (\"book\".flags & 1) = 0");
 
     // Multiple JOINs (#363):
     CHECK(parse("{'WHAT':[['.','session','appId'],['.','user','username'],['.','session','emoId']],\
@@ -212,7 +240,7 @@ TEST_CASE("QueryParser Join", "[Query]") {
                            {'as':'user','on':['=',['.','session','emoId'],['.','user','emoId']]},\
                            {'as':'licence','on':['=',['.','session','licenceID'],['.','licence','id']]}],\
                  'WHERE':['AND',['AND',['=',['.','session','type'],'session'],['=',['.','user','type'],'user']],['=',['.','licence','type'],'licence']]}")
-          == "SELECT fl_result(fl_value(\"session\".body, 'appId')), fl_result(fl_value(\"user\".body, 'username')), fl_result(fl_value(\"session\".body, 'emoId')) FROM kv_default AS \"session\" CROSS JOIN kv_default AS \"user\" ON (fl_value(\"session\".body, 'emoId') = fl_value(\"user\".body, 'emoId')) AND (\"user\".flags & 1) = 0 CROSS JOIN kv_default AS \"licence\" ON (fl_value(\"session\".body, 'licenceID') = fl_value(\"licence\".body, 'id')) AND (\"licence\".flags & 1) = 0 WHERE ((fl_value(\"session\".body, 'type') = 'session' AND fl_value(\"user\".body, 'type') = 'user') AND fl_value(\"licence\".body, 'type') = 'licence') AND (\"session\".flags & 1) = 0");
+          == "SELECT fl_result(fl_value(\"session\".body, 'appId', \"session\".sequence)), fl_result(fl_value(\"user\".body, 'username', \"user\".sequence)), fl_result(fl_value(\"session\".body, 'emoId', \"session\".sequence)) FROM kv_default AS \"session\" CROSS JOIN kv_default AS \"user\" ON (fl_value(\"session\".body, 'emoId') = fl_value(\"user\".body, 'emoId')) AND (\"user\".flags & 1) = 0 CROSS JOIN kv_default AS \"licence\" ON (fl_value(\"session\".body, 'licenceID') = fl_value(\"licence\".body, 'id')) AND (\"licence\".flags & 1) = 0 WHERE ((fl_value(\"session\".body, 'type') = 'session' AND fl_value(\"user\".body, 'type') = 'user') AND fl_value(\"licence\".body, 'type') = 'licence') AND (\"session\".flags & 1) = 0");
 }
 
 
@@ -226,13 +254,27 @@ TEST_CASE("QueryParser Collate", "[Query][Collation]") {
                   FROM: [{as: 'book'}],\
                  WHERE: ['=', ['.book.author'], ['$AUTHOR']], \
               ORDER_BY: [ ['COLLATE', {'unicode':true, 'case':false}, ['.book.title']] ]}")
-          == "SELECT fl_result(fl_value(\"book\".body, 'title')) "
+          == "SELECT fl_result(fl_value(\"book\".body, 'title', \"book\".sequence)) "
                "FROM kv_default AS \"book\" "
               "WHERE (fl_value(\"book\".body, 'author') = $_AUTHOR) AND (\"book\".flags & 1) = 0 "
            "ORDER BY fl_value(\"book\".body, 'title') COLLATE LCUnicode_C__");
 }
 
 
+TEST_CASE("QueryParser CREATE INDEX", "[Query]") {
+    QueryParser qp("kv_default");
+    alloc_slice what = JSONConverter::convertJSON(json5("[['.num']]"));
+    qp.writeCreateIndex("num", Value::fromTrustedData(what)->asArray());
+    CHECK(qp.SQL() == "CREATE INDEX \"num\" ON kv_default (fl_value(body, 'num'))");
+
+    alloc_slice where = JSONConverter::convertJSON(json5("['=', ['.type'], 'order']"));
+    qp.writeCreateIndex("num", Value::fromTrustedData(what)->asArray(),
+                        Value::fromTrustedData(where));
+    CHECK(qp.SQL() == "CREATE INDEX \"num\" ON kv_default (fl_value(body, 'num')) "
+                      "WHERE fl_value(body, 'type') = 'order'");
+}
+
+
 TEST_CASE("QueryParser errors", "[Query][!throws]") {
     mustFail("['poop()', 1]");
     mustFail("['power()', 1]");
@@ -21,6 +21,7 @@
 #include "Error.hh"
 #include "Fleece.hh"
 #include "Benchmark.hh"
+#include "SQLiteFleeceUtil.hh"
 
 #include "LiteCoreTest.hh"
 
@@ -197,6 +198,213 @@ TEST_CASE_METHOD(DataFileTestFixture, "Create/Delete Index", "[Query][FTS]") {
 }
 
 
+// Writes a doc with a Fleece body of the form {"tags":[...]}
+static void writeTaggedDoc(KeyStore *store, const char *docID,
+                           const vector<string> &tags, Transaction &t) {
+    fleece::Encoder enc;
+    enc.beginDictionary(1);
+    enc.writeKey("tags");
+    enc.beginArray();
+    for (auto &tag : tags)
+        enc.writeString(tag);
+    enc.endArray();
+    enc.endDictionary();
+    alloc_slice body = enc.extractOutput();
+    store->set(slice(docID), nullslice, body, DocumentFlags::kNone, t);
+}
+
+TEST_CASE_METHOD(DataFileTestFixture, "Array index", "[Query]") {
+    {
+        Transaction t(store->dataFile());
+        writeTaggedDoc(store, "doc1", {"red", "green"}, t);
+        writeTaggedDoc(store, "doc2", {"blue"}, t);
+        writeTaggedDoc(store, "doc3", {}, t);
+        t.commit();
+    }
+    store->createIndex("tags"_sl, "[[\".tags\"]]"_sl, KeyStore::kArrayIndex);
+    auto indexes = extractIndexes(store->getIndexes());
+    CHECK(indexes == vector<string>{"tags"});
+
+    Retained<Query> query{ store->compileQuery(json5(
+        "{WHAT: ['._id'], WHERE: ['ANY', 'T', ['.tags'], ['=', ['?T'], ['$tag']]], "
+        " ORDER_BY: [['._id']]}")) };
+    auto tagged = [&](const char *tag) {
+        Query::Options options;
+        options.paramBindings = alloc_slice(stringWithFormat("{\"tag\":\"%s\"}", tag));
+        unique_ptr<QueryEnumerator> e(query->createEnumerator(&options));
+        vector<string> docIDs;
+        while (e->next())
+            docIDs.push_back(e->columns()[0]->asString().asString());
+        return docIDs;
+    };
+    CHECK(tagged("red") == vector<string>{"doc1"});
+    CHECK(tagged("blue") == vector<string>{"doc2"});
+    CHECK(tagged("pink").empty());
+
+    // The index is searched, instead of testing each doc:
+    string explanation = query->explain();
+    Log("%s", explanation.c_str());
+    CHECK(explanation.find("SEARCH") != string::npos);
+    CHECK(explanation.find("INDEX tags (value=?)") != string::npos);
+
+    // The index is kept up to date:
+    {
+        Transaction t(store->dataFile());
+        writeTaggedDoc(store, "doc2", {"red"}, t);
+        writeTaggedDoc(store, "doc4", {"blue", "red"}, t);
+        store->del("doc1"_sl, t);
+        t.commit();
+    }
+    CHECK(tagged("red") == (vector<string>{"doc2", "doc4"}));
+    CHECK(tagged("blue") == vector<string>{"doc4"});
+    CHECK(tagged("green").empty());
+
+    store->deleteIndex("tags"_sl);
+    CHECK(extractIndexes(store->getIndexes()).empty());
+    query = store->compileQuery(json5(
+        "{WHAT: ['._id'], WHERE: ['ANY', 'T', ['.tags'], ['=', ['?T'], ['$tag']]], "
+        " ORDER_BY: [['._id']]}"));
+    CHECK(tagged("blue") == vector<string>{"doc4"});
+}
+
+
+// Writes a doc with a Fleece body of the form {"lat":lat,"lon":lon}
+static void writeLocationDoc(KeyStore *store, const char *docID,
+                             double lat, double lon, Transaction &t) {
+    fleece::Encoder enc;
+    enc.beginDictionary(2);
+    enc.writeKey("lat");
+    enc.writeDouble(lat);
+    enc.writeKey("lon");
+    enc.writeDouble(lon);
+    enc.endDictionary();
+    alloc_slice body = enc.extractOutput();
+    store->set(slice(docID), nullslice, body, DocumentFlags::kNone, t);
+}
+
+TEST_CASE_METHOD(DataFileTestFixture, "Geo index", "[Query]") {
+    {
+        Transaction t(store->dataFile());
+        writeLocationDoc(store, "sf",      37.7749, -122.4194, t);
+        writeLocationDoc(store, "oakland", 37.8044, -122.2712, t);
+        writeLocationDoc(store, "nyc",     40.7128,  -74.0060, t);
+        t.commit();
+    }
+
+    // Queries need the index:
+    ExpectException(error::LiteCore, error::NoSuchIndex, [&]{
+        Retained<Query> query{ store->compileQuery(json5(
+            "{WHAT: ['._id'], WHERE: ['WITHIN_BOX', 'geo', 37, -123, 38, -122]}")) };
+    });
+
+    store->createIndex("geo"_sl, "[[\".lat\"], [\".lon\"]]"_sl, KeyStore::kGeoIndex);
+    CHECK(extractIndexes(store->getIndexes()) == vector<string>{"geo"});
+
+    auto run = [&](Query *query) {
+        unique_ptr<QueryEnumerator> e(query->createEnumerator());
+        vector<string> docIDs;
+        while (e->next())
+            docIDs.push_back(e->columns()[0]->asString().asString());
+        return docIDs;
+    };
+
+    Retained<Query> box{ store->compileQuery(json5(
+        "{WHAT: ['._id'], WHERE: ['WITHIN_BOX', 'geo', 37, -123, 38, -122], "
+        " ORDER_BY: [['._id']]}")) };
+    CHECK(run(box) == (vector<string>{"oakland", "sf"}));
+    string explanation = box->explain();
+    Log("%s", explanation.c_str());
+    CHECK(explanation.find("VIRTUAL TABLE") != string::npos);
+
+    // SF to Oakland is about 13km:
+    Retained<Query> radius{ store->compileQuery(json5(
+        "{WHAT: ['._id'], WHERE: ['WITHIN_RADIUS', 'geo', 37.7749, -122.4194, 10000]}")) };
+    CHECK(run(radius) == vector<string>{"sf"});
+    radius = store->compileQuery(json5(
+        "{WHAT: ['._id'], WHERE: ['WITHIN_RADIUS', 'geo', 37.7749, -122.4194, 20000], "
+        " ORDER_BY: [['._id']]}"));
+    CHECK(run(radius) == (vector<string>{"oakland", "sf"}));
+
+    // The index is kept up to date:
+    {
+        Transaction t(store->dataFile());
+        writeLocationDoc(store, "nyc", 37.5, -122.5, t);
+        store->del("sf"_sl, t);
+        t.commit();
+    }
+    CHECK(run(box) == (vector<string>{"nyc", "oakland"}));
+
+    // Re-creating the index with different coordinates replaces it:
+    store->createIndex("geo"_sl, "[[\".lon\"], [\".lat\"]]"_sl, KeyStore::kGeoIndex);
+    CHECK(extractIndexes(store->getIndexes()) == vector<string>{"geo"});
+    box = store->compileQuery(json5(
+        "{WHAT: ['._id'], WHERE: ['WITHIN_BOX', 'geo', -123, 37, -122, 38], "
+        " ORDER_BY: [['._id']]}"));
+    CHECK(run(box) == (vector<string>{"nyc", "oakland"}));
+
+    store->deleteIndex("geo"_sl);
+    CHECK(extractIndexes(store->getIndexes()).empty());
+}
+
+
+TEST_CASE_METHOD(DataFileTestFixture, "Geo index across the 180th meridian", "[Query]") {
+    {
+        Transaction t(store->dataFile());
+        writeLocationDoc(store, "east", -17.0,  179.9, t);
+        writeLocationDoc(store, "west", -17.0, -179.9, t);
+        writeLocationDoc(store, "far",  -17.0, -179.0, t);
+        t.commit();
+    }
+    store->createIndex("geo"_sl, "[[\".lat\"], [\".lon\"]]"_sl, KeyStore::kGeoIndex);
+
+    auto run = [&](const char *where) {
+        Retained<Query> query{ store->compileQuery(json5(
+            string("{WHAT: ['._id'], WHERE: ") + where + ", ORDER_BY: [['._id']]}")) };
+        unique_ptr<QueryEnumerator> e(query->createEnumerator());
+        vector<string> docIDs;
+        while (e->next())
+            docIDs.push_back(e->columns()[0]->asString().asString());
+        return docIDs;
+    };
+
+    // 0.1 degree of longitude at 17 degrees South is about 10.6km:
+    CHECK(run("['WITHIN_RADIUS', 'geo', -17.0, 179.95, 20000]")
+          == (vector<string>{"east", "west"}));
+    CHECK(run("['WITHIN_RADIUS', 'geo', -17.0, -179.95, 20000]")
+          == (vector<string>{"east", "west"}));
+    CHECK(run("['WITHIN_RADIUS', 'geo', -17.0, 179.95, 8000]")
+          == (vector<string>{"east"}));
+}
+
+
+TEST_CASE_METHOD(DataFileTestFixture, "Partial index", "[Query]") {
+    addNumberedDocs(store);
+    store->createIndex("bignums"_sl,
+                       json5("{WHAT: [['.num']], WHERE: ['>', ['.num'], 50]}"));
+    CHECK(extractIndexes(store->getIndexes()) == vector<string>{"bignums"});
+
+    // Only value indexes can be partial:
+    ExpectException(error::LiteCore, error::InvalidQuery, [&]{
+        store->createIndex("bignums_fts"_sl,
+                           json5("{WHAT: [['.num']], WHERE: ['>', ['.num'], 50]}"),
+                           KeyStore::kFullTextIndex);
+    });
+
+    // A query whose WHERE clause includes the index's test can use it:
+    Retained<Query> query{ store->compileQuery(json5(
+        "{WHAT: ['.num'], WHERE: ['AND', ['>', ['.num'], 50], ['<', ['.num'], 55]]}")) };
+    string explanation = query->explain();
+    Log("%s", explanation.c_str());
+    CHECK(explanation.find("bignums") != string::npos);
+
+    unique_ptr<QueryEnumerator> e(query->createEnumerator());
+    int64_t num = 51;
+    while (e->next())
+        CHECK(e->columns()[0]->asInt() == num++);
+    CHECK(num == 55);
+}
+
+
 TEST_CASE_METHOD(DataFileTestFixture, "Query SELECT", "[Query]") {
     addNumberedDocs(store);
     // Use a (SQL) query based on the Fleece "num" property:
@@ -251,6 +459,110 @@ TEST_CASE_METHOD(DataFileTestFixture, "Query SELECT WHAT", "[Query]") {
     REQUIRE(num == 101);
 }
 
+TEST_CASE_METHOD(DataFileTestFixture, "Query cache", "[Query]") {
+    auto stats0 = db->queryCacheStats();
+    Retained<Query> query1{ store->compileQuery(json5(
+        "{WHAT: ['.num'], WHERE: ['>', ['.num'], 10]}")) };
+    // The same query, with different whitespace and key order, comes from the cache:
+    Retained<Query> query2{ store->compileQuery(
+        "{\"WHERE\": [\">\", [\".num\"], 10],\n  \"WHAT\": [\".num\"]}"_sl) };
+    CHECK(query2.get() == query1.get());
+    auto stats = db->queryCacheStats();
+    CHECK(stats.misses == stats0.misses + 1);
+    CHECK(stats.hits == stats0.hits + 1);
+    CHECK(stats.count == stats0.count + 1);
+
+    Retained<Query> query3{ store->compileQuery(json5(
+        "{WHAT: ['.num'], WHERE: ['>', ['.num'], 20]}")) };
+    CHECK(query3.get() != query1.get());
+    CHECK(db->queryCacheStats().misses == stats0.misses + 2);
+
+    // Creating an index clears the cache:
+    store->createIndex("num"_sl, "[\".num\"]"_sl);
+    CHECK(db->queryCacheStats().count == 0);
+    Retained<Query> query4{ store->compileQuery(json5(
+        "{WHAT: ['.num'], WHERE: ['>', ['.num'], 10]}")) };
+    CHECK(query4.get() != query1.get());
+}
+
+
+TEST_CASE_METHOD(DataFileTestFixture, "Query cache with two connections", "[Query]") {
+    addNumberedDocs(store);
+    const char *expr = "{WHAT: ['.num'], WHERE: ['>', ['.num'], 10]}";
+    Retained<Query> query1{ store->compileQuery(json5(expr)) };
+
+    // Creating an index through another connection invalidates the cached query:
+    unique_ptr<DataFile> db2 { newDatabase(db->filePath()) };
+    KeyStore &store2 = db2->getKeyStore(store->name());
+    store2.createIndex("num"_sl, "[\".num\"]"_sl);
+    Retained<Query> query2{ store->compileQuery(json5(expr)) };
+    CHECK(query2.get() != query1.get());
+
+    // ...and so does deleting it:
+    store2.deleteIndex("num"_sl);
+    Retained<Query> query3{ store->compileQuery(json5(expr)) };
+    CHECK(query3.get() != query2.get());
+    unique_ptr<QueryEnumerator> e(query3->createEnumerator());
+    CHECK(e->getRowCount() == 90);
+}
+
+
+TEST_CASE_METHOD(DataFileTestFixture, "Query doc root memoization", "[Query]") {
+    addNumberedDocs(store);
+    Retained<Query> query{ store->compileQuery(json5(
+        "{WHAT: ['.num', ['*', ['.num'], ['.num']]], WHERE: ['>', ['.num'], 10]}")) };
+    auto stats0 = DocRootCache::stats();
+    Stopwatch st;
+    unique_ptr<QueryEnumerator> e(query->createEnumerator());
+    int64_t i = 11;
+    while (e->next()) {
+        CHECK(e->columns()[0]->asInt() == i);
+        CHECK(e->columns()[1]->asInt() == i * i);
+        ++i;
+    }
+    st.printReport("Query of two properties", i - 11, "row");
+    CHECK(i == 101);
+    auto stats = DocRootCache::stats();
+    Log("Derived %llu doc roots, reused %llu",
+        (unsigned long long)(stats.derived - stats0.derived),
+        (unsigned long long)(stats.reused - stats0.reused));
+    // The first result column derives each row's root, and the others reuse it:
+    CHECK(stats.reused - stats0.reused >= 90);
+    CHECK(stats.derived - stats0.derived < 4 * 100);
+}
+
+
+TEST_CASE_METHOD(DataFileTestFixture, "Query doc root memoization with aggregates", "[Query]") {
+    // The bodies are all the same size, so SQLite may put one row's body where the last one was:
+    {
+        Transaction t(db);
+        for (int i = 1; i <= 100; i++) {
+            string docID = stringWithFormat("rec-%03d", i);
+            fleece::Encoder enc;
+            enc.beginDictionary();
+            enc.writeKey("a");
+            enc.writeInt(i);
+            enc.writeKey("b");
+            enc.writeInt(2 * i);
+            enc.endDictionary();
+            alloc_slice body = enc.extractOutput();
+            store->set(slice(docID), nullslice, body, DocumentFlags::kNone, t);
+        }
+        t.commit();
+    }
+    // One step aggregates every row, and the CASE evaluates only one property per row:
+    Retained<Query> query{ store->compileQuery(json5(
+        "{WHAT: [['sum()', ['CASE', null, ['=', ['%', ['._sequence'], 2], 0], ['.a'], ['.b']]],"
+                "['sum()', ['.a']], ['sum()', ['.b']]]}")) };
+    unique_ptr<QueryEnumerator> e(query->createEnumerator());
+    REQUIRE(e->next());
+    CHECK(e->columns()[0]->asInt() == 2550 + 2 * 2500);   // a of even rows, b of odd rows
+    CHECK(e->columns()[1]->asInt() == 5050);
+    CHECK(e->columns()[2]->asInt() == 10100);
+    CHECK(!e->next());
+}
+
+
 TEST_CASE_METHOD(DataFileTestFixture, "Query SELECT All", "[Query]") {
     addNumberedDocs(store);
     Retained<Query> query1{ store->compileQuery(json5("{WHAT: [['.main'], ['*', ['.main.num'], ['.main.num']]], WHERE: ['>', ['.main.num'], 10], FROM: [{AS: 'main'}]}")) };
@@ -365,6 +677,170 @@ TEST_CASE_METHOD(DataFileTestFixture, "Query refresh", "[Query]") {
 }
 
 
+TEST_CASE_METHOD(DataFileTestFixture, "Query streaming", "[Query]") {
+    addNumberedDocs(store);
+    Retained<Query> query{ store->compileQuery(json5(
+                     "{WHAT: ['.num'], WHERE: ['>', ['.num'], 10], ORDER_BY: [['.num']]}")) };
+    Query::Options options;
+    options.streaming = true;
+
+    SECTION("Read all rows") {
+        unique_ptr<QueryEnumerator> e(query->createEnumerator(&options));
+        int num = 11;
+        while (e->next())
+            CHECK(e->columns()[0]->asInt() == num++);
+        CHECK(num == 101);
+        CHECK(!e->next());
+        CHECK(e->refresh() == nullptr);
+    }
+
+    SECTION("Random access") {
+        unique_ptr<QueryEnumerator> e(query->createEnumerator(&options));
+        REQUIRE(e->next());
+        REQUIRE(e->next());
+        CHECK(e->columns()[0]->asInt() == 12);
+        CHECK(e->getRowCount() == 90);
+        CHECK(e->columns()[0]->asInt() == 12);       // current row is still valid
+        REQUIRE(e->next());
+        CHECK(e->columns()[0]->asInt() == 13);
+        e->seek(50);
+        CHECK(e->columns()[0]->asInt() == 61);
+        ExpectException(error::LiteCore, error::UnsupportedOperation, [&]{
+            e->seek(1);
+        });
+    }
+
+    SECTION("Early close") {
+        unique_ptr<QueryEnumerator> e(query->createEnumerator(&options));
+        REQUIRE(e->next());
+        e->close();
+        CHECK(!e->next());
+    }
+
+    SECTION("Concurrent enumerators") {
+        unique_ptr<QueryEnumerator> e1(query->createEnumerator(&options));
+        REQUIRE(e1->next());
+        unique_ptr<QueryEnumerator> e2(query->createEnumerator(&options));
+        int num = 12;
+        while (e1->next())
+            CHECK(e1->columns()[0]->asInt() == num++);
+        CHECK(num == 101);
+        num = 11;
+        while (e2->next())
+            CHECK(e2->columns()[0]->asInt() == num++);
+        CHECK(num == 101);
+    }
+}
+
+
+TEST_CASE_METHOD(DataFileTestFixture, "Query concurrent enumerators", "[Query]") {
+    addNumberedDocs(store);
+    Retained<Query> query{ store->compileQuery(json5(
+                     "{WHAT: ['.num'], WHERE: ['>', ['.num'], ['$min']], ORDER_BY: [['.num']]}")) };
+    // Each streaming enumerator keeps its statement busy, with its own parameter bindings:
+    vector<unique_ptr<QueryEnumerator>> enums;
+    for (int i = 0; i < 6; ++i) {
+        Query::Options options;
+        string params = stringWithFormat("{\"min\": %d}", 10 * i);
+        options.paramBindings = slice(params);
+        options.streaming = true;
+        enums.emplace_back(query->createEnumerator(&options));
+    }
+    for (int row = 1; row <= 40; ++row) {
+        for (int i = 0; i < 6; ++i) {
+            REQUIRE(enums[i]->next());
+            CHECK(enums[i]->columns()[0]->asInt() == 10 * i + row);
+        }
+    }
+    enums.clear();
+
+    // Statements go back to the pool, and get reused:
+    Query::Options options;
+    options.paramBindings = "{\"min\": 95}"_sl;
+    unique_ptr<QueryEnumerator> e(query->createEnumerator(&options));
+    CHECK(e->getRowCount() == 5);
+}
+
+
+TEST_CASE_METHOD(DataFileTestFixture, "Live query", "[Query]") {
+    addNumberedDocs(store);
+    vector<LiveQuery::RowChange> changes;
+
+    SECTION("Unsorted") {
+        Retained<Query> query{ store->compileQuery(json5(
+                         "{WHAT: ['.num'], WHERE: ['<=', ['.num'], 10]}")) };
+        unique_ptr<LiveQuery> live(query->createLiveQuery());
+        CHECK(live->rowCount() == 10);
+
+        // Change a doc that isn't in the results:
+        {
+            Transaction t(db);
+            writeNumberedDoc(store, 50, "hi"_sl, t);
+            t.commit();
+        }
+        CHECK(!live->update({alloc_slice("rec-050"_sl)}, changes));
+        CHECK(changes.empty());
+
+        // Add a doc that matches:
+        {
+            Transaction t(db);
+            writeNumberedDoc(store, 0, nullslice, t);
+            t.commit();
+        }
+        CHECK(live->update({alloc_slice("rec-000"_sl)}, changes));
+        REQUIRE(changes.size() == 1);
+        CHECK(changes[0].type == LiveQuery::RowChange::kInserted);
+        CHECK(changes[0].newIndex == 10);
+
+        // Delete a doc that's in the results:
+        changes.clear();
+        {
+            Transaction t(db);
+            store->set("rec-003"_sl, "2-ffff"_sl, nullslice, DocumentFlags::kDeleted, t);
+            t.commit();
+        }
+        CHECK(live->update({alloc_slice("rec-003"_sl)}, changes));
+        REQUIRE(changes.size() == 1);
+        CHECK(changes[0].type == LiveQuery::RowChange::kRemoved);
+        CHECK(changes[0].oldIndex == 2);
+
+        unique_ptr<QueryEnumerator> e(live->createEnumerator());
+        CHECK(e->getRowCount() == 10);
+        REQUIRE(e->next());
+        CHECK(e->columns()[0]->asInt() == 1);
+    }
+
+    SECTION("Sorted") {
+        Retained<Query> query{ store->compileQuery(json5(
+                         "{WHAT: ['.num'], WHERE: ['<=', ['.num'], 10], ORDER_BY: [['.num']]}")) };
+        unique_ptr<LiveQuery> live(query->createLiveQuery());
+        CHECK(live->rowCount() == 10);
+
+        // Move rec-002 between rec-009 and rec-010:
+        {
+            Transaction t(db);
+            fleece::Encoder enc;
+            enc.beginDictionary();
+            enc.writeKey("num");
+            enc.writeDouble(9.5);
+            enc.endDictionary();
+            alloc_slice body = enc.extractOutput();
+            store->set("rec-002"_sl, nullslice, body, DocumentFlags::kNone, t);
+            t.commit();
+        }
+        CHECK(live->update({alloc_slice("rec-002"_sl), alloc_slice("rec-099"_sl)}, changes));
+        REQUIRE(changes.size() == 1);
+        CHECK(changes[0].type == LiveQuery::RowChange::kMoved);
+        CHECK(changes[0].oldIndex == 1);
+        CHECK(changes[0].newIndex == 8);
+
+        unique_ptr<QueryEnumerator> e(live->createEnumerator());
+        e->seek(8);
+        CHECK(e->columns()[0]->asDouble() == 9.5);
+    }
+}
+
+
 TEST_CASE_METHOD(DataFileTestFixture, "Query boolean", "[Query]") {
     {
         Transaction t(store->dataFile());
@@ -573,6 +1049,19 @@ TEST_CASE_METHOD(DataFileTestFixture, "Query regex", "[Query]") {
     REQUIRE(e->columns()[0]->asString() == "nothing"_sl);
     REQUIRE(e->next());
     REQUIRE(e->columns()[0]->asString() == "invalid"_sl);
+
+    // Pattern that varies by row:
+    query = store->compileQuery(json5(
+        "{'WHAT': ['._id'], WHERE: ['REGEXP_LIKE()', ['.value'], ['.value']]}"));
+    e.reset(query->createEnumerator());
+    CHECK(e->getRowCount() == 3);
+
+    // Invalid pattern:
+    query = store->compileQuery(json5(
+        "{'WHAT': ['._id'], WHERE: ['REGEXP_LIKE()', ['.value'], '[']}"));
+    ExpectException(error::SQLite, SQLITE_ERROR, [&]{
+        e.reset(query->createEnumerator());
+    });
 }
 
 TEST_CASE_METHOD(DataFileTestFixture, "Query type check", "[Query]") {
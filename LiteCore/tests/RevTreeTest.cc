@@ -17,6 +17,9 @@
 //
 
 #include "RevTree.hh"
+#include "RevTreeView.hh"
+#include "StringUtil.hh"
+#include "Benchmark.hh"
 
 #include "LiteCoreTest.hh"
 
@@ -50,3 +53,133 @@ TEST_CASE("RevID Parsing") {
     CHECK(!r.tryParse("1-aa "_sl));
     CHECK(!r.tryParse(" 1-aa"_sl));
 }
+
+
+// Builds a tree of `depth` generations, each saved with its own sequence, plus a conflicting
+// branch off the middle. Only the leaves have bodies, as after a normal save.
+static void buildTree(RevTree &tree, unsigned depth, sequence_t &seq) {
+    int status;
+    const Rev *parent = nullptr, *branchPoint = nullptr;
+    for (unsigned gen = 1; gen <= depth; ++gen) {
+        revidBuffer revID(slice(stringWithFormat("%u-%08x%08x%08x%08x%08x", gen,
+                                                 gen, 0xdeadbeef, 0x1234, gen * 7, 0x5555)));
+        parent = tree.insert(revID, "{\"name\":\"value\"}"_sl, (Rev::Flags)0, parent,
+                             false, false, status);
+        REQUIRE(parent);
+        tree.saved(++seq);
+        if (gen == depth / 2)
+            branchPoint = parent;
+    }
+    revidBuffer conflictID(slice(stringWithFormat("%u-cafebabe", depth / 2 + 1)));
+    REQUIRE(tree.insert(conflictID, "{}"_sl, Rev::kDeleted, branchPoint, true, true, status));
+    tree.saved(++seq);
+    tree.setLatestRevisionOnRemote(RevTree::kDefaultRemoteID, parent);
+    tree.removeNonLeafBodies();
+}
+
+
+TEST_CASE("RevTree Encoding", "[RevTree]") {
+    sequence_t seq = 1000;
+    RevTree tree;
+    buildTree(tree, 20, seq);
+    alloc_slice v1 = tree.encode(RevTree::kEncodingV1);
+    alloc_slice v2 = tree.encode(RevTree::kEncodingV2);
+    CHECK(v2.size < v1.size);
+
+    for (int version = 1; version <= 2; ++version) {
+        INFO("Encoding v" << version);
+        alloc_slice encoded = (version == 1) ? v1 : v2;
+        RevTree decoded(encoded, seq);
+        REQUIRE(decoded.size() == tree.size());
+        for (unsigned i = 0; i < tree.size(); ++i) {
+            const Rev *rev = tree[i], *rev2 = decoded[i];
+            CHECK(rev2->revID == rev->revID);
+            CHECK(rev2->sequence == rev->sequence);
+            CHECK(rev2->flags == (rev->flags & ~Rev::kNew));
+            CHECK(rev2->body() == rev->body());
+            if (rev->parent)
+                CHECK(rev2->parent == decoded[rev->parent->index()]);
+            else
+                CHECK(rev2->parent == nullptr);
+        }
+        CHECK(decoded.latestRevisionOnRemote(RevTree::kDefaultRemoteID)->revID
+                == tree.latestRevisionOnRemote(RevTree::kDefaultRemoteID)->revID);
+        CHECK(decoded.encode(RevTree::Encoding(version)) == encoded);
+    }
+}
+
+
+TEST_CASE("RevTreeView", "[RevTree]") {
+    sequence_t seq = 1000;
+    RevTree tree;
+    buildTree(tree, 20, seq);
+    for (int version = 1; version <= 2; ++version) {
+        INFO("Encoding v" << version);
+        alloc_slice encoded = tree.encode(RevTree::Encoding(version));
+        RevTreeView view(encoded, seq);
+        REQUIRE(view.count() == tree.size());
+        CHECK(view.current().revID == tree.currentRevision()->revID);
+
+        unsigned i = 0;
+        for (auto &info : view) {
+            const Rev *rev = tree[i];
+            CHECK(info.index == i);
+            CHECK(info.revID == rev->revID);
+            CHECK(info.sequence == rev->sequence);
+            CHECK(info.flags == (rev->flags & ~Rev::kNew));
+            CHECK(info.body == rev->body());
+            CHECK(info.parentIndex == (rev->parent ? rev->parent->index() : RevTreeView::kNoRev));
+            CHECK(view.get(rev->revID).index == i);
+            ++i;
+        }
+        CHECK(i == tree.size());
+        CHECK(!view.get(i).exists());
+        CHECK(!view.get(revidBuffer("99-ffff"_sl)).exists());
+        CHECK(view.latestRevisionOnRemote(RevTree::kDefaultRemoteID)
+                == tree.latestRevisionOnRemote(RevTree::kDefaultRemoteID)->index());
+        CHECK(view.latestRevisionOnRemote(2) == RevTreeView::kNoRev);
+    }
+
+    // A v2 tree whose revs 1 and 2 are each other's parent can't be given generations. That's
+    // found when the tree is indexed, by the first access past the current revision:
+    const uint8_t cycle[] = {0xFF, 3, 3,
+                             0x00, 0, 1, 1, 'a', 1,
+                             0x00, 3, 1, 1, 'b', 2,
+                             0x00, 2, 1, 1, 'c', 3};
+    RevTreeView view(slice(cycle, sizeof(cycle)), seq);
+    CHECK(view.current().exists());
+    CHECK(view.current().revID.generation() == 1);
+    ExpectException(error::LiteCore, error::CorruptRevisionData, [&]{
+        view.get(1);
+    });
+}
+
+
+TEST_CASE("RevTree Encoding Benchmark", "[RevTree][Perf][.slow]") {
+    static const unsigned kNumTrees = 10000, kDecodes = 10;
+    sequence_t seq = 0;
+    vector<alloc_slice> encoded[2];
+    for (unsigned i = 0; i < kNumTrees; ++i) {
+        RevTree tree;
+        buildTree(tree, 20, seq);
+        encoded[0].push_back(tree.encode(RevTree::kEncodingV1));
+        encoded[1].push_back(tree.encode(RevTree::kEncodingV2));
+    }
+
+    for (int v = 0; v < 2; ++v) {
+        size_t totalSize = 0;
+        for (auto &raw : encoded[v])
+            totalSize += raw.size;
+        fprintf(stderr, "Encoding v%d: %.1f bytes/doc\n", v + 1, totalSize / (double)kNumTrees);
+
+        Stopwatch st;
+        for (unsigned n = 0; n < kDecodes; ++n) {
+            for (auto &raw : encoded[v]) {
+                RevTree tree(raw, 1);
+                CHECK(tree.size() == 21);
+            }
+        }
+        st.printReport(stringWithFormat("Decoding v%d", v + 1).c_str(),
+                       kNumTrees * kDecodes, "tree");
+    }
+}
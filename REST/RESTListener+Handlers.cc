@@ -25,6 +25,7 @@
 #include "Request.hh"
 #include "StringUtil.hh"
 #include "c4ExceptionUtils.hh"
+#include <algorithm>
 #include <functional>
 
 using namespace std;
@@ -141,16 +142,31 @@ namespace litecore { namespace REST {
 #pragma mark - DOCUMENT HANDLERS:
 
 
+    // Returns a docID query parameter, which in CouchDB is JSON-encoded (i.e. quoted.)
+    static string docIDQuery(RequestResponse &rq, const char *param) {
+        string value = rq.query(param);
+        if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+            value = value.substr(1, value.size() - 2);
+        return value;
+    }
+
+
     void RESTListener::handleGetAllDocs(RequestResponse &rq, C4Database *db) {
         // Apply options:
-        C4EnumeratorOptions options;
+        C4EnumeratorOptions options = {};
         options.flags = kC4IncludeNonConflicted;
         if (rq.boolQuery("descending"))
             options.flags |= kC4Descending;
         bool includeDocs = rq.boolQuery("include_docs");
         if (includeDocs)
             options.flags |= kC4IncludeBodies;
-        // TODO: Implement startkey, endkey, skip, limit, etc.
+        string startKey = docIDQuery(rq, "startkey"), endKey = docIDQuery(rq, "endkey");
+        if (!startKey.empty())
+            options.startKey = slice(startKey);
+        if (!endKey.empty())
+            options.endKey = slice(endKey);
+        options.skip = max(rq.intQuery("skip"), (int64_t)0);
+        options.limit = max(rq.intQuery("limit"), (int64_t)0);
 
         // Create enumerator:
         C4Error err;